@@ -0,0 +1,273 @@
+// Micro-benchmarks for the Tiny interpreter.
+//
+// Run `tiny_bench` to run all of them, or `tiny_bench <name>...` to run a subset. Pass `--register`
+// to compile the scripts with TINY_BACKEND_REGISTER, and `--region` to run them on threads with a
+// TINY_HEAP_REGION heap.
+// Build in release mode, the numbers are meaningless otherwise.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "tiny.h"
+
+static double Now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static TINY_FOREIGN_FUNCTION(Nop) { return args[0]; }
+
+static Tiny_Backend Backend = TINY_BACKEND_STACK;
+static Tiny_HeapMode HeapMode = TINY_HEAP_GC;
+
+static Tiny_State *CompileBenchState(const char *name, const char *code) {
+    Tiny_State *state = Tiny_CreateStateWithBackend(Tiny_DefaultContext, Backend);
+
+    Tiny_BindStandardLib(state);
+    Tiny_BindStandardArray(state);
+    Tiny_BindStandardDict(state);
+    Tiny_BindFunction(state, "nop(int): int", Nop);
+
+    Tiny_CompileResult result = Tiny_CompileString(state, name, code);
+
+    if (result.type != TINY_COMPILE_SUCCESS) {
+        fprintf(stderr, "%s: %s\n", name, result.error.msg);
+        Tiny_DeleteState(state);
+        return NULL;
+    }
+
+    return state;
+}
+
+// Runs the script three times: once a cycle at a time through Tiny_ExecuteCycle (which also tells
+// us how many instructions the script executes), once through Tiny_Run, and once in slices of
+// SLICE_CYCLES through Tiny_RunBudget (like a scheduler would), and reports the average cost of
+// dispatching and executing a single instruction for each.
+#define SLICE_CYCLES 1000
+
+static void BenchDispatch(const char *name, const char *code) {
+    Tiny_State *state = CompileBenchState(name, code);
+
+    if (!state) {
+        return;
+    }
+
+    Tiny_StateThread thread;
+
+    Tiny_InitThreadWithHeap(&thread, state, Tiny_DefaultContext, HeapMode);
+    Tiny_StartThread(&thread);
+
+    long long cycles = 0;
+
+    double start = Now();
+    while (Tiny_ExecuteCycle(&thread)) ++cycles;
+    double stepTime = Now() - start;
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_InitThreadWithHeap(&thread, state, Tiny_DefaultContext, HeapMode);
+    Tiny_StartThread(&thread);
+
+    start = Now();
+    Tiny_Run(&thread);
+    double runTime = Now() - start;
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_InitThreadWithHeap(&thread, state, Tiny_DefaultContext, HeapMode);
+    Tiny_StartThread(&thread);
+
+    start = Now();
+    while (Tiny_RunBudget(&thread, SLICE_CYCLES, NULL) == TINY_RUN_BUDGET_EXHAUSTED);
+    double sliceTime = Now() - start;
+
+    Tiny_DestroyThread(&thread);
+
+    printf(
+        "%-16s %10lld cycles  run %8.2f ms %6.2f ns/cycle  slice %8.2f ms %6.2f ns/cycle  step "
+        "%8.2f ms %6.2f ns/cycle\n",
+        name, cycles, runTime * 1e3, runTime * 1e9 / cycles, sliceTime * 1e3,
+        sliceTime * 1e9 / cycles, stepTime * 1e3, stepTime * 1e9 / cycles);
+
+    Tiny_DeleteState(state);
+}
+
+static void BenchLoop(void) {
+    BenchDispatch("loop",
+                  "i := 0\n"
+                  "while i < 5000000 { i += 1 }\n");
+}
+
+static void BenchFib(void) {
+    BenchDispatch("fib",
+                  "func fib(n: int): int {\n"
+                  "    if n < 2 { return n }\n"
+                  "    return fib(n - 1) + fib(n - 2)\n"
+                  "}\n"
+                  "x := fib(27)\n");
+}
+
+static void BenchFloat(void) {
+    BenchDispatch("float",
+                  "x := 0.0\n"
+                  "for i := 0; i < 2000000; i += 1 { x = x * 0.5 + 1.5 }\n");
+}
+
+static void BenchStruct(void) {
+    BenchDispatch("struct",
+                  "struct Point { x: int y: int }\n"
+                  "sum := 0\n"
+                  "for i := 0; i < 1000000; i += 1 {\n"
+                  "    p := new Point{i, 1}\n"
+                  "    sum += p.x - p.y\n"
+                  "}\n");
+}
+
+static void BenchForeign(void) {
+    BenchDispatch("foreign",
+                  "sum := 0\n"
+                  "for i := 0; i < 2000000; i += 1 { sum += nop(i) }\n");
+}
+
+static void BenchLocals(void) {
+    BenchDispatch("locals",
+                  "struct Point { x: int y: int }\n"
+                  "func run(): int {\n"
+                  "    p := new Point{1, 2}\n"
+                  "    sum := 0\n"
+                  "    for i := 0; i < 2000000; i += 1 { sum += i + p.x - p.y }\n"
+                  "    return sum\n"
+                  "}\n"
+                  "x := run()\n");
+}
+
+static void BenchSubstr(void) {
+    BenchDispatch("substr",
+                  "s := strcat(\"the quick brown fox jumps over the lazy dog \", int_to_str(0))\n"
+                  "n := 0\n"
+                  "for i := 0; i < 1000000; i += 1 {\n"
+                  "    start := i % 20\n"
+                  "    n += strlen(substr(s, start, start + 24))\n"
+                  "}\n");
+}
+
+static void BenchDict(void) {
+    BenchDispatch("dict",
+                  "d := dict()\n"
+                  "names := dict_str_int()\n"
+                  "for i := 0; i < 1000; i += 1 {\n"
+                  "    dict_str_int_put(names, strcat(\"header-name-\", int_to_str(i)), i)\n"
+                  "}\n"
+                  "key := strcat(\"header-name-\", int_to_str(500))\n"
+                  "n := 0\n"
+                  "for j := 0; j < 1000000; j += 1 {\n"
+                  "    dict_put(d, j % 5000, j)\n"
+                  "    n += cast(dict_get(d, (j * 7) % 5000), int)\n"
+                  "    if j % 3 == 0 { dict_remove(d, (j * 13) % 5000) }\n"
+                  "    n += dict_str_int_get(names, key)\n"
+                  "}\n");
+}
+
+static void BenchDictIter(void) {
+    BenchDispatch("dict_iter",
+                  "d := dict()\n"
+                  "for i := 0; i < 1000; i += 1 { dict_put(d, i, i) }\n"
+                  "n := 0\n"
+                  "for j := 0; j < 1000; j += 1 {\n"
+                  "    foreach k, v in d { n += cast(v, int) }\n"
+                  "}\n");
+}
+
+// Every key made of "AB" and "B!" pairs has the same djb2 hash, which is what dict keys used to be
+// hashed with. With a keyed hash the time per cycle should stay flat as the key count goes up
+// rather than growing linearly (i.e. quadratic overall).
+static void BenchDictFlood(void) {
+    for (int bits = 10; bits <= 16; bits += 2) {
+        char name[32];
+        char code[1024];
+
+        snprintf(name, sizeof(name), "dict_flood_%d", 1 << bits);
+        snprintf(code, sizeof(code),
+                 "func key(i: int): str {\n"
+                 "    s := \"\"\n"
+                 "    n := i\n"
+                 "    for b := 0; b < %d; b += 1 {\n"
+                 "        if n %% 2 == 0 { s = strcat(s, \"AB\") } else { s = strcat(s, \"B!\") }\n"
+                 "        n = n / 2\n"
+                 "    }\n"
+                 "    return s\n"
+                 "}\n"
+                 "d := dict_str_int()\n"
+                 "for i := 0; i < %d; i += 1 { dict_str_int_put(d, key(i), i) }\n",
+                 bits, 1 << bits);
+
+        BenchDispatch(name, code);
+    }
+}
+
+// Arrays of ints are packed, so filling/copying/sorting them runs over a plain Tiny_Int buffer
+static void BenchArrayInt(void) {
+    BenchDispatch("array_int",
+                  "use array(\"int\") as array_int\n"
+                  "a := array_int()\n"
+                  "for i := 0; i < 1000000; i += 1 { array_int_push(a, (i * 7919) % 1000003) }\n"
+                  "b := array_int()\n"
+                  "n := 0\n"
+                  "for j := 0; j < 10; j += 1 {\n"
+                  "    array_int_copy(b, a)\n"
+                  "    array_int_sort(b)\n"
+                  "    n += b[j]\n"
+                  "    array_int_fill(b, j)\n"
+                  "}\n"
+                  "foreach x in a { n += x }\n");
+}
+
+typedef struct Benchmark {
+    const char *name;
+    void (*run)(void);
+} Benchmark;
+
+static const Benchmark Benchmarks[] = {
+    {"loop", BenchLoop},     {"fib", BenchFib},         {"float", BenchFloat},
+    {"struct", BenchStruct}, {"foreign", BenchForeign}, {"locals", BenchLocals},
+    {"substr", BenchSubstr}, {"dict", BenchDict},       {"dict_flood", BenchDictFlood},
+    {"dict_iter", BenchDictIter}, {"array_int", BenchArrayInt},
+};
+
+int main(int argc, char **argv) {
+    int count = sizeof(Benchmarks) / sizeof(Benchmarks[0]);
+
+    int numNames = argc - 1;
+
+    for (int j = 1; j < argc; ++j) {
+        if (strcmp(argv[j], "--register") == 0) {
+            Backend = TINY_BACKEND_REGISTER;
+            --numNames;
+        }
+
+        if (strcmp(argv[j], "--region") == 0) {
+            HeapMode = TINY_HEAP_REGION;
+            --numNames;
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        bool run = numNames == 0;
+
+        for (int j = 1; j < argc; ++j) {
+            if (strcmp(argv[j], Benchmarks[i].name) == 0) {
+                run = true;
+                break;
+            }
+        }
+
+        if (run) {
+            Benchmarks[i].run();
+        }
+    }
+
+    return 0;
+}
@@ -206,7 +206,7 @@ static Tiny_Value DrawText(Tiny_StateThread* thread, const Tiny_Value* args, int
     char buf[128] = {0};
     char* s = buf;
 
-    const char* fmt = Tiny_ToString(args[5]);
+    const char* fmt = Tiny_ToCString(thread, args[5]);
 
     int arg = 6;
 
@@ -61,13 +61,14 @@ static Tiny_Value Lib_ReloadScriptsNextFrame(Tiny_StateThread* thread, const Tin
 
 static Tiny_Value Lib_Strspn(Tiny_StateThread* thread, const Tiny_Value* args, int count) {
     assert(count == 2);
-    return Tiny_NewInt(strspn(Tiny_ToString(args[0]), Tiny_ToString(args[1])));
+    return Tiny_NewInt(
+        strspn(Tiny_ToCString(thread, args[0]), Tiny_ToCString(thread, args[1])));
 }
 
 static Tiny_Value Lib_Strtod(Tiny_StateThread* thread, const Tiny_Value* args, int count) {
     assert(count == 1);
 
-    const char* s = Tiny_ToString(args[0]);
+    const char* s = Tiny_ToCString(thread, args[0]);
 
     assert(s);
 
@@ -121,7 +122,7 @@ static Tiny_Value Lib_MoveToFirstOccuranceOfString(Tiny_StateThread* thread, con
 
     assert(count == 2);
 
-    const char* s = Tiny_ToString(args[0]);
+    const char* s = Tiny_ToCString(thread, args[0]);
 
     assert(s);
 
@@ -155,7 +156,7 @@ static Tiny_Value Lib_StoreTempLine(Tiny_StateThread* thread, const Tiny_Value*
         return Tiny_NewBool(false);
     }
 
-    strcpy(ed->tempLines[ed->numTempLines++], Tiny_ToString(args[0]));
+    strcpy(ed->tempLines[ed->numTempLines++], Tiny_ToCString(thread, args[0]));
     return Tiny_NewBool(true);
 }
 
@@ -190,7 +191,11 @@ static Tiny_Value Lib_OpenFile(Tiny_StateThread* thread, const Tiny_Value* args,
 
     Editor* ed = thread->userdata;
 
-    if (MyOpenFile(&ed->buf, Tiny_ToString(args[0]))) {
+    if (MyOpenFile(&ed->buf, Tiny_ToCString(thread, args[0]))) {
+        // args points into the thread's stack, which file_opened could end up moving, so this has
+        // to be done before calling it
+        strcpy(ed->filename, Tiny_ToCString(thread, args[0]));
+
         int fileOpened = Tiny_GetFunctionIndex(ed->state, "file_opened");
 
         if (fileOpened >= 0) {
@@ -198,7 +203,6 @@ static Tiny_Value Lib_OpenFile(Tiny_StateThread* thread, const Tiny_Value* args,
         }
 
         MoveTo(ed, 0, 0);
-        strcpy(ed->filename, Tiny_ToString(args[0]));
 
         return Tiny_NewBool(true);
     }
@@ -211,7 +215,7 @@ static Tiny_Value Lib_WriteFile(Tiny_StateThread* thread, const Tiny_Value* args
 
     Editor* ed = thread->userdata;
 
-    if (MyWriteFile(&ed->buf, Tiny_ToString(args[0]))) {
+    if (MyWriteFile(&ed->buf, Tiny_ToCString(thread, args[0]))) {
         int fileWritten = Tiny_GetFunctionIndex(ed->state, "file_written");
 
         if (fileWritten >= 0) {
@@ -231,7 +235,7 @@ static Tiny_Value Lib_GetCmd(Tiny_StateThread* thread, const Tiny_Value* args, i
 static Tiny_Value Lib_SetStatus(Tiny_StateThread* thread, const Tiny_Value* args, int count) {
     StatusTime = 0;
 
-    const char* fmt = Tiny_ToString(args[0]);
+    const char* fmt = Tiny_ToCString(thread, args[0]);
     char* s = Status;
 
     int arg = 1;
@@ -243,7 +247,7 @@ static Tiny_Value Lib_SetStatus(Tiny_StateThread* thread, const Tiny_Value* args
             fmt += 1;
             switch (*fmt) {
                 case 's':
-                    s += sprintf(s, "%s", Tiny_ToString(args[arg]));
+                    s += sprintf(s, "%s", Tiny_ToCString(thread, args[arg]));
                     break;
                 case 'g':
                     s += sprintf(s, "%g", Tiny_ToNumber(args[arg]));
@@ -341,7 +345,7 @@ static Tiny_Value Lib_InsertString(Tiny_StateThread* thread, const Tiny_Value* a
 
     assert(count == 1);
 
-    InsertString(&ed->buf, ed->cur.x, ed->cur.y, Tiny_ToString(args[0]));
+    InsertString(&ed->buf, ed->cur.x, ed->cur.y, Tiny_ToCString(thread, args[0]));
 
     return Tiny_Null;
 }
@@ -405,12 +409,12 @@ static Tiny_Value Lib_SetLine(Tiny_StateThread* thread, const Tiny_Value* args,
 
     if (count == 2) {
         int index = (int)Tiny_ToNumber(args[0]);
-        const char* s = Tiny_ToString(args[1]);
+        const char* s = Tiny_ToCString(thread, args[1]);
 
         SetLine(&ed->buf, index, s);
     } else {
         assert(count == 1);
-        const char* s = Tiny_ToString(args[0]);
+        const char* s = Tiny_ToCString(thread, args[0]);
 
         SetLine(&ed->buf, ed->cur.y, s);
     }
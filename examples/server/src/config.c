@@ -21,7 +21,7 @@
 static TINY_FOREIGN_FUNCTION(AddCommonScript) {
     Config* c = thread->userdata;
 
-    sb_push(c->commonScripts, estrdup(Tiny_ToString(args[0])));
+    sb_push(c->commonScripts, estrdup(Tiny_ToCString(thread, args[0])));
 
     return Tiny_Null;
 }
@@ -45,7 +45,7 @@ static TINY_FOREIGN_FUNCTION(SetCyclesPerLoop) {
 static TINY_FOREIGN_FUNCTION(SetName) {
     Config* c = thread->userdata;
 
-    c->name = estrdup(Tiny_ToString(args[0]));
+    c->name = estrdup(Tiny_ToCString(thread, args[0]));
 
     return Tiny_Null;
 }
@@ -55,8 +55,8 @@ static TINY_FOREIGN_FUNCTION(AddRoute) {
 
     Route r;
 
-    r.pattern = estrdup(Tiny_ToString(args[0]));
-    r.filename = estrdup(Tiny_ToString(args[1]));
+    r.pattern = estrdup(Tiny_ToCString(thread, args[0]));
+    r.filename = estrdup(Tiny_ToCString(thread, args[1]));
 
     sb_push(c->routes, r);
 
@@ -82,7 +82,7 @@ static TINY_FOREIGN_FUNCTION(GetArgv) {
 static TINY_FOREIGN_FUNCTION(SetPort) {
     Config* c = thread->userdata;
 
-    c->port = estrdup(Tiny_ToString(args[0]));
+    c->port = estrdup(Tiny_ToCString(thread, args[0]));
 
     return Tiny_Null;
 }
@@ -100,7 +100,7 @@ static TINY_FOREIGN_FUNCTION(SetNumThreads) {
 static TINY_FOREIGN_FUNCTION(Lib_LoadModule) {
     Config* c = thread->userdata;
 
-    const char* name = Tiny_ToString(args[0]);
+    const char* name = Tiny_ToCString(thread, args[0]);
 
     ForeignModule mod = {0};
 
@@ -116,11 +116,11 @@ static TINY_FOREIGN_FUNCTION(Lib_LoadModule) {
     }
 
     for (int i = 1; i < count; i += 2) {
-        const char* procName = Tiny_ToString(args[i]);
+        const char* procName = Tiny_ToCString(thread, args[i]);
 
         ForeignModuleFunction modFunc;
 
-        modFunc.sig = estrdup(Tiny_ToString(args[i + 1]));
+        modFunc.sig = estrdup(Tiny_ToCString(thread, args[i + 1]));
 
 #ifdef _WIN32
         modFunc.func = (Tiny_ForeignFunction)GetProcAddress(mod.handle, procName);
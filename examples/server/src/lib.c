@@ -23,11 +23,14 @@ static void FinalizeBuf(Tiny_Context* ctx, void* bp) {
     free(bp);
 }
 
+static size_t BufSize(void* bp) { return sizeof(unsigned char*) + sb_count(*(unsigned char**)bp); }
+
 const Tiny_NativeProp BufProp = {
     "buf",
 
     NULL,
     FinalizeBuf,
+    BufSize,
 };
 
 extern const Tiny_NativeProp DictProp;
@@ -38,7 +41,7 @@ static TINY_FOREIGN_FUNCTION(Buf) {
     *buf = NULL;
 
     if (count == 1) {
-        const char* str = Tiny_ToString(args[0]);
+        const char* str = Tiny_ToCString(thread, args[0]);
 
         size_t len = strlen(str);
 
@@ -63,7 +66,7 @@ static TINY_FOREIGN_FUNCTION(BufPushByte) {
 
 static TINY_FOREIGN_FUNCTION(BufPushStr) {
     unsigned char** buf = Tiny_ToAddr(args[0]);
-    const char* str = Tiny_ToString(args[1]);
+    const char* str = Tiny_ToCString(thread, args[1]);
 
     size_t len = strlen(str);
 
@@ -96,7 +99,7 @@ static TINY_FOREIGN_FUNCTION(BufToStr) {
 }
 
 static TINY_FOREIGN_FUNCTION(GetFileContents) {
-    const char* filename = Tiny_ToString(args[0]);
+    const char* filename = Tiny_ToCString(thread, args[0]);
 
     FILE* file = fopen(filename, "rb");
 
@@ -120,7 +123,7 @@ static TINY_FOREIGN_FUNCTION(GetFileContents) {
 }
 
 static TINY_FOREIGN_FUNCTION(FilePutContents) {
-    const char* filename = Tiny_ToString(args[0]);
+    const char* filename = Tiny_ToCString(thread, args[0]);
     unsigned char** buf = Tiny_ToAddr(args[1]);
 
     FILE* file = fopen(filename, "wb");
@@ -146,7 +149,7 @@ static void ConvertPath(char* s) {
 }
 
 static TINY_FOREIGN_FUNCTION(ListDir) {
-    const char* dir = Tiny_ToString(args[0]);
+    const char* dir = Tiny_ToCString(thread, args[0]);
 
 #ifdef _WIN32
     char path[MAX_PATH];
@@ -208,7 +211,7 @@ static char* DecodeURL(const char* s) {
 }
 
 static TINY_FOREIGN_FUNCTION(Lib_DecodeURL) {
-    const char* s = Tiny_ToString(args[0]);
+    const char* s = Tiny_ToCString(thread, args[0]);
     char* buf = DecodeURL(s);
 
     return Tiny_NewString(thread, buf, sb_count(buf));
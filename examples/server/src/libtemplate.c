@@ -19,11 +19,10 @@
 
 extern Tiny_NativeProp DictProp;
 extern Tiny_NativeProp ArrayProp;
+extern Tiny_NativeProp PackedArrayProp;
 extern Tiny_NativeProp BufProp;
 
-static void AppendStr(char** buf, const char* s) {
-    size_t len = strlen(s);
-
+static void AppendStrLen(char** buf, const char* s, size_t len) {
     char* start = sb_add(*buf, len);
 
     for (int i = 0; i < len; ++i) {
@@ -31,21 +30,47 @@ static void AppendStr(char** buf, const char* s) {
     }
 }
 
-static const Tiny_Value* ReadVar(const char* filename, int* line, FILE* f, Dict* env, Array* arr,
-                                 int arrIndex, int c, char* var) {
+static void AppendStr(char** buf, const char* s) { AppendStrLen(buf, s, strlen(s)); }
+
+// Arrays of bool, int and float are packed (see PackedArray), everything else is an Array
+static bool IsArray(Tiny_Value val) {
+    return Tiny_GetProp(val) == &ArrayProp || Tiny_GetProp(val) == &PackedArrayProp;
+}
+
+static int GetArrayLen(Tiny_Value arr) {
+    if (Tiny_GetProp(arr) == &PackedArrayProp) {
+        return PackedArrayLen(Tiny_ToAddr(arr));
+    }
+
+    return ArrayLen(Tiny_ToAddr(arr));
+}
+
+static Tiny_Value GetArrayElem(Tiny_Value arr, int index) {
+    if (Tiny_GetProp(arr) == &PackedArrayProp) {
+        return PackedArrayGet(Tiny_ToAddr(arr), index);
+    }
+
+    return *ArrayGet(Tiny_ToAddr(arr), index);
+}
+
+// Elements of packed arrays don't exist as Tiny_Values, so '$_' is read into elem
+static const Tiny_Value* ReadVar(const char* filename, int* line, FILE* f, Dict* env,
+                                 Tiny_Value arr, int arrIndex, Tiny_Value* elem, int c,
+                                 char* var) {
     const Tiny_Value* val = NULL;
 
     if (c == '_') {
-        if (!arr) {
+        if (Tiny_IsNull(arr)) {
             ERROR("Attempted to use '$_' outside of array expansion.\n");
         }
 
-        assert(arrIndex >= 0 && arrIndex < ArrayLen(arr));
+        assert(arrIndex >= 0 && arrIndex < GetArrayLen(arr));
 
         var[0] = '_';
         var[1] = 0;
 
-        val = ArrayGet(arr, arrIndex);
+        *elem = GetArrayElem(arr, arrIndex);
+        val = elem;
     } else {
         int i = 0;
 
@@ -61,10 +86,7 @@ static const Tiny_Value* ReadVar(const char* filename, int* line, FILE* f, Dict*
 
         var[i] = 0;
 
-        val = DictGet(env, (Tiny_Value){
-                               .type = TINY_VAL_CONST_STRING,
-                               .cstr = var,
-                           });
+        val = DictGet(env, Tiny_NewConstString(var));
     }
 
     return val;
@@ -73,7 +95,7 @@ error:
 }
 
 static bool Expand(const char* filename, int* line, FILE* f, char** pBuf, int end, Dict* env,
-                   Array* arr, int arrIndex) {
+                   Tiny_Value arr, int arrIndex) {
     char* buf = *pBuf;
 
     while (true) {
@@ -94,8 +116,9 @@ static bool Expand(const char* filename, int* line, FILE* f, char** pBuf, int en
             }
 
             char var[VAR_SIZE];
+            Tiny_Value elem;
 
-            const Tiny_Value* val = ReadVar(filename, line, f, env, arr, arrIndex, c, var);
+            const Tiny_Value* val = ReadVar(filename, line, f, env, arr, arrIndex, &elem, c, var);
 
             c = getc(f);
 
@@ -127,14 +150,14 @@ static bool Expand(const char* filename, int* line, FILE* f, char** pBuf, int en
 
             long pos = ftell(f);
 
-            if (!val || Tiny_GetProp(*val) != &ArrayProp) {
+            if (!val || !IsArray(*val)) {
                 ERROR("Attempted to expand '[%s]' but %s is not an array.\n", var, var);
             } else {
-                Array* a = Tiny_ToAddr(*val);
+                Tiny_Value a = *val;
 
                 *pBuf = buf;
 
-                for (int i = 0; i < ArrayLen(a); ++i) {
+                for (int i = 0; i < GetArrayLen(a); ++i) {
                     fseek(f, epos, SEEK_SET);
                     Expand(filename, line, f, pBuf, '}', env, a, i);
                 }
@@ -152,8 +175,9 @@ static bool Expand(const char* filename, int* line, FILE* f, char** pBuf, int en
             }
 
             char var[VAR_SIZE];
+            Tiny_Value elem;
 
-            const Tiny_Value* val = ReadVar(filename, line, f, env, arr, arrIndex, c, var);
+            const Tiny_Value* val = ReadVar(filename, line, f, env, arr, arrIndex, &elem, c, var);
 
             c = getc(f);
 
@@ -206,7 +230,7 @@ static bool Expand(const char* filename, int* line, FILE* f, char** pBuf, int en
             }
 
             *pBuf = buf;
-            Expand(filename, line, f, pBuf, '}', env, NULL, -1);
+            Expand(filename, line, f, pBuf, '}', env, Tiny_Null, -1);
 
             buf = *pBuf;
 
@@ -220,33 +244,41 @@ static bool Expand(const char* filename, int* line, FILE* f, char** pBuf, int en
             }
 
             char var[VAR_SIZE];
+            Tiny_Value elem;
 
-            const Tiny_Value* val = ReadVar(filename, line, f, env, arr, arrIndex, c, var);
+            const Tiny_Value* val = ReadVar(filename, line, f, env, arr, arrIndex, &elem, c, var);
 
             if (!val) {
                 ERROR("Var '%s' doesn't exist in env.\n", var);
             }
 
-            switch (val->type) {
+            switch (Tiny_GetType(*val)) {
                 case TINY_VAL_BOOL: {
-                    AppendStr(&buf, val->boolean ? "true" : "false");
+                    AppendStr(&buf, Tiny_AsBool(*val) ? "true" : "false");
                 } break;
 
                 case TINY_VAL_INT: {
                     char s[32];
-                    sprintf(s, "%i", val->i);
+                    sprintf(s, "%i", (int)Tiny_AsInt(*val));
                     AppendStr(&buf, s);
                 } break;
 
                 case TINY_VAL_FLOAT: {
                     char s[32];
-                    sprintf(s, "%g", val->f);
+                    sprintf(s, "%g", Tiny_AsFloat(*val));
                     AppendStr(&buf, s);
                 } break;
 
                 case TINY_VAL_STRING:
-                case TINY_VAL_CONST_STRING: {
-                    AppendStr(&buf, Tiny_ToString(*val));
+                case TINY_VAL_CONST_STRING:
+                case TINY_VAL_SMALL_STRING: {
+                    char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+                    size_t len;
+
+                    // The string could be a slice, which isn't null terminated
+                    const char* str = Tiny_ToStringChars(*val, smallBuf, &len);
+
+                    AppendStrLen(&buf, str, len);
                 } break;
 
                 case TINY_VAL_NATIVE: {
@@ -280,7 +312,7 @@ error:
 }
 
 static TINY_FOREIGN_FUNCTION(RenderTemplate) {
-    const char* filename = Tiny_ToString(args[0]);
+    const char* filename = Tiny_ToCString(thread, args[0]);
     Dict* env = Tiny_ToAddr(args[1]);
 
     FILE* f = fopen(filename, "r");
@@ -293,7 +325,7 @@ static TINY_FOREIGN_FUNCTION(RenderTemplate) {
     int line = 1;
     char* buf = NULL;
 
-    if (!Expand(filename, &line, f, &buf, EOF, env, NULL, -1)) {
+    if (!Expand(filename, &line, f, &buf, EOF, env, Tiny_Null, -1)) {
         fclose(f);
         sb_free(buf);
 
@@ -22,6 +22,14 @@
 
 #define Waiting(thread) (AtomicLoad(((Context*)((thread)->userdata))->waiting))
 
+typedef struct {
+    Tiny_StateThread* thread;
+    int funcIndex;
+
+    int count;
+    Tiny_Value args[];
+} WorkerData;
+
 typedef struct {
     Request req;
     Sock client;
@@ -29,34 +37,21 @@ typedef struct {
 
     int waiting;
 
+    // Set by call_wait_unsafe, and handed off to the worker by LoopBody once the thread is
+    // suspended
+    WorkerData* pendingCall;
+
     // This is the worker thread created for the waiting calls
     thrd_t worker;
 } Context;
 
-typedef struct {
-    Tiny_StateThread* thread;
-    const Tiny_Value* args;
-    int count;
-} WorkerData;
-
 extern const Tiny_NativeProp BufProp;
 
 static int DoCallWait(void* pData) {
     WorkerData* data = pData;
 
-    const char* funcName = Tiny_ToString(data->args[0]);
-
-    int funcIndex = Tiny_GetFunctionIndex(data->thread->state, funcName);
-
-    if (funcIndex < 0) {
-        fprintf(stderr, "Attempted to call_wait a non-existent function '%s'.\n", funcName);
-        data->thread->retVal = Tiny_Null;
-        free(data);
-        return 1;
-    }
-
     data->thread->retVal =
-        Tiny_CallFunction(data->thread, funcIndex, &data->args[1], data->count - 1);
+        Tiny_CallFunction(data->thread, data->funcIndex, data->args, data->count);
 
     Context* ctx = data->thread->userdata;
 
@@ -72,16 +67,33 @@ static int DoCallWait(void* pData) {
 static TINY_FOREIGN_FUNCTION(CallWaitUnsafe) {
     Context* ctx = thread->userdata;
 
-    WorkerData* data = malloc(sizeof(WorkerData));
+    const char* funcName = Tiny_ToCString(thread, args[0]);
+
+    int funcIndex = Tiny_GetFunctionIndex(thread->state, funcName);
+
+    if (funcIndex < 0) {
+        fprintf(stderr, "Attempted to call_wait a non-existent function '%s'.\n", funcName);
+        return Tiny_Null;
+    }
+
+    // The args live on the thread's stack, which the worker will be using, so they're copied
+    WorkerData* data = malloc(sizeof(WorkerData) + sizeof(Tiny_Value) * (count - 1));
 
     data->thread = thread;
-    data->args = args;
-    data->count = count;
+    data->funcIndex = funcIndex;
+    data->count = count - 1;
 
-    thrd_create(&ctx->worker, DoCallWait, data);
+    memcpy(data->args, &args[1], sizeof(Tiny_Value) * (count - 1));
 
     AtomicInc(ctx->waiting);
 
+    // The interpreter is still using the thread until this returns and it's suspended, so the
+    // worker isn't started until then (see LoopBody). It sets the thread's retVal, which is what
+    // this call ends up returning once the thread resumes.
+    ctx->pendingCall = data;
+
+    Tiny_YieldThread(thread);
+
     return Tiny_Null;
 }
 
@@ -143,7 +155,7 @@ static TINY_MACRO_FUNCTION(CallWaitMacro) {
 static TINY_FOREIGN_FUNCTION(Sends) {
     Context* ctx = thread->userdata;
 
-    const char* s = Tiny_ToString(args[0]);
+    const char* s = Tiny_ToCString(thread, args[0]);
 
     return Tiny_NewInt(SockSend(&ctx->client, s, (int)strlen(s)));
 }
@@ -151,7 +163,7 @@ static TINY_FOREIGN_FUNCTION(Sends) {
 static TINY_FOREIGN_FUNCTION(Sendf) {
     Context* ctx = thread->userdata;
 
-    const char* s = Tiny_ToString(args[0]);
+    const char* s = Tiny_ToCString(thread, args[0]);
 
     int arg = 1;
 
@@ -182,7 +194,7 @@ static TINY_FOREIGN_FUNCTION(Sendf) {
                 } break;
 
                 case 's': {
-                    const char* ss = Tiny_ToString(args[arg]);
+                    const char* ss = Tiny_ToCString(thread, args[arg]);
 
                     while (*ss) {
                         sb_push(buf, *ss++);
@@ -252,7 +264,7 @@ static TINY_FOREIGN_FUNCTION(GetRequestBody) {
 static TINY_FOREIGN_FUNCTION(Lib_GetHeaderValue) {
     Context* ctx = thread->userdata;
 
-    const char* name = Tiny_ToString(args[0]);
+    const char* name = Tiny_ToCString(thread, args[0]);
 
     const char* s = GetHeaderValue(&ctx->req, name);
 
@@ -375,15 +387,18 @@ static void LoopBody(Server* serv) {
 
         bool willHaveRunningThread = true;
 
-        for (int k = 0; k < serv->conf.cyclesPerLoop; ++k) {
-            if (!Tiny_ExecuteCycle(thread)) {
-                break;
-            }
+        // call_wait yields the thread, so we don't need to check whether it's waiting after
+        // every cycle
+        if (Tiny_RunBudget(thread, serv->conf.cyclesPerLoop, NULL) == TINY_RUN_YIELDED) {
+            Context* ctx = thread->userdata;
 
-            if (Waiting(thread)) {
-                willHaveRunningThread = false;
-                break;
+            // The thread is fully suspended now, so the worker can have it
+            if (ctx->pendingCall) {
+                thrd_create(&ctx->worker, DoCallWait, ctx->pendingCall);
+                ctx->pendingCall = NULL;
             }
+
+            willHaveRunningThread = false;
         }
 
         if (thread->pc < 0) {
@@ -480,6 +495,7 @@ static void LoopBody(Server* serv) {
             ctx->serv = serv;
 
             ctx->waiting = 0;
+            ctx->pendingCall = NULL;
 
             Tiny_InitThread(thread, state);
 
@@ -95,14 +95,27 @@ int main(int argc, char** argv) {
     }
 
     bool dis = false;
+    Tiny_Backend backend = TINY_BACKEND_STACK;
+    const char* pairProfilePath = NULL;
 
     for (int i = 2; i < argc; ++i) {
         if (strcmp(argv[i], "--dis") == 0) {
             dis = true;
+        } else if (strcmp(argv[i], "--register") == 0) {
+            backend = TINY_BACKEND_REGISTER;
+        } else if (strcmp(argv[i], "--pair-profile") == 0 && i + 1 < argc) {
+            pairProfilePath = argv[++i];
         }
     }
 
-    Tiny_State* state = Tiny_CreateState();
+#ifndef TINY_PROFILE_OPCODE_PAIRS
+    if (pairProfilePath) {
+        fprintf(stderr, "--pair-profile requires a build with TINY_PROFILE_OPCODE_PAIRS\n");
+        return 1;
+    }
+#endif
+
+    Tiny_State* state = Tiny_CreateStateWithBackend(Tiny_DefaultContext, backend);
 
     Tiny_BindStandardIO(state);
     Tiny_BindStandardArray(state);
@@ -143,9 +156,28 @@ int main(int argc, char** argv) {
 
     Tiny_Run(&stateThread);
 
+    const char* error = Tiny_GetThreadError(&stateThread);
+
+    if (error) {
+        fprintf(stderr, "%s\n", error);
+    }
+
+#ifdef TINY_PROFILE_OPCODE_PAIRS
+    if (pairProfilePath) {
+        FILE* file = fopen(pairProfilePath, "w");
+
+        if (file) {
+            Tiny_WriteOpcodePairProfile(&stateThread, file);
+            fclose(file);
+        } else {
+            fprintf(stderr, "Unable to open '%s' for writing\n", pairProfilePath);
+        }
+    }
+#endif
+
     Tiny_DestroyThread(&stateThread);
 
     Tiny_DeleteState(state);
 
-    return 0;
+    return error ? 1 : 0;
 }
@@ -11,6 +11,7 @@
 #include "minctest.h"
 #include "pos.h"
 #include "tiny.h"
+#include "util.h"
 
 #define lok_print_return(test, ...)   \
     do {                              \
@@ -120,14 +121,7 @@ static void test_PosToFriendlyPos(void) {
 static void test_InitArrayEx(void) {
     Array array;
 
-    Tiny_Value data[] = {{
-                             .type = TINY_VAL_INT,
-                             .i = 1,
-                         },
-                         {
-                             .type = TINY_VAL_INT,
-                             .i = 2,
-                         }};
+    Tiny_Value data[] = {Tiny_NewInt(1), Tiny_NewInt(2)};
 
     InitArrayEx(&array, Tiny_DefaultContext, sizeof(data) / sizeof(data[0]), data);
 
@@ -143,15 +137,12 @@ static void test_ArrayPush(void) {
     InitArray(&array, Tiny_DefaultContext);
 
     for (int i = 0; i < 64; ++i) {
-        ArrayPush(&array, (Tiny_Value){
-                              .type = TINY_VAL_INT,
-                              .i = i,
-                          });
+        ArrayPush(&array, Tiny_NewInt(i));
     }
 
     lequal(ArrayLen(&array), 64);
-    lequal(ArrayGet(&array, 2)->i, 2);
-    lequal(ArrayGet(&array, 21)->i, 21);
+    lequal(Tiny_ToInt(*ArrayGet(&array, 2)), 2);
+    lequal(Tiny_ToInt(*ArrayGet(&array, 21)), 21);
 
     DestroyArray(&array);
 }
@@ -162,10 +153,7 @@ static void test_ArrayPop(void) {
     InitArray(&array, Tiny_DefaultContext);
 
     for (int i = 0; i < 1000; ++i) {
-        ArrayPush(&array, (Tiny_Value){
-                              .type = TINY_VAL_INT,
-                              .i = i,
-                          });
+        ArrayPush(&array, Tiny_NewInt(i));
     }
 
     lequal(ArrayLen(&array), 1000);
@@ -173,7 +161,7 @@ static void test_ArrayPop(void) {
     Tiny_Value result;
     ArrayPop(&array, &result);
 
-    lequal(result.i, 999);
+    lequal(Tiny_ToInt(result), 999);
     lequal(ArrayLen(&array), 999);
 
     for (int i = 0; i < 998; ++i) {
@@ -182,7 +170,7 @@ static void test_ArrayPop(void) {
 
     ArrayPop(&array, &result);
 
-    lequal(result.i, 0);
+    lequal(Tiny_ToInt(result), 0);
     lequal(ArrayLen(&array), 0);
 
     DestroyArray(&array);
@@ -194,21 +182,14 @@ static void test_ArraySet(void) {
     InitArray(&array, Tiny_DefaultContext);
 
     for (int i = 0; i < 1000; ++i) {
-        ArrayPush(&array, (Tiny_Value){
-                              .type = TINY_VAL_INT,
-                              .i = i,
-                          });
+        ArrayPush(&array, Tiny_NewInt(i));
     }
 
     lequal(ArrayLen(&array), 1000);
 
-    ArraySet(&array, 500,
-             (Tiny_Value){
-                 .type = TINY_VAL_INT,
-                 .i = 10,
-             });
+    ArraySet(&array, 500, Tiny_NewInt(10));
 
-    lequal(ArrayGet(&array, 500)->i, 10);
+    lequal(Tiny_ToInt(*ArrayGet(&array, 500)), 10);
 
     DestroyArray(&array);
 }
@@ -219,22 +200,15 @@ static void test_ArrayInsert(void) {
     InitArray(&array, Tiny_DefaultContext);
 
     for (int i = 0; i < 1000; ++i) {
-        ArrayPush(&array, (Tiny_Value){
-                              .type = TINY_VAL_INT,
-                              .i = i,
-                          });
+        ArrayPush(&array, Tiny_NewInt(i));
     }
 
     lequal(ArrayLen(&array), 1000);
 
-    ArrayInsert(&array, 500,
-                (Tiny_Value){
-                    .type = TINY_VAL_INT,
-                    .i = 10,
-                });
+    ArrayInsert(&array, 500, Tiny_NewInt(10));
 
     lequal(ArrayLen(&array), 1001);
-    lequal(ArrayGet(&array, 500)->i, 10);
+    lequal(Tiny_ToInt(*ArrayGet(&array, 500)), 10);
 
     DestroyArray(&array);
 }
@@ -245,23 +219,65 @@ static void test_ArrayRemove(void) {
     InitArray(&array, Tiny_DefaultContext);
 
     for (int i = 0; i < 1000; ++i) {
-        ArrayPush(&array, (Tiny_Value){
-                              .type = TINY_VAL_INT,
-                              .i = i,
-                          });
+        ArrayPush(&array, Tiny_NewInt(i));
     }
 
     lequal(ArrayLen(&array), 1000);
-    lequal(ArrayGet(&array, 500)->i, 500);
+    lequal(Tiny_ToInt(*ArrayGet(&array, 500)), 500);
 
     ArrayRemove(&array, 500);
 
     lequal(ArrayLen(&array), 999);
-    lequal(ArrayGet(&array, 500)->i, 501);
+    lequal(Tiny_ToInt(*ArrayGet(&array, 500)), 501);
 
     DestroyArray(&array);
 }
 
+static void test_PackedArray(void) {
+    PackedArray array;
+
+    Tiny_Value data[] = {Tiny_NewInt(3), Tiny_NewInt(-1), Tiny_NewInt(2)};
+
+    InitPackedArrayEx(&array, Tiny_DefaultContext, PACKED_ARRAY_INT,
+                      sizeof(data) / sizeof(data[0]), data);
+
+    lequal(PackedArrayLen(&array), 3);
+    lequal(Tiny_ToInt(PackedArrayGet(&array, 1)), -1);
+
+    for (int i = 0; i < 1000; ++i) {
+        PackedArrayPush(&array, Tiny_NewInt(i));
+    }
+
+    lequal(PackedArrayLen(&array), 1003);
+
+    // Elements are stored unboxed
+    lequal(((Tiny_Int *)array.data)[503], 500);
+
+    PackedArrayInsert(&array, 1, Tiny_NewInt(10));
+    PackedArrayRemove(&array, 0);
+
+    lequal(Tiny_ToInt(PackedArrayShift(&array)), 10);
+    lequal(Tiny_ToInt(PackedArrayPop(&array)), 999);
+
+    PackedArraySortInts(&array);
+
+    lequal(Tiny_ToInt(PackedArrayGet(&array, 0)), -1);
+    lequal(Tiny_ToInt(PackedArrayGet(&array, PackedArrayLen(&array) - 1)), 998);
+
+    PackedArray bools;
+
+    InitPackedArray(&bools, Tiny_DefaultContext, PACKED_ARRAY_BOOL);
+    PackedArrayResize(&bools, 100, Tiny_NewBool(true));
+    PackedArraySet(&bools, 50, Tiny_NewBool(false));
+
+    lequal(Tiny_GetType(PackedArrayGet(&bools, 0)), TINY_VAL_BOOL);
+    lok(Tiny_ToBool(PackedArrayGet(&bools, 49)));
+    lok(!Tiny_ToBool(PackedArrayGet(&bools, 50)));
+
+    DestroyPackedArray(&bools);
+    DestroyPackedArray(&array);
+}
+
 static void test_Array(void) {
     test_InitArrayEx();
     test_ArrayPush();
@@ -269,6 +285,7 @@ static void test_Array(void) {
     test_ArraySet();
     test_ArrayInsert();
     test_ArrayRemove();
+    test_PackedArray();
 }
 
 static void test_DictSet(void) {
@@ -277,15 +294,7 @@ static void test_DictSet(void) {
     InitDict(&dict, Tiny_DefaultContext);
 
     for (int i = 0; i < 1000; ++i) {
-        DictSet(&dict,
-                (Tiny_Value){
-                    .type = TINY_VAL_INT,
-                    .i = i,
-                },
-                (Tiny_Value){
-                    .type = TINY_VAL_INT,
-                    .i = i,
-                });
+        DictSet(&dict, Tiny_NewInt(i), Tiny_NewInt(i));
     }
 
     lok(dict.filledCount == 1000);
@@ -293,12 +302,9 @@ static void test_DictSet(void) {
     bool allGood = true;
 
     for (int i = 0; i < 1000; ++i) {
-        const Tiny_Value *pValue = DictGet(&dict, (Tiny_Value){
-                                                      .type = TINY_VAL_INT,
-                                                      .i = i,
-                                                  });
+        const Tiny_Value *pValue = DictGet(&dict, Tiny_NewInt(i));
 
-        if (!pValue || pValue->i != i) {
+        if (!pValue || Tiny_ToInt(*pValue) != i) {
             allGood = false;
             break;
         }
@@ -315,18 +321,10 @@ static void test_DictRemove(void) {
     InitDict(&dict, Tiny_DefaultContext);
 
     for (int i = 0; i < 1000; ++i) {
-        DictSet(&dict,
-                (Tiny_Value){
-                    .type = TINY_VAL_INT,
-                    .i = i,
-                },
-                (Tiny_Value){
-                    .type = TINY_VAL_INT,
-                    .i = i,
-                });
+        DictSet(&dict, Tiny_NewInt(i), Tiny_NewInt(i));
 
         if (i % 2 == 0) {
-            DictRemove(&dict, (Tiny_Value){.type = TINY_VAL_INT, .i = i / 2});
+            DictRemove(&dict, Tiny_NewInt(i / 2));
         }
     }
 
@@ -335,10 +333,7 @@ static void test_DictRemove(void) {
     Tiny_Value foundKey = {0};
 
     for (int i = 0; i < 500; ++i) {
-        Tiny_Value key = {
-            .type = TINY_VAL_INT,
-            .i = i,
-        };
+        Tiny_Value key = Tiny_NewInt(i);
 
         if (DictGet(&dict, key)) {
             foundKey = key;
@@ -351,12 +346,9 @@ static void test_DictRemove(void) {
     int neInt = -1;
 
     for (int i = 500; i < 1000; ++i) {
-        Tiny_Value key = {
-            .type = TINY_VAL_INT,
-            .i = i,
-        };
+        Tiny_Value key = Tiny_NewInt(i);
 
-        int value = DictGet(&dict, key)->i;
+        int value = Tiny_ToInt(*DictGet(&dict, key));
 
         if (value != i) {
             neInt = i;
@@ -375,15 +367,7 @@ static void test_DictClear(void) {
     InitDict(&dict, Tiny_DefaultContext);
 
     for (int i = 0; i < 1000; ++i) {
-        DictSet(&dict,
-                (Tiny_Value){
-                    .type = TINY_VAL_INT,
-                    .i = i,
-                },
-                (Tiny_Value){
-                    .type = TINY_VAL_INT,
-                    .i = i,
-                });
+        DictSet(&dict, Tiny_NewInt(i), Tiny_NewInt(i));
     }
 
     lequal(dict.filledCount, 1000);
@@ -395,10 +379,7 @@ static void test_DictClear(void) {
     Tiny_Value foundKey = {0};
 
     for (int i = 0; i < 1000; ++i) {
-        Tiny_Value key = {
-            .type = TINY_VAL_INT,
-            .i = i,
-        };
+        Tiny_Value key = Tiny_NewInt(i);
 
         if (DictGet(&dict, key)) {
             foundKey = key;
@@ -406,15 +387,153 @@ static void test_DictClear(void) {
         }
     }
 
-    lok_print(Tiny_IsNull(foundKey), "key=%lld", (int64_t)foundKey.i);
+    lok_print(Tiny_IsNull(foundKey), "key=%lld", (int64_t)Tiny_ToInt(foundKey));
+
+    DestroyDict(&dict);
+}
+
+// Lots of removes and re-inserts over a small set of keys leave deleted slots all over the
+// table, which lookups have to probe past and resizes have to clear out.
+static void test_DictChurn(void) {
+    Dict dict;
+
+    InitDict(&dict, Tiny_DefaultContext);
+
+    enum { KEY_COUNT = 300 };
+
+    int expected[KEY_COUNT];
+
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        expected[i] = -1;
+    }
+
+    unsigned int rng = 12345;
+    int mismatches = 0;
+
+    for (int i = 0; i < 200000; ++i) {
+        rng = rng * 1103515245 + 12345;
+        int k = (rng >> 8) % KEY_COUNT;
+
+        if ((rng >> 20) % 3 == 0) {
+            DictRemove(&dict, Tiny_NewInt(k));
+            expected[k] = -1;
+        } else {
+            DictSet(&dict, Tiny_NewInt(k), Tiny_NewInt(i));
+            expected[k] = i;
+        }
+
+        const Tiny_Value *value = DictGet(&dict, Tiny_NewInt(k));
+
+        if (expected[k] < 0 ? value != NULL : (!value || Tiny_ToInt(*value) != expected[k])) {
+            mismatches += 1;
+        }
+    }
+
+    lequal(mismatches, 0);
+
+    int filled = 0;
+
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        const Tiny_Value *value = DictGet(&dict, Tiny_NewInt(i));
+
+        if (expected[i] >= 0) {
+            filled += 1;
+        }
+
+        if (expected[i] < 0 ? value != NULL : (!value || Tiny_ToInt(*value) != expected[i])) {
+            mismatches += 1;
+        }
+    }
+
+    lequal(mismatches, 0);
+    lequal(dict.filledCount, filled);
+
+    // Deleted slots get reused or cleared out rather than growing the table forever
+    lok(dict.bucketCount <= 1024);
+
+    DestroyDict(&dict);
+}
+
+// Every string made of "AB" and "B!" pairs has the same unkeyed djb2 hash (which is what dict
+// used to use), so these used to all land in one probe chain.
+static void test_DictCollidingStrings(void) {
+    enum { BITS = 12, KEY_COUNT = 1 << BITS };
+
+    static char keys[KEY_COUNT][BITS * 2 + 1];
+
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        for (int b = 0; b < BITS; ++b) {
+            memcpy(&keys[i][b * 2], (i >> b) & 1 ? "B!" : "AB", 2);
+        }
+
+        keys[i][BITS * 2] = '\0';
+    }
+
+    Dict hashes;
+
+    InitDict(&hashes, Tiny_DefaultContext);
+
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        Tiny_Value hash = Tiny_NewInt(Tiny_HashString(Tiny_NewConstString(keys[i])));
+        DictSet(&hashes, hash, Tiny_NewBool(true));
+    }
+
+    // 32-bit hashes, so a collision or two is possible but not much more than that
+    lok(hashes.filledCount > KEY_COUNT - 4);
+
+    DestroyDict(&hashes);
+
+    Dict dict;
+
+    InitDict(&dict, Tiny_DefaultContext);
+
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        DictSet(&dict, Tiny_NewConstString(keys[i]), Tiny_NewInt(i));
+    }
+
+    lequal(dict.filledCount, KEY_COUNT);
+
+    int wrong = 0;
+
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        const Tiny_Value *value = DictGet(&dict, Tiny_NewConstString(keys[i]));
+
+        if (!value || Tiny_ToInt(*value) != i) {
+            wrong += 1;
+        }
+    }
+
+    lequal(wrong, 0);
 
     DestroyDict(&dict);
 }
 
+// Inputs equal to the hash's public constants mustn't cancel out the seed, otherwise keys made of
+// them would collide the same way no matter what the seed is
+static void test_HashSeedBlinding(void) {
+    // HASH_P1 and HASH_P0 in util.c
+    const uint64_t p1 = 0xe7037ed1a0b428dbull;
+    const uint64_t p0 = 0xa0761d6478bd642full;
+
+    uint8_t key[48];
+
+    for (int i = 0; i < sizeof(key); i += 16) {
+        memcpy(&key[i], &p1, sizeof(p1));
+        memset(&key[i + 8], i, 8);
+    }
+
+    lok(Tiny_HashBytes(key, sizeof(key), 1) != Tiny_HashBytes(key, sizeof(key), 2));
+    lok(Tiny_HashBytes(key, 32, 1) != Tiny_HashBytes(key, 32, 2));
+    lok(Tiny_HashInt(p0, 1) != Tiny_HashInt(p0, 2));
+}
+
 static void test_Dict(void) {
     test_DictSet();
     test_DictRemove();
     test_DictClear();
+    test_DictChurn();
+    test_DictCollidingStrings();
+    test_HashSeedBlinding();
 }
 
 static Tiny_Value Lib_Print(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
@@ -422,25 +541,30 @@ static Tiny_Value Lib_Print(Tiny_StateThread *thread, const Tiny_Value *args, in
 
     Tiny_Value val = args[0];
 
-    switch (val.type) {
+    switch (Tiny_GetType(val)) {
         case TINY_VAL_NULL:
             puts("null\n");
             break;
         case TINY_VAL_BOOL:
-            puts(val.boolean ? "true\n" : "false\n");
+            puts(Tiny_ToBool(val) ? "true\n" : "false\n");
             break;
         case TINY_VAL_INT:
-            printf("%lld\n", val.i);
+            printf("%lld\n", Tiny_ToInt(val));
             break;
         case TINY_VAL_FLOAT:
-            printf("%f\n", val.f);
+            printf("%f\n", Tiny_ToFloat(val));
             break;
         case TINY_VAL_STRING:
+        case TINY_VAL_CONST_STRING:
+        case TINY_VAL_SMALL_STRING:
             printf("%s\n", Tiny_ToString(val));
             break;
         case TINY_VAL_NATIVE:
             printf("native <%s at %p>\n", Tiny_GetProp(val)->name, Tiny_ToAddr(val));
             break;
+        default:
+            printf("<value of type %d>\n", (int)Tiny_GetType(val));
+            break;
     }
 
     return Tiny_Null;
@@ -462,8 +586,8 @@ static void test_StateCompile(void) {
     for (int i = 0; i < 1000; ++i) {
         InitThread(&threads[i], state);
 
-        Tiny_Value val = Tiny_CallFunction(&threads[i], factIndex,
-                                           &(Tiny_Value){.type = TINY_VAL_INT, .i = 5}, 1);
+        Tiny_Value val =
+            Tiny_CallFunction(&threads[i], factIndex, (Tiny_Value[]){Tiny_NewInt(5)}, 1);
 
         if (Tiny_ToInt(val) != 120) {
             allEqual = false;
@@ -494,13 +618,13 @@ static void test_MultiCompileString(void) {
 
     Tiny_Value ret = Tiny_CallFunction(&thread, Tiny_GetFunctionIndex(state, "add"), args, 2);
 
-    lok(ret.type == TINY_VAL_INT);
-    lequal(ret.i, 30);
+    lok(Tiny_GetType(ret) == TINY_VAL_INT);
+    lequal(Tiny_ToInt(ret), 30);
 
     ret = Tiny_CallFunction(&thread, Tiny_GetFunctionIndex(state, "sub"), args, 2);
 
-    lok(ret.type == TINY_VAL_INT);
-    lequal(ret.i, -10);
+    lok(Tiny_GetType(ret) == TINY_VAL_INT);
+    lequal(Tiny_ToInt(ret), -10);
 
     Tiny_DestroyThread(&thread);
 
@@ -523,10 +647,10 @@ static void test_TinyStateCallFunction(void) {
 
     Tiny_Value ret = Tiny_CallFunction(&thread, fact, &arg, 1);
 
-    lok(ret.type == TINY_VAL_INT);
+    lok(Tiny_GetType(ret) == TINY_VAL_INT);
     lok(Tiny_IsThreadDone(&thread));
 
-    lequal(ret.i, 120);
+    lequal(Tiny_ToInt(ret), 120);
 
     Tiny_DestroyThread(&thread);
 
@@ -537,8 +661,8 @@ static Tiny_Value CallFunc(Tiny_StateThread *thread, const Tiny_Value *args, int
     Tiny_Value ret = Tiny_CallFunction(
         thread, Tiny_GetFunctionIndex(thread->state, Tiny_ToString(args[0])), &args[1], count - 1);
 
-    lok(ret.type == TINY_VAL_INT);
-    lequal(ret.i, 120);
+    lok(Tiny_GetType(ret) == TINY_VAL_INT);
+    lequal(Tiny_ToInt(ret), 120);
 
     return ret;
 }
@@ -635,17 +759,11 @@ static void test_TinyDict(void) {
 
     lok(Tiny_GetProp(dict) == &DictProp);
 
-    Tiny_Value num = *DictGet(d, (Tiny_Value){
-                                     .type = TINY_VAL_CONST_STRING,
-                                     .cstr = "a",
-                                 });
+    Tiny_Value num = *DictGet(d, Tiny_NewConstString("a"));
 
     lequal(Tiny_ToInt(num), 10);
 
-    num = *DictGet(d, (Tiny_Value){
-                          .type = TINY_VAL_CONST_STRING,
-                          .cstr = "b",
-                      });
+    num = *DictGet(d, Tiny_NewConstString("b"));
 
     lequal(Tiny_ToInt(num), 20);
 
@@ -696,19 +814,22 @@ static void test_RevPolishCalc(void) {
 
     while (Tiny_ExecuteCycle(&thread));
 
-    extern const Tiny_NativeProp ArrayProp;
+    extern const Tiny_NativeProp PackedArrayProp;
 
     int stack = Tiny_GetGlobalIndex(state, "stack");
 
-    Array *a = Tiny_ToAddr(Tiny_GetGlobal(&thread, stack));
+    // Arrays of floats are packed
+    lok(Tiny_GetProp(Tiny_GetGlobal(&thread, stack)) == &PackedArrayProp);
 
-    lequal(ArrayLen(a), 1);
+    PackedArray *a = Tiny_ToAddr(Tiny_GetGlobal(&thread, stack));
 
-    Tiny_Value num = *ArrayGet(a, 0);
+    lequal(PackedArrayLen(a), 1);
+
+    Tiny_Value num = PackedArrayGet(a, 0);
 
     // Float because ston produces float
-    lequal(num.type, TINY_VAL_FLOAT);
-    lfequal(num.f, 0);
+    lequal(Tiny_GetType(num), TINY_VAL_FLOAT);
+    lfequal(Tiny_ToFloat(num), 0);
 
     Tiny_DestroyThread(&thread);
 
@@ -723,13 +844,11 @@ static void test_CheckMallocs() {
     }
 
     for (int i = 0; i < AllocDict.bucketCount; ++i) {
-        Tiny_Value key = *ArrayGet(&AllocDict.keys, i);
-
-        if (Tiny_IsNull(key)) {
+        if (!DictIsSlotFilled(&AllocDict, i)) {
             continue;
         }
 
-        Tiny_Value value = *ArrayGet(&AllocDict.values, i);
+        Tiny_Value value = AllocDict.slots[i].value;
 
         AllocInfo *info = Tiny_ToAddr(value);
 
@@ -921,7 +1040,7 @@ static void test_DisasmOne() {
 
     Tiny_DisasmOne(state, &pc, buf, sizeof(buf));
 
-    lsequal(buf, "0 ((disasm):1)\tPUSH_INT 10");
+    lsequal(buf, "0 ((disasm):1)\tPUSH_INT 30");
 
     Tiny_DeleteState(state);
 }
@@ -1014,12 +1133,12 @@ static void test_IndexSyntax() {
     Tiny_Run(&thread);
 
     Tiny_Value zv = Tiny_GetGlobal(&thread, zeroIdx);
-    lequal_return(zv.type, TINY_VAL_INT);
-    lequal_return(zv.i, 0);
+    lequal_return(Tiny_GetType(zv), TINY_VAL_INT);
+    lequal_return(Tiny_ToInt(zv), 0);
 
     Tiny_Value tv = Tiny_GetGlobal(&thread, twoIdx);
-    lequal_return(tv.type, TINY_VAL_INT);
-    lequal_return(tv.i, 2);
+    lequal_return(Tiny_GetType(tv), TINY_VAL_INT);
+    lequal_return(Tiny_ToInt(tv), 2);
 
     Tiny_DeleteState(state);
 }
@@ -1046,10 +1165,10 @@ static void test_NestedStructAssignValue() {
     Tiny_Run(&thread);
 
     Tiny_Value bv = Tiny_GetGlobal(&thread, b);
-    lequal_return(bv.type, TINY_VAL_STRUCT);
-    lequal_return(bv.obj->ostruct.fields[0].i, 10);
-    lequal_return(bv.obj->ostruct.fields[1].type, TINY_VAL_STRUCT);
-    lequal_return(bv.obj->ostruct.fields[1].obj->ostruct.fields[0].i, 30);
+    lequal_return(Tiny_GetType(bv), TINY_VAL_STRUCT);
+    lequal_return(Tiny_ToInt(Tiny_GetField(bv, 0)), 10);
+    lequal_return(Tiny_GetType(Tiny_GetField(bv, 1)), TINY_VAL_STRUCT);
+    lequal_return(Tiny_ToInt(Tiny_GetField(Tiny_GetField(bv, 1), 0)), 30);
 
     Tiny_DeleteState(state);
 }
@@ -1077,12 +1196,12 @@ static void test_LeftAndRightShift() {
     Tiny_Run(&thread);
 
     Tiny_Value xv = Tiny_GetGlobal(&thread, x);
-    lequal_return(xv.type, TINY_VAL_INT);
-    lequal_return(xv.i, 4);
+    lequal_return(Tiny_GetType(xv), TINY_VAL_INT);
+    lequal_return(Tiny_ToInt(xv), 4);
 
     Tiny_Value yv = Tiny_GetGlobal(&thread, y);
-    lequal_return(yv.type, TINY_VAL_INT);
-    lequal_return(yv.i, 1);
+    lequal_return(Tiny_GetType(yv), TINY_VAL_INT);
+    lequal_return(Tiny_ToInt(yv), 1);
 
     Tiny_DeleteState(state);
 }
@@ -1142,8 +1261,8 @@ static void test_Foreach() {
     Tiny_Run(&thread);
 
     Tiny_Value sum = Tiny_GetGlobal(&thread, sumIdx);
-    lequal_return(sum.type, TINY_VAL_INT);
-    lequal_return(sum.i, 8);
+    lequal_return(Tiny_GetType(sum), TINY_VAL_INT);
+    lequal_return(Tiny_ToInt(sum), 8);
 
     Tiny_DeleteState(state);
 }
@@ -1175,8 +1294,8 @@ static void test_ForeachRev() {
     Tiny_Run(&thread);
 
     Tiny_Value sum = Tiny_GetGlobal(&thread, sumIdx);
-    lequal_return(sum.type, TINY_VAL_INT);
-    lequal_return(sum.i, 8);
+    lequal_return(Tiny_GetType(sum), TINY_VAL_INT);
+    lequal_return(Tiny_ToInt(sum), 8);
 
     Tiny_DeleteState(state);
 }
@@ -1208,12 +1327,1351 @@ static void test_ForeachRevNoIndex() {
     Tiny_Run(&thread);
 
     Tiny_Value sum = Tiny_GetGlobal(&thread, sumIdx);
-    lequal_return(sum.type, TINY_VAL_INT);
-    lequal_return(sum.i, 6);
+    lequal_return(Tiny_GetType(sum), TINY_VAL_INT);
+    lequal_return(Tiny_ToInt(sum), 6);
+
+    Tiny_DeleteState(state);
+}
+
+static bool SumDictValues(Tiny_Value key, Tiny_Value value, void *userdata) {
+    *(Tiny_Int *)userdata += Tiny_ToInt(value);
+    return true;
+}
+
+static void test_ForeachDict() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindStandardLib(state);
+    Tiny_BindStandardDict(state);
+
+    const char *code =
+        "d := dict_str_int(\"a\", 1, \"b\", 2, \"c\", 3)\n"
+        "sum := 0\n"
+        "seen_b := 0\n"
+        "foreach k, v in d { sum += v if k == \"b\" { seen_b += 1 } }\n"
+        "func count_keys(x: dict): int {\n"
+        "    n := 0\n"
+        "    foreach k in x { if cast(k, int) > 100 { break } n += 1 }\n"
+        "    return n\n"
+        "}\n"
+        "g := dict()\n"
+        "for i := 0; i < 100; i += 1 { dict_put(g, i, i * 2) }\n"
+        "count := count_keys(g)\n"
+        "empty := count_keys(dict())\n"
+        "foreach rk, rv in d { dict_str_int_remove(d, rk) }\n"
+        "left := 0\n"
+        "foreach lk in d { left += 1 }\n";
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(foreach dict)", code);
+
+    lok_print_return(result.type == TINY_COMPILE_SUCCESS, "Failed to compile: %s\n",
+                     result.error.msg);
+
+    Tiny_StateThread thread;
+
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "sum"))), 6);
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "seen_b"))), 1);
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "count"))), 100);
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "empty"))), 0);
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "left"))), 0);
+
+    Tiny_Int total = 0;
+    DictIterate(Tiny_ToAddr(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "g"))),
+                SumDictValues, &total);
+
+    lequal(total, 99 * 100);
+
+    Tiny_DestroyThread(&thread);
+
+    // Dicts have no order to reverse
+    result = Tiny_CompileString(state, "(foreach dict reverse)",
+                                "foreach k, v in_reverse dict() {}\n");
+
+    lequal(result.type, TINY_COMPILE_ERROR);
+
+    Tiny_DeleteState(state);
+}
+
+static void test_PackedArrayMacro() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindStandardLib(state);
+    Tiny_BindStandardArray(state);
+
+    const char *code =
+        "use array(\"int\") as array_int\n"
+        "use array(\"float\") as array_float\n"
+        "use array(\"bool\") as array_bool\n"
+        "use array(\"str\") as array_str\n"
+        "a := array_int(5, 3, 9)\n"
+        "array_int_push(a, 1)\n"
+        "array_int_insert(a, 0, 7)\n"
+        "array_int_sort(a)\n"
+        "first := a[0]\n"
+        "last := array_int_pop(a)\n"
+        "front := array_int_shift(a)\n"
+        "array_int_remove(a, 1)\n"
+        "b := array_int()\n"
+        "array_int_copy(b, a)\n"
+        "array_int_resize_fill(b, 5, 4)\n"
+        "isum := 0\n"
+        "foreach x in b { isum += x }\n"
+        "big := array_int(4000000000, -4000000000, 0)\n"
+        "array_int_sort(big)\n"
+        "smallest := big[0]\n"
+        "fa := array_float(1.5)\n"
+        "array_float_resize(fa, 3)\n"
+        "fa[2] = 2.5\n"
+        "fsum := fa[0] + fa[1] + fa[2]\n"
+        "ba := array_bool()\n"
+        "array_bool_resize_fill(ba, 3, true)\n"
+        "ba[1] = false\n"
+        "bcount := 0\n"
+        "foreach y in ba { if y bcount += 1 }\n"
+        "names := array_str(\"a\")\n"
+        "sb := strbuf()\n"
+        "strbuf_appendf(sb, \"%q %q\", b, ba)\n"
+        "s := strbuf_to_str(sb)\n";
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(packed array macro)", code);
+
+    lok_print_return(result.type == TINY_COMPILE_SUCCESS, "Failed to compile: %s\n",
+                     result.error.msg);
+
+    Tiny_StateThread thread;
+
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "first"))), 1);
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "last"))), 9);
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "front"))), 1);
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "isum"))), 22);
+    lok(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "smallest"))) ==
+        -4000000000LL);
+    lfequal(Tiny_ToFloat(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "fsum"))), 4);
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "bcount"))), 2);
+
+    Tiny_Value s = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "s"));
+
+    lok(strcmp(Tiny_ToString(s), "[3, 7, 4, 4, 4] [true, false, true]") == 0);
+
+    extern const Tiny_NativeProp ArrayProp;
+    extern const Tiny_NativeProp PackedArrayProp;
+
+    // Only arrays of primitives are packed
+    lok(Tiny_GetProp(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "a"))) ==
+        &PackedArrayProp);
+    lok(Tiny_GetProp(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "names"))) == &ArrayProp);
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+// From the server example (see test/CMakeLists.txt)
+void BindBuffer(Tiny_State *state);
+void BindTemplateUtils(Tiny_State *state);
+
+static void test_TemplateArrays() {
+    const char *templatePath = "test_template.html";
+
+    FILE *f = fopen(templatePath, "w");
+
+    lok_print_return(f, "Failed to open %s for writing\n", templatePath);
+
+    // Laid out like the server's templates, which have a newline after every '{' and '}'
+    fputs("<ul>[nums]{\n<li>$_</li>}\n</ul>[names]{\n$_;}\n[keys]{\n$_}\n", f);
+    fclose(f);
+
+    Tiny_State *state = CreateState();
+
+    Tiny_BindStandardLib(state);
+    Tiny_BindStandardArray(state);
+    Tiny_BindStandardDict(state);
+    BindBuffer(state);
+    BindTemplateUtils(state);
+
+    // Arrays of ints are packed and arrays of strs aren't, so both kinds are expanded here
+    const char *code =
+        "use dict(\"int\", \"bool\") as dib\n"
+        "nums := array_int(1, 2, 3)\n"
+        "names := array_str(\"a\", \"b\")\n"
+        "env := dict(\"nums\", nums, \"names\", names, \"keys\", dib_keys(dib(7, true)))\n"
+        "b := render_template(\"test_template.html\", env)\n"
+        "s := \"\"\n"
+        "if b != null { s = buf_to_str(b) }\n";
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(template arrays)", code);
+
+    if (result.type == TINY_COMPILE_SUCCESS) {
+        Tiny_StateThread thread;
+
+        InitThread(&thread, state);
+
+        Tiny_StartThread(&thread);
+        Tiny_Run(&thread);
+
+        const char *s = Tiny_ToString(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "s")));
+
+        lok(s && strcmp(s, "<ul><li>1</li><li>2</li><li>3</li></ul>a;b;7") == 0);
+
+        Tiny_DestroyThread(&thread);
+    } else {
+        lok_print(false, "Failed to compile: %s\n", result.error.msg);
+    }
+
+    Tiny_DeleteState(state);
+
+    remove(templatePath);
+}
+
+static void test_DictMacro() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindStandardLib(state);
+    Tiny_BindStandardArray(state);
+    Tiny_BindStandardDict(state);
+
+    const char *code =
+        "use dict(\"int\", \"int\") as dii\n"
+        "use dict(\"str\", \"float\") as dsf\n"
+        "use dict(\"float\", \"bool\") as dfb\n"
+        "d := dii(1, 10, 2, 20)\n"
+        "dii_put(d, 3, 30)\n"
+        "d[4] = 40\n"
+        "total := d[1] + dii_get(d, 3) + d[4]\n"
+        "had := dii_exists(d, 2)\n"
+        "dii_remove(d, 2)\n"
+        "has := dii_exists(d, 2)\n"
+        "len := dii_len(d)\n"
+        "weighted := 0\n"
+        "foreach k, v in d { weighted += k * v }\n"
+        "key_count := array_int_len(dii_keys(d))\n"
+        "f := dsf(\"a\", 1.5)\n"
+        "f[\"b\"] = 2.5\n"
+        "fsum := f[\"a\"] + f[\"b\"]\n"
+        "z := dfb(0.0, true)\n"
+        "neg_zero := dfb_get(z, -0.0)\n";
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(dict macro)", code);
+
+    lok_print_return(result.type == TINY_COMPILE_SUCCESS, "Failed to compile: %s\n",
+                     result.error.msg);
+
+    Tiny_StateThread thread;
+
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "total"))), 80);
+    lok(Tiny_ToBool(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "had"))));
+    lok(!Tiny_ToBool(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "has"))));
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "len"))), 3);
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "weighted"))), 260);
+    lequal(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "key_count"))), 3);
+    lfequal(Tiny_ToFloat(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "fsum"))), 4);
+    lok(Tiny_ToBool(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "neg_zero"))));
+
+    extern const Tiny_NativeProp DictProp;
+    extern const Tiny_NativeProp PrimitiveDictProp;
+
+    Tiny_Value d = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "d"));
+    Tiny_Value f = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "f"));
+
+    // Only dicts of primitives can skip marking
+    lok(Tiny_GetProp(d) == &PrimitiveDictProp);
+    lok(Tiny_GetProp(f) == &DictProp);
+
+    Tiny_DestroyThread(&thread);
+
+    result = Tiny_CompileString(state, "(dict macro one arg)", "use dict(\"int\") as di\n");
+
+    lequal(result.type, TINY_COMPILE_ERROR);
+
+    Tiny_DeleteState(state);
+}
+
+static void test_TypedArithmetic() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindStandardLib(state);
+
+    const char *code =
+        "f := 1.5 + 1\n"
+        "g := 2 * 0.25\n"
+        "h := -f\n"
+        "i := 7 / 2\n"
+        "j := 1 < 1.5 && 2.5 >= 2\n"
+        "k := 10 == 10 && 1.5 != 2.5 && true == true\n"
+        "l := strcat(\"a\", \"b\") == \"ab\" && \"ab\" != strcat(\"a\", \"c\")\n"
+        "m := 0.5\n"
+        "m += 1.0\n"
+        "m -= 0.25\n";
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(typed arithmetic)", code);
+
+    lok_print_return(result.type == TINY_COMPILE_SUCCESS, "Failed to compile: %s\n",
+                     result.error.msg);
+
+    Tiny_StateThread thread;
+
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    Tiny_Value f = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "f"));
+    Tiny_Value g = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "g"));
+    Tiny_Value h = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "h"));
+    Tiny_Value i = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "i"));
+    Tiny_Value j = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "j"));
+    Tiny_Value k = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "k"));
+    Tiny_Value l = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "l"));
+    Tiny_Value m = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "m"));
+
+    lequal(Tiny_GetType(f), TINY_VAL_FLOAT);
+    lfequal(Tiny_ToFloat(f), 2.5);
+    lfequal(Tiny_ToFloat(g), 0.5);
+    lfequal(Tiny_ToFloat(h), -2.5);
+    lequal(Tiny_GetType(i), TINY_VAL_INT);
+    lequal((int)Tiny_ToInt(i), 3);
+    lok(Tiny_ToBool(j));
+    lok(Tiny_ToBool(k));
+    lok(Tiny_ToBool(l));
+    lfequal(Tiny_ToFloat(m), 1.25);
+
+    Tiny_DestroyThread(&thread);
 
     Tiny_DeleteState(state);
 }
 
+static void test_ValueRoundTrip() {
+#ifdef TINY_VALUE_NANBOX
+    lequal((int)sizeof(Tiny_Value), 8);
+#endif
+
+    Tiny_Value zeroed = {0};
+
+    lok(Tiny_IsNull(zeroed));
+    lok(Tiny_IsNull(Tiny_Null));
+
+    lequal(Tiny_GetType(Tiny_NewBool(false)), TINY_VAL_BOOL);
+    lok(!Tiny_ToBool(Tiny_NewBool(false)));
+    lok(Tiny_ToBool(Tiny_NewBool(true)));
+
+    lequal((int)Tiny_ToInt(Tiny_NewInt(-1)), -1);
+    lequal((int)Tiny_ToInt(Tiny_NewInt(0)), 0);
+    lok(Tiny_ToInt(Tiny_NewInt(-123456789012)) == -123456789012);
+
+    lfequal(Tiny_ToFloat(Tiny_NewFloat(-0.5)), -0.5);
+    lequal(Tiny_GetType(Tiny_NewFloat(1.0 / 0.0)), TINY_VAL_FLOAT);
+    lequal(Tiny_GetType(Tiny_NewFloat(-1.0 / 0.0)), TINY_VAL_FLOAT);
+    lequal(Tiny_GetType(Tiny_NewFloat(0.0 / 0.0)), TINY_VAL_FLOAT);
+    lequal(Tiny_GetType(Tiny_NewFloat(-(0.0 / 0.0))), TINY_VAL_FLOAT);
+
+    const char *str = "hello";
+    int x = 0;
+
+    lok(Tiny_ToString(Tiny_NewConstString(str)) == str);
+    lok(Tiny_ToAddr(Tiny_NewLightNative(&x)) == &x);
+    lequal(Tiny_GetType(Tiny_NewLightNative(NULL)), TINY_VAL_LIGHT_NATIVE);
+}
+
+// Returns true if any instruction in the state's program disassembles to something starting
+// with the given prefix
+static bool ProgramContains(const Tiny_State *state, const char *prefix) {
+    char buf[256];
+    int pc = 0;
+
+    while (pc >= 0) {
+        if (!Tiny_DisasmOne(state, &pc, buf, sizeof(buf))) {
+            break;
+        }
+
+        const char *inst = strchr(buf, '\t');
+
+        if (inst && strncmp(inst + 1, prefix, strlen(prefix)) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void test_Superinstructions() {
+    Tiny_State *state = CreateState();
+
+    const char *code =
+        "struct P { x: int y: int }\n"
+        "func g(): int { return 1 }\n"
+        "func f(n: int): int {\n"
+        "    p := new P{3, 4}\n"
+        "    sum := 0\n"
+        "    i := 0\n"
+        "    while i < 10 {\n"
+        "        sum += p.x\n"
+        "        i += 1\n"
+        "    }\n"
+        "    j := p.y\n"
+        "    j -= 1\n"
+        "    return sum + j + g()\n"
+        "}\n"
+        "x := f(0)\n";
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(superinstructions)", code);
+
+    lequal_return(result.type, TINY_COMPILE_SUCCESS);
+
+    lok(ProgramContains(state, "LT_LOCAL_CONST_GOTOZ"));
+    lok(ProgramContains(state, "INC_LOCAL"));
+    lok(ProgramContains(state, "DEC_LOCAL"));
+    lok(ProgramContains(state, "GETLOCAL_STRUCT_GET"));
+    lok(ProgramContains(state, "CALL_RETVAL"));
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    Tiny_Value x = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "x"));
+
+    lequal((int)Tiny_ToInt(x), 34);
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+static int64_t RunWithBackend(Tiny_Backend backend, const char *code, Tiny_Int *x, Tiny_Float *y) {
+    Tiny_State *state = Tiny_CreateStateWithBackend(Context, backend);
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(backend)", code);
+
+    lequal(result.type, TINY_COMPILE_SUCCESS);
+
+    if (backend == TINY_BACKEND_REGISTER) {
+        lok(ProgramContains(state, "ADD_INT_R"));
+        lok(ProgramContains(state, "LT_INT_RK_GOTOZ"));
+    } else {
+        lok(!ProgramContains(state, "ADD_INT_R"));
+    }
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+
+    int64_t cycles = 0;
+
+    while (Tiny_ExecuteCycle(&thread)) {
+        ++cycles;
+    }
+
+    *x = Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "x")));
+    *y = Tiny_ToFloat(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "y")));
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+
+    return cycles;
+}
+
+static void test_RegisterBackend() {
+    const char *code =
+        "struct P { x: int }\n"
+        "func fib(n: int): int {\n"
+        "    if n <= 1 { return n }\n"
+        "    return fib(n - 1) + fib(n - 2)\n"
+        "}\n"
+        "func g(a: int, b: int): int {\n"
+        "    p := new P{a}\n"
+        "    sum := 0\n"
+        "    for i := 0; i < 100; i += 1 {\n"
+        "        c := (i * 3 + a) % 7\n"
+        "        if c > 3 { sum += c } else { sum -= 1 }\n"
+        "        if i >= b && c == 2 { sum = sum * 2 - p.x }\n"
+        "        big := i > b\n"
+        "        if big { sum += 1 }\n"
+        "    }\n"
+        "    j := 10\n"
+        "    while 0 < j { j -= 3 }\n"
+        "    k := 2 - j\n"
+        "    k /= 2\n"
+        "    return sum + j + k + fib(10)\n"
+        "}\n"
+        "func h(f: float): float {\n"
+        "    r := 0.0\n"
+        "    i := 0.0\n"
+        "    while i < f {\n"
+        "        r = r + i * 0.5 - r / 4.0\n"
+        "        i += 1.0\n"
+        "    }\n"
+        "    if r == f { return 0.0 }\n"
+        "    return r\n"
+        "}\n"
+        "x := g(5, 50)\n"
+        "y := h(10.0)\n";
+
+    Tiny_Int stackX = 0, regX = 0;
+    Tiny_Float stackY = 0, regY = 0;
+
+    int64_t stackCycles = RunWithBackend(TINY_BACKEND_STACK, code, &stackX, &stackY);
+    int64_t regCycles = RunWithBackend(TINY_BACKEND_REGISTER, code, &regX, &regY);
+
+    lequal((int)stackX, 13471);
+    lequal((int)regX, (int)stackX);
+    lfequal(stackY, 12.4505);
+    lfequal(regY, stackY);
+
+    // The whole point
+    lok(regCycles < stackCycles);
+}
+
+static void test_Peephole() {
+    const char *code =
+        "func f(n: int): int {\n"
+        "    a := 1\n"
+        "    a = n\n"
+        "    sum := 0\n"
+        "    i := 0\n"
+        "    while true {\n"
+        "        if i != 3 { sum += -i } else { sum += 100 }\n"
+        "        if !(i < 5) { break }\n"
+        "        i += 1\n"
+        "    }\n"
+        "    return sum + a\n"
+        "}\n"
+        "func g(v: float): float { return -v }\n"
+        "func h(a: str, b: str): bool { return a != b }\n"
+        "x := f(7)\n"
+        "y := g(2.5)\n"
+        "z := h(\"a\", \"b\")\n";
+
+    for (int level = 0; level <= 1; ++level) {
+        Tiny_State *state = CreateState();
+
+        Tiny_SetOptimizationLevel(state, level);
+
+        Tiny_CompileResult result = Tiny_CompileString(state, "(peephole)", code);
+
+        lequal(result.type, TINY_COMPILE_SUCCESS);
+
+        lequal(ProgramContains(state, "NEG_INT"), level > 0);
+        lequal(ProgramContains(state, "NEG_FLOAT"), level > 0);
+        lequal(ProgramContains(state, "NOT_EQU_STR"), level > 0);
+        lequal(ProgramContains(state, "GOTONZ"), level > 0);
+        lequal(ProgramContains(state, "MUL_INT"), level == 0);
+        lok(!ProgramContains(state, "MISALIGNED_INSTRUCTION"));
+
+        Tiny_StateThread thread;
+        InitThread(&thread, state);
+
+        Tiny_StartThread(&thread);
+        Tiny_Run(&thread);
+
+        lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "x"))), 95);
+        lfequal(Tiny_ToFloat(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "y"))), -2.5);
+        lok(Tiny_ToBool(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "z"))));
+
+        Tiny_DestroyThread(&thread);
+
+        Tiny_DeleteState(state);
+    }
+}
+
+static void test_ConstantFolding() {
+    const char *code =
+        "secs := 60 * 60 * 24\n"
+        "half := BUFSIZE / 2 + (1 << 4)\n"
+        "ratio := 1 + 0.5 * 2\n"
+        "name := strcat(NAME, \"-\", \"lang\")\n"
+        "mode := 0\n"
+        "if DEBUG { mode = 1 } else { mode = 2 }\n"
+        "while DEBUG { mode += 10 }\n"
+        "release := !DEBUG && 3 > 2\n";
+
+    for (int level = 0; level <= 1; ++level) {
+        Tiny_State *state = CreateState();
+
+        Tiny_SetOptimizationLevel(state, level);
+
+        Tiny_BindStandardLib(state);
+
+        Tiny_BindConstInt(state, "BUFSIZE", 4096);
+        Tiny_BindConstBool(state, "DEBUG", false);
+        Tiny_BindConstString(state, "NAME", "tiny");
+
+        Tiny_CompileResult result = Tiny_CompileString(state, "(folding)", code);
+
+        lequal(result.type, TINY_COMPILE_SUCCESS);
+
+        lequal(ProgramContains(state, "PUSH_INT 86400"), level > 0);
+        lequal(ProgramContains(state, "MUL_INT"), level == 0);
+        lequal(ProgramContains(state, "CALLF"), level == 0);
+        lequal(ProgramContains(state, "GOTOZ"), level == 0);
+
+        Tiny_StateThread thread;
+        InitThread(&thread, state);
+
+        Tiny_StartThread(&thread);
+        Tiny_Run(&thread);
+
+        lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "secs"))),
+               86400);
+        lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "half"))),
+               2064);
+        lfequal(Tiny_ToFloat(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "ratio"))), 2);
+        lsequal(Tiny_ToString(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "name"))),
+                "tiny-lang");
+        lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "mode"))), 2);
+        lok(Tiny_ToBool(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "release"))));
+
+        Tiny_DestroyThread(&thread);
+
+        Tiny_DeleteState(state);
+    }
+}
+
+static void test_Inliner() {
+    const char *code =
+        "struct P { x: int y: int }\n"
+        "func get_x(p: P): int { return p.x }\n"
+        "func clamp(v: int, lo: int, hi: int): int {\n"
+        "    if v < lo return lo\n"
+        "    if v > hi return hi\n"
+        "    return v\n"
+        "}\n"
+        "func fact(n: int): int { return if n <= 1 1 else n * fact(n - 1) }\n"
+        "func f(n: int): int {\n"
+        "    p := new P{n, 2}\n"
+        "    return get_x(p) + clamp(n * 3, 0, 10) + clamp(get_x(p), 5, 6) + fact(4)\n"
+        "}\n"
+        "x := f(2)\n"
+        "y := clamp(-5, 0, 10)\n";
+
+    for (int level = 0; level <= 1; ++level) {
+        Tiny_State *state = CreateState();
+
+        Tiny_SetOptimizationLevel(state, level);
+
+        Tiny_CompileResult result = Tiny_CompileString(state, "(inliner)", code);
+
+        lequal(result.type, TINY_COMPILE_SUCCESS);
+
+        if (level > 0) {
+            // Recursive functions are never inlined, but clamp should be
+            lok(ProgramContains(state, "CALL_RETVAL 1"));
+            lok(!ProgramContains(state, "CALL_RETVAL 3"));
+        } else {
+            lok(ProgramContains(state, "CALL 3"));
+        }
+
+        Tiny_StateThread thread;
+        InitThread(&thread, state);
+
+        Tiny_StartThread(&thread);
+        Tiny_Run(&thread);
+
+        lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "x"))), 37);
+        lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "y"))), 0);
+
+        Tiny_DestroyThread(&thread);
+
+        Tiny_DeleteState(state);
+    }
+}
+
+static void test_GrowableStacks() {
+    Tiny_State *state = CreateState();
+
+    Tiny_CompileResult result =
+        Tiny_CompileString(state, "(stacks)",
+                           "func sum(n: int): int { if n == 0 return 0 return n + sum(n - 1) }\n"
+                           "func forever(n: int): int { return forever(n + 1) + 1 }\n"
+                           "x := sum(50000)\n");
+
+    lequal(result.type, TINY_COMPILE_SUCCESS);
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    // Nothing is allocated for the stack until the thread runs
+    lok(!thread.stack);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    lok(!Tiny_GetThreadError(&thread));
+    lok(thread.stackCap > TINY_THREAD_STACK_CHUNK_SIZE);
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "x"))), 1250025000);
+
+    Tiny_Value arg = Tiny_NewInt(40000);
+    Tiny_Value ret = Tiny_CallFunction(&thread, Tiny_GetFunctionIndex(state, "sum"), &arg, 1);
+
+    lok(!Tiny_GetThreadError(&thread));
+    lequal((int)Tiny_ToInt(ret), 800020000);
+
+    // Unbounded recursion stops the thread instead of running off the end of the stack
+    arg = Tiny_NewInt(0);
+    Tiny_CallFunction(&thread, Tiny_GetFunctionIndex(state, "forever"), &arg, 1);
+
+    lok(Tiny_IsThreadDone(&thread));
+    lok(Tiny_GetThreadError(&thread) != NULL);
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+static TINY_FOREIGN_FUNCTION(YieldFunc) {
+    Tiny_YieldThread(thread);
+    return Tiny_Null;
+}
+
+static void test_RunBudget() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindFunction(state, "yield(): int", YieldFunc);
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(budget)",
+                                                   "i := 0\n"
+                                                   "while i < 1000 { i += 1 }\n"
+                                                   "x := yield() + 1\n"
+                                                   "y := yield() + 2\n");
+
+    lequal(result.type, TINY_COMPILE_SUCCESS);
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+
+    int64_t executed = 0;
+
+    lequal(Tiny_RunBudget(&thread, 10, &executed), TINY_RUN_BUDGET_EXHAUSTED);
+    lequal((int)executed, 10);
+
+    Tiny_RunResult res;
+
+    while ((res = Tiny_RunBudget(&thread, 100, NULL)) == TINY_RUN_BUDGET_EXHAUSTED);
+
+    lequal(res, TINY_RUN_YIELDED);
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "i"))), 1000);
+
+    // Whatever retVal is when the thread resumes is what the yielding call returns
+    thread.retVal = Tiny_NewInt(10);
+
+    lequal(Tiny_RunBudget(&thread, 1000, NULL), TINY_RUN_YIELDED);
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "x"))), 11);
+
+    thread.retVal = Tiny_NewInt(20);
+
+    lequal(Tiny_RunBudget(&thread, 1000, NULL), TINY_RUN_DONE);
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "y"))), 22);
+
+    lequal(Tiny_RunBudget(&thread, 1000, &executed), TINY_RUN_DONE);
+    lequal((int)executed, 0);
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+static TINY_FOREIGN_FUNCTION(BigString) {
+    size_t len = (size_t)Tiny_ToInt(args[0]);
+
+    char *str = Tiny_AllocUsingContext(thread->ctx, NULL, len + 1);
+
+    memset(str, 'a', len);
+    str[len] = '\0';
+
+    return Tiny_NewString(thread, str, len);
+}
+
+static int SizedNativesFreed = 0;
+
+static void FreeSizedNative(Tiny_Context *ctx, void *ptr) { SizedNativesFreed += 1; }
+
+static const Tiny_NativeProp SizedNativeProp = {"sized", NULL, FreeSizedNative};
+
+static TINY_FOREIGN_FUNCTION(BigNative) {
+    return Tiny_NewNativeSized(thread, NULL, &SizedNativeProp, 1 << 20);
+}
+
+static void test_GCByteAccounting() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindFunction(state, "big_string(int): str", BigString);
+    Tiny_BindFunction(state, "big_native(): any", BigNative);
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(gc bytes)",
+                                                   "s := \"\"\n"
+                                                   "for i := 0; i < 50; i += 1 {\n"
+                                                   "    s = big_string(1000000)\n"
+                                                   "}\n"
+                                                   "n := big_native()\n"
+                                                   "for j := 0; j < 10; j += 1 {\n"
+                                                   "    big_native()\n"
+                                                   "}\n");
+
+    lequal(result.type, TINY_COMPILE_SUCCESS);
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    // Even though few objects were allocated, they were big enough to trigger collections, so
+    // at most a couple of the big objects should be alive at any point
+    lok(thread.heapBytes < 4 * 1000000);
+    lok(SizedNativesFreed > 0);
+    lequal((int)Tiny_StringLen(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "s"))), 1000000);
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+static void test_MarkLongList() {
+    Tiny_State *state = CreateState();
+
+    Tiny_CompileResult result =
+        Tiny_CompileString(state, "(mark long list)",
+                           "struct Node { value: int next: Node }\n"
+                           "head := cast(null, Node)\n"
+                           "for i := 0; i < 10000000; i += 1 { head = new Node{i, head} }\n"
+                           "n := 0\n"
+                           "for p := head; p != null; p = p.next { n += 1 }\n");
+
+    lequal(result.type, TINY_COMPILE_SUCCESS);
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    // The whole list was marked by every collection that happened while it was being built,
+    // which would overflow the C stack if marking recursed through the fields
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "n"))), 10000000);
+    lequal(thread.numObjects, 10000000);
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+static void test_GCStatsAndPolicy() {
+    Tiny_State *state = CreateState();
+
+    Tiny_CompileResult result = Tiny_CompileString(
+        state, "(gc stats)",
+        "struct Node { value: int next: Node }\n"
+        "keep := cast(null, Node)\n"
+        "for i := 0; i < 1000; i += 1 { keep = new Node{i, keep} }\n"
+        "for j := 0; j < 20000; j += 1 { g := new Node{j, cast(null, Node)} }\n");
+
+    lequal(result.type, TINY_COMPILE_SUCCESS);
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    Tiny_GCPolicy policy = Tiny_GetGCPolicy(&thread);
+    policy.manualOnly = true;
+
+    Tiny_SetGCPolicy(&thread, policy);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    Tiny_GCStats stats;
+    Tiny_GetGCStats(&thread, &stats);
+
+    // Nothing was collected until we asked for it
+    lequal(stats.collections, 0);
+    lequal(stats.liveObjects, 21000);
+    lok(stats.allocatedBytesSinceGC == stats.liveBytes);
+
+    Tiny_CollectGarbage(&thread);
+
+    Tiny_GetGCStats(&thread, &stats);
+
+    // Only the list and the last node assigned to g are left
+    lequal(stats.collections, 1);
+    lequal(stats.liveObjects, 1001);
+    lok(stats.freedObjects == 19999);
+    lok(stats.freedBytes > 0 && stats.liveBytes > 0);
+    lok(stats.allocatedBytesSinceGC == 0);
+
+    Tiny_DestroyThread(&thread);
+
+    // A bigger growth factor means fewer collections for the same program
+    int collections[2];
+
+    for (int i = 0; i < 2; ++i) {
+        InitThread(&thread, state);
+
+        policy = Tiny_GetGCPolicy(&thread);
+        policy.growthFactor = i == 0 ? 2 : 8;
+        policy.minHeapBytes = 1024;
+
+        Tiny_SetGCPolicy(&thread, policy);
+
+        Tiny_StartThread(&thread);
+        Tiny_Run(&thread);
+
+        Tiny_GetGCStats(&thread, &stats);
+        collections[i] = stats.collections;
+
+        Tiny_DestroyThread(&thread);
+    }
+
+    lok(collections[1] > 0 && collections[1] < collections[0]);
+
+    Tiny_DeleteState(state);
+}
+
+static void test_StringSlices() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindStandardLib(state);
+
+    Tiny_CompileResult result =
+        Tiny_CompileString(state, "(string slices)",
+                           "base := strcat(\"12345678901234567890\", int_to_str(12345))\n"
+                           "a := substr(base, 0, 18)\n"
+                           "b := substr(a, 2, 18)\n"
+                           "c := str_copy(b)\n"
+                           "short := substr(base, 0, 3)\n"
+                           "n := str_to_int(substr(strcat(\"000000000000000012\", "
+                           "int_to_str(345)), 0, 18))\n"
+                           "equal := b == \"3456789012345678\"\n"
+                           "base = \"\"\n");
+
+    lok_print_return(result.type == TINY_COMPILE_SUCCESS, "Failed to compile: %s\n",
+                     result.error.msg);
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    Tiny_Value a = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "a"));
+    Tiny_Value b = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "b"));
+    Tiny_Value c = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "c"));
+
+    char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+    size_t aLen, bLen;
+
+    // Slices point into the string they were made from, and slicing a slice doesn't make a chain
+    lok(Tiny_AsObject(a)->isSlice && Tiny_AsObject(b)->isSlice);
+    lok(Tiny_ToStringChars(b, smallBuf, &bLen) == Tiny_ToStringChars(a, smallBuf, &aLen) + 2);
+    lequal((int)aLen, 18);
+    lequal((int)bLen, 16);
+    lok(!Tiny_AsObject(c)->isSlice);
+    lequal(Tiny_GetType(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "short"))),
+           TINY_VAL_SMALL_STRING);
+
+    // Parsing a slice doesn't run past its end into the rest of the string
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "n"))), 12);
+    lok(Tiny_ToBool(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "equal"))));
+
+    // The slices keep the base string alive even though nothing else references it anymore
+    Tiny_CollectGarbage(&thread);
+
+    lequal((int)Tiny_StringLen(a), 18);
+    lok(memcmp(Tiny_ToStringChars(a, smallBuf, &aLen), "123456789012345678", 18) == 0);
+    lok(memcmp(Tiny_ToStringChars(b, smallBuf, &bLen), "3456789012345678", 16) == 0);
+
+    // Tiny_ToString gives the slice its own null terminated copy of its characters
+    const char *cstr = Tiny_ToString(a);
+
+    lok(strcmp(cstr, "123456789012345678") == 0);
+    lok(!Tiny_AsObject(a)->isSlice || Tiny_ToStringChars(a, smallBuf, &aLen) == cstr);
+
+    // a has its own copy now, but b still points into (and keeps alive) the base string
+    Tiny_CollectGarbage(&thread);
+
+    lok(Tiny_ToString(a) == cstr);
+    lok(Tiny_ToCString(&thread, a) == cstr);
+    lok(memcmp(Tiny_ToStringChars(b, smallBuf, &bLen), "3456789012345678", 16) == 0);
+    lok(strcmp(Tiny_ToString(b), "3456789012345678") == 0);
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+static void test_StrBuf() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindStandardLib(state);
+
+    Tiny_CompileResult result =
+        Tiny_CompileString(state, "(strbuf)",
+                           "struct Inner { name: str ok: bool }\n"
+                           "struct Outer { id: int inner: Inner score: float }\n"
+                           "use json(\"Outer\")\n"
+                           "b := strbuf()\n"
+                           "for i := 0; i < 1000; i += 1 { strbuf_append_int(b, i % 10) }\n"
+                           "long_len := strbuf_len(b)\n"
+                           "strbuf_clear(b)\n"
+                           "strbuf_append_str(b, \"a\", \"b\")\n"
+                           "strbuf_append_char(b, 'c')\n"
+                           "strbuf_append_float(b, 1.5)\n"
+                           "strbuf_appendf(b, \" %i %s %q\", 42, \"x\", \"y\")\n"
+                           "s := strbuf_to_str(b)\n"
+                           "len_after := strbuf_len(b)\n"
+                           "j := Outer_to_json(new Outer{7, new Inner{\"n\", true}, 0.5})\n");
+
+    lok_print_return(result.type == TINY_COMPILE_SUCCESS, "Failed to compile: %s\n",
+                     result.error.msg);
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "long_len"))),
+           1000);
+
+    Tiny_Value s = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "s"));
+
+    lok(strcmp(Tiny_ToString(s), "abc1.5 42 x \"y\"") == 0);
+    lequal((int)Tiny_StringLen(s), 15);
+
+    // The buffer was handed over to the string
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "len_after"))), 0);
+
+    lok(strcmp(Tiny_ToString(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "j"))),
+               "{\"id\":7,\"inner\":{\"name\":\"n\",\"ok\":true},\"score\":0.5}") == 0);
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+static void test_SmallStrings() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindStandardLib(state);
+    Tiny_BindStandardDict(state);
+
+    Tiny_CompileResult result =
+        Tiny_CompileString(state, "(small strings)",
+                           "d := dict_str_int()\n"
+                           "for i := 0; i < 1000; i += 1 {\n"
+                           "    dict_str_int_put(d, int_to_str(i), i)\n"
+                           "}\n"
+                           "found := dict_str_int_get(d, \"42\")\n"
+                           "found_cat := dict_str_int_get(d, strcat(\"9\", int_to_str(99)))\n"
+                           "equal := int_to_str(12) == \"12\"\n"
+                           "not_equal := int_to_str(12) == int_to_str(120)\n"
+                           "small := int_to_str(123)\n"
+                           "big := strcat(small, \"4567890123456789\")\n");
+
+    lok_print_return(result.type == TINY_COMPILE_SUCCESS, "Failed to compile: %s\n",
+                     result.error.msg);
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    // The keys are stored in the dict itself, so all that's on the heap is the dict
+    lok(thread.numObjects < 10);
+
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "found"))), 42);
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "found_cat"))), 999);
+    lok(Tiny_ToBool(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "equal"))));
+    lok(!Tiny_ToBool(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "not_equal"))));
+
+    Tiny_Value small = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "small"));
+    Tiny_Value big = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "big"));
+
+    lequal(Tiny_GetType(small), TINY_VAL_SMALL_STRING);
+    lequal((int)Tiny_StringLen(small), 3);
+    lok(strcmp(Tiny_ToString(small), "123") == 0);
+
+    lequal(Tiny_GetType(big), TINY_VAL_STRING);
+    lok(strcmp(Tiny_ToString(big), "1234567890123456789") == 0);
+
+    // Small strings copied into buffers of our own don't get overwritten by later conversions like
+    // the scratch buffers Tiny_ToString uses do
+    char bufs[TINY_SMALL_STRING_SCRATCH_COUNT + 1][TINY_SMALL_STRING_MAX_LEN + 1];
+    const char *strs[TINY_SMALL_STRING_SCRATCH_COUNT + 1];
+
+    for (int i = 0; i <= TINY_SMALL_STRING_SCRATCH_COUNT; ++i) {
+        strs[i] = Tiny_ToStringBuf(small, bufs[i]);
+        lok(strs[i] == bufs[i]);
+    }
+
+    for (int i = 0; i <= TINY_SMALL_STRING_SCRATCH_COUNT; ++i) {
+        Tiny_ToString(small);
+    }
+
+    lok(strcmp(strs[0], "123") == 0 && strcmp(strs[TINY_SMALL_STRING_SCRATCH_COUNT], "123") == 0);
+    lok(Tiny_ToStringBuf(big, bufs[0]) == Tiny_ToString(big));
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+static void test_StringInterning() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindStandardLib(state);
+    Tiny_BindStandardDict(state);
+
+    Tiny_CompileResult result = Tiny_CompileString(
+        state, "(string interning)",
+        "func key(i: int): str { return strcat(\"some long key \", int_to_str(i)) }\n"
+        "a := key(10)\n"
+        "b := key(10)\n"
+        "c := key(11)\n"
+        "d := dict_str_int()\n"
+        "for i := 0; i < 1000; i += 1 { dict_str_int_put(d, key(i % 100), i) }\n"
+        "found := dict_str_int_get(d, key(42))\n"
+        "for j := 0; j < 10000; j += 1 { key(1000 + j) }\n"
+        "again := key(1000)\n");
+
+    lok_print_return(result.type == TINY_COMPILE_SUCCESS, "Failed to compile: %s\n",
+                     result.error.msg);
+
+    Tiny_StateThread thread;
+    InitThread(&thread, state);
+
+    Tiny_SetStringInterning(&thread, true);
+
+    // Collect often (and incrementally) so that interned strings get found again while
+    // collections are in progress
+    Tiny_SetGCPolicy(&thread, (Tiny_GCPolicy){.growthFactor = 2, .minHeapBytes = 4096});
+    Tiny_SetGCPauseBudget(&thread, 1);
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    Tiny_Value a = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "a"));
+    Tiny_Value b = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "b"));
+    Tiny_Value c = Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "c"));
+
+    // Equal strings share an object
+    lok(Tiny_AsObject(a) == Tiny_AsObject(b));
+    lok(Tiny_AsObject(a) != Tiny_AsObject(c));
+    lok(!Tiny_AreValuesEqual(a, c));
+
+    lequal((int)Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "found"))), 942);
+
+    // The strings which are garbage get removed from the table when they're freed
+    Tiny_CollectGarbage(&thread);
+
+    lok(thread.internCount < 200);
+    lok(strcmp(Tiny_ToString(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "again"))),
+               "some long key 1000") == 0);
+
+    Tiny_Value copy = Tiny_NewStringCopyNullTerminated(&thread, "some long key 1000");
+
+    lok(Tiny_AsObject(copy) ==
+        Tiny_AsObject(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "again"))));
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+static int CountedAllocs = 0;
+
+static void *CountingAlloc(void *ptr, size_t size, void *userdata) {
+    if (!ptr && size > 0) {
+        CountedAllocs += 1;
+    }
+
+    return Alloc(ptr, size, userdata);
+}
+
+static void test_ObjectSlabs() {
+    Tiny_State *state = CreateState();
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(object slabs)",
+                                                   "struct Point { x: int y: int }\n"
+                                                   "sum := 0\n"
+                                                   "for i := 0; i < 100000; i += 1 {\n"
+                                                   "    p := new Point{i, 1}\n"
+                                                   "    sum += p.x - p.y\n"
+                                                   "}\n");
+
+    lequal(result.type, TINY_COMPILE_SUCCESS);
+
+    Tiny_StateThread thread;
+    Tiny_InitThreadWithContext(&thread, state, (Tiny_Context){CountingAlloc, NULL});
+
+    CountedAllocs = 0;
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    lok(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "sum"))) ==
+        4999950000LL - 100000);
+
+    // The slots of collected points are reused, so only a handful of slabs were ever allocated
+    // rather than one allocation per point
+    lok(CountedAllocs < 100);
+
+    Tiny_DestroyThread(&thread);
+
+    Tiny_DeleteState(state);
+}
+
+static void test_RegionHeap() {
+    Tiny_State *state = CreateState();
+
+    Tiny_BindFunction(state, "big_string(int): str", BigString);
+    Tiny_BindFunction(state, "big_native(): any", BigNative);
+
+    Tiny_CompileResult result = Tiny_CompileString(state, "(region heap)",
+                                                   "struct Point { x: int y: int }\n"
+                                                   "sum := 0\n"
+                                                   "for i := 0; i < 10000; i += 1 {\n"
+                                                   "    p := new Point{i, 1}\n"
+                                                   "    sum += p.x - p.y\n"
+                                                   "}\n"
+                                                   "for j := 0; j < 10; j += 1 {\n"
+                                                   "    big_string(100000)\n"
+                                                   "    big_native()\n"
+                                                   "}\n");
+
+    lequal(result.type, TINY_COMPILE_SUCCESS);
+
+    Tiny_StateThread thread;
+    Tiny_InitThreadWithHeap(&thread, state, Context, TINY_HEAP_REGION);
+
+    SizedNativesFreed = 0;
+
+    Tiny_StartThread(&thread);
+    Tiny_Run(&thread);
+
+    lok(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "sum"))) ==
+        49995000 - 10000);
+
+    // Nothing was collected even though the heap got well past TINY_GC_MIN_HEAP_BYTES
+    lequal(thread.numObjects, 10000 + 20);
+    lequal(SizedNativesFreed, 0);
+
+    // The natives are still finalized (and the strings freed, which test_CheckMallocs checks)
+    Tiny_DestroyThread(&thread);
+
+    lequal(SizedNativesFreed, 10);
+
+    Tiny_DeleteState(state);
+}
+
+static void test_IncrementalGC() {
+    const char *code =
+        "use array(\"any\") as aany\n"
+        "struct Node { value: int next: Node }\n"
+        "struct Holder { list: Node }\n"
+        "head := cast(null, Node)\n"
+        "holder := new Holder{cast(null, Node)}\n"
+        "keep := aany()\n"
+        "func build() {\n"
+        "    for i := 0; i < 50000; i += 1 { head = new Node{i, head} }\n"
+        "}\n"
+        "func churn(k: int) {\n"
+        "    // Move nodes from far ahead in the list (so likely not marked yet) into places that\n"
+        "    // were likely marked already, allocating in between\n"
+        "    far := head\n"
+        "    while far != null {\n"
+        "        for j := 0; j < 200 && far != null; j += 1 { far = far.next }\n"
+        "        if far != null && far.next != null {\n"
+        "            m := far.next\n"
+        "            far.next = m.next\n"
+        "            if k % 2 == 0 {\n"
+        "                m.next = holder.list\n"
+        "                holder.list = m\n"
+        "            } else {\n"
+        "                m.next = cast(null, Node)\n"
+        "                aany_push(keep, m)\n"
+        "            }\n"
+        "            m = cast(null, Node)\n"
+        "        }\n"
+        "        garbage := new Node{0, cast(null, Node)}\n"
+        "    }\n"
+        "}\n"
+        "func total(): int {\n"
+        "    sum := 0\n"
+        "    for p := head; p != null; p = p.next { sum += p.value }\n"
+        "    for p := holder.list; p != null; p = p.next { sum += p.value }\n"
+        "    for i := 0; i < aany_len(keep); i += 1 {\n"
+        "        sum += cast(aany_get(keep, i), Node).value\n"
+        "    }\n"
+        "    return sum\n"
+        "}\n"
+        "build()\n"
+        "for k := 0; k < 400; k += 1 { churn(k) }\n"
+        "sum := total()\n";
+
+    // A budget of 1 microsecond makes every collection step do as little as possible, so the
+    // program gets to mutate the heap in between pretty much every chunk of work
+    const int budgets[] = {0, 1, 1000};
+
+    int64_t stopTheWorldWork = 0;
+
+    for (int b = 0; b < sizeof(budgets) / sizeof(budgets[0]); ++b) {
+        Tiny_State *state = CreateState();
+
+        Tiny_BindStandardArray(state);
+
+        Tiny_CompileResult result = Tiny_CompileString(state, "(incremental gc)", code);
+
+        lok_print_return(result.type == TINY_COMPILE_SUCCESS, "Failed to compile: %s\n",
+                         result.error.msg);
+
+        Tiny_StateThread thread;
+        InitThread(&thread, state);
+
+        Tiny_SetGCPauseBudget(&thread, budgets[b]);
+
+        Tiny_StartThread(&thread);
+        Tiny_Run(&thread);
+
+        // Nothing reachable was collected, even though the heap was rewired mid-collection
+        lok(Tiny_ToInt(Tiny_GetGlobal(&thread, Tiny_GetGlobalIndex(state, "sum"))) == 1249975000);
+
+        // How long a pause takes depends on the machine, so check the work done in each one
+        // instead, which the budget bounds exactly
+        if (budgets[b] == 0) {
+            stopTheWorldWork = thread.gcMaxStepWork;
+        } else {
+            lok(thread.gcMaxStepWork > 0);
+            lok(thread.gcMaxStepWork <= (int64_t)budgets[b] * TINY_GC_WORK_PER_MICRO);
+        }
+
+        Tiny_DestroyThread(&thread);
+
+        Tiny_DeleteState(state);
+    }
+
+    // Otherwise even a collector that ignored the budget would stay within it
+    lok(stopTheWorldWork > (int64_t)budgets[2] * TINY_GC_WORK_PER_MICRO);
+}
+
 int main(int argc, char *argv[]) {
     lrun("Pos to friendly pos", test_PosToFriendlyPos);
     lrun("All Array tests", test_Array);
@@ -1242,6 +2700,29 @@ int main(int argc, char *argv[]) {
     lrun("Tiny Foreach Syntax", test_Foreach);
     lrun("Tiny Foreach Reverse Syntax", test_ForeachRev);
     lrun("Tiny Foreach Reverse Noindex Syntax", test_ForeachRevNoIndex);
+    lrun("Tiny Foreach Dict", test_ForeachDict);
+    lrun("Tiny Dict Macro", test_DictMacro);
+    lrun("Tiny Packed Array Macro", test_PackedArrayMacro);
+    lrun("Tiny Template Arrays", test_TemplateArrays);
+    lrun("Tiny Typed Arithmetic", test_TypedArithmetic);
+    lrun("Tiny Value round trip", test_ValueRoundTrip);
+    lrun("Tiny Superinstructions", test_Superinstructions);
+    lrun("Tiny Register Backend", test_RegisterBackend);
+    lrun("Tiny Peephole", test_Peephole);
+    lrun("Tiny Constant Folding", test_ConstantFolding);
+    lrun("Tiny Inliner", test_Inliner);
+    lrun("Tiny Growable Stacks", test_GrowableStacks);
+    lrun("Tiny Run Budget", test_RunBudget);
+    lrun("Tiny GC Byte Accounting", test_GCByteAccounting);
+    lrun("Tiny Incremental GC", test_IncrementalGC);
+    lrun("Tiny Mark Long List", test_MarkLongList);
+    lrun("Tiny Object Slabs", test_ObjectSlabs);
+    lrun("Tiny Region Heap", test_RegionHeap);
+    lrun("Tiny GC Stats and Policy", test_GCStatsAndPolicy);
+    lrun("Tiny String Slices", test_StringSlices);
+    lrun("Tiny String Builder", test_StrBuf);
+    lrun("Tiny Small Strings", test_SmallStrings);
+    lrun("Tiny String Interning", test_StringInterning);
 
     lrun("Check no leak in tests", test_CheckMallocs);
 
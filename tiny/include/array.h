@@ -32,3 +32,51 @@ void ArraySet(Array *array, int index, Tiny_Value value);
 Tiny_Value *ArrayGet(Array *array, int index);
 
 void DestroyArray(Array *array);
+
+typedef enum {
+    PACKED_ARRAY_INT,    // Elements are Tiny_Int
+    PACKED_ARRAY_FLOAT,  // Elements are Tiny_Float
+    PACKED_ARRAY_BOOL,   // Elements are uint8_t (0 or 1)
+} PackedArrayType;
+
+// An array of primitives stored unboxed and back to back (e.g. an int array is just a
+// Tiny_Int[]) so it takes a fraction of the memory of an Array and there's nothing in it for the
+// GC to mark. Values are unboxed when they're put in and boxed when they're taken out.
+typedef struct {
+    Tiny_Context ctx;
+    PackedArrayType type;
+    int len, cap;
+    void *data;
+} PackedArray;
+
+void InitPackedArray(PackedArray *array, Tiny_Context ctx, PackedArrayType type);
+void InitPackedArrayEx(PackedArray *array, Tiny_Context ctx, PackedArrayType type, int length,
+                       const Tiny_Value *initValues);
+
+size_t PackedArrayElemSize(PackedArrayType type);
+
+int PackedArrayLen(const PackedArray *array);
+
+// Both arrays must have the same type
+void PackedArrayCopy(PackedArray *dest, const PackedArray *src);
+
+void PackedArrayClear(PackedArray *array);
+void PackedArrayResize(PackedArray *array, int length, Tiny_Value newValue);
+void PackedArrayFill(PackedArray *array, Tiny_Value value);
+
+void PackedArrayPush(PackedArray *array, Tiny_Value value);
+Tiny_Value PackedArrayPop(PackedArray *array);
+
+// Pop from front
+Tiny_Value PackedArrayShift(PackedArray *array);
+
+void PackedArrayInsert(PackedArray *array, int index, Tiny_Value value);
+void PackedArrayRemove(PackedArray *array, int index);
+
+void PackedArraySet(PackedArray *array, int index, Tiny_Value value);
+Tiny_Value PackedArrayGet(const PackedArray *array, int index);
+
+// Sorts in ascending order. Only valid for PACKED_ARRAY_INT.
+void PackedArraySortInts(PackedArray *array);
+
+void DestroyPackedArray(PackedArray *array);
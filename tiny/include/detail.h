@@ -13,7 +13,25 @@ typedef uint8_t Word;
 typedef struct Tiny_Object {
     bool marked;
 
-    Tiny_ValueType type;
+    // Whether this is a string which points into another string's characters (see
+    // Tiny_NewStringSlice). The string it points into is stored right after the object.
+    bool isSlice;
+
+    // Whether this is a string in its thread's intern table (see Tiny_SetStringInterning)
+    bool isInterned;
+
+    uint8_t type;  // Tiny_ValueType
+
+    // For strings, the hash of their characters (see Tiny_HashString). It's computed the first
+    // time it's needed, so 0 means it hasn't been yet.
+    //
+    // This is only 32 bits so that it fits next to the flags above without making every object
+    // bigger. That means two different strings share a hash about once every 2^32 pairs rather
+    // than 2^64, so expect some among a few tens of thousands of strings. They can't be picked
+    // on purpose without the seed, and a shared hash only costs a comparison of the characters:
+    // nothing treats equal hashes as equal strings.
+    uint32_t hash;
+
     struct Tiny_Object *next;
 
     union {
@@ -23,6 +41,9 @@ typedef struct Tiny_Object {
             // a pointer to the same allocation as this object!
             //
             // Otherwise (if calling NewString) this points to a string allocated separately.
+            //
+            // For slices, this points into the characters of the string they were sliced from,
+            // so it isn't null terminated.
             char *ptr;
         } string;
 
@@ -63,9 +84,25 @@ typedef struct Tiny_State {
     Tiny_ForeignFunction *foreignFunctions;
 
     // Compiler Info
+    Tiny_Backend backend;
+    int optimizationLevel;
+
     int currScope;
     Tiny_Symbol *currFunc;
 
+    // While the register backend is compiling a function, nextReg is the first free frame slot
+    // (temporaries are allocated above the locals) and maxReg is the number of slots the function
+    // needs. Both are -1 otherwise.
+    int nextReg;
+    int maxReg;
+
+    // The expressions which calls to small functions are replaced with, indexed by function
+    // index (NULL if the function can't be inlined). These outlive the parser arena of the
+    // compile that created them (so they can be inlined into code compiled later) and are
+    // allocated in inlineArena.
+    struct Tiny_Expr **inlineExprs;  // array
+    Tiny_Arena inlineArena;
+
     // TODO(Apaar): Make an arena for symbol table
 
     Tiny_Symbol **globalSymbols;  // array
@@ -90,3 +127,12 @@ typedef struct Tiny_State {
     // here.
     Tiny_CompileResult compileErrorResult;
 } Tiny_State;
+
+// The standard library's strcat. The compiler folds calls to it whose arguments are all string
+// constants, so it needs to be able to recognize it.
+Tiny_Value Tiny_StdStrcat(Tiny_StateThread *thread, const Tiny_Value *args, int count);
+
+// Hashes the characters of any kind of string, so strings which are equal hash the same. Never
+// returns 0. String objects cache their hash. Only 32 bits (see hash in Tiny_Object), so dicts
+// with string keys get their 64-bit hashes from this rather than from the characters.
+uint32_t Tiny_HashString(Tiny_Value value);
@@ -1,11 +1,41 @@
 #pragma once
 
-#include "array.h"
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "tiny.h"
 
+// Number of control bytes compared at once when probing (one SSE2 register)
+#define DICT_GROUP_WIDTH 16
+
+// Keys and values are stored next to each other (along with the full hash of the key) so that
+// checking a candidate slot only touches one place in memory.
+typedef struct {
+    Tiny_Value key, value;
+    uint64_t hash;
+} DictSlot;
+
+// An open-addressing hash table laid out like a "Swiss table". Every slot has a control byte
+// which either marks it as empty/deleted or holds 7 bits of the hash of the key in it. Lookups
+// scan the control bytes a group at a time and only compare keys in slots whose bits match.
 typedef struct {
+    Tiny_Context ctx;
+
+    // bucketCount + DICT_GROUP_WIDTH bytes; the first group is mirrored past the end so
+    // a group can be loaded starting at any slot.
+    uint8_t *ctrl;
+    DictSlot *slots;
+
+    // bucketCount is always a power of two
     int bucketCount, filledCount;
-    Array keys, values;
+
+    // How many more keys can be put into empty slots before the table has to be resized
+    int growthLeft;
+
+    // Keys are hashed with this so that which keys collide can't be predicted from outside, and
+    // differs between dicts so that inserting one dict's keys (in slot order) into another doesn't
+    // pile them up in the same places.
+    uint64_t seed;
 } Dict;
 
 void InitDict(Dict *dict, Tiny_Context ctx);
@@ -18,3 +48,25 @@ void DictRemove(Dict *dict, Tiny_Value key);
 void DictClear(Dict *dict);
 
 void DestroyDict(Dict *dict);
+
+// Walks the dict without allocating. Cursors are ints: DictNext(dict, 0) returns a cursor to the
+// first entry, DictNext(dict, cursor) returns one to the entry after it, and 0 means there are no
+// more entries. DictAt returns the entry at a cursor (or NULL if there isn't one there).
+//
+// Removing keys while iterating is fine, but adding them may cause entries to be skipped or seen
+// twice (if the dict grows).
+int DictNext(const Dict *dict, int cursor);
+const DictSlot *DictAt(const Dict *dict, int cursor);
+
+// Return false to stop iterating
+typedef bool (*DictIterateFunc)(Tiny_Value key, Tiny_Value value, void *userdata);
+
+// Calls fn for every entry in the dict. Same rules as DictNext regarding modifying the dict.
+void DictIterate(const Dict *dict, DictIterateFunc fn, void *userdata);
+
+// Use this to iterate over the dict, e.g.
+//
+// for (int i = 0; i < dict->bucketCount; ++i) {
+//     if (DictIsSlotFilled(dict, i)) { ... dict->slots[i].key ... }
+// }
+static inline bool DictIsSlotFilled(const Dict *dict, int i) { return dict->ctrl[i] < 0x80; }
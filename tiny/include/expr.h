@@ -32,6 +32,9 @@ typedef enum {
     TINY_EXP_INDEX,
     TINY_EXP_IF_TERNARY,
     TINY_EXP_FOREACH,
+
+    // Only created by the inliner (see InlineCalls in tiny.c)
+    TINY_EXP_INLINE_CALL,
 } Tiny_ExprType;
 
 // Node for a singly-linked list of strings.
@@ -59,8 +62,8 @@ typedef struct Tiny_Expr {
     union {
         bool boolean;
 
-        int iValue;
-        float fValue;
+        Tiny_Int iValue;
+        Tiny_Float fValue;
         int sIndex;
 
         struct {
@@ -167,6 +170,8 @@ typedef struct Tiny_Expr {
         } index;
 
         struct {
+            // For things iterated with a cursor (see iterNextFunc), these are the key and value
+            // instead, e.g. `foreach k, v in d`.
             Tiny_Symbol *elemVar;
             Tiny_Symbol *indexVar;
 
@@ -193,6 +198,27 @@ typedef struct Tiny_Expr {
 
             const Tiny_Symbol *lenFunc;
             const Tiny_Symbol *getIndexFunc;
+
+            // If {type(range)}_iter_next exists, these are set (instead of lenFunc and
+            // getIndexFunc) and the loop walks the range with an int cursor: iter_next(range, 0)
+            // gives the first cursor, iter_next(range, cursor) gives the one after it, and 0 means
+            // there are no more. iter_key/iter_value get the key and value at a cursor.
+            const Tiny_Symbol *iterNextFunc;
+            const Tiny_Symbol *iterKeyFunc;
+            const Tiny_Symbol *iterValueFunc;
+
+            Tiny_Symbol *cursorVar;
         } forEach;
+
+        // A call to a function whose body was substituted into the caller.
+        //
+        // The args are stored in the locals in `temps` (which was added to the caller) in order
+        // and then `body` is evaluated. Args which don't need to be stored (because they're
+        // literals or locals) have a NULL temp and were substituted into the body directly.
+        struct {
+            struct Tiny_Expr *argsHead;
+            Tiny_Symbol **temps;
+            struct Tiny_Expr *body;
+        } inlineCall;
     };
 } Tiny_Expr;
@@ -41,11 +41,40 @@ enum {
     TINY_OP_GT,
     TINY_OP_GTE,
 
+    // Typed versions of the arithmetic and comparison ops above. The compiler emits
+    // these when it knows the types of both operands, so they don't check them.
+    TINY_OP_ADD_INT,
+    TINY_OP_SUB_INT,
+    TINY_OP_MUL_INT,
+    TINY_OP_DIV_INT,
+    TINY_OP_LT_INT,
+    TINY_OP_LTE_INT,
+    TINY_OP_GT_INT,
+    TINY_OP_GTE_INT,
+
+    TINY_OP_ADD_FLOAT,
+    TINY_OP_SUB_FLOAT,
+    TINY_OP_MUL_FLOAT,
+    TINY_OP_DIV_FLOAT,
+    TINY_OP_LT_FLOAT,
+    TINY_OP_LTE_FLOAT,
+    TINY_OP_GT_FLOAT,
+    TINY_OP_GTE_FLOAT,
+
+    // Converts the int on top of the stack into a float
+    TINY_OP_INT_TO_FLOAT,
+
+    // Integer only
     TINY_OP_ADD1,
     TINY_OP_SUB1,
 
     TINY_OP_EQU,
 
+    TINY_OP_EQU_BOOL,
+    TINY_OP_EQU_INT,
+    TINY_OP_EQU_FLOAT,
+    TINY_OP_EQU_STR,
+
     TINY_OP_LOG_NOT,
 
     TINY_OP_SET,
@@ -68,6 +97,87 @@ enum {
 
     TINY_OP_GET_RETVAL,
 
+    // The peephole pass (see OptimizeProgram) rewrites the sequences described next to these.
+
+    // PUSH_INT -1; MUL_INT
+    TINY_OP_NEG_INT,
+    // PUSH_FLOAT -1; MUL_FLOAT
+    TINY_OP_NEG_FLOAT,
+    // EQU; LOG_NOT (and the same for the typed EQU ops)
+    TINY_OP_NOT_EQU,
+    TINY_OP_NOT_EQU_BOOL,
+    TINY_OP_NOT_EQU_INT,
+    TINY_OP_NOT_EQU_FLOAT,
+    TINY_OP_NOT_EQU_STR,
+    // LOG_NOT; GOTOZ pc, or GOTOZ over a GOTO pc
+    TINY_OP_GOTONZ,
+
+    // Superinstructions. The compiler never generates these directly; FuseSuperinstructions
+    // rewrites the sequences described next to each one after the code has been generated.
+
+    // GETLOCAL_W a; GETLOCAL_W b
+    TINY_OP_GETLOCAL_W2,
+    // GETLOCAL_W a; STRUCT_GET i
+    TINY_OP_GETLOCAL_STRUCT_GET,
+    // GETLOCAL_W a; PUSH_INT k (or PUSH_0, PUSH_1); LT_INT; GOTOZ pc
+    TINY_OP_LT_LOCAL_CONST_GOTOZ,
+    // GETLOCAL_W a; ADD1; SETLOCAL a
+    TINY_OP_INC_LOCAL,
+    // GETLOCAL_W a; SUB1; SETLOCAL a
+    TINY_OP_DEC_LOCAL,
+    // CALL nargs f; GET_RETVAL
+    TINY_OP_CALL_RETVAL,
+    // CALLF nargs f; GET_RETVAL
+    TINY_OP_CALLF_RETVAL,
+
+    // Register instructions, only generated by TINY_BACKEND_REGISTER. Registers are frame slots
+    // relative to the frame pointer (so args are negative) stored in a signed byte.
+
+    // r[d] = r[s]
+    TINY_OP_MOVE_R,
+    // r[d] = k
+    TINY_OP_LOAD_INT_R,
+    TINY_OP_LOAD_FLOAT_R,
+    // Pops into r[d]
+    TINY_OP_POP_R,
+    // r[d] = r[s].fields[i]
+    TINY_OP_STRUCT_GET_R,
+
+    // r[d] = r[a] op r[b]
+    TINY_OP_ADD_INT_R,
+    TINY_OP_SUB_INT_R,
+    TINY_OP_MUL_INT_R,
+    TINY_OP_DIV_INT_R,
+    TINY_OP_MOD_INT_R,
+    TINY_OP_LT_INT_R,
+    TINY_OP_LTE_INT_R,
+    TINY_OP_EQU_INT_R,
+
+    TINY_OP_ADD_FLOAT_R,
+    TINY_OP_SUB_FLOAT_R,
+    TINY_OP_MUL_FLOAT_R,
+    TINY_OP_DIV_FLOAT_R,
+    TINY_OP_LT_FLOAT_R,
+    TINY_OP_LTE_FLOAT_R,
+    TINY_OP_EQU_FLOAT_R,
+
+    // r[d] = r[a] op k
+    TINY_OP_ADD_INT_RK,
+    TINY_OP_MUL_INT_RK,
+
+    // if !r[s] goto pc
+    TINY_OP_GOTOZ_R,
+
+    // if !(r[a] op r[b]) goto pc
+    TINY_OP_LT_INT_R_GOTOZ,
+    TINY_OP_LTE_INT_R_GOTOZ,
+
+    // if !(r[a] op k) goto pc
+    TINY_OP_LT_INT_RK_GOTOZ,
+    TINY_OP_LTE_INT_RK_GOTOZ,
+    TINY_OP_GT_INT_RK_GOTOZ,
+    TINY_OP_GTE_INT_RK_GOTOZ,
+
     TINY_OP_HALT,
 
     TINY_OP_MISALIGNED_INSTRUCTION
@@ -5,13 +5,46 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
+// Thread stacks start out with room for this many values (once the thread runs) and grow in
+// multiples of it as they fill up
+#ifndef TINY_THREAD_STACK_CHUNK_SIZE
+#define TINY_THREAD_STACK_CHUNK_SIZE 64
+#endif
+
+// The most values a thread's stack can grow to hold before the thread stops with a stack overflow
 #ifndef TINY_THREAD_STACK_SIZE
-#define TINY_THREAD_STACK_SIZE 128
+#define TINY_THREAD_STACK_SIZE (1 << 20)
 #endif
 
+// The deepest a thread's calls can be nested before it stops with a stack overflow
 #ifndef TINY_THREAD_MAX_CALL_DEPTH
-#define TINY_THREAD_MAX_CALL_DEPTH 64
+#define TINY_THREAD_MAX_CALL_DEPTH (1 << 18)
+#endif
+
+// Threads don't collect garbage until their heap (see heapBytes in Tiny_StateThread) is at least
+// this big
+#ifndef TINY_GC_MIN_HEAP_BYTES
+#define TINY_GC_MIN_HEAP_BYTES (1 << 15)
+#endif
+
+// How many objects an incremental collection step (see Tiny_SetGCPauseBudget) may mark or sweep
+// per microsecond of its budget. Steps stop at this many regardless of what the clock says, so
+// the amount of work done in a pause is bounded even if the clock is coarse.
+#ifndef TINY_GC_WORK_PER_MICRO
+#define TINY_GC_WORK_PER_MICRO 16
+#endif
+
+// Objects (see Tiny_StateThread) are allocated out of slabs of this many bytes
+#ifndef TINY_OBJECT_SLAB_SIZE
+#define TINY_OBJECT_SLAB_SIZE (1 << 14)
+#endif
+
+// Objects are put into size classes 16 bytes apart. Ones bigger than the biggest class are
+// allocated from the thread's context directly.
+#ifndef TINY_OBJECT_SIZE_CLASS_COUNT
+#define TINY_OBJECT_SIZE_CLASS_COUNT 16
 #endif
 
 #ifndef TINY_MAX_COMPILE_ERR_MSG_SZ
@@ -22,6 +55,12 @@
 #define TINY_MAX_MACRO_RESULT_ERR_MSG_SZ 1024
 #endif
 
+// Functions whose body is a single expression (or a chain of `if c return x` ending in a return)
+// with at most this many nodes in it are inlined at their call sites.
+#ifndef TINY_INLINE_BUDGET
+#define TINY_INLINE_BUDGET 16
+#endif
+
 // I use setjmp/longjmp internally to handle compile errors.
 // This means I have to store an array of jmp_buf to handle
 // errors in nested compile calls without clobbering previous
@@ -107,6 +146,11 @@ typedef struct Tiny_NativeProp {
 
     void (*protectFromGC)(void *);
     void (*finalize)(Tiny_Context *, void *);
+
+    // Optional. Returns how many bytes the native owns, so that natives that grow (like arrays)
+    // count towards the thread's heap size. It's called when the native is created and every
+    // time the garbage collector runs. See also Tiny_NewNativeSized.
+    size_t (*size)(void *);
 } Tiny_NativeProp;
 
 typedef enum {
@@ -119,12 +163,123 @@ typedef enum {
     TINY_VAL_NATIVE,
     TINY_VAL_LIGHT_NATIVE,
     TINY_VAL_STRUCT,
+
+    // Short strings stored inside the value itself (see TINY_SMALL_STRING_MAX_LEN). These aren't
+    // objects, so use Tiny_ToString/Tiny_StringLen on them like you would on a const string.
+    TINY_VAL_SMALL_STRING,
 } Tiny_ValueType;
 
 // TODO(Apaar): We should untag the non-boxed values and just have the bytecode be typed.
 //
 // Since we don't officially support polymorphic stuff, we can just store
 // GC roots elsewhere. I think I did that in the `snow-common` branch.
+//
+// Don't access the fields of a Tiny_Value directly; use Tiny_GetType and the Tiny_As/Tiny_To
+// functions below. That way your code works regardless of whether TINY_VALUE_NANBOX is defined.
+#ifdef TINY_VALUE_NANBOX
+
+// With TINY_VALUE_NANBOX defined, values are packed into 8 bytes instead of 16.
+//
+// Floats are stored as doubles, and every other value lives in the 48-bit payload of a
+// quiet NaN alongside a 3-bit tag (NaN floats are all collapsed into a single NaN which
+// doesn't look like a tagged value). This means that:
+//
+// - Ints only keep their low 48 bits (they're sign-extended when read back).
+// - Pointers must fit in 48 bits, which is the case for user-space addresses on all the 64-bit
+//   platforms we care about.
+//
+// The bits are stored XORed with the encoding of null so that a zeroed-out value is null,
+// just like it is in the default representation.
+//
+// Small strings are stored in the payload one byte per character, padded with zeroes.
+typedef struct Tiny_Value {
+    uint64_t bits;
+} Tiny_Value;
+
+#define TINY_SMALL_STRING_MAX_LEN 6
+
+#define TINY_NANBOX_XOR 0xFFF8000000000000ull
+#define TINY_NANBOX_PAYLOAD_MASK 0x0000FFFFFFFFFFFFull
+
+// Largest int that survives the trip through a value
+#define TINY_NANBOX_INT_MAX ((Tiny_Int)((1ll << 47) - 1))
+
+// Anything below this (after the XOR) is a tagged value, anything above it is a float.
+#define TINY_NANBOX_FLOAT_MIN (1ull << 51)
+
+// Null and bool share a tag: a zero payload is null, otherwise the low bit is the bool.
+enum {
+    TINY_NANBOX_TAG_NULL_BOOL,
+    TINY_NANBOX_TAG_INT,
+    TINY_NANBOX_TAG_STRING,
+    TINY_NANBOX_TAG_CONST_STRING,
+    TINY_NANBOX_TAG_NATIVE,
+    TINY_NANBOX_TAG_LIGHT_NATIVE,
+    TINY_NANBOX_TAG_STRUCT,
+    TINY_NANBOX_TAG_SMALL_STRING,
+};
+
+static inline Tiny_ValueType Tiny_GetType(const Tiny_Value value) {
+    static const Tiny_ValueType tagTypes[] = {
+        TINY_VAL_NULL,         TINY_VAL_INT,          TINY_VAL_STRING, TINY_VAL_CONST_STRING,
+        TINY_VAL_NATIVE,       TINY_VAL_LIGHT_NATIVE, TINY_VAL_STRUCT, TINY_VAL_SMALL_STRING,
+    };
+
+    if (value.bits >= TINY_NANBOX_FLOAT_MIN) return TINY_VAL_FLOAT;
+
+    unsigned tag = (unsigned)(value.bits >> 48);
+
+    if (tag == TINY_NANBOX_TAG_NULL_BOOL) return value.bits ? TINY_VAL_BOOL : TINY_VAL_NULL;
+
+    return tagTypes[tag];
+}
+
+static inline bool Tiny_AsBool(const Tiny_Value value) { return value.bits & 1; }
+
+static inline Tiny_Int Tiny_AsInt(const Tiny_Value value) {
+    return (Tiny_Int)((int64_t)(value.bits << 16) >> 16);
+}
+
+static inline Tiny_Float Tiny_AsFloat(const Tiny_Value value) {
+    uint64_t bits = value.bits ^ TINY_NANBOX_XOR;
+
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+
+    return (Tiny_Float)d;
+}
+
+static inline const char *Tiny_AsConstString(const Tiny_Value value) {
+    return (const char *)(uintptr_t)(value.bits & TINY_NANBOX_PAYLOAD_MASK);
+}
+
+static inline void *Tiny_AsLightNative(const Tiny_Value value) {
+    return (void *)(uintptr_t)(value.bits & TINY_NANBOX_PAYLOAD_MASK);
+}
+
+static inline Tiny_Object *Tiny_AsObject(const Tiny_Value value) {
+    return (Tiny_Object *)(uintptr_t)(value.bits & TINY_NANBOX_PAYLOAD_MASK);
+}
+
+// Copies the characters of a small string into `buf`, which must have room for
+// TINY_SMALL_STRING_MAX_LEN + 1 chars, null terminates them and returns how many there are.
+static inline size_t Tiny_AsSmallString(const Tiny_Value value, char *buf) {
+    size_t len = 0;
+
+    for (; len < TINY_SMALL_STRING_MAX_LEN; ++len) {
+        char c = (char)(value.bits >> (len * 8));
+
+        if (!c) break;
+        buf[len] = c;
+    }
+
+    buf[len] = '\0';
+
+    return len;
+}
+
+#else
+
 typedef struct Tiny_Value {
     union {
         bool boolean;
@@ -133,16 +288,61 @@ typedef struct Tiny_Value {
         const char *cstr;  // for TINY_VAL_CONST_STRING
         void *addr;        // for TINY_VAL_LIGHT_NATIVE
         Tiny_Object *obj;
+
+        // For TINY_VAL_SMALL_STRING, padded with zeroes.
+        //
+        // There's room for more characters in the padding after `type`, but then it would have to
+        // be a member, and every value that gets built would have to copy it around.
+        char small[8];
     };
 
     uint8_t type;
 } Tiny_Value;
 
+#define TINY_SMALL_STRING_MAX_LEN 8
+
+static inline Tiny_ValueType Tiny_GetType(const Tiny_Value value) {
+    return (Tiny_ValueType)value.type;
+}
+
+static inline bool Tiny_AsBool(const Tiny_Value value) { return value.boolean; }
+static inline Tiny_Int Tiny_AsInt(const Tiny_Value value) { return value.i; }
+static inline Tiny_Float Tiny_AsFloat(const Tiny_Value value) { return value.f; }
+static inline const char *Tiny_AsConstString(const Tiny_Value value) { return value.cstr; }
+static inline void *Tiny_AsLightNative(const Tiny_Value value) { return value.addr; }
+static inline Tiny_Object *Tiny_AsObject(const Tiny_Value value) { return value.obj; }
+
+// See the TINY_VALUE_NANBOX version above
+static inline size_t Tiny_AsSmallString(const Tiny_Value value, char *buf) {
+    memcpy(buf, value.small, TINY_SMALL_STRING_MAX_LEN);
+    buf[TINY_SMALL_STRING_MAX_LEN] = '\0';
+
+    return strlen(buf);
+}
+
+#endif
+
 typedef struct Tiny_Frame {
     int pc, fp;
     uint8_t nargs;
+
+    // Whether the return value should be pushed onto the stack once we return to this frame
+    bool pushRetVal;
 } Tiny_Frame;
 
+// Controls when a thread collects garbage (see Tiny_SetGCPolicy)
+typedef struct Tiny_GCPolicy {
+    // Once a collection finishes, the next one starts when the heap has grown to this many times
+    // what survived it. Bigger factors mean fewer collections but more memory. Must be > 1.
+    double growthFactor;
+
+    // No collection starts before the heap is at least this big
+    size_t minHeapBytes;
+
+    // If set, garbage is only collected when Tiny_CollectGarbage is called
+    bool manualOnly;
+} Tiny_GCPolicy;
+
 typedef struct Tiny_StateThread {
     // Each thread can maintain its own context
     // so that you can e.g. override allocation
@@ -156,7 +356,55 @@ typedef struct Tiny_StateThread {
     // The garbage collection and heap is thread-local
     Tiny_Object *gcHead;
     int numObjects;
-    int maxNumObjects;
+
+    // Roughly how many bytes the objects on the heap take up, including what natives own (see
+    // Tiny_NativeProp). Garbage is collected once this reaches nextGCBytes, which is worked out
+    // from gcPolicy and how many bytes survived the previous collection.
+    //
+    // Objects are only ever collected in between instructions which can allocate, never in the
+    // middle of a foreign function (unless it calls Tiny_CollectGarbage).
+    size_t heapBytes;
+    size_t nextGCBytes;
+
+    Tiny_GCPolicy gcPolicy;
+    size_t gcSurvivedBytes;
+
+    // See Tiny_SetGCPauseBudget. While a collection is in progress, gcPhase is TINY_GC_MARK or
+    // TINY_GC_SWEEP and objects which have been found to be reachable but whose references
+    // haven't been followed yet are in grayStack. sweepList holds the objects which have yet to
+    // be swept (objects allocated in the meantime are put in gcHead).
+    int gcPhase;
+    int gcPauseBudgetMicros;
+    Tiny_Object **grayStack;  // array
+    Tiny_Object *sweepList;
+
+    // Statistics for Tiny_GetGCStats
+    int gcCount;
+    int64_t gcTotalPauseMicros;
+    int64_t gcMaxPauseMicros;
+    int64_t gcMaxStepWork;  // The most objects marked or swept in a single step
+    int64_t gcFreedObjects;
+    uint64_t gcFreedBytes;
+    size_t gcAllocatedBytes;
+
+    // Small objects are carved out of slabs (see TINY_OBJECT_SLAB_SIZE) which are allocated from
+    // ctx and only freed when the thread is destroyed. Objects which get collected are put on the
+    // free list for their size class, and the next object of that size takes their place.
+    struct Tiny_ObjectSlab *objectSlabs;
+    size_t objectSlabUsed;
+    void *objectFreeLists[TINY_OBJECT_SIZE_CLASS_COUNT];
+
+    // If the thread was initialized with TINY_HEAP_REGION, objects are allocated out of this
+    // instead, and gcHead only holds the objects which need to be cleaned up (natives and strings
+    // which own their characters). NULL otherwise.
+    struct Tiny_Arena *region;
+
+    // See Tiny_SetStringInterning. The table is open addressed with linear probing and its
+    // capacity is a power of 2. Strings are removed from it when they're freed.
+    bool internStrings;
+    Tiny_Object **internTable;
+    size_t internCapacity;
+    size_t internCount;
 
     // Global vars are owned by each thread
     Tiny_Value *globalVars;
@@ -164,19 +412,44 @@ typedef struct Tiny_StateThread {
     int pc, fp, sp;
     Tiny_Value retVal;
 
-    Tiny_Value stack[TINY_THREAD_STACK_SIZE];
+    // The stack is allocated from the thread's context the first time something is pushed onto it
+    // and grows as needed (see TINY_THREAD_STACK_CHUNK_SIZE). Since growing it can move it, don't
+    // hold on to pointers into it (like the args passed to a foreign function) across anything
+    // that could push onto it, e.g. Tiny_CallFunction.
+    Tiny_Value *stack;
+    int stackCap;
 
     int fc;
-    Tiny_Frame frames[TINY_THREAD_MAX_CALL_DEPTH];
+    Tiny_Frame *frames;  // Grows like the stack does
+    int frameCap;
+
+    // If the thread was stopped by an error at runtime (e.g. it overflowed its stack), this
+    // describes it. NULL otherwise.
+    const char *error;
+
+    // Set when a foreign function calls Tiny_YieldThread and cleared once the thread resumes. If
+    // the call was one whose result gets pushed onto the stack, that push is put off until then.
+    bool yielded;
+    bool pushRetValOnResume;
 
     // Userdata pointer. Set to NULL when InitThread is called. Use it for
     // whatever you want
     void *userdata;
+
+#ifdef TINY_PROFILE_OPCODE_PAIRS
+    // How many times each opcode was executed right after another one, indexed by
+    // [previous opcode * 256 + opcode]. See Tiny_WriteOpcodePairProfile.
+    uint64_t *opcodePairCounts;
+    int prevOpcode;
+#endif
 } Tiny_StateThread;
 
 typedef Tiny_Value (*Tiny_ForeignFunction)(Tiny_StateThread *thread, const Tiny_Value *args,
                                            int count);
 
+// `args` points into the thread's stack, which can be moved when it grows. Don't use it (or any
+// pointer into it) after calling anything that could run Tiny code on the thread, like
+// Tiny_CallFunction; copy what you need out of it beforehand.
 #define TINY_FOREIGN_FUNCTION(name) \
     Tiny_Value name(Tiny_StateThread *thread, const Tiny_Value *args, int count)
 
@@ -186,8 +459,17 @@ extern Tiny_Context Tiny_DefaultContext;
 
 // If you're storing Tiny_Value in your native objects, you should call this
 // on them via your `protectFromGC` function in the props.
+//
+// This doesn't follow the value's references right away (the object is queued on the thread's
+// grayStack instead), so marking doesn't recurse no matter how deeply nested the values are.
 void Tiny_ProtectFromGC(Tiny_Value value);
 
+// If the thread's collector is incremental (see Tiny_SetGCPauseBudget), foreign functions have to
+// call this on every value they store inside of a native object, unless it was one of their args
+// or it was allocated after the foreign function was called (both of those are taken care of).
+// For example, a value you got from Tiny_CallFunction or took out of another native.
+void Tiny_GCWriteBarrier(Tiny_StateThread *thread, Tiny_Value value);
+
 Tiny_Value Tiny_NewBool(bool value);
 Tiny_Value Tiny_NewInt(Tiny_Int i);
 Tiny_Value Tiny_NewFloat(Tiny_Float f);
@@ -199,6 +481,9 @@ Tiny_Value Tiny_NewLightNative(void *ptr);
 //
 // Note that this does not null terminate the provided string, so if you have C functions
 // which rely on null-terminated strings, ensure that you null terminate these yourself.
+//
+// Strings of up to TINY_SMALL_STRING_MAX_LEN chars (without any '\0' in them) are stored in the
+// value itself instead (see TINY_VAL_SMALL_STRING), in which case `str` is freed right away.
 Tiny_Value Tiny_NewString(Tiny_StateThread *thread, char *str, size_t len);
 
 // This is equivalent to Tiny_NewString but it figures out the length assuming
@@ -211,40 +496,101 @@ Tiny_Value Tiny_NewStringNullTerminated(Tiny_StateThread *thread, char *str);
 // both the Tiny object "metadata" and the string itself. If you haven't already
 // allocated memory for your string and are ready to hand it off, I highly recommend
 // using this instead of `Tiny_NewString`.
+//
+// Short strings don't allocate at all (see Tiny_NewString).
 Tiny_Value Tiny_NewStringCopy(Tiny_StateThread *thread, const char *src, size_t len);
 
 // Same as Tiny_NewStringCopy but assumes the given string is null terminated.
 Tiny_Value Tiny_NewStringCopyNullTerminated(Tiny_StateThread *thread, const char *src);
 
+// Returns a string made of the `len` characters of `str` starting at `start` which points into
+// `str` instead of copying them, and keeps `str` alive for as long as it's around. Short strings
+// and slices of constant strings are copied instead since that's about as cheap.
+//
+// Note that slices aren't null terminated, so Tiny_ToString has to copy their characters the
+// first time it's called on them. Use Tiny_ToStringChars to get at them without copying.
+Tiny_Value Tiny_NewStringSlice(Tiny_StateThread *thread, Tiny_Value str, size_t start, size_t len);
+
 Tiny_Value Tiny_NewNative(Tiny_StateThread *thread, void *ptr, const Tiny_NativeProp *prop);
 
-static inline bool Tiny_IsNull(const Tiny_Value value) { return value.type == TINY_VAL_NULL; }
+// Same as Tiny_NewNative but `size` is how many bytes `ptr` owns, which counts towards the
+// thread's heap size. If the native's size can change, give its prop a `size` function instead
+// (it takes precedence over this).
+Tiny_Value Tiny_NewNativeSized(Tiny_StateThread *thread, void *ptr, const Tiny_NativeProp *prop,
+                               size_t size);
+
+// The Tiny_As* functions above return the payload of a value without checking its type, so
+// only use them once you've checked the type with Tiny_GetType. The functions below check the
+// type and return a default if it doesn't match.
+
+static inline bool Tiny_IsNull(const Tiny_Value value) {
+    return Tiny_GetType(value) == TINY_VAL_NULL;
+}
+
+// True for all kinds of strings (TINY_VAL_STRING, TINY_VAL_CONST_STRING, TINY_VAL_SMALL_STRING)
+static inline bool Tiny_IsString(const Tiny_Value value) {
+    Tiny_ValueType type = Tiny_GetType(value);
+
+    return type == TINY_VAL_STRING || type == TINY_VAL_CONST_STRING ||
+           type == TINY_VAL_SMALL_STRING;
+}
 
 static inline bool Tiny_ToBool(const Tiny_Value value) {
-    if (value.type != TINY_VAL_BOOL) return false;
-    return value.boolean;
+    if (Tiny_GetType(value) != TINY_VAL_BOOL) return false;
+    return Tiny_AsBool(value);
 }
 
 static inline Tiny_Int Tiny_ToInt(const Tiny_Value value) {
-    if (value.type != TINY_VAL_INT) return 0;
-    return value.i;
+    if (Tiny_GetType(value) != TINY_VAL_INT) return 0;
+    return Tiny_AsInt(value);
 }
 
 static inline Tiny_Float Tiny_ToFloat(const Tiny_Value value) {
-    if (value.type != TINY_VAL_FLOAT) return 0;
-    return value.f;
+    if (Tiny_GetType(value) != TINY_VAL_FLOAT) return 0;
+    return Tiny_AsFloat(value);
 }
 
 static inline Tiny_Float Tiny_ToNumber(const Tiny_Value value) {
-    if (value.type == TINY_VAL_FLOAT) return value.f;
-    if (value.type != TINY_VAL_INT) return 0;
+    Tiny_ValueType type = Tiny_GetType(value);
+
+    if (type == TINY_VAL_FLOAT) return Tiny_AsFloat(value);
+    if (type != TINY_VAL_INT) return 0;
 
-    return (Tiny_Float)value.i;
+    return (Tiny_Float)Tiny_AsInt(value);
 }
 
 // Returns NULL if the value isn't a string/const string
+//
+// The result is always null terminated. The first time this is called on a slice (see
+// Tiny_NewStringSlice), its characters are copied so it doesn't keep the string it was sliced from
+// alive anymore.
+//
+// WARNING: Small strings (see TINY_VAL_SMALL_STRING) don't have any memory of their own, so
+// they're copied into one of TINY_SMALL_STRING_SCRATCH_COUNT scratch buffers which are reused
+// round-robin. The result is overwritten by the TINY_SMALL_STRING_SCRATCH_COUNT-th call after it,
+// so don't store it or hold onto it across calls that might convert more strings (running Tiny
+// code, calling other natives, etc.); copy it or use Tiny_ToStringBuf instead. The scratch buffers
+// are per OS thread, so calls on different threads don't overwrite each other's results.
 const char *Tiny_ToString(const Tiny_Value value);
 
+#define TINY_SMALL_STRING_SCRATCH_COUNT 16
+
+// Same as Tiny_ToString except small strings are copied into `smallBuf`, which must have room
+// for TINY_SMALL_STRING_MAX_LEN + 1 chars, so the result lives for as long as the buffer (or the
+// string, if it isn't small) does.
+const char *Tiny_ToStringBuf(const Tiny_Value value, char *smallBuf);
+
+// Returns the characters of the string/const string and stores how many there are in `len`
+// (returns NULL and stores 0 otherwise). Small strings are copied into `smallBuf`, which must have
+// room for TINY_SMALL_STRING_MAX_LEN + 1 chars, and slices are returned as they are.
+//
+// This means the result ISN'T null terminated if the string is a slice, so only use this if you
+// go by `len`. It's cheaper than Tiny_ToString since it never copies a slice.
+const char *Tiny_ToStringChars(const Tiny_Value value, char *smallBuf, size_t *len);
+
+// Same as Tiny_ToString (which is null terminated for slices as well now), kept for compatibility.
+const char *Tiny_ToCString(Tiny_StateThread *thread, Tiny_Value value);
+
 // Returns 0 if the value isn't a string/const string
 size_t Tiny_StringLen(const Tiny_Value value);
 
@@ -270,6 +616,31 @@ Tiny_State *Tiny_CreateState(void);
 // Note how the Context is copied.
 Tiny_State *Tiny_CreateStateWithContext(Tiny_Context ctx);
 
+// Selects the kind of code that gets generated for a Tiny_State.
+typedef enum Tiny_Backend {
+    // Every expression is evaluated on the thread's stack. This is the default.
+    TINY_BACKEND_STACK,
+
+    // Inside functions, locals (and temporaries) live in frame slots which instructions name
+    // directly, so e.g. `a = b + c` is a single ADD_INT_R instead of four stack instructions.
+    //
+    // Only int/float arithmetic, comparisons, and assignments to locals are compiled this way.
+    // Everything else, including all code outside of functions, still uses the stack.
+    TINY_BACKEND_REGISTER,
+} Tiny_Backend;
+
+// Same as Tiny_CreateStateWithContext but lets you pick the backend which every module compiled
+// into the state uses.
+Tiny_State *Tiny_CreateStateWithBackend(Tiny_Context ctx, Tiny_Backend backend);
+
+// Controls how much the bytecode is optimized after it is generated, which affects every
+// subsequent compile into this state.
+//
+// 0 turns the optimizations (constant folding, inlining, superinstructions and the peephole pass)
+// off, which is handy when debugging the code generator since the disassembly then matches the
+// code exactly. 1, the default, turns them all on.
+void Tiny_SetOptimizationLevel(Tiny_State *state, int level);
+
 // Exposes an opaque type of the given name.
 // The same typename can be registered multiple times, but it will only be
 // defined once.
@@ -331,6 +702,23 @@ void Tiny_InitThread(Tiny_StateThread *thread, const Tiny_State *state);
 void Tiny_InitThreadWithContext(Tiny_StateThread *thread, const Tiny_State *state,
                                 Tiny_Context ctx);
 
+// Selects how a thread manages the memory for its objects.
+typedef enum Tiny_HeapMode {
+    // Objects are garbage collected. This is the default.
+    TINY_HEAP_GC,
+
+    // Objects are bump allocated out of an arena and are never collected. All of them are freed
+    // at once by Tiny_DestroyThread (natives are still finalized then).
+    //
+    // This is meant for short-lived threads which don't allocate much, like a thread per request
+    // in a server. A thread which keeps allocating will keep growing until it's destroyed.
+    TINY_HEAP_REGION,
+} Tiny_HeapMode;
+
+// Same as Tiny_InitThreadWithContext but lets you pick how the thread's heap is managed.
+void Tiny_InitThreadWithHeap(Tiny_StateThread *thread, const Tiny_State *state, Tiny_Context ctx,
+                             Tiny_HeapMode mode);
+
 // Sets the PC of the thread to the entry point of the program
 // and allocates space for global variables if they're not already
 // allocated
@@ -364,11 +752,21 @@ void Tiny_SetGlobal(Tiny_StateThread *thread, int globalIndex, Tiny_Value value)
 // state of the thread prior to the function call and restores it afterwards.
 // This also allocates globals if the thread hasn't been started already, and in
 // that case, once the function call is over, the thread will be "done".
+//
+// The call can grow (and so move) the thread's stack, so when calling this from a foreign function,
+// its `args` (and any other pointers into the stack) aren't valid afterwards. Passing them in as
+// `args` is fine though.
 Tiny_Value Tiny_CallFunction(Tiny_StateThread *thread, int functionIndex, const Tiny_Value *args,
                              int count);
 
 static inline bool Tiny_IsThreadDone(const Tiny_StateThread *thread) { return thread->pc < 0; }
 
+// If the thread is done because it ran into an error (see the `error` field of Tiny_StateThread),
+// returns a description of it. Otherwise returns NULL.
+static inline const char *Tiny_GetThreadError(const Tiny_StateThread *thread) {
+    return thread->error;
+}
+
 // Run a single cycle of the thread.
 // Could potentially trigger garbage collection
 // at the end of the cycle.
@@ -381,6 +779,89 @@ bool Tiny_ExecuteCycle(Tiny_StateThread *thread);
 // Tiny_Run.
 void Tiny_Run(Tiny_StateThread *thread);
 
+enum { TINY_GC_IDLE, TINY_GC_MARK, TINY_GC_SWEEP };
+
+// By default, once a thread's heap needs collecting it's all done in one go, which could take
+// a while for threads with lots of objects. This makes the collector incremental instead: the
+// work is spread out over many pauses of at most roughly `micros` microseconds (in between which
+// the thread keeps running). Each pause also marks or sweeps at most
+// `micros * TINY_GC_WORK_PER_MICRO` objects. Pass 0 to go back to collecting all at once.
+//
+// Note the write barrier requirement for natives this imposes (see Tiny_GCWriteBarrier).
+void Tiny_SetGCPauseBudget(Tiny_StateThread *thread, int micros);
+
+// Starts a collection if there isn't one in progress and does all of the work at once (regardless
+// of the pause budget). If a collection was already in progress, it is finished first and then
+// another one is done, so that everything which was garbage when this was called is freed.
+//
+// This can be called from a foreign function (the values on the thread's stack, including the
+// args, are safe), but any objects it created which aren't referenced from anywhere else yet
+// will be freed. Does nothing for threads with a TINY_HEAP_REGION heap.
+void Tiny_CollectGarbage(Tiny_StateThread *thread);
+
+// Replaces the thread's policy, which takes effect right away. By default, the growth factor is 2,
+// the minimum heap size is TINY_GC_MIN_HEAP_BYTES, and garbage is collected automatically.
+void Tiny_SetGCPolicy(Tiny_StateThread *thread, Tiny_GCPolicy policy);
+Tiny_GCPolicy Tiny_GetGCPolicy(const Tiny_StateThread *thread);
+
+typedef struct Tiny_GCStats {
+    // How many collections have finished, and how long the thread spent collecting (a collection
+    // can take several pauses if it's incremental, see Tiny_SetGCPauseBudget)
+    int collections;
+    int64_t totalPauseMicros;
+    int64_t maxPauseMicros;
+
+    // What's on the heap right now. While a collection is sweeping, liveBytes only counts the
+    // objects which have already been swept (and any allocated since).
+    int liveObjects;
+    size_t liveBytes;
+
+    // Totals over every collection so far
+    int64_t freedObjects;
+    uint64_t freedBytes;
+
+    // How many bytes have been allocated since the last collection finished
+    size_t allocatedBytesSinceGC;
+} Tiny_GCStats;
+
+void Tiny_GetGCStats(const Tiny_StateThread *thread, Tiny_GCStats *stats);
+
+// With interning on, creating a string (through Tiny_NewString or Tiny_NewStringCopy, which is
+// what the standard library uses) first checks whether the thread already has a string with the
+// same characters and returns that one if so. Interned strings are compared by pointer, which
+// makes comparisons and dict lookups with them much cheaper, but every string that's created
+// costs a hash table lookup. Slices and strings created while interning was off aren't interned.
+//
+// Off by default.
+void Tiny_SetStringInterning(Tiny_StateThread *thread, bool enabled);
+
+typedef enum Tiny_RunResult {
+    // The thread finished (or was already done before the call)
+    TINY_RUN_DONE,
+    // The thread executed as many cycles as it was allowed to
+    TINY_RUN_BUDGET_EXHAUSTED,
+    // A foreign function called Tiny_YieldThread
+    TINY_RUN_YIELDED,
+    // The thread was stopped by an error (see Tiny_GetThreadError)
+    TINY_RUN_ERROR,
+} Tiny_RunResult;
+
+// Runs at most `maxCycles` cycles of the thread and returns why it stopped. If `executed` isn't
+// NULL, the number of cycles that were actually executed is written to it.
+//
+// This is meant for schedulers which time-slice many threads: it's much cheaper than calling
+// Tiny_ExecuteCycle `maxCycles` times.
+Tiny_RunResult Tiny_RunBudget(Tiny_StateThread *thread, int64_t maxCycles, int64_t *executed);
+
+// Call this from a foreign function to make Tiny_RunBudget (or Tiny_Run) return as soon as the
+// foreign function does, without executing any more cycles. The thread picks up where it left
+// off the next time it's run.
+//
+// The foreign function's result is read from `thread->retVal` when the thread resumes rather than
+// when the foreign function returns, so whoever resumes it can supply the result (e.g. once some
+// work it started on another OS thread completes).
+void Tiny_YieldThread(Tiny_StateThread *thread);
+
 // This will write the filename and line number of the currently executing
 // piece of Tiny code to `fileName` and `line` respectively. You can provide
 // NULL for either if you don't care about their value.
@@ -439,6 +920,15 @@ void Tiny_DestroyThread(Tiny_StateThread *thread);
 // Once it reaches the end, it sets `pc` to -1.
 bool Tiny_DisasmOne(const Tiny_State *state, int *pc, char *buf, size_t maxlen);
 
+#ifdef TINY_PROFILE_OPCODE_PAIRS
+// Writes out how many times each pair of opcodes was executed back to back by the
+// given thread, most frequent first, one "count first_opcode second_opcode" per line.
+//
+// This is what the superinstructions in opcodes.h were picked from; run your workload with
+// TINY_PROFILE_OPCODE_PAIRS defined and look at the top of the list.
+void Tiny_WriteOpcodePairProfile(const Tiny_StateThread *thread, FILE *file);
+#endif
+
 typedef enum Tiny_MacroResultType {
     TINY_MACRO_SUCCESS = 0,
     TINY_MACRO_ERROR = 1
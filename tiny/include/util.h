@@ -2,6 +2,7 @@
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "tiny.h"
 
@@ -26,3 +27,12 @@ int Tiny_TranslatePosToLineNumber(const char *src, Tiny_TokenPos pos);
 
 void Tiny_FormatErrorV(char *buf, size_t bufsize, const char *fileName, const char *src,
                        Tiny_TokenPos pos, const char *s, va_list args);
+
+// Keyed hashing (in the style of wyhash) for hash tables whose keys might come from untrusted
+// input. Without knowing the seed, it's not feasible to pick keys that collide.
+uint64_t Tiny_HashBytes(const void *data, size_t len, uint64_t seed);
+uint64_t Tiny_HashInt(uint64_t x, uint64_t seed);
+
+// Random seed that's picked the first time this is called and stays the same for the rest of the
+// process (so hashes cached in string objects stay valid). Safe to call from multiple threads.
+uint64_t Tiny_GetHashSeed(void);
@@ -22,16 +22,11 @@ static size_t NextMultipleOf(size_t value, size_t factor) {
 
     assert(factor % 2 == 0);
 
-    // Seems correct, I have tried 2 numbers
-    // 3, 4
-    // 011, 100
-    // 011 => 100
-    // 000 + factor = 4
-    //
-    // 7, 4
-    // 111, 100
-    // 100...
-    return (value & ~(factor - 1)) + factor;
+    // Values which are already a multiple of factor stay the same, e.g.
+    // (3, 4) => 4
+    // (4, 4) => 4
+    // (7, 4) => 8
+    return (value + factor - 1) & ~(factor - 1);
 }
 
 void Tiny_InitArena(Tiny_Arena* a, Tiny_Context ctx) {
@@ -99,3 +99,213 @@ Tiny_Value *ArrayGet(Array *array, int index) {
 }
 
 void DestroyArray(Array *array) { sb_free(&array->ctx, array->data); }
+
+void InitPackedArray(PackedArray *array, Tiny_Context ctx, PackedArrayType type) {
+    array->ctx = ctx;
+    array->type = type;
+    array->len = 0;
+    array->cap = 0;
+    array->data = NULL;
+}
+
+size_t PackedArrayElemSize(PackedArrayType type) {
+    switch (type) {
+        case PACKED_ARRAY_INT:
+            return sizeof(Tiny_Int);
+        case PACKED_ARRAY_FLOAT:
+            return sizeof(Tiny_Float);
+        case PACKED_ARRAY_BOOL:
+            return sizeof(uint8_t);
+    }
+
+    assert(0);
+    return 0;
+}
+
+static void PackedArrayReserve(PackedArray *array, int cap) {
+    if (cap <= array->cap) {
+        return;
+    }
+
+    int newCap = array->cap * 2;
+
+    if (newCap < cap) newCap = cap;
+    if (newCap < 8) newCap = 8;
+
+    array->data = Tiny_AllocUsingContext(array->ctx, array->data,
+                                         newCap * PackedArrayElemSize(array->type));
+    array->cap = newCap;
+}
+
+// Unboxes value into every element in [start, end). These loops are trivial enough for the
+// compiler to vectorize.
+static void PackedArrayFillRange(PackedArray *array, int start, int end, Tiny_Value value) {
+    switch (array->type) {
+        case PACKED_ARRAY_INT: {
+            Tiny_Int *data = array->data;
+            Tiny_Int v = Tiny_ToInt(value);
+
+            for (int i = start; i < end; ++i) data[i] = v;
+        } break;
+
+        case PACKED_ARRAY_FLOAT: {
+            Tiny_Float *data = array->data;
+            Tiny_Float v = Tiny_ToNumber(value);
+
+            for (int i = start; i < end; ++i) data[i] = v;
+        } break;
+
+        case PACKED_ARRAY_BOOL: {
+            memset((uint8_t *)array->data + start, Tiny_ToBool(value), end - start);
+        } break;
+    }
+}
+
+void InitPackedArrayEx(PackedArray *array, Tiny_Context ctx, PackedArrayType type, int length,
+                       const Tiny_Value *initValues) {
+    InitPackedArray(array, ctx, type);
+    PackedArrayReserve(array, length);
+
+    array->len = length;
+
+    for (int i = 0; i < length; ++i) {
+        PackedArraySet(array, i, initValues[i]);
+    }
+}
+
+int PackedArrayLen(const PackedArray *array) { return array->len; }
+
+void PackedArrayCopy(PackedArray *dest, const PackedArray *src) {
+    assert(dest->type == src->type);
+
+    PackedArrayReserve(dest, src->len);
+
+    if (src->len > 0) {
+        memcpy(dest->data, src->data, src->len * PackedArrayElemSize(src->type));
+    }
+
+    dest->len = src->len;
+}
+
+void PackedArrayClear(PackedArray *array) { array->len = 0; }
+
+void PackedArrayResize(PackedArray *array, int newLen, Tiny_Value newValue) {
+    assert(newLen >= 0);
+
+    if (newLen > array->len) {
+        PackedArrayReserve(array, newLen);
+        PackedArrayFillRange(array, array->len, newLen, newValue);
+    }
+
+    array->len = newLen;
+}
+
+void PackedArrayFill(PackedArray *array, Tiny_Value value) {
+    PackedArrayFillRange(array, 0, array->len, value);
+}
+
+void PackedArrayPush(PackedArray *array, Tiny_Value value) {
+    PackedArrayReserve(array, array->len + 1);
+
+    array->len += 1;
+    PackedArraySet(array, array->len - 1, value);
+}
+
+Tiny_Value PackedArrayPop(PackedArray *array) {
+    assert(array->len > 0);
+
+    Tiny_Value value = PackedArrayGet(array, array->len - 1);
+    array->len -= 1;
+
+    return value;
+}
+
+Tiny_Value PackedArrayShift(PackedArray *array) {
+    assert(array->len > 0);
+
+    Tiny_Value value = PackedArrayGet(array, 0);
+
+    PackedArrayRemove(array, 0);
+
+    return value;
+}
+
+void PackedArrayInsert(PackedArray *array, int index, Tiny_Value value) {
+    assert(index >= 0 && index < array->len);
+
+    size_t elemSize = PackedArrayElemSize(array->type);
+
+    PackedArrayReserve(array, array->len + 1);
+
+    uint8_t *data = array->data;
+
+    memmove(&data[(index + 1) * elemSize], &data[index * elemSize],
+            elemSize * (array->len - index));
+    array->len += 1;
+
+    PackedArraySet(array, index, value);
+}
+
+void PackedArrayRemove(PackedArray *array, int index) {
+    assert(index >= 0 && index < array->len);
+
+    size_t elemSize = PackedArrayElemSize(array->type);
+    uint8_t *data = array->data;
+
+    memmove(&data[index * elemSize], &data[(index + 1) * elemSize],
+            elemSize * (array->len - index - 1));
+    array->len -= 1;
+}
+
+void PackedArraySet(PackedArray *array, int index, Tiny_Value value) {
+    assert(index >= 0 && index < array->len);
+
+    switch (array->type) {
+        case PACKED_ARRAY_INT:
+            ((Tiny_Int *)array->data)[index] = Tiny_ToInt(value);
+            break;
+        case PACKED_ARRAY_FLOAT:
+            ((Tiny_Float *)array->data)[index] = Tiny_ToNumber(value);
+            break;
+        case PACKED_ARRAY_BOOL:
+            ((uint8_t *)array->data)[index] = Tiny_ToBool(value);
+            break;
+    }
+}
+
+Tiny_Value PackedArrayGet(const PackedArray *array, int index) {
+    assert(index >= 0 && index < array->len);
+
+    switch (array->type) {
+        case PACKED_ARRAY_INT:
+            return Tiny_NewInt(((const Tiny_Int *)array->data)[index]);
+        case PACKED_ARRAY_FLOAT:
+            return Tiny_NewFloat(((const Tiny_Float *)array->data)[index]);
+        case PACKED_ARRAY_BOOL:
+            return Tiny_NewBool(((const uint8_t *)array->data)[index]);
+    }
+
+    assert(0);
+    return Tiny_Null;
+}
+
+static int ComparePackedInts(const void *aRaw, const void *bRaw) {
+    Tiny_Int a = *(const Tiny_Int *)aRaw;
+    Tiny_Int b = *(const Tiny_Int *)bRaw;
+
+    return (a > b) - (a < b);
+}
+
+void PackedArraySortInts(PackedArray *array) {
+    assert(array->type == PACKED_ARRAY_INT);
+
+    if (array->len > 1) {
+        qsort(array->data, array->len, sizeof(Tiny_Int), ComparePackedInts);
+    }
+}
+
+void DestroyPackedArray(PackedArray *array) {
+    if (array->data) {
+        Tiny_AllocUsingContext(array->ctx, array->data, 0);
+    }
+}
@@ -4,198 +4,361 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define INIT_BUCKET_COUNT 32
+#include "detail.h"
+#include "util.h"
 
-// djb2 - http://www.cse.yorku.ca/~oz/hash.html
-static unsigned long HashBytes(const char *first, const char *last) {
-    unsigned long hash = 5381;
-    int c;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DICT_SSE2
+#include <emmintrin.h>
+#endif
 
-    while (first != last && (c = *first++)) hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+#define INIT_BUCKET_COUNT 16
 
-    return hash;
-}
+// Control bytes for slots without a key in them. Both have the high bit set, which the 7-bit
+// hash tags of filled slots never do.
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+
+static uint64_t HashValue(const Dict *dict, Tiny_Value value) {
+    uint64_t hash = 0;
 
-static unsigned long HashValue(Tiny_Value value) {
-    switch (value.type) {
+    switch (Tiny_GetType(value)) {
         case TINY_VAL_BOOL:
-            return (int)value.boolean + 1;
+            hash = (int)Tiny_AsBool(value) + 1;
+            break;
         case TINY_VAL_INT:
-            return (Tiny_Int)value.i;
-        case TINY_VAL_CONST_STRING:
-        case TINY_VAL_STRING: {
-            const char *start = Tiny_ToString(value);
-            size_t len = Tiny_StringLen(value);
-
-            return HashBytes(start, start + len);
+            hash = Tiny_AsInt(value);
+            break;
+        case TINY_VAL_FLOAT: {
+            // 0.0 == -0.0 so they have to hash the same
+            Tiny_Float f = Tiny_AsFloat(value);
+            if (f == 0) f = 0;
+
+            memcpy(&hash, &f, sizeof(f));
         } break;
+        case TINY_VAL_CONST_STRING:
+        case TINY_VAL_STRING:
+        case TINY_VAL_SMALL_STRING:
+            // String objects cache their hash
+            hash = Tiny_HashString(value);
+            break;
         case TINY_VAL_STRUCT:
-            return (uintptr_t)value.obj;
+            hash = (uintptr_t)Tiny_AsObject(value);
+            break;
         default: {
             void *ptr = Tiny_ToAddr(value);
 
             assert(ptr);
 
-            return (uintptr_t)ptr;
+            hash = (uintptr_t)ptr;
         } break;
     }
+
+    // Ints hash to themselves and pointers have their low bits clear, but the tag comes from the
+    // low 7 bits and the position from the rest, so every bit has to depend on every other.
+    return Tiny_HashInt(hash, dict->seed);
 }
 
-static void Init(Dict *dict, Tiny_Context ctx, int bucketCount) {
-    dict->bucketCount = bucketCount;
-    dict->filledCount = 0;
+static uint8_t HashTag(uint64_t hash) { return hash & 0x7F; }
+static size_t HashPos(uint64_t hash) { return (size_t)(hash >> 7); }
 
-    InitArray(&dict->keys, ctx);
-    InitArray(&dict->values, ctx);
+// Bit i is set if the i-th control byte of a group matched
+typedef uint32_t GroupMask;
 
-    Tiny_Value nullValue = {0};
+#ifdef DICT_SSE2
+static GroupMask MatchByte(const uint8_t *group, uint8_t c) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+}
 
-    ArrayResize(&dict->keys, bucketCount, nullValue);
-    ArrayResize(&dict->values, bucketCount, nullValue);
+static GroupMask MatchEmptyOrDeleted(const uint8_t *group) {
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
 }
+#else
+static GroupMask MatchByte(const uint8_t *group, uint8_t c) {
+    GroupMask mask = 0;
 
-static void Grow(Dict *dict) {
-    Dict newDict;
+    for (int i = 0; i < DICT_GROUP_WIDTH; ++i) {
+        mask |= (GroupMask)(group[i] == c) << i;
+    }
 
-    Init(&newDict, dict->keys.ctx, dict->bucketCount * 2);
+    return mask;
+}
 
-    for (int i = 0; i < dict->bucketCount; ++i) {
-        Tiny_Value prevKey = *ArrayGet(&dict->keys, i);
+static GroupMask MatchEmptyOrDeleted(const uint8_t *group) {
+    GroupMask mask = 0;
 
-        // If there was a value in that bucket
-        if (!Tiny_IsNull(prevKey)) {
-            Tiny_Value prevValue = *ArrayGet(&dict->values, i);
-            DictSet(&newDict, prevKey, prevValue);
-        }
+    for (int i = 0; i < DICT_GROUP_WIDTH; ++i) {
+        mask |= (GroupMask)(group[i] >> 7) << i;
     }
 
-    // Free the previous data (keys etc)
-    DestroyDict(dict);
-    *dict = newDict;
+    return mask;
 }
+#endif
+
+static GroupMask MatchEmpty(const uint8_t *group) { return MatchByte(group, CTRL_EMPTY); }
 
-void InitDict(Dict *dict, Tiny_Context ctx) { Init(dict, ctx, INIT_BUCKET_COUNT); }
+static int LowestBit(GroupMask mask) {
+    assert(mask);
 
-void DestroyDict(Dict *dict) {
-    DestroyArray(&dict->keys);
-    DestroyArray(&dict->values);
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        ++i;
+    }
+    return i;
+#endif
 }
 
-void DictSet(Dict *dict, Tiny_Value key, Tiny_Value value) {
-    // TODO: Perhaps think about having a DictSetEx where you can
-    // adjust growth factor and parameters (like allow it to fail
-    // if there's no space). Better yet, break these apart into
-    // DictSet and DictSetGrow so that it's clear.
-    if (dict->filledCount >= dict->bucketCount / 2) Grow(dict);
+static int HighestBit(GroupMask mask) {
+    assert(mask);
 
-    unsigned long hash = HashValue(key);
+#if defined(__GNUC__) || defined(__clang__)
+    return 31 - __builtin_clz(mask);
+#else
+    int i = 0;
+    while (mask >>= 1) ++i;
+    return i;
+#endif
+}
 
-    unsigned long index = hash % dict->bucketCount;
+// Keep the table at most 7/8 full
+static int MaxFilled(int bucketCount) { return bucketCount - bucketCount / 8; }
 
-    Tiny_Value prevKey = *ArrayGet(&dict->keys, (int)index);
+static void SetCtrl(Dict *dict, size_t index, uint8_t c) {
+    dict->ctrl[index] = c;
 
-    unsigned long origin = index;
+    // Keep the mirror of the first group in sync
+    if (index < DICT_GROUP_WIDTH) {
+        dict->ctrl[dict->bucketCount + index] = c;
+    }
+}
 
-    // While an empty spot or the key we want to set isn't found
-    while (!Tiny_IsNull(prevKey) && !Tiny_AreValuesEqual(prevKey, key)) {
-        // Probe for a spot to put this key/value
-        ++index;
-        index %= dict->bucketCount;
+static void Init(Dict *dict, Tiny_Context ctx, int bucketCount, uint64_t seed) {
+    assert(bucketCount >= DICT_GROUP_WIDTH && (bucketCount & (bucketCount - 1)) == 0);
 
-        // It wrapped around so there's no space
-        // Just grow and keep on trying
-        if (index == origin) {
-            Grow(dict);
+    dict->ctx = ctx;
+    dict->seed = seed;
+    dict->bucketCount = bucketCount;
+    dict->filledCount = 0;
+    dict->growthLeft = MaxFilled(bucketCount);
+
+    // Slots and control bytes share an allocation
+    dict->slots = Tiny_AllocUsingContext(
+        ctx, NULL, sizeof(DictSlot) * bucketCount + bucketCount + DICT_GROUP_WIDTH);
+    dict->ctrl = (uint8_t *)(dict->slots + bucketCount);
+
+    memset(dict->ctrl, CTRL_EMPTY, bucketCount + DICT_GROUP_WIDTH);
+}
+
+// Values with the same type and payload are always equal. Checking that first saves a call into
+// Tiny_AreValuesEqual for int and pointer keys.
+static bool AreKeysEqual(Tiny_Value a, Tiny_Value b) {
+#ifdef TINY_VALUE_NANBOX
+    if (a.bits == b.bits) return true;
+#else
+    if (a.type == b.type && a.i == b.i) return true;
+#endif
+
+    return Tiny_AreValuesEqual(a, b);
+}
+
+// Probes through groups at increasing distances (1, 2, 3... groups away) which, since the
+// bucket count is a power of two, visits every group before it repeats.
+static int FindSlot(const Dict *dict, Tiny_Value key, uint64_t hash) {
+    size_t mask = dict->bucketCount - 1;
+    size_t pos = HashPos(hash) & mask;
+    uint8_t tag = HashTag(hash);
+
+    for (size_t stride = DICT_GROUP_WIDTH;; stride += DICT_GROUP_WIDTH) {
+        const uint8_t *group = dict->ctrl + pos;
+
+        for (GroupMask m = MatchByte(group, tag); m; m &= m - 1) {
+            size_t index = (pos + LowestBit(m)) & mask;
+            const DictSlot *slot = &dict->slots[index];
+
+            if (slot->hash == hash && AreKeysEqual(slot->key, key)) {
+                return (int)index;
+            }
+        }
 
-            // Index must be recreated since bucket count changed
-            index = hash % dict->bucketCount;
-            origin = index;
+        // The key would've been put in that empty slot if it wasn't found before it
+        if (MatchEmpty(group)) {
+            return -1;
         }
 
-        prevKey = *ArrayGet(&dict->keys, (int)index);
+        pos = (pos + stride) & mask;
     }
+}
 
-    // There was no key here before (i.e bucket was empty)
-    if (Tiny_IsNull(prevKey)) {
-        ArraySet(&dict->keys, (int)index, key);
+// Finds the first empty or deleted slot along the probe sequence for the given hash. There is
+// always at least one since growthLeft keeps some slots empty.
+static size_t FindFreeSlot(const Dict *dict, uint64_t hash) {
+    size_t mask = dict->bucketCount - 1;
+    size_t pos = HashPos(hash) & mask;
 
-        dict->filledCount += 1;
-    } else {
-        // Otherwise, we do nothing with the key since the user
-        // is probably replacing the value
+    for (size_t stride = DICT_GROUP_WIDTH;; stride += DICT_GROUP_WIDTH) {
+        GroupMask m = MatchEmptyOrDeleted(dict->ctrl + pos);
+
+        if (m) {
+            return (pos + LowestBit(m)) & mask;
+        }
+
+        pos = (pos + stride) & mask;
     }
+}
+
+// Puts a key that's known not to be in the dict into the given free slot
+static void FillSlot(Dict *dict, size_t index, Tiny_Value key, Tiny_Value value, uint64_t hash) {
+    if (dict->ctrl[index] == CTRL_EMPTY) {
+        dict->growthLeft -= 1;
+    }
+
+    SetCtrl(dict, index, HashTag(hash));
+
+    DictSlot *slot = &dict->slots[index];
 
-    ArraySet(&dict->values, (int)index, value);
+    slot->key = key;
+    slot->value = value;
+    slot->hash = hash;
+
+    dict->filledCount += 1;
 }
 
-const Tiny_Value *DictGet(Dict *dict, Tiny_Value key) {
-    unsigned long index = HashValue(key) % dict->bucketCount;
-    unsigned long origin = index;
+static void Resize(Dict *dict, int bucketCount) {
+    Dict newDict;
 
-    for (;;) {
-        Tiny_Value keyHere = *ArrayGet(&dict->keys, (int)index);
+    // Has to keep the seed since the stored hashes were computed with it
+    Init(&newDict, dict->ctx, bucketCount, dict->seed);
 
-        if (Tiny_IsNull(keyHere)) return NULL;
+    for (int i = 0; i < dict->bucketCount; ++i) {
+        if (!DictIsSlotFilled(dict, i)) continue;
 
-        if (Tiny_AreValuesEqual(keyHere, key)) return ArrayGet(&dict->values, (int)index);
+        // We have the hash stored and all keys are distinct so no need to hash or compare
+        const DictSlot *slot = &dict->slots[i];
+        FillSlot(&newDict, FindFreeSlot(&newDict, slot->hash), slot->key, slot->value, slot->hash);
+    }
 
-        index += 1;
-        index %= dict->bucketCount;
+    // Free the previous slots
+    DestroyDict(dict);
+    *dict = newDict;
+}
 
-        if (index == origin) {
-            // Wrapped around, so it definitely doesn't exist
-            return NULL;
-        }
+void InitDict(Dict *dict, Tiny_Context ctx) {
+    // Every dict lives at a different address so this gives each of them a different seed
+    Init(dict, ctx, INIT_BUCKET_COUNT, Tiny_HashInt((uintptr_t)dict, Tiny_GetHashSeed()));
+}
+
+void DestroyDict(Dict *dict) { Tiny_AllocUsingContext(dict->ctx, dict->slots, 0); }
+
+void DictSet(Dict *dict, Tiny_Value key, Tiny_Value value) {
+    uint64_t hash = HashValue(dict, key);
+
+    int found = FindSlot(dict, key, hash);
+
+    if (found >= 0) {
+        // The user is replacing the value; the key stays as is
+        dict->slots[found].value = value;
+        return;
     }
 
-    // No key here indicates that it doesn't exist
-    return NULL;
+    size_t index = FindFreeSlot(dict, hash);
+
+    // Reusing a deleted slot doesn't use up any more space but filling an empty one does
+    if (dict->growthLeft == 0 && dict->ctrl[index] == CTRL_EMPTY) {
+        // If most of the used up space is deleted slots, just clear them out instead of growing
+        int bucketCount = dict->filledCount < MaxFilled(dict->bucketCount) / 2
+                              ? dict->bucketCount
+                              : dict->bucketCount * 2;
+
+        Resize(dict, bucketCount);
+
+        index = FindFreeSlot(dict, hash);
+    }
+
+    FillSlot(dict, index, key, value, hash);
+}
+
+const Tiny_Value *DictGet(Dict *dict, Tiny_Value key) {
+    int index = FindSlot(dict, key, HashValue(dict, key));
+
+    return index >= 0 ? &dict->slots[index].value : NULL;
 }
 
 void DictRemove(Dict *dict, Tiny_Value key) {
-    unsigned long hash = HashValue(key);
+    int index = FindSlot(dict, key, HashValue(dict, key));
 
-    unsigned long index = hash % dict->bucketCount;
-    unsigned long origin = index;
+    if (index < 0) return;
 
-    for (;;) {
-        Tiny_Value keyHere = *ArrayGet(&dict->keys, (int)index);
+    size_t mask = dict->bucketCount - 1;
 
-        if (Tiny_IsNull(keyHere)) return;  // Done
+    // A lookup only moves on from a group if it has no empty slots in it. If there are empty
+    // slots on both sides of this one that are less than a group apart, then no group that
+    // contains this slot was ever full, so no lookup could have probed past it and we can
+    // mark it empty rather than leaving a tombstone.
+    GroupMask emptyBefore = MatchEmpty(dict->ctrl + (((size_t)index - DICT_GROUP_WIDTH) & mask));
+    GroupMask emptyAfter = MatchEmpty(dict->ctrl + index);
 
-        if (Tiny_AreValuesEqual(keyHere, key)) {
-            ArraySet(&dict->keys, (int)index, Tiny_Null);
+    bool wasNeverFull = emptyBefore && emptyAfter &&
+                        LowestBit(emptyAfter) + (DICT_GROUP_WIDTH - 1 - HighestBit(emptyBefore)) <
+                            DICT_GROUP_WIDTH;
 
-            dict->filledCount -= 1;
-        } else if ((HashValue(keyHere) % dict->bucketCount) != index) {
-            // NOTE(Apaar): I'm amazed that I knew how to avoid tombstones in
-            // a linear-probed hash table way back in the day! The code below
-            // is mostly from 2017 and it is now 2023 (almost 2024)
+    if (wasNeverFull) {
+        SetCtrl(dict, index, CTRL_EMPTY);
+        dict->growthLeft += 1;
+    } else {
+        SetCtrl(dict, index, CTRL_DELETED);
+    }
 
-            // keyHere was displaced into the spot for `key`
+    // Don't hold on to the key/value
+    dict->slots[index].key = Tiny_Null;
+    dict->slots[index].value = Tiny_Null;
 
-            // The given key was colliding with the original or some other
-            // key was colliding with the original and took keyHere's
-            // spot so remove the key from this slot and readd the key/value
-            // to the table.
-            const Tiny_Value *value = ArrayGet(&dict->values, (int)index);
+    dict->filledCount -= 1;
+}
 
-            ArraySet(&dict->keys, (int)index, Tiny_Null);
-            dict->filledCount -= 1;
+void DictClear(Dict *dict) {
+    memset(dict->ctrl, CTRL_EMPTY, dict->bucketCount + DICT_GROUP_WIDTH);
 
-            DictSet(dict, keyHere, *value);
-        }
+    dict->filledCount = 0;
+    dict->growthLeft = MaxFilled(dict->bucketCount);
+}
+
+int DictNext(const Dict *dict, int cursor) {
+    assert(cursor >= 0);
+
+    // The cursor for the entry in slot i is i + 1, so this starts right after it
+    for (int i = cursor; i < dict->bucketCount; i += DICT_GROUP_WIDTH) {
+        GroupMask filled = ~MatchEmptyOrDeleted(dict->ctrl + i) & ((1u << DICT_GROUP_WIDTH) - 1);
 
-        index += 1;
-        index %= dict->bucketCount;
+        if (filled) {
+            int index = i + LowestBit(filled);
+
+            // The group might've read past the end into the mirrored control bytes
+            return index < dict->bucketCount ? index + 1 : 0;
+        }
     }
+
+    return 0;
 }
 
-void DictClear(Dict *dict) {
-    for (int i = 0; i < dict->bucketCount; ++i) {
-        ArraySet(&dict->keys, i, Tiny_Null);
-        ArraySet(&dict->values, i, Tiny_Null);
+const DictSlot *DictAt(const Dict *dict, int cursor) {
+    if (cursor <= 0 || cursor > dict->bucketCount || !DictIsSlotFilled(dict, cursor - 1)) {
+        return NULL;
     }
 
-    dict->filledCount = 0;
+    return &dict->slots[cursor - 1];
+}
+
+void DictIterate(const Dict *dict, DictIterateFunc fn, void *userdata) {
+    for (int cursor = DictNext(dict, 0); cursor; cursor = DictNext(dict, cursor)) {
+        const DictSlot *slot = &dict->slots[cursor - 1];
+
+        if (!fn(slot->key, slot->value, userdata)) {
+            break;
+        }
+    }
 }
@@ -2,11 +2,13 @@
 #include <errno.h>
 #include <limits.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "array.h"
 #include "detail.h"
 #include "dict.h"
 #include "tiny.h"
@@ -45,12 +47,14 @@ void __stdcall Sleep(DWORD dwMilliseconds);
 static Tiny_Value Strlen(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
     Tiny_Value val = args[0];
 
-    return Tiny_NewInt(strlen(Tiny_ToString(val)));
+    return Tiny_NewInt(Tiny_StringLen(val));
 }
 
 static Tiny_Value Stridx(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    const char *s = Tiny_ToString(args[0]);
-    size_t len = strlen(s);
+    char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+    size_t len;
+
+    const char *s = Tiny_ToStringChars(args[0], smallBuf, &len);
 
     Tiny_Int i = Tiny_ToInt(args[1]);
 
@@ -60,8 +64,10 @@ static Tiny_Value Stridx(Tiny_StateThread *thread, const Tiny_Value *args, int c
 }
 
 static TINY_FOREIGN_FUNCTION(Strchr) {
-    const char *s = Tiny_ToString(args[0]);
-    size_t len = Tiny_StringLen(args[0]);
+    char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+    size_t len;
+
+    const char *s = Tiny_ToStringChars(args[0], smallBuf, &len);
     char c = Tiny_ToInt(args[1]);
 
     const char *cs = memchr(s, c, len);
@@ -80,8 +86,8 @@ static const Tiny_NativeProp FileProp = {
 };
 
 static Tiny_Value Lib_Fopen(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    const char *filename = Tiny_ToString(args[0]);
-    const char *mode = Tiny_ToString(args[1]);
+    const char *filename = Tiny_ToCString(thread, args[0]);
+    const char *mode = Tiny_ToCString(thread, args[1]);
 
     FILE *file = fopen(filename, mode);
 
@@ -130,8 +136,11 @@ static Tiny_Value Lib_Fseek(Tiny_StateThread *thread, const Tiny_Value *args, in
 
 static Tiny_Value Lib_Fwrite(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
     FILE *file = Tiny_ToAddr(args[0]);
-    const char *str = Tiny_ToString(args[1]);
-    int num = count == 3 ? (int)Tiny_ToNumber(args[2]) : (int)strlen(str);
+    char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+    size_t len;
+
+    const char *str = Tiny_ToStringChars(args[1], smallBuf, &len);
+    int num = count == 3 ? (int)Tiny_ToNumber(args[2]) : (int)len;
 
     return Tiny_NewInt(fwrite(str, 1, num, file));
 }
@@ -145,7 +154,7 @@ static Tiny_Value Lib_Fclose(Tiny_StateThread *thread, const Tiny_Value *args, i
 }
 
 static Tiny_Value Lib_ReadFile(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    FILE *file = fopen(Tiny_ToString(args[0]), "rb");
+    FILE *file = fopen(Tiny_ToCString(thread, args[0]), "rb");
 
     if (!file) {
         return Tiny_Null;
@@ -166,15 +175,18 @@ static Tiny_Value Lib_ReadFile(Tiny_StateThread *thread, const Tiny_Value *args,
 }
 
 static Tiny_Value Lib_WriteFile(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    FILE *file = fopen(Tiny_ToString(args[0]), "w");
+    FILE *file = fopen(Tiny_ToCString(thread, args[0]), "w");
 
     if (!file) {
         return Tiny_NewBool(false);
     }
 
-    const char *s = Tiny_ToString(args[1]);
+    char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+    size_t len;
 
-    fwrite(s, 1, strlen(s), file);
+    const char *str = Tiny_ToStringChars(args[1], smallBuf, &len);
+
+    fwrite(str, 1, len, file);
     fclose(file);
 
     return Tiny_NewBool(true);
@@ -195,35 +207,28 @@ static void ArrayMark(void *ptr) {
     }
 }
 
+static size_t ArraySize(void *ptr) {
+    Array *array = ptr;
+
+    return sizeof(Array) + sizeof(Tiny_Value) * ArrayLen(array);
+}
+
 const Tiny_NativeProp ArrayProp = {
     "array",
     ArrayMark,
     ArrayFree,
+    ArraySize,
 };
 
-// This elides the cost of marking every element of the array (which can be very expensive)
-const Tiny_NativeProp PrimitiveArrayProp = {
-    "array",
-    NULL,
-    ArrayFree,
-};
-
-static Tiny_Value CreateArrayEx(Tiny_StateThread *thread, int count, const Tiny_Value *values,
-                                bool primitive) {
+static Tiny_Value CreateArrayEx(Tiny_StateThread *thread, int count, const Tiny_Value *values) {
     Array *array = Tiny_AllocUsingContext(thread->ctx, NULL, sizeof(Array));
 
     InitArrayEx(array, thread->ctx, count, values);
 
-    memcpy(array->data, values, sizeof(Tiny_Value) * count);
-
-    return Tiny_NewNative(thread, array, primitive ? &PrimitiveArrayProp : &ArrayProp);
+    return Tiny_NewNative(thread, array, &ArrayProp);
 }
 
-static TINY_FOREIGN_FUNCTION(CreateArray) { return CreateArrayEx(thread, count, args, false); }
-
-static TINY_FOREIGN_FUNCTION(CreatePrimitiveArray) {
-    return CreateArrayEx(thread, count, args, true);
-}
+static TINY_FOREIGN_FUNCTION(CreateArray) { return CreateArrayEx(thread, count, args); }
 
 static TINY_FOREIGN_FUNCTION(Lib_ArrayLen) {
     Array *array = Tiny_ToAddr(args[0]);
@@ -337,20 +342,120 @@ static TINY_FOREIGN_FUNCTION(Lib_ArrayInsert) {
     return Tiny_Null;
 }
 
-static int CompareInts(const void *aRaw, const void *bRaw) {
-    const Tiny_Value *a = aRaw;
-    const Tiny_Value *b = bRaw;
+static void PackedArrayFree(Tiny_Context *ctx, void *ptr) {
+    PackedArray *array = ptr;
 
-    assert(a->type == TINY_VAL_INT);
-    assert(b->type == TINY_VAL_INT);
+    DestroyPackedArray(array);
+    Tiny_AllocUsingContext(*ctx, array, 0);
+}
+
+static size_t PackedArraySize(void *ptr) {
+    PackedArray *array = ptr;
 
-    return (int)(a->i - b->i);
+    return sizeof(PackedArray) + PackedArrayElemSize(array->type) * array->cap;
 }
 
-static TINY_FOREIGN_FUNCTION(Lib_ArraySortInt) {
-    Array *array = Tiny_ToAddr(args[0]);
+// Used for arrays of bool, int and float. There's nothing to mark since the elements are all
+// primitives.
+const Tiny_NativeProp PackedArrayProp = {
+    "array",
+    NULL,
+    PackedArrayFree,
+    PackedArraySize,
+};
+
+static Tiny_Value CreatePackedArrayEx(Tiny_StateThread *thread, PackedArrayType type, int count,
+                                      const Tiny_Value *values) {
+    PackedArray *array = Tiny_AllocUsingContext(thread->ctx, NULL, sizeof(PackedArray));
+
+    InitPackedArrayEx(array, thread->ctx, type, count, values);
+
+    return Tiny_NewNative(thread, array, &PackedArrayProp);
+}
+
+static TINY_FOREIGN_FUNCTION(CreateIntArray) {
+    return CreatePackedArrayEx(thread, PACKED_ARRAY_INT, count, args);
+}
+
+static TINY_FOREIGN_FUNCTION(CreateFloatArray) {
+    return CreatePackedArrayEx(thread, PACKED_ARRAY_FLOAT, count, args);
+}
+
+static TINY_FOREIGN_FUNCTION(CreateBoolArray) {
+    return CreatePackedArrayEx(thread, PACKED_ARRAY_BOOL, count, args);
+}
 
-    qsort(array->data, ArrayLen(array), sizeof(Tiny_Value), CompareInts);
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayLen) {
+    return Tiny_NewInt(PackedArrayLen(Tiny_ToAddr(args[0])));
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayClear) {
+    PackedArrayClear(Tiny_ToAddr(args[0]));
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayResize) {
+    // Unboxing null gives 0, 0.0 or false which is what the new elements should be
+    PackedArrayResize(Tiny_ToAddr(args[0]), (int)Tiny_ToInt(args[1]), Tiny_Null);
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayResizeFill) {
+    PackedArrayResize(Tiny_ToAddr(args[0]), (int)Tiny_ToInt(args[1]), args[2]);
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayFill) {
+    PackedArrayFill(Tiny_ToAddr(args[0]), args[1]);
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayCopy) {
+    PackedArrayCopy(Tiny_ToAddr(args[0]), Tiny_ToAddr(args[1]));
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayPush) {
+    PackedArrayPush(Tiny_ToAddr(args[0]), args[1]);
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayGet) {
+    return PackedArrayGet(Tiny_ToAddr(args[0]), (int)Tiny_ToInt(args[1]));
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArraySet) {
+    PackedArraySet(Tiny_ToAddr(args[0]), (int)Tiny_ToInt(args[1]), args[2]);
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayPop) { return PackedArrayPop(Tiny_ToAddr(args[0])); }
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayShift) {
+    return PackedArrayShift(Tiny_ToAddr(args[0]));
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayRemove) {
+    PackedArrayRemove(Tiny_ToAddr(args[0]), (int)Tiny_ToInt(args[1]));
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArrayInsert) {
+    PackedArrayInsert(Tiny_ToAddr(args[0]), (int)Tiny_ToInt(args[1]), args[2]);
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PackedArraySortInt) {
+    PackedArraySortInts(Tiny_ToAddr(args[0]));
 
     return Tiny_Null;
 }
@@ -358,12 +463,11 @@ static TINY_FOREIGN_FUNCTION(Lib_ArraySortInt) {
 static void DictProtectFromGC(void *p) {
     Dict *d = p;
 
-    for (int i = 0; i < d->bucketCount; ++i) {
-        Tiny_Value key = *ArrayGet(&d->keys, i);
-        if (!Tiny_IsNull(key)) {
-            Tiny_ProtectFromGC(key);
-            Tiny_ProtectFromGC(*ArrayGet(&d->values, i));
-        }
+    for (int cursor = DictNext(d, 0); cursor; cursor = DictNext(d, cursor)) {
+        const DictSlot *slot = DictAt(d, cursor);
+
+        Tiny_ProtectFromGC(slot->key);
+        Tiny_ProtectFromGC(slot->value);
     }
 }
 
@@ -373,13 +477,30 @@ static void DictFree(Tiny_Context *ctx, void *d) {
     Tiny_AllocUsingContext(*ctx, d, 0);
 }
 
+static size_t DictSize(void *d) {
+    Dict *dict = d;
+
+    return sizeof(Dict) + (sizeof(DictSlot) + 1) * dict->bucketCount + DICT_GROUP_WIDTH;
+}
+
 const Tiny_NativeProp DictProp = {
     "dict",
     DictProtectFromGC,
     DictFree,
+    DictSize,
 };
 
-static Tiny_Value CreateDict(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
+// For dicts whose keys and values are all primitives, so there's nothing to mark (like
+// PackedArrayProp)
+const Tiny_NativeProp PrimitiveDictProp = {
+    "dict",
+    NULL,
+    DictFree,
+    DictSize,
+};
+
+static Tiny_Value CreateDictEx(Tiny_StateThread *thread, const Tiny_Value *args, int count,
+                               bool primitive) {
     Dict *dict = Tiny_AllocUsingContext(thread->ctx, NULL, sizeof(Dict));
 
     InitDict(dict, thread->ctx);
@@ -394,18 +515,30 @@ static Tiny_Value CreateDict(Tiny_StateThread *thread, const Tiny_Value *args, i
 
     for (int i = 0; i < count; i += 2) DictSet(dict, args[i], args[i + 1]);
 
-    return Tiny_NewNative(thread, dict, &DictProp);
+    return Tiny_NewNative(thread, dict, primitive ? &PrimitiveDictProp : &DictProp);
+}
+
+static TINY_FOREIGN_FUNCTION(CreateDict) { return CreateDictEx(thread, args, count, false); }
+
+static TINY_FOREIGN_FUNCTION(CreatePrimitiveDict) {
+    return CreateDictEx(thread, args, count, true);
+}
+
+static Tiny_Value Lib_DictLen(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
+    Dict *dict = Tiny_ToAddr(args[0]);
+
+    return Tiny_NewInt(dict->filledCount);
 }
 
 static Tiny_Value Lib_DictPut(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    Dict *dict = args[0].obj->nat.addr;
+    Dict *dict = Tiny_ToAddr(args[0]);
     DictSet(dict, args[1], args[2]);
 
     return Tiny_Null;
 }
 
 static Tiny_Value Lib_DictExists(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    Dict *dict = args[0].obj->nat.addr;
+    Dict *dict = Tiny_ToAddr(args[0]);
 
     const Tiny_Value *value = DictGet(dict, args[1]);
 
@@ -413,7 +546,7 @@ static Tiny_Value Lib_DictExists(Tiny_StateThread *thread, const Tiny_Value *arg
 }
 
 static Tiny_Value Lib_DictGet(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    Dict *dict = args[0].obj->nat.addr;
+    Dict *dict = Tiny_ToAddr(args[0]);
     const Tiny_Value *value = DictGet(dict, args[1]);
 
     if (value) return *value;
@@ -422,54 +555,102 @@ static Tiny_Value Lib_DictGet(Tiny_StateThread *thread, const Tiny_Value *args,
 }
 
 static Tiny_Value Lib_DictRemove(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    Dict *dict = args[0].obj->nat.addr;
+    Dict *dict = Tiny_ToAddr(args[0]);
     DictRemove(dict, args[1]);
 
     return Tiny_Null;
 }
 
 static Tiny_Value Lib_DictClear(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    DictClear(args[0].obj->nat.addr);
+    DictClear(Tiny_ToAddr(args[0]));
     return Tiny_Null;
 }
 
-static Tiny_Value Lib_DictKeys(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    Dict *dict = args[0].obj->nat.addr;
-
+static Tiny_Value DictToArray(Tiny_StateThread *thread, Dict *dict, bool values) {
     Array *array = Tiny_AllocUsingContext(thread->ctx, NULL, sizeof(Array));
 
     InitArray(array, thread->ctx);
 
-    for (int i = 0; i < dict->bucketCount; ++i) {
-        Tiny_Value key = *ArrayGet(&dict->keys, i);
-
-        if (!Tiny_IsNull(key)) {
-            ArrayPush(array, key);
-        }
+    for (int cursor = DictNext(dict, 0); cursor; cursor = DictNext(dict, cursor)) {
+        const DictSlot *slot = DictAt(dict, cursor);
+        ArrayPush(array, values ? slot->value : slot->key);
     }
 
     return Tiny_NewNative(thread, array, &ArrayProp);
 }
 
-static Tiny_Value Lib_DictValues(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    Dict *dict = args[0].obj->nat.addr;
+// For when the keys/values are primitives, since then the array type they go into is packed
+static Tiny_Value DictToPackedArray(Tiny_StateThread *thread, Dict *dict, PackedArrayType type,
+                                    bool values) {
+    PackedArray *array = Tiny_AllocUsingContext(thread->ctx, NULL, sizeof(PackedArray));
 
-    Array *array = Tiny_AllocUsingContext(thread->ctx, NULL, sizeof(Array));
+    InitPackedArray(array, thread->ctx, type);
 
-    InitArray(array, thread->ctx);
+    for (int cursor = DictNext(dict, 0); cursor; cursor = DictNext(dict, cursor)) {
+        const DictSlot *slot = DictAt(dict, cursor);
+        PackedArrayPush(array, values ? slot->value : slot->key);
+    }
 
-    for (int i = 0; i < dict->bucketCount; ++i) {
-        Tiny_Value key = *ArrayGet(&dict->keys, i);
+    return Tiny_NewNative(thread, array, &PackedArrayProp);
+}
 
-        if (!Tiny_IsNull(key)) {
-            ArrayPush(array, *ArrayGet(&dict->values, i));
-        }
+static TINY_FOREIGN_FUNCTION(Lib_DictKeys) {
+    return DictToArray(thread, Tiny_ToAddr(args[0]), false);
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_DictValues) {
+    return DictToArray(thread, Tiny_ToAddr(args[0]), true);
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_DictIntKeys) {
+    return DictToPackedArray(thread, Tiny_ToAddr(args[0]), PACKED_ARRAY_INT, false);
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_DictIntValues) {
+    return DictToPackedArray(thread, Tiny_ToAddr(args[0]), PACKED_ARRAY_INT, true);
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_DictFloatKeys) {
+    return DictToPackedArray(thread, Tiny_ToAddr(args[0]), PACKED_ARRAY_FLOAT, false);
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_DictFloatValues) {
+    return DictToPackedArray(thread, Tiny_ToAddr(args[0]), PACKED_ARRAY_FLOAT, true);
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_DictBoolKeys) {
+    return DictToPackedArray(thread, Tiny_ToAddr(args[0]), PACKED_ARRAY_BOOL, false);
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_DictBoolValues) {
+    return DictToPackedArray(thread, Tiny_ToAddr(args[0]), PACKED_ARRAY_BOOL, true);
+}
+
+static Tiny_Value Lib_DictIterNext(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
+    Dict *dict = Tiny_ToAddr(args[0]);
+    Tiny_Int cursor = Tiny_ToInt(args[1]);
+
+    if (cursor < 0) {
+        return Tiny_NewInt(0);
     }
 
-    return Tiny_NewNative(thread, array, &ArrayProp);
+    // Anything past the end is handled by DictNext
+    return Tiny_NewInt(DictNext(dict, cursor > INT_MAX ? INT_MAX : (int)cursor));
+}
+
+static Tiny_Value Lib_DictIterKey(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
+    const DictSlot *slot = DictAt(Tiny_ToAddr(args[0]), (int)Tiny_ToInt(args[1]));
+
+    return slot ? slot->key : Tiny_Null;
+}
+
+static Tiny_Value Lib_DictIterValue(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
+    const DictSlot *slot = DictAt(Tiny_ToAddr(args[0]), (int)Tiny_ToInt(args[1]));
+
+    return slot ? slot->value : Tiny_Null;
 }
 
-static Tiny_Value Strcat(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
+Tiny_Value Tiny_StdStrcat(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
     size_t totalLen = 0;
 
     for (int i = 0; i < count; ++i) {
@@ -480,8 +661,12 @@ static Tiny_Value Strcat(Tiny_StateThread *thread, const Tiny_Value *args, int c
     char *ptr = newString;
 
     for (int i = 0; i < count; ++i) {
-        size_t len = Tiny_StringLen(args[i]);
-        memcpy(ptr, Tiny_ToString(args[i]), len);
+        char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+        size_t len;
+
+        const char *str = Tiny_ToStringChars(args[i], smallBuf, &len);
+
+        memcpy(ptr, str, len);
 
         ptr += len;
     }
@@ -494,7 +679,6 @@ static Tiny_Value Strcat(Tiny_StateThread *thread, const Tiny_Value *args, int c
 static Tiny_Value Lib_Substr(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
     assert(count == 3);
 
-    const char *s = Tiny_ToString(args[0]);
     size_t sLen = Tiny_StringLen(args[0]);
 
     Tiny_Int start = Tiny_ToInt(args[1]);
@@ -512,27 +696,30 @@ static Tiny_Value Lib_Substr(Tiny_StateThread *thread, const Tiny_Value *args, i
 
     assert(end <= sLen);
 
-    char *sub = Tiny_AllocUsingContext(thread->ctx, NULL, end - start + 1);
-    for (int i = start; i < end; ++i) {
-        sub[i - start] = s[i];
-    }
-    sub[end - start] = '\0';
+    // This doesn't copy the characters, see Tiny_NewStringSlice
+    return Tiny_NewStringSlice(thread, args[0], (size_t)start, (size_t)(end - start));
+}
 
-    // TODO(Apaar): Figure out if there's a way we can just not allocate for this
-    // TODO(Apaar): If strings are immutable and refcounted, we could just point
-    // to the same string if we had some kind of "slice" primitive.
-    return Tiny_NewString(thread, sub, (size_t)(end - start));
+// Slices keep the string they were sliced from alive, so if you only need a small piece of a big
+// string for a long time, it's better to copy it
+static TINY_FOREIGN_FUNCTION(Lib_StrCopy) {
+    char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+    size_t len;
+
+    const char *str = Tiny_ToStringChars(args[0], smallBuf, &len);
+
+    return Tiny_NewStringCopy(thread, str, len);
 }
 
 static Tiny_Value Lib_Ston(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    const char *str = Tiny_ToString(args[0]);
+    const char *str = Tiny_ToCString(thread, args[0]);
     float value = strtof(str, NULL);
 
     return Tiny_NewFloat(value);
 }
 
 static Tiny_Value Lib_Stoi(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    const char *str = Tiny_ToString(args[0]);
+    const char *str = Tiny_ToCString(thread, args[0]);
     Tiny_Int base = count > 1 ? Tiny_ToInt(args[1]) : 10;
 
     Tiny_Int value = (Tiny_Int)strtoll(str, NULL, base);
@@ -574,7 +761,14 @@ static Tiny_Value Rand(Tiny_StateThread *thread, const Tiny_Value *args, int cou
 }
 
 static Tiny_Value Lib_Input(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    if (count >= 1) printf("%s", Tiny_ToString(args[0]));
+    if (count >= 1) {
+        char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+        size_t len;
+
+        const char *prompt = Tiny_ToStringChars(args[0], smallBuf, &len);
+
+        printf("%.*s", (int)len, prompt);
+    }
 
     char *buffer = Tiny_AllocUsingContext(thread->ctx, NULL, 8);
     size_t bufferLength = 0;
@@ -602,81 +796,218 @@ static Tiny_Value Lib_Input(Tiny_StateThread *thread, const Tiny_Value *args, in
     return Tiny_NewString(thread, buffer, bufferLength);
 }
 
-static void Print(Tiny_Value val, bool repr) {
-    switch (val.type) {
+// A growable string buffer. There's always room for a null terminator after `len` so that the
+// buffer can be handed over to a Tiny string without copying it.
+typedef struct StrBuf {
+    Tiny_Context ctx;
+
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+static void InitStrBuf(StrBuf *sb, Tiny_Context ctx) {
+    sb->ctx = ctx;
+    sb->data = NULL;
+    sb->len = 0;
+    sb->cap = 0;
+}
+
+static void DestroyStrBuf(StrBuf *sb) {
+    Tiny_AllocUsingContext(sb->ctx, sb->data, 0);
+
+    sb->data = NULL;
+    sb->len = 0;
+    sb->cap = 0;
+}
+
+static void StrBufReserve(StrBuf *sb, size_t extra) {
+    size_t needed = sb->len + extra + 1;
+
+    if (needed <= sb->cap) {
+        return;
+    }
+
+    size_t newCap = sb->cap > 0 ? sb->cap * 2 : 32;
+
+    while (newCap < needed) {
+        newCap *= 2;
+    }
+
+    sb->data = Tiny_AllocUsingContext(sb->ctx, sb->data, newCap);
+    sb->cap = newCap;
+}
+
+static void StrBufAppend(StrBuf *sb, const char *s, size_t len) {
+    StrBufReserve(sb, len);
+
+    memcpy(sb->data + sb->len, s, len);
+    sb->len += len;
+}
+
+static void StrBufAppendChar(StrBuf *sb, char c) {
+    StrBufReserve(sb, 1);
+
+    sb->data[sb->len++] = c;
+}
+
+static void StrBufAppendv(StrBuf *sb, const char *fmt, va_list args) {
+    va_list argsCopy;
+
+    // Try formatting into whatever room is left first; that's enough most of the time
+    StrBufReserve(sb, 0);
+
+    va_copy(argsCopy, args);
+    int len = vsnprintf(sb->data + sb->len, sb->cap - sb->len, fmt, argsCopy);
+    va_end(argsCopy);
+
+    assert(len >= 0);
+
+    if (sb->len + len >= sb->cap) {
+        StrBufReserve(sb, len);
+        vsnprintf(sb->data + sb->len, sb->cap - sb->len, fmt, args);
+    }
+
+    sb->len += len;
+}
+
+static void StrBufAppendf(StrBuf *sb, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    StrBufAppendv(sb, fmt, args);
+    va_end(args);
+}
+
+// Hands the buffer over to a new string and leaves `sb` empty
+static Tiny_Value StrBufToString(Tiny_StateThread *thread, StrBuf *sb) {
+    if (sb->len == 0) {
+        DestroyStrBuf(sb);
+        return Tiny_NewConstString("");
+    }
+
+    sb->data[sb->len] = '\0';
+
+    Tiny_Value value = Tiny_NewString(thread, sb->data, sb->len);
+
+    sb->data = NULL;
+    sb->len = 0;
+    sb->cap = 0;
+
+    return value;
+}
+
+// Everything below writes to `out` or to stdout if `out` is NULL
+static void Emit(StrBuf *out, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+
+    if (out) {
+        StrBufAppendv(out, fmt, args);
+    } else {
+        vprintf(fmt, args);
+    }
+
+    va_end(args);
+}
+
+static void EmitChar(StrBuf *out, char c) {
+    if (out) {
+        StrBufAppendChar(out, c);
+    } else {
+        putc(c, stdout);
+    }
+}
+
+static void Print(StrBuf *out, Tiny_Value val, bool repr) {
+    switch (Tiny_GetType(val)) {
         case TINY_VAL_NULL:
-            printf("<null>");
+            Emit(out, "<null>");
             break;
         case TINY_VAL_BOOL:
-            printf("%s", val.boolean ? "true" : "false");
+            Emit(out, "%s", Tiny_AsBool(val) ? "true" : "false");
             break;
         case TINY_VAL_INT:
-            printf("%lld", (int64_t)val.i);
+            Emit(out, "%lld", (int64_t)Tiny_AsInt(val));
             break;
         case TINY_VAL_FLOAT:
-            printf("%f", val.f);
+            Emit(out, "%f", Tiny_AsFloat(val));
             break;
         case TINY_VAL_CONST_STRING:
             if (repr) {
-                printf("\"%s\"", val.cstr);
+                Emit(out, "\"%s\"", Tiny_AsConstString(val));
             } else {
-                printf("%s", val.cstr);
+                Emit(out, "%s", Tiny_AsConstString(val));
             }
             break;
         case TINY_VAL_STRING:
+        case TINY_VAL_SMALL_STRING: {
+            char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+            size_t len;
+
+            const char *str = Tiny_ToStringChars(val, smallBuf, &len);
+
             if (repr) {
-                printf("\"%.*s\"", (int)val.obj->string.len, val.obj->string.ptr);
+                Emit(out, "\"%.*s\"", (int)len, str);
             } else {
-                printf("%.*s", (int)val.obj->string.len, val.obj->string.ptr);
+                Emit(out, "%.*s", (int)len, str);
             }
-            break;
+        } break;
         case TINY_VAL_LIGHT_NATIVE:
-            printf("<light native at %p>", val.addr);
+            Emit(out, "<light native at %p>", Tiny_AsLightNative(val));
             break;
         case TINY_VAL_NATIVE: {
-            if (repr &&
-                (val.obj->nat.prop == &ArrayProp || val.obj->nat.prop == &PrimitiveArrayProp)) {
-                printf("[");
+            const Tiny_NativeProp *prop = Tiny_GetProp(val);
+
+            if (repr && (prop == &ArrayProp || prop == &PackedArrayProp)) {
+                Emit(out, "[");
+
+                bool packed = prop == &PackedArrayProp;
+                void *array = Tiny_ToAddr(val);
 
-                Array *array = val.obj->nat.addr;
+                int len = packed ? PackedArrayLen(array) : ArrayLen(array);
 
                 bool first = true;
 
-                for (int i = 0; i < ArrayLen(array); ++i) {
+                for (int i = 0; i < len; ++i) {
                     if (!first) {
-                        printf(", ");
+                        Emit(out, ", ");
                     }
                     first = false;
 
-                    Tiny_Value value = *ArrayGet(array, i);
+                    Tiny_Value value = packed ? PackedArrayGet(array, i) : *ArrayGet(array, i);
 
-                    Print(value, true);
+                    Print(out, value, true);
                 }
 
-                printf("]");
-            } else if (val.obj->nat.prop && val.obj->nat.prop->name)
-                printf("<native '%s' at %p>", val.obj->nat.prop->name, val.obj->nat.addr);
+                Emit(out, "]");
+            } else if (prop && prop->name)
+                Emit(out, "<native '%s' at %p>", prop->name, Tiny_ToAddr(val));
             else
-                printf("<native at %p>", val.obj->nat.addr);
+                Emit(out, "<native at %p>", Tiny_ToAddr(val));
         } break;
         case TINY_VAL_STRUCT: {
-            printf("struct {");
+            Emit(out, "struct {");
 
-            for (int i = 0; i < val.obj->ostruct.n; ++i) {
+            Tiny_Object *obj = Tiny_AsObject(val);
+
+            for (int i = 0; i < obj->ostruct.n; ++i) {
                 if (i > 0) {
-                    printf(", ");
+                    Emit(out, ", ");
                 }
 
-                Print(val.obj->ostruct.fields[i], true);
+                Print(out, obj->ostruct.fields[i], true);
             }
 
-            putc('}', stdout);
+            EmitChar(out, '}');
         } break;
     }
 }
 
-static Tiny_Value Lib_Printf(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    const char *fmt = Tiny_ToString(args[0]);
+// args[0] is the format string, the rest are the values it refers to
+static void Format(Tiny_StateThread *thread, StrBuf *out, const Tiny_Value *args, int count) {
+    const char *fmt = Tiny_ToCString(thread, args[0]);
 
     int arg = 1;
 
@@ -690,36 +1021,142 @@ static Tiny_Value Lib_Printf(Tiny_StateThread *thread, const Tiny_Value *args, i
             ++fmt;
             switch (*fmt) {
                 case 'i':
-                    printf("%lld", (int64_t)args[arg].i);
+                    Emit(out, "%lld", (int64_t)Tiny_AsInt(args[arg]));
                     break;
                 case 'f':
-                    printf("%f", args[arg].f);
-                    break;
-                case 's':
-                    printf("%.*s", (int)Tiny_StringLen(args[arg]), Tiny_ToString(args[arg]));
+                    Emit(out, "%f", Tiny_AsFloat(args[arg]));
                     break;
+                case 's': {
+                    char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+                    size_t len;
+
+                    const char *str = Tiny_ToStringChars(args[arg], smallBuf, &len);
+
+                    Emit(out, "%.*s", (int)len, str);
+                } break;
                 case 'c':
-                    printf("%c", (char)args[arg].i);
+                    EmitChar(out, (char)Tiny_AsInt(args[arg]));
                     break;
 
                 case 'q':
-                    Print(args[arg], true);
+                    Print(out, args[arg], true);
                     break;
                 case '%':
-                    putc('%', stdout);
+                    EmitChar(out, '%');
 
                 default:
-                    printf("\nInvalid format specifier '%c'\n", *fmt);
+                    Emit(out, "\nInvalid format specifier '%c'\n", *fmt);
             }
             ++fmt;
             ++arg;
         } else
-            putc(*fmt++, stdout);
+            EmitChar(out, *fmt++);
     }
+}
+
+static Tiny_Value Lib_Printf(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
+    Format(thread, NULL, args, count);
 
     return Tiny_Null;
 }
 
+static void StrBufFree(Tiny_Context *ctx, void *ptr) {
+    StrBuf *sb = ptr;
+
+    DestroyStrBuf(sb);
+    Tiny_AllocUsingContext(*ctx, sb, 0);
+}
+
+static size_t StrBufSize(void *ptr) {
+    StrBuf *sb = ptr;
+
+    return sizeof(StrBuf) + sb->cap;
+}
+
+static const Tiny_NativeProp StrBufProp = {
+    "strbuf",
+    NULL,
+    StrBufFree,
+    StrBufSize,
+};
+
+static TINY_FOREIGN_FUNCTION(Lib_StrBuf) {
+    StrBuf *sb = Tiny_AllocUsingContext(thread->ctx, NULL, sizeof(StrBuf));
+
+    InitStrBuf(sb, thread->ctx);
+
+    if (count > 0) {
+        Tiny_Int cap = Tiny_ToInt(args[0]);
+
+        assert(cap >= 0);
+
+        StrBufReserve(sb, (size_t)cap);
+    }
+
+    return Tiny_NewNative(thread, sb, &StrBufProp);
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_StrBufAppendStr) {
+    StrBuf *sb = Tiny_ToAddr(args[0]);
+
+    for (int i = 1; i < count; ++i) {
+        char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+        size_t len;
+
+        const char *str = Tiny_ToStringChars(args[i], smallBuf, &len);
+
+        StrBufAppend(sb, str, len);
+    }
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_StrBufAppendInt) {
+    StrBufAppendf(Tiny_ToAddr(args[0]), "%lld", (int64_t)Tiny_ToInt(args[1]));
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_StrBufAppendFloat) {
+    // Same formatting as ntos
+    StrBufAppendf(Tiny_ToAddr(args[0]), "%g", Tiny_ToFloat(args[1]));
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_StrBufAppendChar) {
+    StrBufAppendChar(Tiny_ToAddr(args[0]), (char)Tiny_ToInt(args[1]));
+
+    return Tiny_Null;
+}
+
+// Same format specifiers as printf
+static TINY_FOREIGN_FUNCTION(Lib_StrBufAppendf) {
+    Format(thread, Tiny_ToAddr(args[0]), args + 1, count - 1);
+
+    return Tiny_Null;
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_StrBufLen) {
+    StrBuf *sb = Tiny_ToAddr(args[0]);
+
+    return Tiny_NewInt((Tiny_Int)sb->len);
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_StrBufClear) {
+    StrBuf *sb = Tiny_ToAddr(args[0]);
+
+    // Keep the memory around since the buffer is likely going to be filled up again
+    sb->len = 0;
+
+    return Tiny_Null;
+}
+
+// This doesn't copy; the string takes the buffer and the strbuf is left empty
+static TINY_FOREIGN_FUNCTION(Lib_StrBufToStr) {
+    return StrBufToString(thread, Tiny_ToAddr(args[0]));
+}
+
 static Tiny_Value Exit(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
     Tiny_Int arg = Tiny_ToInt(args[0]);
 
@@ -808,37 +1245,51 @@ static Tiny_MacroResult BindJsonSerializerForType(Tiny_State *state, const Tiny_
         return (Tiny_MacroResult){.type = TINY_MACRO_SUCCESS};
     }
 
-    // Hopefully enough lol?
-    char buf[2048] = {0};
-    int used = 0;
+    char name[256] = {0};
 
-    snprintf(buf, sizeof(buf), "%s_to_json", sym->name);
+    snprintf(name, sizeof(name), "%s_to_json", sym->name);
 
-    if (Tiny_FindFuncSymbol(state, buf)) {
+    if (Tiny_FindFuncSymbol(state, name)) {
         // Already bound, don't bother
         return (Tiny_MacroResult){.type = TINY_MACRO_SUCCESS};
     }
 
-    used +=
-        snprintf(buf, sizeof(buf), "func %s_to_json(v: %s): str {\n\treturn strcat(\"{\",\n\t\t",
-                 sym->name, sym->name);
+    // Every struct gets a %s_write_json which appends to a strbuf so that nested structs are
+    // serialized into the same buffer instead of being concatenated together at every level.
+    StrBuf code;
+    InitStrBuf(&code, state->ctx);
 
-    for (int i = 0; i < Tiny_SymbolArrayCount(sym->sstruct.fields); ++i) {
-        if (i > 0) {
-            used += snprintf(buf + used, sizeof(buf) - used, ", \",\",\n\t\t");
-        }
+    StrBufAppendf(&code, "func %s_write_json(b: strbuf, v: %s) {\n", sym->name, sym->name);
 
+    for (int i = 0; i < Tiny_SymbolArrayCount(sym->sstruct.fields); ++i) {
         const Tiny_Symbol *fieldSym = sym->sstruct.fields[i];
+        const Tiny_Symbol *fieldTag = fieldSym->fieldTag;
 
-        BindJsonSerializerForType(state, fieldSym->fieldTag);
+        BindJsonSerializerForType(state, fieldTag);
 
-        used += snprintf(buf + used, sizeof(buf) - used, "\"\\\"%s\\\":\", %s_to_json(v.%s)",
-                         fieldSym->name, fieldSym->fieldTag->name, fieldSym->name);
+        StrBufAppendf(&code, "\tstrbuf_append_str(b, \"%s\\\"%s\\\":\")\n", i > 0 ? "," : "{",
+                      fieldSym->name);
+
+        if (fieldTag->type == TINY_SYM_TAG_FOREIGN) {
+            // These only have a %s_to_json (see above)
+            StrBufAppendf(&code, "\tstrbuf_append_str(b, %s_to_json(v.%s))\n", fieldTag->name,
+                          fieldSym->name);
+        } else {
+            StrBufAppendf(&code, "\t%s_write_json(b, v.%s)\n", fieldTag->name, fieldSym->name);
+        }
     }
 
-    used += snprintf(buf + used, sizeof(buf) - used, ",\n\t\"}\")\n}");
+    StrBufAppendf(&code, "\tstrbuf_append_str(b, \"%s\")\n}\n",
+                  Tiny_SymbolArrayCount(sym->sstruct.fields) > 0 ? "}" : "{}");
+
+    StrBufAppendf(&code,
+                  "func %s_to_json(v: %s): str {\n\tb := strbuf()\n\t%s_write_json(b, v)\n"
+                  "\treturn strbuf_to_str(b)\n}\n",
+                  sym->name, sym->name, sym->name);
+
+    Tiny_CompileResult compileResult = Tiny_CompileString(state, "(json mod)", code.data);
 
-    Tiny_CompileResult compileResult = Tiny_CompileString(state, "(json mod)", buf);
+    DestroyStrBuf(&code);
 
     if (compileResult.type != TINY_COMPILE_SUCCESS) {
         Tiny_MacroResult macroResult = {.type = TINY_MACRO_ERROR};
@@ -872,6 +1323,25 @@ static TINY_MACRO_FUNCTION(JsonMacroFunction) {
     return BindJsonSerializerForType(state, sym);
 }
 
+static bool IsPrimitiveType(const Tiny_Symbol *type) {
+    return type->type == TINY_SYM_TAG_BOOL || type->type == TINY_SYM_TAG_INT ||
+           type->type == TINY_SYM_TAG_FLOAT;
+}
+
+// Arrays of primitives are packed (see PackedArray) so they get a different constructor
+static Tiny_ForeignFunction GetArrayConstructor(const Tiny_Symbol *elemType) {
+    switch (elemType->type) {
+        case TINY_SYM_TAG_BOOL:
+            return CreateBoolArray;
+        case TINY_SYM_TAG_INT:
+            return CreateIntArray;
+        case TINY_SYM_TAG_FLOAT:
+            return CreateFloatArray;
+        default:
+            return CreateArray;
+    }
+}
+
 static TINY_MACRO_FUNCTION(ArrayMacroFunction) {
     if (nargs != 1) {
         return (Tiny_MacroResult){
@@ -905,100 +1375,197 @@ static TINY_MACRO_FUNCTION(ArrayMacroFunction) {
 
     char sigbuf[512] = {0};
 
-    bool primitive = elemType->type == TINY_SYM_TAG_BOOL || elemType->type == TINY_SYM_TAG_INT ||
-                     elemType->type == TINY_SYM_TAG_FLOAT;
+    // Elements are boxed/unboxed by the packed functions as they're passed in/out
+    bool packed = IsPrimitiveType(elemType);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s(...): %s", asName, asName);
-    Tiny_BindFunction(state, sigbuf, primitive ? CreatePrimitiveArray : CreateArray);
+    Tiny_BindFunction(state, sigbuf, GetArrayConstructor(elemType));
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_clear(%s): void", asName, asName);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayClear);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayClear : Lib_ArrayClear);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_resize(%s, int): void", asName, asName);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayResize);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayResize : Lib_ArrayResize);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_resize_fill(%s, int, %s): void", asName, asName, args[0]);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayResizeFill);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayResizeFill : Lib_ArrayResizeFill);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_fill(%s, %s): void", asName, asName, args[0]);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayFill);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayFill : Lib_ArrayFill);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_get(%s, int): %s", asName, asName, args[0]);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayGet);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayGet : Lib_ArrayGet);
 
     // Conform to the array index syntax
     snprintf(sigbuf, sizeof(sigbuf), "%s_get_index(%s, int): %s", asName, asName, args[0]);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayGet);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayGet : Lib_ArrayGet);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_set(%s, int, %s): void", asName, asName, args[0]);
-    Tiny_BindFunction(state, sigbuf, Lib_ArraySet);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArraySet : Lib_ArraySet);
 
     // Conform to the array index syntax
     snprintf(sigbuf, sizeof(sigbuf), "%s_set_index(%s, int, %s): void", asName, asName, args[0]);
-    Tiny_BindFunction(state, sigbuf, Lib_ArraySet);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArraySet : Lib_ArraySet);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_len(%s): int", asName, asName);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayLen);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayLen : Lib_ArrayLen);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_push(%s, %s): void", asName, asName, args[0]);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayPush);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayPush : Lib_ArrayPush);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_copy(%s, %s): void", asName, asName, asName);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayCopy);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayCopy : Lib_ArrayCopy);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_pop(%s): %s", asName, asName, args[0]);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayPop);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayPop : Lib_ArrayPop);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_shift(%s): %s", asName, asName, args[0]);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayShift);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayShift : Lib_ArrayShift);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_remove(%s, int): void", asName, asName);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayRemove);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayRemove : Lib_ArrayRemove);
 
     snprintf(sigbuf, sizeof(sigbuf), "%s_insert(%s, int, %s): void", asName, asName, args[0]);
-    Tiny_BindFunction(state, sigbuf, Lib_ArrayInsert);
+    Tiny_BindFunction(state, sigbuf, packed ? Lib_PackedArrayInsert : Lib_ArrayInsert);
 
     if (elemType->type == TINY_SYM_TAG_INT) {
         // TODO(Apaar): Add functions to sort other types
         snprintf(sigbuf, sizeof(sigbuf), "%s_sort(%s): void", asName, asName);
-        Tiny_BindFunction(state, sigbuf, Lib_ArraySortInt);
+        Tiny_BindFunction(state, sigbuf, Lib_PackedArraySortInt);
     }
 
     return (Tiny_MacroResult){.type = TINY_MACRO_SUCCESS};
 }
 
-void Tiny_BindStandardArray(Tiny_State *state) {
-    Tiny_BindMacro(state, "array", ArrayMacroFunction);
+// The array_%s types for primitives are packed, so the keys/values have to be put into one of those
+static Tiny_ForeignFunction GetDictToArrayFunction(const Tiny_Symbol *type, bool values) {
+    switch (type->type) {
+        case TINY_SYM_TAG_BOOL:
+            return values ? Lib_DictBoolValues : Lib_DictBoolKeys;
+        case TINY_SYM_TAG_INT:
+            return values ? Lib_DictIntValues : Lib_DictIntKeys;
+        case TINY_SYM_TAG_FLOAT:
+            return values ? Lib_DictFloatValues : Lib_DictFloatKeys;
+        default:
+            return values ? Lib_DictValues : Lib_DictKeys;
+    }
 }
 
-void Tiny_BindStandardDict(Tiny_State *state) {
-    ArrayMacroFunction(state, (char *const[]){"any"}, 1, "array_any");
-    ArrayMacroFunction(state, (char *const[]){"str"}, 1, "array_str");
+static TINY_MACRO_FUNCTION(DictMacroFunction) {
+    if (nargs != 2) {
+        return (Tiny_MacroResult){
+            .type = TINY_MACRO_ERROR,
+            .error.msg = "Must specify exactly 2 arguments (key and value type) to 'use dict'",
+        };
+    }
 
-    Tiny_RegisterType(state, "dict");
+    if (!asName) {
+        return (Tiny_MacroResult){
+            .type = TINY_MACRO_ERROR,
+            .error.msg = "Must specify an 'as' name when doing 'use dict'",
+        };
+    }
+
+    const Tiny_Symbol *alreadyExists = Tiny_FindTypeSymbol(state, asName);
+    if (alreadyExists) {
+        return (Tiny_MacroResult){.type = TINY_MACRO_SUCCESS};
+    }
+
+    const Tiny_Symbol *keyType = Tiny_FindTypeSymbol(state, args[0]);
+
+    if (!keyType) {
+        return (Tiny_MacroResult){
+            .type = TINY_MACRO_ERROR,
+            .error.msg = "The dict key type you specified does not exist",
+        };
+    }
 
-    Tiny_BindFunction(state, "dict(...): dict", CreateDict);
-    Tiny_BindFunction(state, "dict_put(dict, any, any): void", Lib_DictPut);
-    Tiny_BindFunction(state, "dict_exists(dict, any): bool", Lib_DictExists);
-    Tiny_BindFunction(state, "dict_get(dict, any): any", Lib_DictGet);
-    Tiny_BindFunction(state, "dict_remove(dict, any): void", Lib_DictRemove);
-    Tiny_BindFunction(state, "dict_keys(dict): array_any", Lib_DictKeys);
-    Tiny_BindFunction(state, "dict_values(dict): array_any", Lib_DictValues);
-    Tiny_BindFunction(state, "dict_clear(dict): void", Lib_DictClear);
+    const Tiny_Symbol *valueType = Tiny_FindTypeSymbol(state, args[1]);
 
-    // Conform to index protocol
-    Tiny_BindFunction(state, "dict_get_index(dict, str): any", Lib_DictGet);
-    Tiny_BindFunction(state, "dict_set_index(dict, str, any): void", Lib_DictPut);
+    if (!valueType) {
+        return (Tiny_MacroResult){
+            .type = TINY_MACRO_ERROR,
+            .error.msg = "The dict value type you specified does not exist",
+        };
+    }
+
+    // The keys and values functions return arrays of the key and value types
+    char keysName[256] = {0};
+    char valuesName[256] = {0};
+
+    snprintf(keysName, sizeof(keysName), "array_%s", args[0]);
+    snprintf(valuesName, sizeof(valuesName), "array_%s", args[1]);
+
+    ArrayMacroFunction(state, &args[0], 1, keysName);
+    ArrayMacroFunction(state, &args[1], 1, valuesName);
+
+    Tiny_RegisterType(state, asName);
+
+    char sigbuf[512] = {0};
+
+    // Only ever holds values that don't need to be marked
+    bool primitive = IsPrimitiveType(keyType) && IsPrimitiveType(valueType);
+
+    snprintf(sigbuf, sizeof(sigbuf), "%s(...): %s", asName, asName);
+    Tiny_BindFunction(state, sigbuf, primitive ? CreatePrimitiveDict : CreateDict);
+
+    snprintf(sigbuf, sizeof(sigbuf), "%s_put(%s, %s, %s): void", asName, asName, args[0],
+             args[1]);
+    Tiny_BindFunction(state, sigbuf, Lib_DictPut);
+
+    snprintf(sigbuf, sizeof(sigbuf), "%s_exists(%s, %s): bool", asName, asName, args[0]);
+    Tiny_BindFunction(state, sigbuf, Lib_DictExists);
+
+    snprintf(sigbuf, sizeof(sigbuf), "%s_get(%s, %s): %s", asName, asName, args[0], args[1]);
+    Tiny_BindFunction(state, sigbuf, Lib_DictGet);
+
+    snprintf(sigbuf, sizeof(sigbuf), "%s_remove(%s, %s): void", asName, asName, args[0]);
+    Tiny_BindFunction(state, sigbuf, Lib_DictRemove);
+
+    snprintf(sigbuf, sizeof(sigbuf), "%s_clear(%s): void", asName, asName);
+    Tiny_BindFunction(state, sigbuf, Lib_DictClear);
+
+    snprintf(sigbuf, sizeof(sigbuf), "%s_len(%s): int", asName, asName);
+    Tiny_BindFunction(state, sigbuf, Lib_DictLen);
 
-    Tiny_RegisterType(state, "dict_str_int");
+    snprintf(sigbuf, sizeof(sigbuf), "%s_keys(%s): %s", asName, asName, keysName);
+    Tiny_BindFunction(state, sigbuf, GetDictToArrayFunction(keyType, false));
 
-    Tiny_BindFunction(state, "dict_str_int(...): dict_str_int", CreateDict);
-    Tiny_BindFunction(state, "dict_str_int_put(dict_str_int, str, int): void", Lib_DictPut);
-    Tiny_BindFunction(state, "dict_str_int_exists(dict_str_int, str): bool", Lib_DictExists);
-    Tiny_BindFunction(state, "dict_str_int_get(dict_str_int, str): int", Lib_DictGet);
-    Tiny_BindFunction(state, "dict_str_int_remove(dict_str_int, str): void", Lib_DictRemove);
-    Tiny_BindFunction(state, "dict_str_int_keys(dict_str_int): array_str", Lib_DictKeys);
-    Tiny_BindFunction(state, "dict_str_int_clear(dict_str_int): void", Lib_DictClear);
+    snprintf(sigbuf, sizeof(sigbuf), "%s_values(%s): %s", asName, asName, valuesName);
+    Tiny_BindFunction(state, sigbuf, GetDictToArrayFunction(valueType, true));
+
+    // Conform to the index syntax
+    snprintf(sigbuf, sizeof(sigbuf), "%s_get_index(%s, %s): %s", asName, asName, args[0],
+             args[1]);
+    Tiny_BindFunction(state, sigbuf, Lib_DictGet);
+
+    // Conform to the index syntax
+    snprintf(sigbuf, sizeof(sigbuf), "%s_set_index(%s, %s, %s): void", asName, asName, args[0],
+             args[1]);
+    Tiny_BindFunction(state, sigbuf, Lib_DictPut);
+
+    // Lets you `foreach k, v in d`, see DictNext for how the cursor works
+    snprintf(sigbuf, sizeof(sigbuf), "%s_iter_next(%s, int): int", asName, asName);
+    Tiny_BindFunction(state, sigbuf, Lib_DictIterNext);
+
+    snprintf(sigbuf, sizeof(sigbuf), "%s_iter_key(%s, int): %s", asName, asName, args[0]);
+    Tiny_BindFunction(state, sigbuf, Lib_DictIterKey);
+
+    snprintf(sigbuf, sizeof(sigbuf), "%s_iter_value(%s, int): %s", asName, asName, args[1]);
+    Tiny_BindFunction(state, sigbuf, Lib_DictIterValue);
+
+    return (Tiny_MacroResult){.type = TINY_MACRO_SUCCESS};
+}
+
+void Tiny_BindStandardArray(Tiny_State *state) {
+    Tiny_BindMacro(state, "array", ArrayMacroFunction);
+}
+
+void Tiny_BindStandardDict(Tiny_State *state) {
+    Tiny_BindMacro(state, "dict", DictMacroFunction);
+
+    DictMacroFunction(state, (char *const[]){"any", "any"}, 2, "dict");
+    DictMacroFunction(state, (char *const[]){"str", "int"}, 2, "dict_str_int");
 }
 
 void Tiny_BindStandardIO(Tiny_State *state) {
@@ -1027,32 +1594,58 @@ void Tiny_BindI64(Tiny_State *state) {
     Tiny_BindFunction(state, "i64_to_string(i64): str", Lib_I64ToString);
 }
 
-static TINY_FOREIGN_FUNCTION(Lib_PrimitiveToJson) {
-    assert(count == 1);
-
-    switch (args[0].type) {
-        case TINY_VAL_NULL:
-            return Tiny_NewConstString("null");
+static void WritePrimitiveJson(StrBuf *sb, Tiny_Value value) {
+    switch (Tiny_GetType(value)) {
         case TINY_VAL_BOOL:
-            return Tiny_NewConstString(args[0].boolean ? "true" : "false");
-        case TINY_VAL_FLOAT:
+            StrBufAppendf(sb, "%s", Tiny_AsBool(value) ? "true" : "false");
+            break;
         case TINY_VAL_INT:
-            return Lib_Ntos(thread, args, count);
+            StrBufAppendf(sb, "%lld", (int64_t)Tiny_AsInt(value));
+            break;
+        case TINY_VAL_FLOAT:
+            // Same formatting as ntos
+            StrBufAppendf(sb, "%g", Tiny_AsFloat(value));
+            break;
         case TINY_VAL_CONST_STRING:
-        case TINY_VAL_STRING: {
-            // TODO(Apaar): Escape args[0] string
-            Tiny_Value forwardArgs[] = {Tiny_NewConstString("\""), args[0],
-                                        Tiny_NewConstString("\"")};
+        case TINY_VAL_STRING:
+        case TINY_VAL_SMALL_STRING: {
+            char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+            size_t len;
 
-            return Strcat(thread, forwardArgs, sizeof(forwardArgs));
+            const char *str = Tiny_ToStringChars(value, smallBuf, &len);
+
+            // TODO(Apaar): Escape string
+            StrBufAppendChar(sb, '"');
+            StrBufAppend(sb, str, len);
+            StrBufAppendChar(sb, '"');
         } break;
 
         default:
             // TODO(Apaar): Panic in this scenario
-            return Tiny_NewConstString("null");
+            StrBufAppendf(sb, "null");
+            break;
     }
 }
 
+static TINY_FOREIGN_FUNCTION(Lib_PrimitiveToJson) {
+    assert(count == 1);
+
+    StrBuf sb;
+    InitStrBuf(&sb, thread->ctx);
+
+    WritePrimitiveJson(&sb, args[0]);
+
+    return StrBufToString(thread, &sb);
+}
+
+static TINY_FOREIGN_FUNCTION(Lib_PrimitiveWriteJson) {
+    assert(count == 2);
+
+    WritePrimitiveJson(Tiny_ToAddr(args[0]), args[1]);
+
+    return Tiny_Null;
+}
+
 static TINY_MACRO_FUNCTION(DelegateMacroFunction) {
     if (nargs != 1) {
         return (Tiny_MacroResult){
@@ -1138,7 +1731,7 @@ static TINY_MACRO_FUNCTION(DelegateMacroFunction) {
 static TINY_FOREIGN_FUNCTION(GetFunctionIndex) {
     assert(count == 1);
 
-    int i = Tiny_GetFunctionIndex(thread->state, Tiny_ToString(args[0]));
+    int i = Tiny_GetFunctionIndex(thread->state, Tiny_ToCString(thread, args[0]));
     return Tiny_NewInt(i);
 }
 
@@ -1218,7 +1811,7 @@ static TINY_FOREIGN_FUNCTION(DebugBreak) {
                     break;
                 }
 
-                Print(thread->stack[pos], true);
+                Print(NULL, thread->stack[pos], true);
                 putchar('\n');
             }
         } else if (strcmp(cmd, "dumpfunc\n") == 0 || strcmp(cmd, "df\n") == 0) {
@@ -1242,7 +1835,7 @@ static TINY_FOREIGN_FUNCTION(DebugBreak) {
                 assert(sym->type == TINY_SYM_LOCAL);
 
                 printf("%s=", sym->name);
-                Print(thread->stack[thread->fp + sym->var.index], true);
+                Print(NULL, thread->stack[thread->fp + sym->var.index], true);
                 putchar('\n');
             }
 
@@ -1252,7 +1845,7 @@ static TINY_FOREIGN_FUNCTION(DebugBreak) {
                 assert(sym->type == TINY_SYM_LOCAL);
 
                 printf("\t%s=", sym->name);
-                Print(thread->stack[thread->fp + sym->var.index], true);
+                Print(NULL, thread->stack[thread->fp + sym->var.index], true);
                 putchar('\n');
             }
         } else if (strcmp(cmd, "s\n") == 0) {
@@ -1274,15 +1867,32 @@ static TINY_FOREIGN_FUNCTION(DebugBreak) {
 }
 
 void Tiny_BindStandardLib(Tiny_State *state) {
+#ifdef TINY_VALUE_NANBOX
+    Tiny_BindConstInt(state, "INT_MAX", TINY_NANBOX_INT_MAX);
+#else
     Tiny_BindConstInt(state, "INT_MAX", INT64_MAX);
+#endif
 
     Tiny_BindFunction(state, "strlen(str): int", Strlen);
     Tiny_BindFunction(state, "str_len(str): int", Strlen);
     Tiny_BindFunction(state, "stridx(str, int): int", Stridx);
     Tiny_BindFunction(state, "sget(str, int): int", Stridx);
     Tiny_BindFunction(state, "strchr(str, int): int", Strchr);
-    Tiny_BindFunction(state, "strcat(str, str, ...): str", Strcat);
+    Tiny_BindFunction(state, "strcat(str, str, ...): str", Tiny_StdStrcat);
     Tiny_BindFunction(state, "substr(str, int, int): str", Lib_Substr);
+    Tiny_BindFunction(state, "str_copy(str): str", Lib_StrCopy);
+
+    Tiny_RegisterType(state, "strbuf");
+
+    Tiny_BindFunction(state, "strbuf(...): strbuf", Lib_StrBuf);
+    Tiny_BindFunction(state, "strbuf_append_str(strbuf, str, ...): void", Lib_StrBufAppendStr);
+    Tiny_BindFunction(state, "strbuf_append_int(strbuf, int): void", Lib_StrBufAppendInt);
+    Tiny_BindFunction(state, "strbuf_append_float(strbuf, float): void", Lib_StrBufAppendFloat);
+    Tiny_BindFunction(state, "strbuf_append_char(strbuf, int): void", Lib_StrBufAppendChar);
+    Tiny_BindFunction(state, "strbuf_appendf(strbuf, str, ...): void", Lib_StrBufAppendf);
+    Tiny_BindFunction(state, "strbuf_len(strbuf): int", Lib_StrBufLen);
+    Tiny_BindFunction(state, "strbuf_clear(strbuf): void", Lib_StrBufClear);
+    Tiny_BindFunction(state, "strbuf_to_str(strbuf): str", Lib_StrBufToStr);
 
     // Conform to array indexing protocol
     Tiny_BindFunction(state, "str_get_index(str, int): int", Stridx);
@@ -1322,6 +1932,11 @@ void Tiny_BindStandardLib(Tiny_State *state) {
     Tiny_BindFunction(state, "int_to_json", Lib_PrimitiveToJson);
     Tiny_BindFunction(state, "float_to_json", Lib_PrimitiveToJson);
 
+    Tiny_BindFunction(state, "bool_write_json(strbuf, bool): void", Lib_PrimitiveWriteJson);
+    Tiny_BindFunction(state, "str_write_json(strbuf, str): void", Lib_PrimitiveWriteJson);
+    Tiny_BindFunction(state, "int_write_json(strbuf, int): void", Lib_PrimitiveWriteJson);
+    Tiny_BindFunction(state, "float_write_json(strbuf, float): void", Lib_PrimitiveWriteJson);
+
     Tiny_BindFunction(state, "get_executing_line", GetExecutingLine);
 
     Tiny_BindMacro(state, "json", JsonMacroFunction);
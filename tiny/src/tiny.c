@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "detail.h"
 #include "expr.h"
@@ -29,6 +30,12 @@
 
 const Tiny_Value Tiny_Null = {TINY_VAL_NULL};
 
+#ifdef _MSC_VER
+#define TINY_THREAD_LOCAL __declspec(thread)
+#else
+#define TINY_THREAD_LOCAL _Thread_local
+#endif
+
 // In the event that you want to declare a symbol that can't be named
 const char *ANON_SYM_NAME = "(anonymous)";
 
@@ -98,2494 +105,4223 @@ static Tiny_StringNode *CreateExprStringNode(Tiny_State *state, const char *str)
     return node;
 }
 
-static void DeleteObject(Tiny_Context *ctx, Tiny_Object *obj) {
-    if (obj->type == TINY_VAL_STRING) {
-        char *internalStr = (char *)obj + sizeof(Tiny_Object);
+// Natives store the size they were created with (see Tiny_NewNativeSized) right after the object
+static inline size_t *GetNativeSizePtr(Tiny_Object *obj) { return (size_t *)(obj + 1); }
+
+// Slices store the string they point into right after the object, along with what's needed to
+// give them their own copy of their characters later on (see Tiny_ToString): the thread they
+// belong to and the region they were allocated in (if any). The parent is NULL once the slice has
+// been given its own copy.
+typedef struct StringSliceInfo {
+    Tiny_Object *parent;
+    Tiny_StateThread *thread;
+    Tiny_Arena *region;
+} StringSliceInfo;
+
+static inline StringSliceInfo *GetSliceInfo(Tiny_Object *obj) {
+    return (StringSliceInfo *)(obj + 1);
+}
 
-        if (obj->string.ptr == internalStr) {
-            // FIXME(Apaar): Is it possible for there to be a string which just happens to be
-            // allocated after the object pointer?
+// How many bytes the object takes up, including whatever it owns
+static size_t GetObjectSize(Tiny_Object *obj) {
+    switch (obj->type) {
+        case TINY_VAL_STRING:
+            if (obj->isSlice) {
+                return sizeof(Tiny_Object) + sizeof(StringSliceInfo) +
+                       (GetSliceInfo(obj)->parent ? 0 : obj->string.len + 1);
+            }
 
-            // If the string pointer is directly after the object then it is part of the object
-            // allocation and does not need to be freed separately
-        } else {
-            TFree(ctx, obj->string.ptr);
-        }
-    } else if (obj->type == TINY_VAL_NATIVE) {
-        if (obj->nat.prop && obj->nat.prop->finalize) {
-            obj->nat.prop->finalize(ctx, obj->nat.addr);
+            // Whether the string is embedded or not, it takes up the same amount of memory
+            return sizeof(Tiny_Object) + obj->string.len + 1;
+
+        case TINY_VAL_STRUCT:
+            return sizeof(Tiny_Object) + sizeof(Tiny_Value) * obj->ostruct.n;
+
+        default: {
+            assert(obj->type == TINY_VAL_NATIVE);
+
+            size_t size = obj->nat.prop && obj->nat.prop->size ? obj->nat.prop->size(obj->nat.addr)
+                                                                 : *GetNativeSizePtr(obj);
+
+            return sizeof(Tiny_Object) + sizeof(size_t) + size;
         }
     }
-
-    TFree(ctx, obj);
 }
 
-static inline bool IsObject(Tiny_Value val) {
-    return val.type == TINY_VAL_STRING || val.type == TINY_VAL_NATIVE ||
-           val.type == TINY_VAL_STRUCT;
-}
+// Size classes are this many bytes apart, which also keeps every object in a slab aligned to it
+#define OBJECT_SIZE_CLASS_STEP 16
 
-void Tiny_ProtectFromGC(Tiny_Value value) {
-    if (!IsObject(value)) return;
+typedef struct Tiny_ObjectSlab {
+    struct Tiny_ObjectSlab *next;
+} Tiny_ObjectSlab;
 
-    Tiny_Object *obj = value.obj;
+// The objects in a slab start this far into it so that they're aligned
+#define OBJECT_SLAB_HEADER_SIZE OBJECT_SIZE_CLASS_STEP
 
-    assert(obj);
+static inline size_t GetObjectSizeClass(size_t size) {
+    return (size + OBJECT_SIZE_CLASS_STEP - 1) / OBJECT_SIZE_CLASS_STEP - 1;
+}
 
-    if (obj->marked) return;
+// Takes memory for an object from the free list for its size class if there's anything on it and
+// from the current slab otherwise. The rest of the current slab is abandoned when an object
+// doesn't fit in it anymore.
+static void *AllocObjectMemory(Tiny_StateThread *thread, size_t size) {
+    size_t sizeClass = GetObjectSizeClass(size);
 
-    if (obj->type == TINY_VAL_NATIVE) {
-        if (obj->nat.prop && obj->nat.prop->protectFromGC)
-            obj->nat.prop->protectFromGC(obj->nat.addr);
-    } else if (obj->type == TINY_VAL_STRUCT) {
-        for (int i = 0; i < obj->ostruct.n; ++i) Tiny_ProtectFromGC(obj->ostruct.fields[i]);
+    if (sizeClass >= TINY_OBJECT_SIZE_CLASS_COUNT) {
+        return TMalloc(&thread->ctx, size);
     }
 
-    obj->marked = 1;
-}
+    void *mem = thread->objectFreeLists[sizeClass];
 
-static void MarkAll(Tiny_StateThread *thread);
+    if (mem) {
+        // Free slots store the next free slot at the start
+        thread->objectFreeLists[sizeClass] = *(void **)mem;
+        return mem;
+    }
 
-static void Sweep(Tiny_StateThread *thread) {
-    Tiny_Object **object = &thread->gcHead;
-    while (*object) {
-        if (!(*object)->marked) {
-            Tiny_Object *unreached = *object;
-            --thread->numObjects;
-            *object = unreached->next;
-            DeleteObject(&thread->ctx, unreached);
-        } else {
-            (*object)->marked = 0;
-            object = &(*object)->next;
-        }
+    size_t classSize = (sizeClass + 1) * OBJECT_SIZE_CLASS_STEP;
+
+    assert(OBJECT_SLAB_HEADER_SIZE + classSize <= TINY_OBJECT_SLAB_SIZE);
+
+    if (!thread->objectSlabs || thread->objectSlabUsed + classSize > TINY_OBJECT_SLAB_SIZE) {
+        Tiny_ObjectSlab *slab = TMalloc(&thread->ctx, TINY_OBJECT_SLAB_SIZE);
+
+        slab->next = thread->objectSlabs;
+        thread->objectSlabs = slab;
+
+        thread->objectSlabUsed = OBJECT_SLAB_HEADER_SIZE;
     }
-}
 
-static void GarbageCollect(Tiny_StateThread *thread) {
-    MarkAll(thread);
-    Sweep(thread);
-    thread->maxNumObjects = thread->numObjects * 2;
+    mem = (char *)thread->objectSlabs + thread->objectSlabUsed;
+    thread->objectSlabUsed += classSize;
+
+    return mem;
 }
 
-const char *Tiny_ToString(const Tiny_Value value) {
-    if (value.type == TINY_VAL_CONST_STRING) return value.cstr;
-    if (value.type != TINY_VAL_STRING) return NULL;
+// `size` must be the same as it was when the memory was allocated
+static void FreeObjectMemory(Tiny_StateThread *thread, void *mem, size_t size) {
+    size_t sizeClass = GetObjectSizeClass(size);
+
+    if (sizeClass >= TINY_OBJECT_SIZE_CLASS_COUNT) {
+        TFree(&thread->ctx, mem);
+        return;
+    }
 
-    return value.obj->string.ptr;
+    *(void **)mem = thread->objectFreeLists[sizeClass];
+    thread->objectFreeLists[sizeClass] = mem;
 }
 
-size_t Tiny_StringLen(const Tiny_Value value) {
-    if (value.type == TINY_VAL_CONST_STRING) return strlen(value.cstr);
-    if (value.type != TINY_VAL_STRING) return 0;
+// Whether the string's characters are part of the object's allocation (see
+// NewStringObjectEmbedString) rather than allocated separately
+static inline bool IsStringEmbedded(Tiny_Object *obj) {
+    // FIXME(Apaar): Is it possible for there to be a string which just happens to be
+    // allocated after the object pointer?
+    return obj->string.ptr == (char *)obj + sizeof(Tiny_Object);
+}
 
-    return value.obj->string.len;
+// Strings used as dict keys often come straight from untrusted input (e.g. form fields), so this
+// is keyed with the process hash seed to make it infeasible to pick strings that collide.
+//
+// The 64-bit hash is folded down to the 32 bits that fit in the object header (see Tiny_Object),
+// and 0 is reserved for hashes which haven't been computed yet, so that's remapped to 1.
+static uint32_t HashStringChars(const char *str, size_t len) {
+    uint64_t hash = Tiny_HashBytes(str, len, Tiny_GetHashSeed());
+    uint32_t folded = (uint32_t)(hash ^ (hash >> 32));
+
+    // Zero means the hash hasn't been computed yet
+    return folded ? folded : 1;
 }
 
-void *Tiny_ToAddr(const Tiny_Value value) {
-    if (value.type == TINY_VAL_LIGHT_NATIVE) return value.addr;
-    if (value.type != TINY_VAL_NATIVE) return NULL;
+static inline uint32_t GetStringObjectHash(Tiny_Object *obj) {
+    if (!obj->hash) {
+        obj->hash = HashStringChars(obj->string.ptr, obj->string.len);
+    }
 
-    return value.obj->nat.addr;
+    return obj->hash;
 }
 
-const Tiny_NativeProp *Tiny_GetProp(const Tiny_Value value) {
-    if (value.type != TINY_VAL_NATIVE) return NULL;
-    return value.obj->nat.prop;
-}
+uint32_t Tiny_HashString(Tiny_Value value) {
+    switch (Tiny_GetType(value)) {
+        case TINY_VAL_STRING:
+            return GetStringObjectHash(Tiny_AsObject(value));
 
-Tiny_Value Tiny_GetField(const Tiny_Value value, int index) {
-    if (value.type != TINY_VAL_STRUCT) return Tiny_Null;
-    assert(index >= 0 && index < value.obj->ostruct.n);
+        case TINY_VAL_SMALL_STRING: {
+            char buf[TINY_SMALL_STRING_MAX_LEN + 1];
+            size_t len = Tiny_AsSmallString(value, buf);
 
-    return value.obj->ostruct.fields[index];
-}
+            return HashStringChars(buf, len);
+        }
 
-bool Tiny_AreValuesEqual(Tiny_Value a, Tiny_Value b) {
-    bool bothStrings = ((a.type == TINY_VAL_CONST_STRING && b.type == TINY_VAL_STRING) ||
-                        (a.type == TINY_VAL_STRING && b.type == TINY_VAL_CONST_STRING));
+        default: {
+            assert(Tiny_GetType(value) == TINY_VAL_CONST_STRING);
 
-    if (a.type != b.type && !bothStrings) {
-        return false;
-    }
+            const char *str = Tiny_AsConstString(value);
 
-    if (a.type == TINY_VAL_NULL) {
-        return true;
+            return HashStringChars(str, strlen(str));
+        }
     }
+}
 
-    if (a.type == TINY_VAL_BOOL) {
-        return a.boolean == b.boolean;
-    }
+static bool MarkObject(Tiny_StateThread *thread, Tiny_Object *obj);
 
-    if (a.type == TINY_VAL_INT) {
-        return a.i == b.i;
-    }
+#define INTERN_TABLE_INIT_CAPACITY 64
 
-    if (a.type == TINY_VAL_FLOAT) {
-        return a.f == b.f;
-    }
+// Returns the slot which holds the interned string with the given characters, or the empty slot
+// where it would go if there isn't one
+static Tiny_Object **FindInternSlot(Tiny_StateThread *thread, const char *str, size_t len,
+                                    uint32_t hash) {
+    size_t mask = thread->internCapacity - 1;
 
-    if (a.type == TINY_VAL_NATIVE) {
-        return a.obj->nat.addr == b.obj->nat.addr;
-    }
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Tiny_Object *obj = thread->internTable[i];
 
-    if (a.type == TINY_VAL_LIGHT_NATIVE) {
-        return a.addr == b.addr;
+        if (!obj || (obj->hash == hash && obj->string.len == len &&
+                     memcmp(obj->string.ptr, str, len) == 0)) {
+            return &thread->internTable[i];
+        }
     }
+}
 
-    if (a.type == TINY_VAL_STRUCT) {
-        return a.obj == b.obj;
-    }
+static void GrowInternTable(Tiny_StateThread *thread) {
+    Tiny_Object **oldTable = thread->internTable;
+    size_t oldCapacity = thread->internCapacity;
 
-    if (a.type == TINY_VAL_STRING) {
-        size_t aLen = Tiny_StringLen(a);
-        size_t bLen = Tiny_StringLen(b);
+    thread->internCapacity = oldCapacity > 0 ? oldCapacity * 2 : INTERN_TABLE_INIT_CAPACITY;
+    thread->internTable = TMalloc(&thread->ctx, sizeof(Tiny_Object *) * thread->internCapacity);
 
-        if (aLen != bLen) {
-            return false;
-        }
+    memset(thread->internTable, 0, sizeof(Tiny_Object *) * thread->internCapacity);
 
-        return strncmp(a.obj->string.ptr, Tiny_ToString(b), aLen) == 0;
-    }
+    size_t mask = thread->internCapacity - 1;
 
-    if (a.type == TINY_VAL_CONST_STRING) {
-        if (b.type == TINY_VAL_CONST_STRING && a.cstr == b.cstr) {
-            return true;
-        }
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        Tiny_Object *obj = oldTable[i];
 
-        size_t aLen = Tiny_StringLen(a);
-        size_t bLen = Tiny_StringLen(b);
+        if (!obj) continue;
 
-        if (aLen != bLen) {
-            return false;
+        size_t j = obj->hash & mask;
+
+        while (thread->internTable[j]) {
+            j = (j + 1) & mask;
         }
 
-        return strncmp(a.cstr, Tiny_ToString(b), aLen) == 0;
+        thread->internTable[j] = obj;
     }
 
-    return false;
+    TFree(&thread->ctx, oldTable);
 }
 
-static Tiny_Object *NewObject(Tiny_StateThread *thread, Tiny_ValueType type, size_t extra) {
-    Tiny_Object *obj = TMalloc(&thread->ctx, sizeof(Tiny_Object) + extra);
+// Returns the interned string with the given characters, or NULL if there isn't one
+static Tiny_Object *FindInternedString(Tiny_StateThread *thread, const char *str, size_t len,
+                                       uint32_t hash) {
+    if (thread->internCount == 0) {
+        return NULL;
+    }
 
-    obj->type = type;
-    obj->next = thread->gcHead;
-    thread->gcHead = obj;
-    obj->marked = 0;
+    Tiny_Object *obj = *FindInternSlot(thread, str, len, hash);
 
-    thread->numObjects++;
+    // The string might be garbage as far as the collection in progress is concerned (it could
+    // have been unreachable when the roots were marked), so it has to be kept alive now that
+    // it's going to be used again. If it's already been swept, this just means it survives the
+    // next collection regardless.
+    if (obj && thread->gcPhase != TINY_GC_IDLE) {
+        MarkObject(thread, obj);
+    }
 
     return obj;
 }
 
-// Allocates memory for and copies the given string contiguously with the object, resulting in
-// a single allocation for the entire thing.
-static Tiny_Object *NewStringObjectEmbedString(Tiny_StateThread *thread, const char *str,
-                                               size_t len) {
-    Tiny_Object *obj = NewObject(thread, TINY_VAL_STRING, len + 1);
+// `obj` must be a string whose hash has been computed and which isn't already interned
+static void InternString(Tiny_StateThread *thread, Tiny_Object *obj) {
+    if ((thread->internCount + 1) * 2 > thread->internCapacity) {
+        GrowInternTable(thread);
+    }
 
-    obj->string.len = len;
-    obj->string.ptr = (char *)obj + sizeof(Tiny_Object);
-    memcpy(obj->string.ptr, str, len);
+    Tiny_Object **slot = FindInternSlot(thread, obj->string.ptr, obj->string.len, obj->hash);
 
-    // Null terminate the string for interfacing with C
-    obj->string.ptr[obj->string.len] = '\0';
+    assert(!*slot);
 
-    return obj;
+    *slot = obj;
+    obj->isInterned = true;
+
+    thread->internCount += 1;
 }
 
-static Tiny_Object *NewStructObject(Tiny_StateThread *thread, Word n) {
-    assert(n >= 0);
+static void UninternString(Tiny_StateThread *thread, Tiny_Object *obj) {
+    size_t mask = thread->internCapacity - 1;
+    size_t i = obj->hash & mask;
 
-    Tiny_Object *obj = NewObject(thread, TINY_VAL_STRUCT, sizeof(Tiny_Value) * n);
-    memset(obj->ostruct.fields, 0, sizeof(Tiny_Value) * n);
+    while (thread->internTable[i] != obj) {
+        i = (i + 1) & mask;
+    }
 
-    obj->ostruct.n = n;
+    // Shift back any strings after this one which were displaced past it, so that there's no
+    // gap in between them and the slot they hash to
+    for (size_t j = (i + 1) & mask; thread->internTable[j]; j = (j + 1) & mask) {
+        size_t home = thread->internTable[j]->hash & mask;
 
-    thread->numObjects++;
+        // Whether `home` is cyclically in (i, j], in which case the string can stay where it is
+        bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
 
-    return obj;
-}
+        if (!stays) {
+            thread->internTable[i] = thread->internTable[j];
+            i = j;
+        }
+    }
 
-Tiny_Value Tiny_NewLightNative(void *ptr) {
-    Tiny_Value val;
+    thread->internTable[i] = NULL;
+    obj->isInterned = false;
 
-    val.type = TINY_VAL_LIGHT_NATIVE;
-    val.addr = ptr;
+    thread->internCount -= 1;
+}
 
-    return val;
+void Tiny_SetStringInterning(Tiny_StateThread *thread, bool enabled) {
+    thread->internStrings = enabled;
 }
 
-Tiny_Value Tiny_NewNative(Tiny_StateThread *thread, void *ptr, const Tiny_NativeProp *prop) {
-    assert(thread && thread->state);
+// Frees whatever the object owns (but not the object itself) and returns how big the object's
+// allocation is (see NewObject)
+static size_t FinalizeObject(Tiny_StateThread *thread, Tiny_Object *obj) {
+    size_t size = sizeof(Tiny_Object);
 
-    // Make sure thread is alive
-    assert(thread->pc >= 0);
+    if (obj->type == TINY_VAL_STRING) {
+        if (obj->isInterned) {
+            UninternString(thread, obj);
+        }
 
-    Tiny_Object *obj = NewObject(thread, TINY_VAL_NATIVE, 0);
+        if (obj->isSlice) {
+            size += sizeof(StringSliceInfo);
 
-    obj->nat.addr = ptr;
-    obj->nat.prop = prop;
+            if (!GetSliceInfo(obj)->parent) {
+                TFree(&thread->ctx, obj->string.ptr);
+            }
+        } else if (IsStringEmbedded(obj)) {
+            size += obj->string.len + 1;
+        } else {
+            TFree(&thread->ctx, obj->string.ptr);
+        }
+    } else if (obj->type == TINY_VAL_STRUCT) {
+        size += sizeof(Tiny_Value) * obj->ostruct.n;
+    } else {
+        assert(obj->type == TINY_VAL_NATIVE);
 
-    Tiny_Value val;
+        size += sizeof(size_t);
 
-    val.type = TINY_VAL_NATIVE;
-    val.obj = obj;
+        if (obj->nat.prop && obj->nat.prop->finalize) {
+            obj->nat.prop->finalize(&thread->ctx, obj->nat.addr);
+        }
+    }
 
-    return val;
+    return size;
 }
 
-Tiny_Value Tiny_NewBool(bool value) {
-    Tiny_Value val;
-
-    val.type = TINY_VAL_BOOL;
-    val.boolean = value;
+static void DeleteObject(Tiny_StateThread *thread, Tiny_Object *obj) {
+    FreeObjectMemory(thread, obj, FinalizeObject(thread, obj));
+}
 
-    return val;
+static inline bool IsObject(Tiny_Value val) {
+    Tiny_ValueType type = Tiny_GetType(val);
+    return type == TINY_VAL_STRING || type == TINY_VAL_NATIVE || type == TINY_VAL_STRUCT;
 }
 
-Tiny_Value Tiny_NewInt(Tiny_Int i) {
-    Tiny_Value val;
+// The thread whose garbage is being collected on this OS thread. Natives mark the values they
+// reference through Tiny_ProtectFromGC, which doesn't take a thread, so this is how it finds the
+// right gray stack.
+static TINY_THREAD_LOCAL Tiny_StateThread *MarkingThread = NULL;
 
-    val.type = TINY_VAL_INT;
-    val.i = i;
+// Marks the object as reachable. Objects which reference other objects are pushed onto the gray
+// stack so that their references get followed later (see MarkGrayObjects). Returns whether the
+// object wasn't already marked.
+static bool MarkObject(Tiny_StateThread *thread, Tiny_Object *obj) {
+    if (obj->marked) return false;
 
-    return val;
+    obj->marked = 1;
+
+    if (obj->type != TINY_VAL_STRING) {
+        sb_push(&thread->ctx, thread->grayStack, obj);
+    } else if (obj->isSlice && GetSliceInfo(obj)->parent) {
+        // Slices are never made out of other slices, so this doesn't go any deeper
+        MarkObject(thread, GetSliceInfo(obj)->parent);
+    }
+
+    return true;
 }
 
-Tiny_Value Tiny_NewFloat(Tiny_Float f) {
-    Tiny_Value val;
+static bool MarkValue(Tiny_StateThread *thread, Tiny_Value value) {
+    if (!IsObject(value)) return false;
 
-    val.type = TINY_VAL_FLOAT;
-    val.f = f;
+    Tiny_Object *obj = Tiny_AsObject(value);
 
-    return val;
+    assert(obj);
+
+    return MarkObject(thread, obj);
 }
 
-Tiny_Value Tiny_NewConstString(const char *str) {
-    assert(str);
+void Tiny_ProtectFromGC(Tiny_Value value) {
+    // This should only be called from inside a `protectFromGC` function
+    assert(MarkingThread);
 
-    Tiny_Value val;
+    MarkValue(MarkingThread, value);
+}
 
-    val.type = TINY_VAL_CONST_STRING;
-    val.cstr = str;
+void Tiny_GCWriteBarrier(Tiny_StateThread *thread, Tiny_Value value) {
+    // Values stored after an object's references have been followed would be missed otherwise
+    if (thread->gcPhase == TINY_GC_MARK) {
+        MarkValue(thread, value);
+    }
+}
 
-    return val;
+void Tiny_SetGCPauseBudget(Tiny_StateThread *thread, int micros) {
+    assert(micros >= 0);
+    thread->gcPauseBudgetMicros = micros;
 }
 
-// This assumes the given char* was allocated using Tiny_AllocUsingContext or equivalent.
-// It takes ownership of the char*, avoiding any intermediate copies.
-Tiny_Value Tiny_NewString(Tiny_StateThread *thread, char *str, size_t len) {
-    assert(thread && thread->state && str);
+// Microseconds since some arbitrary point in time, for timing garbage collection pauses
+static int64_t GetMicros(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
 
-    Tiny_Object *obj = NewObject(thread, TINY_VAL_STRING, 0);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-    obj->string.len = len;
-    obj->string.ptr = str;
+// Marks everything the thread references directly. Since the stack and globals are always
+// scanned in full, writes to them don't need a write barrier. Returns whether any object that
+// wasn't already marked was found.
+static bool MarkRoots(Tiny_StateThread *thread) {
+    assert(thread->state);
 
-    Tiny_Value val;
+    bool found = MarkValue(thread, thread->retVal);
 
-    val.type = TINY_VAL_STRING;
-    val.obj = obj;
+    for (int i = 0; i < thread->sp; ++i) {
+        found |= MarkValue(thread, thread->stack[i]);
+    }
 
-    return val;
-}
+    if (thread->globalVars) {
+        for (int i = 0; i < thread->state->numGlobalVars; ++i) {
+            found |= MarkValue(thread, thread->globalVars[i]);
+        }
+    }
 
-// This is equivalent to Tiny_NewString but it figures out the length assuming
-// the given pointer is null-terminated.
-Tiny_Value Tiny_NewStringNullTerminated(Tiny_StateThread *thread, char *str) {
-    return Tiny_NewString(thread, str, strlen(str));
+    return found;
 }
 
-// Same as Tiny_NewString but it allocate memory for and copies the given string.
-Tiny_Value Tiny_NewStringCopy(Tiny_StateThread *thread, const char *src, size_t len) {
-    assert(thread && thread->state && src);
+// Follows the references of up to `count` objects on the gray stack. Returns how many it did.
+static int MarkGrayObjects(Tiny_StateThread *thread, int count) {
+    int done = 0;
 
-    Tiny_Object *obj = NewStringObjectEmbedString(thread, src, len);
+    for (; done < count && sb_count(thread->grayStack) > 0; ++done) {
+        Tiny_Object *obj = thread->grayStack[--stb__sbn(thread->grayStack)];
 
-    Tiny_Value val;
+        if (obj->type == TINY_VAL_NATIVE) {
+            if (obj->nat.prop && obj->nat.prop->protectFromGC)
+                obj->nat.prop->protectFromGC(obj->nat.addr);
+        } else {
+            assert(obj->type == TINY_VAL_STRUCT);
 
-    val.type = TINY_VAL_STRING;
-    val.obj = obj;
+            for (int i = 0; i < obj->ostruct.n; ++i) MarkValue(thread, obj->ostruct.fields[i]);
+        }
+    }
 
-    return val;
+    return done;
 }
 
-// Same as Tiny_NewStringCopy but assumes the given string is null terminated.
-Tiny_Value Tiny_NewStringCopyNullTerminated(Tiny_StateThread *thread, const char *src) {
-    return Tiny_NewStringCopy(thread, src, strlen(src));
-}
+// Sweeps up to `count` objects off of the sweep list, freeing the ones which weren't marked and
+// putting the rest back on the thread's list of objects. heapBytes is recomputed from the ones
+// that are left (this is when natives get a chance to report how much they've grown). Returns how
+// many objects it swept.
+static int SweepObjects(Tiny_StateThread *thread, int count) {
+    int done = 0;
 
-static void Symbol_destroy(Tiny_Symbol *sym, Tiny_Context *ctx);
+    for (; done < count && thread->sweepList; ++done) {
+        Tiny_Object *obj = thread->sweepList;
+        thread->sweepList = obj->next;
 
-static Tiny_Value Lib_ToInt(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    return Tiny_NewInt((Tiny_Int)Tiny_ToFloat(args[0]));
-}
+        if (!obj->marked) {
+            --thread->numObjects;
 
-static Tiny_Value Lib_ToFloat(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
-    return Tiny_NewFloat((Tiny_Float)Tiny_ToInt(args[0]));
-}
+            thread->gcFreedObjects += 1;
+            thread->gcFreedBytes += GetObjectSize(obj);
 
-Tiny_State *Tiny_CreateStateWithContext(Tiny_Context ctx) {
-    Tiny_State *state = TMalloc(&ctx, sizeof(Tiny_State));
+            DeleteObject(thread, obj);
+        } else {
+            obj->marked = 0;
+            thread->heapBytes += GetObjectSize(obj);
 
-    state->l = (Tiny_Lexer){0};
+            obj->next = thread->gcHead;
+            thread->gcHead = obj;
+        }
+    }
 
-    state->ctx = ctx;
+    return done;
+}
 
-    state->program = NULL;
-    state->numGlobalVars = 0;
+// How many objects are marked or swept in between checking whether we're out of time
+#define GC_WORK_CHUNK 64
 
-    state->numStrings = 0;
+// Works out when the next collection should start (see Tiny_GCPolicy)
+static void UpdateNextGCBytes(Tiny_StateThread *thread) {
+    if (thread->region || thread->gcPolicy.manualOnly) {
+        thread->nextGCBytes = SIZE_MAX;
+        return;
+    }
 
-    state->numFunctions = 0;
-    state->functionPcs = NULL;
+    double next = (double)thread->gcSurvivedBytes * thread->gcPolicy.growthFactor;
 
-    state->numForeignFunctions = 0;
-    state->foreignFunctions = NULL;
+    thread->nextGCBytes = next < (double)thread->gcPolicy.minHeapBytes
+                              ? thread->gcPolicy.minHeapBytes
+                              : next >= (double)SIZE_MAX ? SIZE_MAX : (size_t)next;
+}
 
-    state->currScope = 0;
-    state->currFunc = NULL;
-    state->globalSymbols = NULL;
+// Collects garbage until either the collection is done or `budget` microseconds have passed (or
+// budget * TINY_GC_WORK_PER_MICRO objects have been marked/swept, see Tiny_SetGCPauseBudget; 0
+// means there's no limit), in which case the next call picks up where this one left off. Starts a
+// new collection if there isn't one in progress.
+static void GarbageCollect(Tiny_StateThread *thread, int64_t budget) {
+    int64_t start = GetMicros();
 
-    state->pcToFileLine = NULL;
+    int64_t work = 0;
+    int64_t maxWork = budget > 0 ? budget * TINY_GC_WORK_PER_MICRO : INT64_MAX;
 
-    state->compileCallNestCount = 0;
+    Tiny_StateThread *prevMarkingThread = MarkingThread;
+    MarkingThread = thread;
 
-    Tiny_BindFunction(state, "int(float): int", Lib_ToInt);
-    Tiny_BindFunction(state, "float(int): float", Lib_ToFloat);
+    if (thread->gcPhase == TINY_GC_IDLE) {
+        thread->gcPhase = TINY_GC_MARK;
+        MarkRoots(thread);
+    }
 
-    return state;
-}
+    while (thread->gcPhase != TINY_GC_IDLE) {
+        int chunk = maxWork - work < GC_WORK_CHUNK ? (int)(maxWork - work) : GC_WORK_CHUNK;
+
+        if (thread->gcPhase == TINY_GC_MARK) {
+            if (sb_count(thread->grayStack) > 0) {
+                work += MarkGrayObjects(thread, chunk);
+            } else if (!MarkRoots(thread)) {
+                // Nothing is gray and the roots don't reference anything that isn't marked, so
+                // everything that's reachable has been marked. Objects allocated from here on go
+                // on a fresh list and are left alone until the next collection.
+                thread->gcPhase = TINY_GC_SWEEP;
+                thread->sweepList = thread->gcHead;
+                thread->gcHead = NULL;
+                thread->heapBytes = 0;
+            }
+        } else {
+            work += SweepObjects(thread, chunk);
 
-Tiny_State *Tiny_CreateState(void) { return Tiny_CreateStateWithContext(Tiny_DefaultContext); }
+            if (!thread->sweepList) {
+                thread->gcPhase = TINY_GC_IDLE;
 
-void Tiny_DeleteState(Tiny_State *state) {
-    sb_free(&state->ctx, state->program);
+                thread->gcCount += 1;
+                thread->gcAllocatedBytes = 0;
 
-    // Delete all the Strings
-    for (int i = 0; i < state->numStrings; ++i) {
-        TFree(&state->ctx, state->strings[i]);
+                thread->gcSurvivedBytes = thread->heapBytes;
+                UpdateNextGCBytes(thread);
+            }
+        }
+
+        if (budget > 0 && (work >= maxWork || GetMicros() - start >= budget)) {
+            break;
+        }
     }
 
-    // Delete all symbols
-    for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
-        Symbol_destroy(state->globalSymbols[i], &state->ctx);
+    if (work > thread->gcMaxStepWork) {
+        thread->gcMaxStepWork = work;
     }
 
-    sb_free(&state->ctx, state->globalSymbols);
+    MarkingThread = prevMarkingThread;
 
-    // Reset function and variable data
-    TFree(&state->ctx, state->functionPcs);
-    TFree(&state->ctx, state->foreignFunctions);
+    int64_t pause = GetMicros() - start;
 
-    sb_free(&state->ctx, state->pcToFileLine);
+    thread->gcTotalPauseMicros += pause;
 
-    TFree(&state->ctx, state);
+    if (pause > thread->gcMaxPauseMicros) {
+        thread->gcMaxPauseMicros = pause;
+    }
 }
 
-void Tiny_InitThreadWithContext(Tiny_StateThread *thread, const Tiny_State *state,
-                                Tiny_Context ctx) {
-    thread->ctx = ctx;
+void Tiny_CollectGarbage(Tiny_StateThread *thread) {
+    assert(thread->state);
 
-    thread->state = state;
+    if (thread->region) {
+        return;
+    }
 
-    thread->gcHead = NULL;
-    thread->numObjects = 0;
-    // TODO: Use INIT_GC_THRESH definition
-    thread->maxNumObjects = 8;
+    // Objects which became garbage after the collection in progress started could survive it
+    if (thread->gcPhase != TINY_GC_IDLE) {
+        GarbageCollect(thread, 0);
+    }
 
-    thread->globalVars = NULL;
+    GarbageCollect(thread, 0);
+}
 
-    thread->pc = -1;
-    thread->fp = thread->sp = 0;
+void Tiny_SetGCPolicy(Tiny_StateThread *thread, Tiny_GCPolicy policy) {
+    assert(policy.growthFactor > 1);
 
-    thread->retVal = Tiny_Null;
+    thread->gcPolicy = policy;
+    UpdateNextGCBytes(thread);
+}
 
-    thread->fc = 0;
+Tiny_GCPolicy Tiny_GetGCPolicy(const Tiny_StateThread *thread) { return thread->gcPolicy; }
 
-    thread->userdata = NULL;
-}
+void Tiny_GetGCStats(const Tiny_StateThread *thread, Tiny_GCStats *stats) {
+    stats->collections = thread->gcCount;
+    stats->totalPauseMicros = thread->gcTotalPauseMicros;
+    stats->maxPauseMicros = thread->gcMaxPauseMicros;
 
-void Tiny_InitThread(Tiny_StateThread *thread, const Tiny_State *state) {
-    Tiny_InitThreadWithContext(thread, state, Tiny_DefaultContext);
-}
+    stats->liveObjects = thread->numObjects;
+    stats->liveBytes = thread->heapBytes;
 
-static void AllocGlobals(Tiny_StateThread *thread) {
-    // If the global variables haven't been allocated yet,
-    // do that
-    if (!thread->globalVars) {
-        thread->globalVars =
-            TMalloc(&thread->ctx, sizeof(Tiny_Value) * thread->state->numGlobalVars);
-        memset(thread->globalVars, 0, sizeof(Tiny_Value) * thread->state->numGlobalVars);
-    }
+    stats->freedObjects = thread->gcFreedObjects;
+    stats->freedBytes = thread->gcFreedBytes;
+
+    stats->allocatedBytesSinceGC = thread->gcAllocatedBytes;
 }
 
-void Tiny_StartThread(Tiny_StateThread *thread) {
-    AllocGlobals(thread);
+static TINY_THREAD_LOCAL char SmallStringScratch[TINY_SMALL_STRING_SCRATCH_COUNT]
+                                                [TINY_SMALL_STRING_MAX_LEN + 1];
+static TINY_THREAD_LOCAL unsigned SmallStringScratchIndex = 0;
 
-    // TODO: Eventually move to an actual entry point
-    thread->pc = 0;
+static const char *DetachStringSlice(Tiny_Object *obj);
+
+const char *Tiny_ToString(const Tiny_Value value) {
+    char *smallBuf = NULL;
+
+    if (Tiny_GetType(value) == TINY_VAL_SMALL_STRING) {
+        smallBuf = SmallStringScratch[SmallStringScratchIndex++ % TINY_SMALL_STRING_SCRATCH_COUNT];
+    }
+
+    return Tiny_ToStringBuf(value, smallBuf);
 }
 
-inline static bool ExecuteCycle(Tiny_StateThread *thread);
+const char *Tiny_ToStringBuf(const Tiny_Value value, char *smallBuf) {
+    Tiny_ValueType type = Tiny_GetType(value);
 
-int Tiny_GetGlobalIndex(const Tiny_State *state, const char *name) {
-    for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
-        Tiny_Symbol *sym = state->globalSymbols[i];
+    if (type == TINY_VAL_CONST_STRING) return Tiny_AsConstString(value);
 
-        if (sym->type == TINY_SYM_GLOBAL && strcmp(sym->name, name) == 0) {
-            return sym->var.index;
-        }
+    if (type == TINY_VAL_SMALL_STRING) {
+        Tiny_AsSmallString(value, smallBuf);
+
+        return smallBuf;
     }
 
-    return -1;
-}
+    if (type != TINY_VAL_STRING) return NULL;
 
-int Tiny_GetFunctionIndex(const Tiny_State *state, const char *name) {
-    for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
-        Tiny_Symbol *sym = state->globalSymbols[i];
+    Tiny_Object *obj = Tiny_AsObject(value);
 
-        if (sym->type == TINY_SYM_FUNCTION && strcmp(sym->name, name) == 0) {
-            return sym->func.index;
-        }
+    // Slices point into the middle of another string, so they have to be given their own
+    // (null terminated) copy of their characters
+    if (obj->isSlice && GetSliceInfo(obj)->parent) {
+        return DetachStringSlice(obj);
     }
 
-    return -1;
+    return obj->string.ptr;
 }
 
-static void DoPushIndir(Tiny_StateThread *thread, uint8_t nargs);
-static void DoPush(Tiny_StateThread *thread, Tiny_Value value);
+size_t Tiny_StringLen(const Tiny_Value value) {
+    Tiny_ValueType type = Tiny_GetType(value);
 
-Tiny_Value Tiny_GetGlobal(const Tiny_StateThread *thread, int globalIndex) {
-    assert(globalIndex >= 0 && globalIndex < thread->state->numGlobalVars);
-    assert(thread->globalVars);
+    if (type == TINY_VAL_CONST_STRING) return strlen(Tiny_AsConstString(value));
 
-    return thread->globalVars[globalIndex];
-}
+    if (type == TINY_VAL_SMALL_STRING) {
+        char buf[TINY_SMALL_STRING_MAX_LEN + 1];
+        return Tiny_AsSmallString(value, buf);
+    }
 
-void Tiny_SetGlobal(Tiny_StateThread *thread, int globalIndex, Tiny_Value value) {
-    assert(globalIndex >= 0 && globalIndex < thread->state->numGlobalVars);
-    assert(thread->globalVars);
+    if (type != TINY_VAL_STRING) return 0;
 
-    thread->globalVars[globalIndex] = value;
+    return Tiny_AsObject(value)->string.len;
 }
 
-Tiny_Value Tiny_CallFunction(Tiny_StateThread *thread, int functionIndex, const Tiny_Value *args,
-                             int count) {
-    assert(thread->state && functionIndex >= 0);
+const char *Tiny_ToStringChars(const Tiny_Value value, char *smallBuf, size_t *len) {
+    Tiny_ValueType type = Tiny_GetType(value);
 
-    int pc, fp, sp, fc;
+    if (type == TINY_VAL_SMALL_STRING) {
+        *len = Tiny_AsSmallString(value, smallBuf);
+        return smallBuf;
+    }
 
-    pc = thread->pc;
-    fp = thread->fp;
-    sp = thread->sp;
-    fc = thread->fc;
+    *len = Tiny_StringLen(value);
 
-    Tiny_Value retVal = thread->retVal;
+    // Unlike Tiny_ToString, slices are left alone
+    return type == TINY_VAL_STRING ? Tiny_AsObject(value)->string.ptr : Tiny_ToString(value);
+}
 
-    AllocGlobals(thread);
+// Small strings are always created the same way (see NewSmallString) so two of them are equal
+// exactly when their bits are.
+static inline bool AreSmallStringsEqual(const Tiny_Value a, const Tiny_Value b) {
+#ifdef TINY_VALUE_NANBOX
+    return a.bits == b.bits;
+#else
+    return memcmp(a.small, b.small, sizeof(a.small)) == 0;
+#endif
+}
 
-    for (int i = 0; i < count; ++i) {
-        DoPush(thread, args[i]);
-    }
+void *Tiny_ToAddr(const Tiny_Value value) {
+    Tiny_ValueType type = Tiny_GetType(value);
 
-    thread->pc = thread->state->functionPcs[functionIndex];
-    DoPushIndir(thread, count);
+    if (type == TINY_VAL_LIGHT_NATIVE) return Tiny_AsLightNative(value);
+    if (type != TINY_VAL_NATIVE) return NULL;
 
-    // Keep executing until the indir stack is restored (i.e. function is done)
-    while (thread->fc > fc && ExecuteCycle(thread));
+    return Tiny_AsObject(value)->nat.addr;
+}
 
-    Tiny_Value newRetVal = thread->retVal;
+const Tiny_NativeProp *Tiny_GetProp(const Tiny_Value value) {
+    if (Tiny_GetType(value) != TINY_VAL_NATIVE) return NULL;
+    return Tiny_AsObject(value)->nat.prop;
+}
 
-    thread->pc = pc;
-    thread->fp = fp;
-    thread->sp = sp;
-    thread->fc = fc;
+Tiny_Value Tiny_GetField(const Tiny_Value value, int index) {
+    if (Tiny_GetType(value) != TINY_VAL_STRUCT) return Tiny_Null;
 
-    thread->retVal = retVal;
+    Tiny_Object *obj = Tiny_AsObject(value);
+    assert(index >= 0 && index < obj->ostruct.n);
 
-    return newRetVal;
+    return obj->ostruct.fields[index];
 }
 
-bool Tiny_ExecuteCycle(Tiny_StateThread *thread) { return ExecuteCycle(thread); }
+bool Tiny_AreValuesEqual(Tiny_Value a, Tiny_Value b) {
+    Tiny_ValueType aType = Tiny_GetType(a);
+    Tiny_ValueType bType = Tiny_GetType(b);
 
-void Tiny_Run(Tiny_StateThread *thread) { while (ExecuteCycle(thread)); }
+    if (aType == TINY_VAL_SMALL_STRING && bType == TINY_VAL_SMALL_STRING) {
+        return AreSmallStringsEqual(a, b);
+    }
 
-void Tiny_DestroyThread(Tiny_StateThread *thread) {
-    thread->pc = -1;
+    if (aType == TINY_VAL_STRING && bType == TINY_VAL_STRING) {
+        Tiny_Object *aObj = Tiny_AsObject(a);
+        Tiny_Object *bObj = Tiny_AsObject(b);
 
-    // Free all objects in the gc list
-    while (thread->gcHead) {
-        Tiny_Object *next = thread->gcHead->next;
-        DeleteObject(&thread->ctx, thread->gcHead);
-        thread->gcHead = next;
+        if (aObj == bObj) {
+            return true;
+        }
+
+        // There's only ever one interned string with the same characters
+        if (aObj->isInterned && bObj->isInterned) {
+            return false;
+        }
+
+        if (aObj->hash && bObj->hash && aObj->hash != bObj->hash) {
+            return false;
+        }
     }
 
-    // Free all global variables
-    TFree(&thread->ctx, thread->globalVars);
-}
+    if (Tiny_IsString(a) && Tiny_IsString(b)) {
+        if (aType == TINY_VAL_CONST_STRING && bType == TINY_VAL_CONST_STRING &&
+            Tiny_AsConstString(a) == Tiny_AsConstString(b)) {
+            return true;
+        }
 
-static void MarkAll(Tiny_StateThread *thread) {
-    assert(thread->state);
+        char aBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+        char bBuf[TINY_SMALL_STRING_MAX_LEN + 1];
 
-    Tiny_ProtectFromGC(thread->retVal);
+        size_t aLen, bLen;
 
-    for (int i = 0; i < thread->sp; ++i) Tiny_ProtectFromGC(thread->stack[i]);
+        const char *aChars = Tiny_ToStringChars(a, aBuf, &aLen);
+        const char *bChars = Tiny_ToStringChars(b, bBuf, &bLen);
 
-    for (int i = 0; i < thread->state->numGlobalVars; ++i)
-        Tiny_ProtectFromGC(thread->globalVars[i]);
-}
+        return aLen == bLen && memcmp(aChars, bChars, aLen) == 0;
+    }
 
-static void GenerateCode(Tiny_State *state, Word inst) {
-    sb_push(&state->ctx, state->program, inst);
-}
+    if (aType != bType) {
+        return false;
+    }
 
-// Tiny_State* state, const T* value, int* pPos
-//
-// Pads the bytecode until we are aligned for T, then writes out the bytes for T,
-// storing starting pos in pPos.
-#define GEN_VALUE(state, pValue, pPos)                                   \
-    do {                                                                 \
-        size_t align_minus_one = alignof(*pValue) - 1;                   \
-        int count = sb_count(state->program);                            \
-        int padded_count = (count + align_minus_one) & ~align_minus_one; \
-        for (int i = 0; i < padded_count - count; ++i) {                 \
-            GenerateCode(state, TINY_OP_MISALIGNED_INSTRUCTION);         \
-        }                                                                \
-        *pPos = sb_count(state->program);                                \
-        Word *wp = (Word *)pValue;                                       \
-        for (int i = 0; i < sizeof(*pValue); ++i) {                      \
-            GenerateCode(state, *wp++);                                  \
-        }                                                                \
-    } while (0)
+    if (aType == TINY_VAL_NULL) {
+        return true;
+    }
 
-// Same as GEN_VALUE but ignore position
-#define GEN_VALUE_NOPOS(state, pValue)  \
-    do {                                \
-        int pos = 0;                    \
-        GEN_VALUE(state, pValue, &pos); \
-    } while (0)
+    if (aType == TINY_VAL_BOOL) {
+        return Tiny_AsBool(a) == Tiny_AsBool(b);
+    }
 
-// Tiny_State* state, const T* pValue, int pc
-//
-// Writes out the value stored in pValue to bytecode stream at pc
-// asserting that pc is aligned for the value before doing so
-#define GEN_VALUE_AT(state, pValue, pc)             \
-    do {                                            \
-        assert(pc % alignof(*pValue) == 0);         \
-        Word *wp = (Word *)pValue;                  \
-        for (int i = 0; i < sizeof(*pValue); ++i) { \
-            state->program[pc + i] = *wp++;         \
-        }                                           \
-    } while (0)
+    if (aType == TINY_VAL_INT) {
+        return Tiny_AsInt(a) == Tiny_AsInt(b);
+    }
 
-static int RegisterString(Tiny_State *state, const char *string) {
-    for (int i = 0; i < state->numStrings; ++i) {
-        if (strcmp(state->strings[i], string) == 0) return i;
+    if (aType == TINY_VAL_FLOAT) {
+        return Tiny_AsFloat(a) == Tiny_AsFloat(b);
     }
 
-    assert(state->numStrings < MAX_STRINGS);
-    state->strings[state->numStrings++] = CloneString(&state->ctx, string);
+    if (aType == TINY_VAL_NATIVE) {
+        return Tiny_AsObject(a)->nat.addr == Tiny_AsObject(b)->nat.addr;
+    }
 
-    return state->numStrings - 1;
-}
+    if (aType == TINY_VAL_LIGHT_NATIVE) {
+        return Tiny_AsLightNative(a) == Tiny_AsLightNative(b);
+    }
 
-static Tiny_Symbol *GetPrimTag(Tiny_SymbolType type) {
-    static Tiny_Symbol prims[] = {{
-                                      TINY_SYM_TAG_VOID,
-                                      (char *)"void",
-                                  },
-                                  {
-                                      TINY_SYM_TAG_BOOL,
-                                      (char *)"bool",
-                                  },
-                                  {TINY_SYM_TAG_INT, (char *)"int"},
-                                  {TINY_SYM_TAG_FLOAT, (char *)"float"},
-                                  {TINY_SYM_TAG_STR, (char *)"str"},
-                                  {TINY_SYM_TAG_ANY, (char *)"any"}};
+    if (aType == TINY_VAL_STRUCT) {
+        return Tiny_AsObject(a) == Tiny_AsObject(b);
+    }
 
-    return &prims[type - TINY_SYM_TAG_VOID];
+    return false;
 }
 
-static Tiny_Symbol *Symbol_create(Tiny_SymbolType type, const char *name, Tiny_State *state) {
-    Tiny_Symbol *sym = TMalloc(&state->ctx, sizeof(Tiny_Symbol));
+// Both values are expected to be strings (const or otherwise), but either one could also be
+// null if it was cast from one.
+static inline bool AreStringsEqual(Tiny_Value a, Tiny_Value b) {
+    Tiny_ValueType aType = Tiny_GetType(a);
+    Tiny_ValueType bType = Tiny_GetType(b);
 
-    sym->name = CloneString(&state->ctx, name);
-    sym->type = type;
-    sym->pos = state->l.pos;
+    if (aType == TINY_VAL_CONST_STRING && bType == TINY_VAL_CONST_STRING &&
+        Tiny_AsConstString(a) == Tiny_AsConstString(b)) {
+        return true;
+    }
 
-    return sym;
+    if (aType == TINY_VAL_NULL || bType == TINY_VAL_NULL) {
+        return aType == bType;
+    }
+
+    // This is inlined into Execute, so the comparison itself isn't (it needs buffers for small
+    // strings, which would make Execute's stack frame bigger).
+    return Tiny_AreValuesEqual(a, b);
 }
 
-static void Symbol_destroy(Tiny_Symbol *sym, Tiny_Context *ctx) {
-    if (sym->type == TINY_SYM_FUNCTION) {
-        for (int i = 0; i < sb_count(sym->func.args); ++i) {
-            Tiny_Symbol *arg = sym->func.args[i];
+// Adds to the size of the heap (see heapBytes in Tiny_StateThread)
+static inline void CountAllocation(Tiny_StateThread *thread, size_t size) {
+    thread->heapBytes += size;
+    thread->gcAllocatedBytes += size;
+}
 
-            assert(arg->type == TINY_SYM_LOCAL);
+static Tiny_Object *NewObject(Tiny_StateThread *thread, Tiny_ValueType type, size_t extra) {
+    Tiny_Object *obj;
 
-            Symbol_destroy(arg, ctx);
+    if (thread->region) {
+        obj = Tiny_ArenaAlloc(thread->region, sizeof(Tiny_Object) + extra, sizeof(void *));
+        obj->next = NULL;
+
+        // Only natives and strings which own their characters (see Tiny_NewString, which is the
+        // only place that creates a string with no extra space) need to be cleaned up
+        if (type == TINY_VAL_NATIVE || (type == TINY_VAL_STRING && extra == 0)) {
+            obj->next = thread->gcHead;
+            thread->gcHead = obj;
         }
+    } else {
+        obj = AllocObjectMemory(thread, sizeof(Tiny_Object) + extra);
 
-        sb_free(ctx, sym->func.args);
+        obj->next = thread->gcHead;
+        thread->gcHead = obj;
+    }
 
-        for (int i = 0; i < sb_count(sym->func.locals); ++i) {
-            Tiny_Symbol *local = sym->func.locals[i];
+    obj->type = type;
+    obj->marked = 0;
+    obj->isSlice = false;
+    obj->isInterned = false;
+    obj->hash = 0;
+
+    // Objects allocated while marking could end up referenced only by objects which have already
+    // been marked, so they're treated as reachable
+    if (thread->gcPhase == TINY_GC_MARK) {
+        MarkObject(thread, obj);
+    }
 
-            assert(local->type == TINY_SYM_LOCAL);
+    thread->numObjects++;
+    CountAllocation(thread, sizeof(Tiny_Object) + extra);
 
-            Symbol_destroy(local, ctx);
-        }
+    return obj;
+}
 
-        sb_free(ctx, sym->func.locals);
-    } else if (sym->type == TINY_SYM_FOREIGN_FUNCTION) {
-        sb_free(ctx, sym->foreignFunc.argTags);
-    } else if (sym->type == TINY_SYM_TAG_STRUCT) {
-        for (int i = 0; i < sb_count(sym->sstruct.fields); ++i) {
-            Symbol_destroy(sym->sstruct.fields[i], ctx);
-        }
+// Allocates memory for and copies the given string contiguously with the object, resulting in
+// a single allocation for the entire thing.
+static Tiny_Object *NewStringObjectEmbedString(Tiny_StateThread *thread, const char *str,
+                                               size_t len) {
+    Tiny_Object *obj = NewObject(thread, TINY_VAL_STRING, len + 1);
 
-        sb_free(ctx, sym->sstruct.fields);
-    }
+    obj->string.len = len;
+    obj->string.ptr = (char *)obj + sizeof(Tiny_Object);
+    memcpy(obj->string.ptr, str, len);
 
-    TFree(ctx, sym->name);
-    TFree(ctx, sym);
+    // Null terminate the string for interfacing with C
+    obj->string.ptr[obj->string.len] = '\0';
+
+    return obj;
 }
 
-static void OpenScope(Tiny_State *state) { ++state->currScope; }
+static Tiny_Object *NewStructObject(Tiny_StateThread *thread, Word n) {
+    assert(n >= 0);
 
-static void CloseScope(Tiny_State *state) {
-    if (state->currFunc) {
-        for (int i = 0; i < sb_count(state->currFunc->func.locals); ++i) {
-            Tiny_Symbol *sym = state->currFunc->func.locals[i];
+    Tiny_Object *obj = NewObject(thread, TINY_VAL_STRUCT, sizeof(Tiny_Value) * n);
+    memset(obj->ostruct.fields, 0, sizeof(Tiny_Value) * n);
 
-            assert(sym->type == TINY_SYM_LOCAL);
+    obj->ostruct.n = n;
 
-            if (sym->var.scope == state->currScope) {
-                sym->var.scopeEnded = true;
-            }
-        }
-    }
+    return obj;
+}
 
-    --state->currScope;
+#ifdef TINY_VALUE_NANBOX
+
+static inline Tiny_Value NanBox(unsigned tag, uint64_t payload) {
+    assert(payload <= TINY_NANBOX_PAYLOAD_MASK);
+    return (Tiny_Value){((uint64_t)tag << 48) | payload};
 }
 
-#define ST_MASK(symType) (1UL << (symType))
+static inline Tiny_Value NanBoxPointer(unsigned tag, const void *ptr) {
+    // Pointers have to fit in the payload, see the comment on Tiny_Value
+    return NanBox(tag, (uint64_t)(uintptr_t)ptr);
+}
 
-#define ST_MASK_FUNC (ST_MASK(TINY_SYM_FUNCTION) | ST_MASK(TINY_SYM_FOREIGN_FUNCTION))
-#define ST_MASK_VAR (ST_MASK(TINY_SYM_LOCAL) | ST_MASK(TINY_SYM_GLOBAL))
-#define ST_MASK_VAR_OR_CONST ST_MASK_VAR | ST_MASK(TINY_SYM_CONST)
+#endif
 
-static Tiny_Symbol *FindSymbol(Tiny_State *state, const char *name, uint32_t mask) {
-    // This clever trick let's me unify the codepaths for symbols
-    // that can be named and can't be named
-    if (name == ANON_SYM_NAME) {
-        return NULL;
+// Wraps the given object in a value of the same type
+static inline Tiny_Value NewObjectValue(Tiny_Object *obj) {
+#ifdef TINY_VALUE_NANBOX
+    switch (obj->type) {
+        case TINY_VAL_STRING:
+            return NanBoxPointer(TINY_NANBOX_TAG_STRING, obj);
+        case TINY_VAL_NATIVE:
+            return NanBoxPointer(TINY_NANBOX_TAG_NATIVE, obj);
+        default:
+            assert(obj->type == TINY_VAL_STRUCT);
+            return NanBoxPointer(TINY_NANBOX_TAG_STRUCT, obj);
     }
+#else
+    Tiny_Value val;
 
-    if (state->currFunc && ST_MASK(TINY_SYM_LOCAL) & mask) {
-        // Check local variables
-        for (int i = 0; i < sb_count(state->currFunc->func.locals); ++i) {
-            Tiny_Symbol *sym = state->currFunc->func.locals[i];
-
-            assert(sym->type == TINY_SYM_LOCAL);
+    val.type = obj->type;
+    val.obj = obj;
 
-            // Make sure that it's available in the current scope too
-            if (!sym->var.scopeEnded && strcmp(sym->name, name) == 0) {
-                return sym;
-            }
-        }
+    return val;
+#endif
+}
 
-        // Check arguments
-        for (int i = 0; i < sb_count(state->currFunc->func.args); ++i) {
-            Tiny_Symbol *sym = state->currFunc->func.args[i];
+Tiny_Value Tiny_NewLightNative(void *ptr) {
+#ifdef TINY_VALUE_NANBOX
+    return NanBoxPointer(TINY_NANBOX_TAG_LIGHT_NATIVE, ptr);
+#else
+    Tiny_Value val;
 
-            assert(sym->type == TINY_SYM_LOCAL);
+    val.type = TINY_VAL_LIGHT_NATIVE;
+    val.addr = ptr;
 
-            if (strcmp(sym->name, name) == 0) {
-                return sym;
-            }
-        }
-    }
+    return val;
+#endif
+}
 
-    for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
-        Tiny_Symbol *sym = state->globalSymbols[i];
+Tiny_Value Tiny_NewNativeSized(Tiny_StateThread *thread, void *ptr, const Tiny_NativeProp *prop,
+                               size_t size) {
+    assert(thread && thread->state);
 
-        if (ST_MASK(sym->type) & mask) {
-            if (strcmp(sym->name, name) == 0) return sym;
-        }
-    }
+    // Make sure thread is alive
+    assert(thread->pc >= 0);
 
-    return NULL;
-}
+    Tiny_Object *obj = NewObject(thread, TINY_VAL_NATIVE, sizeof(size_t));
 
-static Tiny_Symbol *DeclareGlobalVar(Tiny_State *state, const char *name) {
-    Tiny_Symbol *sym = FindSymbol(state, name, ST_MASK(TINY_SYM_GLOBAL) | ST_MASK(TINY_SYM_CONST));
+    obj->nat.addr = ptr;
+    obj->nat.prop = prop;
 
-    if (sym) {
-        assert(sym->type == TINY_SYM_GLOBAL || sym->type == TINY_SYM_CONST);
+    *GetNativeSizePtr(obj) = size;
 
-        ReportErrorSL(state,
-                      "Attempted to declare multiple global entities with the same "
-                      "name '%s'.",
-                      name);
+    if (prop && prop->size) {
+        size = prop->size(ptr);
     }
 
-    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_GLOBAL, name, state);
+    CountAllocation(thread, size);
 
-    newNode->var.initialized = false;
-    newNode->var.index = state->numGlobalVars;
-    newNode->var.scope = 0;  // Global variable scope don't matter
-    newNode->var.scopeEnded = false;
+    return NewObjectValue(obj);
+}
 
-    sb_push(&state->ctx, state->globalSymbols, newNode);
+Tiny_Value Tiny_NewNative(Tiny_StateThread *thread, void *ptr, const Tiny_NativeProp *prop) {
+    return Tiny_NewNativeSized(thread, ptr, prop, 0);
+}
 
-    state->numGlobalVars += 1;
+Tiny_Value Tiny_NewBool(bool value) {
+#ifdef TINY_VALUE_NANBOX
+    return NanBox(TINY_NANBOX_TAG_NULL_BOOL, 2 | (uint64_t)value);
+#else
+    Tiny_Value val;
 
-    return newNode;
+    val.type = TINY_VAL_BOOL;
+    val.boolean = value;
+
+    return val;
+#endif
 }
 
-// This expects nargs to be known beforehand because arguments are
-// evaluated/pushed left-to-right so the first argument is actually at -nargs
-// position relative to frame pointer We could reverse it, but this works out
-// nicely for Foreign calls since we can just supply a pointer to the initial
-// arg instead of reversing them.
-static Tiny_Symbol *DeclareArgument(Tiny_State *state, const char *name, Tiny_Symbol *tag,
-                                    int nargs) {
-    assert(state->currFunc);
-    assert(tag);
+Tiny_Value Tiny_NewInt(Tiny_Int i) {
+#ifdef TINY_VALUE_NANBOX
+    // Only the low 48 bits are kept, they're sign-extended in Tiny_AsInt
+    return NanBox(TINY_NANBOX_TAG_INT, (uint64_t)i & TINY_NANBOX_PAYLOAD_MASK);
+#else
+    Tiny_Value val;
 
-    // At this time there would be no locals declared so this should be fine.
-    // Regardless, you shan't have locals + args have the same name.
-    Tiny_Symbol *prevSym = FindSymbol(state, name, ST_MASK(TINY_SYM_LOCAL));
-    if (prevSym) {
-        assert(prevSym->type == TINY_SYM_LOCAL);
+    val.type = TINY_VAL_INT;
+    val.i = i;
 
-        ReportErrorSL(state, "Function '%s' has multiple arguments with the name '%s'.\n",
-                      state->currFunc->name, name);
+    return val;
+#endif
+}
+
+Tiny_Value Tiny_NewFloat(Tiny_Float f) {
+#ifdef TINY_VALUE_NANBOX
+    double d = (double)f;
+    uint64_t bits;
+
+    if (d != d) {
+        // All NaNs become the same quiet NaN so they can't be mistaken for a tagged value
+        bits = 0x7FF8000000000000ull;
+    } else {
+        memcpy(&bits, &d, sizeof(bits));
     }
 
-    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_LOCAL, name, state);
+    return (Tiny_Value){bits ^ TINY_NANBOX_XOR};
+#else
+    Tiny_Value val;
 
-    newNode->var.initialized = false;
-    newNode->var.scopeEnded = false;
-    newNode->var.index = -nargs + sb_count(state->currFunc->func.args);
-    newNode->var.scope = 0;  // These should be accessible anywhere in the function
-    newNode->var.tag = tag;
+    val.type = TINY_VAL_FLOAT;
+    val.f = f;
 
-    sb_push(&state->ctx, state->currFunc->func.args, newNode);
+    return val;
+#endif
+}
 
-    return newNode;
+Tiny_Value Tiny_NewConstString(const char *str) {
+    assert(str);
+
+#ifdef TINY_VALUE_NANBOX
+    return NanBoxPointer(TINY_NANBOX_TAG_CONST_STRING, str);
+#else
+    Tiny_Value val;
+
+    val.type = TINY_VAL_CONST_STRING;
+    val.cstr = str;
+
+    return val;
+#endif
 }
 
-static Tiny_Symbol *DeclareLocal(Tiny_State *state, const char *name) {
-    assert(state->currFunc);
+static inline bool CanBeSmallString(const char *str, size_t len) {
+    return len <= TINY_SMALL_STRING_MAX_LEN && !memchr(str, '\0', len);
+}
 
-    Tiny_Symbol *prevSym = FindSymbol(state, name, ST_MASK(TINY_SYM_LOCAL));
-    if (prevSym) {
-        assert(prevSym->type == TINY_SYM_LOCAL);
+static Tiny_Value NewSmallString(const char *str, size_t len) {
+    assert(CanBeSmallString(str, len));
 
-        ReportErrorSL(state,
-                      "Function '%s' has multiple locals in the same scope with "
-                      "name '%s'.\n",
-                      state->currFunc->name, name);
+#ifdef TINY_VALUE_NANBOX
+    uint64_t payload = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        payload |= (uint64_t)(unsigned char)str[i] << (i * 8);
     }
 
-    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_LOCAL, name, state);
+    return NanBox(TINY_NANBOX_TAG_SMALL_STRING, payload);
+#else
+    Tiny_Value val;
 
-    newNode->var.initialized = false;
-    newNode->var.scopeEnded = false;
-    newNode->var.index = sb_count(state->currFunc->func.locals);
-    newNode->var.scope = state->currScope;
+    // Everything past the string has to be zero, see AreSmallStringsEqual
+    memset(val.small, 0, sizeof(val.small));
+    memcpy(val.small, str, len);
 
-    sb_push(&state->ctx, state->currFunc->func.locals, newNode);
+    val.type = TINY_VAL_SMALL_STRING;
 
-    return newNode;
+    return val;
+#endif
 }
 
-// Declares a local or global depending on whether we are inside a func
-static Tiny_Symbol *DeclareVar(Tiny_State *state, const char *name) {
-    return state->currFunc ? DeclareLocal(state, name) : DeclareGlobalVar(state, name);
-}
+// This assumes the given char* was allocated using Tiny_AllocUsingContext or equivalent.
+// It takes ownership of the char*, avoiding any intermediate copies.
+Tiny_Value Tiny_NewString(Tiny_StateThread *thread, char *str, size_t len) {
+    assert(thread && thread->state && str);
 
-static Tiny_Symbol *DeclareConst(Tiny_State *state, const char *name, Tiny_Symbol *tag) {
-    Tiny_Symbol *sym = FindSymbol(state, name, ST_MASK_VAR_OR_CONST);
+    if (CanBeSmallString(str, len)) {
+        Tiny_Value val = NewSmallString(str, len);
 
-    if (sym) {
-        assert(sym->type == TINY_SYM_CONST || sym->type == TINY_SYM_LOCAL ||
-               sym->type == TINY_SYM_GLOBAL);
+        TFree(&thread->ctx, str);
 
-        ReportErrorSL(state,
-                      "Attempted to define constant with the same name '%s' as "
-                      "another value.\n",
-                      name);
+        return val;
     }
 
-    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_CONST, name, state);
+    uint32_t hash = 0;
 
-    newNode->constant.tag = tag;
+    if (thread->internStrings) {
+        hash = HashStringChars(str, len);
 
-    sb_push(&state->ctx, state->globalSymbols, newNode);
+        Tiny_Object *interned = FindInternedString(thread, str, len, hash);
 
-    return newNode;
-}
+        if (interned) {
+            TFree(&thread->ctx, str);
+            return NewObjectValue(interned);
+        }
+    }
 
-static Tiny_Symbol *DeclareFunction(Tiny_State *state, const char *name) {
-    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_FUNCTION, name, state);
+    Tiny_Object *obj = NewObject(thread, TINY_VAL_STRING, 0);
 
-    newNode->func.index = state->numFunctions;
-    newNode->func.args = NULL;
-    newNode->func.locals = NULL;
+    obj->string.len = len;
+    obj->string.ptr = str;
 
-    sb_push(&state->ctx, state->globalSymbols, newNode);
+    CountAllocation(thread, len + 1);
 
-    state->numFunctions += 1;
+    if (thread->internStrings) {
+        obj->hash = hash;
+        InternString(thread, obj);
+    }
 
-    return newNode;
+    return NewObjectValue(obj);
 }
 
-static Tiny_BindFunctionResultType BindFunction(Tiny_State *state, const char *name,
-                                                Tiny_Symbol **argTags, bool varargs,
-                                                Tiny_Symbol *returnTag, Tiny_ForeignFunction func) {
-    Tiny_Symbol *prevSym = FindSymbol(state, name, ST_MASK(TINY_SYM_FOREIGN_FUNCTION));
-    if (prevSym) {
-        assert(prevSym->type == TINY_SYM_FOREIGN_FUNCTION);
-        return TINY_BIND_FUNCTION_ERROR_DUPLICATE;
-    }
+// This is equivalent to Tiny_NewString but it figures out the length assuming
+// the given pointer is null-terminated.
+Tiny_Value Tiny_NewStringNullTerminated(Tiny_StateThread *thread, char *str) {
+    return Tiny_NewString(thread, str, strlen(str));
+}
 
-    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_FOREIGN_FUNCTION, name, state);
+// Same as Tiny_NewString but it allocate memory for and copies the given string.
+Tiny_Value Tiny_NewStringCopy(Tiny_StateThread *thread, const char *src, size_t len) {
+    assert(thread && thread->state && src);
 
-    newNode->foreignFunc.index = state->numForeignFunctions;
+    if (CanBeSmallString(src, len)) {
+        return NewSmallString(src, len);
+    }
 
-    newNode->foreignFunc.argTags = argTags;
-    newNode->foreignFunc.varargs = varargs;
+    if (!thread->internStrings) {
+        return NewObjectValue(NewStringObjectEmbedString(thread, src, len));
+    }
 
-    newNode->foreignFunc.returnTag = returnTag;
+    uint32_t hash = HashStringChars(src, len);
 
-    newNode->foreignFunc.callee = func;
+    Tiny_Object *obj = FindInternedString(thread, src, len, hash);
 
-    sb_push(&state->ctx, state->globalSymbols, newNode);
+    if (!obj) {
+        obj = NewStringObjectEmbedString(thread, src, len);
 
-    state->numForeignFunctions += 1;
+        obj->hash = hash;
+        InternString(thread, obj);
+    }
 
-    return TINY_BIND_FUNCTION_SUCCESS;
+    return NewObjectValue(obj);
 }
 
-static Tiny_Symbol *GetTagFromName(Tiny_State *state, const char *name, bool declareStruct);
+// Slices shorter than this are copied instead, since a slice takes up about as much space as a
+// copy would and they'd keep the (likely much bigger) string they were sliced from alive.
+#define MIN_STRING_SLICE_LEN 16
 
-void Tiny_RegisterType(Tiny_State *state, const char *name) {
-    Tiny_Symbol *s = GetTagFromName(state, name, false);
+Tiny_Value Tiny_NewStringSlice(Tiny_StateThread *thread, Tiny_Value str, size_t start,
+                               size_t len) {
+    assert(thread && thread->state);
 
-    if (s) {
-        if (s->type == TINY_SYM_TAG_STRUCT && !s->sstruct.defined) {
-            // If there's a struct that's undefined with the same name, the Tiny code is probably
-            // referring to this type that we're about to define here, so just update it in place
-            // to be an opaque foreign type.
-            s->type = TINY_SYM_TAG_FOREIGN;
-        }
+    char smallBuf[TINY_SMALL_STRING_MAX_LEN + 1];
+    size_t strLen;
 
-        return;
+    const char *chars = Tiny_ToStringChars(str, smallBuf, &strLen);
+
+    assert(chars && start + len <= strLen);
+
+    // Constant strings aren't objects so they can't be kept alive, but they don't need to be
+    if (Tiny_GetType(str) != TINY_VAL_STRING || len < MIN_STRING_SLICE_LEN) {
+        return Tiny_NewStringCopy(thread, chars + start, len);
     }
 
-    s = Symbol_create(TINY_SYM_TAG_FOREIGN, name, state);
+    Tiny_Object *parent = Tiny_AsObject(str);
 
-    sb_push(&state->ctx, state->globalSymbols, s);
-}
+    if (parent->isSlice && GetSliceInfo(parent)->parent) {
+        parent = GetSliceInfo(parent)->parent;
+    }
 
-static Tiny_Symbol *ParseTypeL(Tiny_State *state, Tiny_Lexer *l);
+    Tiny_Object *obj = NewObject(thread, TINY_VAL_STRING, sizeof(StringSliceInfo));
 
-Tiny_BindFunctionResultType Tiny_BindFunction(Tiny_State *state, const char *sig,
-                                              Tiny_ForeignFunction func) {
-    Tiny_Lexer l;
+    obj->isSlice = true;
 
-    Tiny_InitLexer(&l, "(bind signature)", sig, state->ctx);
+    obj->string.len = len;
+    obj->string.ptr = (char *)chars + start;
 
-    Tiny_GetToken(&l);
+    GetSliceInfo(obj)->parent = parent;
+    GetSliceInfo(obj)->thread = thread;
+    GetSliceInfo(obj)->region = thread->region;
 
-    assert(l.lastTok == TINY_TOK_IDENT);
+    // NewObject marked the slice before it had a parent
+    if (thread->gcPhase == TINY_GC_MARK) {
+        MarkObject(thread, parent);
+    }
 
-    char *name = CloneString(&state->ctx, l.lexeme);
+    return NewObjectValue(obj);
+}
 
-    Tiny_GetToken(&l);
+// Gives the slice its own copy of its characters, so it doesn't keep the string it was sliced from
+// alive anymore
+static const char *DetachStringSlice(Tiny_Object *obj) {
+    Tiny_StateThread *thread = GetSliceInfo(obj)->thread;
+    Tiny_Arena *region = GetSliceInfo(obj)->region;
 
-    if (l.lastTok != TINY_TOK_OPENPAREN) {
-        // Just the name
-        Tiny_BindFunctionResultType res =
-            BindFunction(state, name, NULL, true, GetPrimTag(TINY_SYM_TAG_ANY), func);
-        Tiny_DestroyLexer(&l);
+    size_t len = obj->string.len;
 
-        TFree(&state->ctx, name);
+    // Objects in a region aren't finalized, so the copy is freed along with the region. This has to
+    // be the slice's region rather than the thread's current one since they can differ.
+    char *chars = region ? Tiny_ArenaAlloc(region, len + 1, 1) : TMalloc(&thread->ctx, len + 1);
 
-        return res;
-    }
+    memcpy(chars, obj->string.ptr, len);
+    chars[len] = '\0';
 
-    Tiny_GetToken(&l);
+    obj->string.ptr = chars;
+    GetSliceInfo(obj)->parent = NULL;
 
-    Tiny_Symbol **argTags = NULL;
-    bool varargs = false;
+    CountAllocation(thread, len + 1);
 
-    for (;;) {
-        if (l.lastTok == TINY_TOK_CLOSEPAREN) {
-            break;
-        }
+    return chars;
+}
 
-        if (l.lastTok == TINY_TOK_COMMA) {
-            Tiny_GetToken(&l);
-        } else if (l.lastTok == TINY_TOK_ELLIPSIS) {
-            varargs = true;
-            Tiny_GetToken(&l);
-        } else {
-            Tiny_Symbol *s = ParseTypeL(state, &l);
+const char *Tiny_ToCString(Tiny_StateThread *thread, Tiny_Value value) {
+    return Tiny_ToString(value);
+}
 
-            assert(s);
+// Same as Tiny_NewStringCopy but assumes the given string is null terminated.
+Tiny_Value Tiny_NewStringCopyNullTerminated(Tiny_StateThread *thread, const char *src) {
+    return Tiny_NewStringCopy(thread, src, strlen(src));
+}
 
-            sb_push(&state->ctx, argTags, s);
-        }
-    }
+static void Symbol_destroy(Tiny_Symbol *sym, Tiny_Context *ctx);
 
-    assert(l.lastTok == TINY_TOK_CLOSEPAREN);
+static Tiny_Value Lib_ToInt(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
+    return Tiny_NewInt((Tiny_Int)Tiny_ToFloat(args[0]));
+}
 
-    Tiny_GetToken(&l);
+static Tiny_Value Lib_ToFloat(Tiny_StateThread *thread, const Tiny_Value *args, int count) {
+    return Tiny_NewFloat((Tiny_Float)Tiny_ToInt(args[0]));
+}
 
-    Tiny_Symbol *returnTag = GetPrimTag(TINY_SYM_TAG_ANY);
+Tiny_State *Tiny_CreateStateWithBackend(Tiny_Context ctx, Tiny_Backend backend) {
+    Tiny_State *state = TMalloc(&ctx, sizeof(Tiny_State));
 
-    if (l.lastTok == TINY_TOK_COLON) {
-        Tiny_GetToken(&l);
+    state->l = (Tiny_Lexer){0};
 
-        returnTag = ParseTypeL(state, &l);
-        assert(returnTag);
-    }
+    state->ctx = ctx;
 
-    Tiny_BindFunctionResultType res = BindFunction(state, name, argTags, varargs, returnTag, func);
+    state->program = NULL;
+    state->numGlobalVars = 0;
 
-    Tiny_DestroyLexer(&l);
+    state->numStrings = 0;
 
-    TFree(&state->ctx, name);
+    state->numFunctions = 0;
+    state->functionPcs = NULL;
 
-    return res;
-}
+    state->numForeignFunctions = 0;
+    state->foreignFunctions = NULL;
 
-void Tiny_BindConstBool(Tiny_State *state, const char *name, bool b) {
-    DeclareConst(state, name, GetPrimTag(TINY_SYM_TAG_BOOL))->constant.bValue = b;
-}
+    state->backend = backend;
+    state->optimizationLevel = 1;
 
-void Tiny_BindConstInt(Tiny_State *state, const char *name, Tiny_Int i) {
-    DeclareConst(state, name, GetPrimTag(TINY_SYM_TAG_INT))->constant.iValue = i;
-}
+    state->currScope = 0;
+    state->currFunc = NULL;
+    state->globalSymbols = NULL;
 
-void Tiny_BindConstFloat(Tiny_State *state, const char *name, Tiny_Float f) {
-    DeclareConst(state, name, GetPrimTag(TINY_SYM_TAG_FLOAT))->constant.fValue = f;
-}
+    state->nextReg = -1;
+    state->maxReg = -1;
 
-void Tiny_BindConstString(Tiny_State *state, const char *name, const char *string) {
-    DeclareConst(state, name, GetPrimTag(TINY_SYM_TAG_STR))->constant.sIndex =
-        RegisterString(state, string);
-}
+    state->pcToFileLine = NULL;
 
-// const Tiny_State* state, int* pPC, T* pDest
-//
-// Aligns pPC for T and then reads T
-#define READ_VALUE_AT(state, pPC, pDest)                      \
-    do {                                                      \
-        size_t align_minus_one = alignof(*pDest) - 1;         \
-        *pPC = (*pPC + align_minus_one) & ~align_minus_one;   \
-        memcpy(pDest, state->program + *pPC, sizeof(*pDest)); \
-        *pPC += sizeof(*pDest) / sizeof(Word);                \
-    } while (0)
+    state->inlineExprs = NULL;
+    Tiny_InitArena(&state->inlineArena, ctx);
 
-static Tiny_Int ReadInteger(Tiny_StateThread *thread) {
-    Tiny_Int val = 0;
+    state->compileCallNestCount = 0;
 
-    READ_VALUE_AT(thread->state, &thread->pc, &val);
+    Tiny_BindFunction(state, "int(float): int", Lib_ToInt);
+    Tiny_BindFunction(state, "float(int): float", Lib_ToFloat);
 
-    return val;
+    return state;
 }
 
-static Tiny_ConstantIndex ReadConstIndex(Tiny_StateThread *thread) {
-    Tiny_ConstantIndex val = 0;
-
-    READ_VALUE_AT(thread->state, &thread->pc, &val);
-
-    return val;
+Tiny_State *Tiny_CreateStateWithContext(Tiny_Context ctx) {
+    return Tiny_CreateStateWithBackend(ctx, TINY_BACKEND_STACK);
 }
 
-static Tiny_Float ReadFloat(Tiny_StateThread *thread) {
-    Tiny_Float val = 0;
-
-    READ_VALUE_AT(thread->state, &thread->pc, &val);
+Tiny_State *Tiny_CreateState(void) { return Tiny_CreateStateWithContext(Tiny_DefaultContext); }
 
-    return val;
+void Tiny_SetOptimizationLevel(Tiny_State *state, int level) {
+    assert(level >= 0);
+    state->optimizationLevel = level;
 }
 
-static void DoPush(Tiny_StateThread *thread, Tiny_Value value) {
-    assert(thread->sp < TINY_THREAD_STACK_SIZE);
-
-    thread->stack[thread->sp++] = value;
-}
+void Tiny_DeleteState(Tiny_State *state) {
+    sb_free(&state->ctx, state->program);
 
-static inline Tiny_Value DoPop(Tiny_StateThread *thread) { return thread->stack[--thread->sp]; }
+    // Delete all the Strings
+    for (int i = 0; i < state->numStrings; ++i) {
+        TFree(&state->ctx, state->strings[i]);
+    }
 
-static void DoPushIndir(Tiny_StateThread *thread, uint8_t nargs) {
-    assert(thread->fc < TINY_THREAD_MAX_CALL_DEPTH);
+    // Delete all symbols
+    for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
+        Symbol_destroy(state->globalSymbols[i], &state->ctx);
+    }
 
-    thread->frames[thread->fc++] = (Tiny_Frame){thread->pc, thread->fp, nargs};
-    thread->fp = thread->sp;
-}
+    sb_free(&state->ctx, state->globalSymbols);
 
-static void DoPopIndir(Tiny_StateThread *thread) {
-    assert(thread->fc > 0);
+    // Reset function and variable data
+    TFree(&state->ctx, state->functionPcs);
+    TFree(&state->ctx, state->foreignFunctions);
 
-    thread->sp = thread->fp;
+    sb_free(&state->ctx, state->pcToFileLine);
 
-    Tiny_Frame frame = thread->frames[--thread->fc];
+    sb_free(&state->ctx, state->inlineExprs);
+    Tiny_DestroyArena(&state->inlineArena);
 
-    thread->sp -= frame.nargs;
-    thread->fp = frame.fp;
-    thread->pc = frame.pc;
+    TFree(&state->ctx, state);
 }
 
-inline static bool ExpectBool(const Tiny_Value value) {
-    assert(value.type == TINY_VAL_BOOL);
-    return value.boolean;
+void Tiny_InitThreadWithContext(Tiny_StateThread *thread, const Tiny_State *state,
+                                Tiny_Context ctx) {
+    Tiny_InitThreadWithHeap(thread, state, ctx, TINY_HEAP_GC);
 }
 
-inline static bool ExecuteCycle(Tiny_StateThread *thread) {
-    assert(thread && thread->state);
-
-    if (thread->pc < 0) return false;
-
-    const Tiny_State *state = thread->state;
+void Tiny_InitThreadWithHeap(Tiny_StateThread *thread, const Tiny_State *state, Tiny_Context ctx,
+                             Tiny_HeapMode mode) {
+    thread->ctx = ctx;
 
-    switch (state->program[thread->pc]) {
-        case TINY_OP_PUSH_NULL: {
-            ++thread->pc;
-            DoPush(thread, Tiny_Null);
-        } break;
+    thread->state = state;
 
-        case TINY_OP_PUSH_NULL_N: {
-            ++thread->pc;
-            Word n = state->program[thread->pc++];
-            memset(&thread->stack[thread->sp], 0, sizeof(Tiny_Value) * n);
-            thread->sp += n;
-        } break;
+    thread->gcHead = NULL;
+    thread->numObjects = 0;
 
-        case TINY_OP_PUSH_TRUE: {
-            ++thread->pc;
-            DoPush(thread, Tiny_NewBool(true));
-        } break;
+    thread->heapBytes = 0;
 
-        case TINY_OP_PUSH_FALSE: {
-            ++thread->pc;
-            DoPush(thread, Tiny_NewBool(false));
-        } break;
+    thread->gcPolicy.growthFactor = 2;
+    thread->gcPolicy.minHeapBytes = TINY_GC_MIN_HEAP_BYTES;
+    thread->gcPolicy.manualOnly = false;
 
-        case TINY_OP_PUSH_INT: {
-            ++thread->pc;
-            DoPush(thread, Tiny_NewInt(ReadInteger(thread)));
-        } break;
+    thread->gcSurvivedBytes = 0;
 
-        case TINY_OP_PUSH_0: {
-            ++thread->pc;
-            DoPush(thread, Tiny_NewInt(0));
-        } break;
+    thread->gcPhase = TINY_GC_IDLE;
+    thread->gcPauseBudgetMicros = 0;
+    thread->grayStack = NULL;
+    thread->sweepList = NULL;
 
-        case TINY_OP_PUSH_1: {
-            ++thread->pc;
-            DoPush(thread, Tiny_NewInt(1));
-        } break;
+    thread->gcCount = 0;
+    thread->gcTotalPauseMicros = 0;
+    thread->gcMaxPauseMicros = 0;
+    thread->gcMaxStepWork = 0;
+    thread->gcFreedObjects = 0;
+    thread->gcFreedBytes = 0;
+    thread->gcAllocatedBytes = 0;
 
-        case TINY_OP_PUSH_CHAR: {
-            ++thread->pc;
-            DoPush(thread, Tiny_NewInt(state->program[thread->pc++]));
-        } break;
+    thread->objectSlabs = NULL;
+    thread->objectSlabUsed = 0;
+    memset(thread->objectFreeLists, 0, sizeof(thread->objectFreeLists));
 
-        case TINY_OP_PUSH_FLOAT: {
-            ++thread->pc;
-            DoPush(thread, Tiny_NewFloat(ReadFloat(thread)));
-        } break;
+    thread->region = NULL;
 
-        case TINY_OP_PUSH_STRING: {
-            ++thread->pc;
-            Tiny_Int stringIndex = ReadInteger(thread);
-            DoPush(thread, Tiny_NewConstString(state->strings[stringIndex]));
-        } break;
+    thread->internStrings = false;
+    thread->internTable = NULL;
+    thread->internCapacity = 0;
+    thread->internCount = 0;
 
-        case TINY_OP_PUSH_STRING_FF: {
-            ++thread->pc;
-            Word sIndex = state->program[thread->pc++];
-            DoPush(thread, Tiny_NewConstString(state->strings[sIndex]));
-        } break;
+    if (mode == TINY_HEAP_REGION) {
+        thread->region = TMalloc(&thread->ctx, sizeof(Tiny_Arena));
+        Tiny_InitArena(thread->region, thread->ctx);
+    } else {
+        assert(mode == TINY_HEAP_GC);
+    }
 
-        case TINY_OP_PUSH_STRUCT: {
-            ++thread->pc;
-            Word nFields = state->program[thread->pc++];
-            assert(nFields > 0);
+    // Nothing is ever collected in a region
+    UpdateNextGCBytes(thread);
 
-            Tiny_Object *obj = NewStructObject(thread, nFields);
-            memcpy(obj->ostruct.fields, &thread->stack[thread->sp - nFields],
-                   sizeof(Tiny_Value) * nFields);
-            thread->sp -= nFields;
+    thread->globalVars = NULL;
 
-            DoPush(thread, (Tiny_Value){.type = TINY_VAL_STRUCT, .obj = obj});
-        } break;
+    thread->pc = -1;
+    thread->fp = thread->sp = 0;
 
-        case TINY_OP_STRUCT_GET: {
-            ++thread->pc;
-            Word i = state->program[thread->pc++];
-            Tiny_Value *vstruct = &thread->stack[thread->sp - 1];
+    thread->retVal = Tiny_Null;
 
-            assert(vstruct->type == TINY_VAL_STRUCT);
-            assert(i >= 0 && i < vstruct->obj->ostruct.n);
+    thread->stack = NULL;
+    thread->stackCap = 0;
 
-            *vstruct = vstruct->obj->ostruct.fields[i];
-        } break;
+    thread->fc = 0;
+    thread->frames = NULL;
+    thread->frameCap = 0;
 
-        case TINY_OP_STRUCT_SET: {
-            ++thread->pc;
-            Word i = state->program[thread->pc++];
+    thread->error = NULL;
 
-            Tiny_Value vstruct = DoPop(thread);
-            Tiny_Value val = DoPop(thread);
+    thread->yielded = false;
+    thread->pushRetValOnResume = false;
 
-            assert(vstruct.type == TINY_VAL_STRUCT);
-            assert(i >= 0 && i < vstruct.obj->ostruct.n);
+    thread->userdata = NULL;
 
-            vstruct.obj->ostruct.fields[i] = val;
-        } break;
+#ifdef TINY_PROFILE_OPCODE_PAIRS
+    thread->opcodePairCounts = TMalloc(&thread->ctx, sizeof(uint64_t) * 256 * 256);
+    memset(thread->opcodePairCounts, 0, sizeof(uint64_t) * 256 * 256);
 
-#define BIN_OP(OP, operator)                                      \
-    case TINY_OP_##OP: {                                          \
-        Tiny_Value *a = &thread->stack[thread->sp - 2];           \
-        Tiny_Value b = thread->stack[--thread->sp];               \
-        if (a->type == TINY_VAL_INT && b.type == TINY_VAL_INT) {  \
-            a->i = a->i operator b.i;                             \
-        } else {                                                  \
-            if (a->type == TINY_VAL_INT) a->f = (Tiny_Float)a->i; \
-            if (b.type == TINY_VAL_INT) b.f = (Tiny_Float)b.i;    \
-            a->type = TINY_VAL_FLOAT;                             \
-            a->f = a->f operator b.f;                             \
-        }                                                         \
-        ++thread->pc;                                             \
-    } break;
+    thread->prevOpcode = -1;
+#endif
+}
 
-#define BIN_OP_INT(OP, operator)                             \
-    case TINY_OP_##OP: {                                     \
-        Tiny_Value val2 = DoPop(thread);                     \
-        Tiny_Value val1 = DoPop(thread);                     \
-        DoPush(thread, Tiny_NewInt(val1.i operator val2.i)); \
-        ++thread->pc;                                        \
-    } break;
+void Tiny_InitThread(Tiny_StateThread *thread, const Tiny_State *state) {
+    Tiny_InitThreadWithContext(thread, state, Tiny_DefaultContext);
+}
 
-#define REL_OP(OP, operator)                                                     \
-    case TINY_OP_##OP: {                                                         \
-        Tiny_Value *a = &thread->stack[thread->sp - 2];                          \
-        Tiny_Value b = thread->stack[--thread->sp];                              \
-        bool result;                                                             \
-        if (a->type == TINY_VAL_FLOAT || b.type == TINY_VAL_FLOAT) {             \
-            Tiny_Float af = (a->type == TINY_VAL_INT) ? (Tiny_Float)a->i : a->f; \
-            Tiny_Float bf = (b.type == TINY_VAL_INT) ? (Tiny_Float)b.i : b.f;    \
-            result = af operator bf;                                             \
-        } else {                                                                 \
-            result = a->i operator b.i;                                          \
-        }                                                                        \
-        a->type = TINY_VAL_BOOL;                                                 \
-        a->boolean = result;                                                     \
-        ++thread->pc;                                                            \
-    } break;
+static void AllocGlobals(Tiny_StateThread *thread) {
+    // If the global variables haven't been allocated yet,
+    // do that
+    if (!thread->globalVars) {
+        thread->globalVars =
+            TMalloc(&thread->ctx, sizeof(Tiny_Value) * thread->state->numGlobalVars);
+        memset(thread->globalVars, 0, sizeof(Tiny_Value) * thread->state->numGlobalVars);
+    }
+}
 
-            BIN_OP(ADD, +)
-            BIN_OP(SUB, -)
-            BIN_OP(MUL, *)
-            BIN_OP(DIV, /)
-            BIN_OP_INT(MOD, %)
-            BIN_OP_INT(OR, |)
-            BIN_OP_INT(AND, &)
-            BIN_OP_INT(SHIFT_LEFT, <<)
-            BIN_OP_INT(SHIFT_RIGHT, >>)
-
-            REL_OP(LT, <)
-            REL_OP(GT, >)
-            REL_OP(GTE, >=)
-            REL_OP(LTE, <=)
+void Tiny_StartThread(Tiny_StateThread *thread) {
+    AllocGlobals(thread);
 
-#undef BIN_OP
-#undef BIN_OP_INT
-#undef REL_OP
+    // TODO: Eventually move to an actual entry point
+    thread->pc = 0;
+}
 
-        case TINY_OP_ADD1: {
-            ++thread->pc;
-            thread->stack[thread->sp - 1].i += 1;
-        } break;
+static int64_t Execute(Tiny_StateThread *thread, int stopFc, int64_t maxCycles);
 
-        case TINY_OP_SUB1: {
-            ++thread->pc;
-            thread->stack[thread->sp - 1].i -= 1;
-        } break;
+int Tiny_GetGlobalIndex(const Tiny_State *state, const char *name) {
+    for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
+        Tiny_Symbol *sym = state->globalSymbols[i];
 
-        case TINY_OP_EQU: {
-            ++thread->pc;
-            Tiny_Value b = DoPop(thread);
-            Tiny_Value a = DoPop(thread);
-            DoPush(thread, Tiny_NewBool(Tiny_AreValuesEqual(a, b)));
-        } break;
+        if (sym->type == TINY_SYM_GLOBAL && strcmp(sym->name, name) == 0) {
+            return sym->var.index;
+        }
+    }
 
-        case TINY_OP_LOG_NOT: {
-            ++thread->pc;
-            Tiny_Value a = DoPop(thread);
-            DoPush(thread, Tiny_NewBool(!ExpectBool(a)));
-        } break;
+    return -1;
+}
 
-        case TINY_OP_SET: {
-            ++thread->pc;
-            Tiny_ConstantIndex varIdx = ReadConstIndex(thread);
-            thread->globalVars[varIdx] = DoPop(thread);
-        } break;
+int Tiny_GetFunctionIndex(const Tiny_State *state, const char *name) {
+    for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
+        Tiny_Symbol *sym = state->globalSymbols[i];
 
-        case TINY_OP_GET: {
-            ++thread->pc;
-            Tiny_ConstantIndex varIdx = ReadConstIndex(thread);
-            DoPush(thread, thread->globalVars[varIdx]);
-        } break;
+        if (sym->type == TINY_SYM_FUNCTION && strcmp(sym->name, name) == 0) {
+            return sym->func.index;
+        }
+    }
 
-        case TINY_OP_GOTO: {
-            ++thread->pc;
-            Tiny_ConstantIndex newPc = ReadConstIndex(thread);
-            thread->pc = newPc;
-        } break;
+    return -1;
+}
 
-        case TINY_OP_GOTOZ: {
-            ++thread->pc;
-            Tiny_ConstantIndex newPc = ReadConstIndex(thread);
-            Tiny_Value val = DoPop(thread);
-            if (!ExpectBool(val)) thread->pc = newPc;
-        } break;
+static bool ReserveStack(Tiny_StateThread *thread, int n);
+static bool DoPushIndir(Tiny_StateThread *thread, uint8_t nargs);
+static void StopWithError(Tiny_StateThread *thread, const char *error);
 
-        case TINY_OP_CALL: {
-            ++thread->pc;
-            Word nargs = state->program[thread->pc++];
-            Tiny_ConstantIndex funcIdx = ReadConstIndex(thread);
-            DoPushIndir(thread, nargs);
-            thread->pc = state->functionPcs[funcIdx];
-        } break;
+Tiny_Value Tiny_GetGlobal(const Tiny_StateThread *thread, int globalIndex) {
+    assert(globalIndex >= 0 && globalIndex < thread->state->numGlobalVars);
+    assert(thread->globalVars);
 
-        case TINY_OP_RETURN: {
-            thread->retVal = Tiny_Null;
-            DoPopIndir(thread);
-        } break;
+    return thread->globalVars[globalIndex];
+}
 
-        case TINY_OP_RETURN_VALUE: {
-            thread->retVal = DoPop(thread);
-            DoPopIndir(thread);
-        } break;
+void Tiny_SetGlobal(Tiny_StateThread *thread, int globalIndex, Tiny_Value value) {
+    assert(globalIndex >= 0 && globalIndex < thread->state->numGlobalVars);
+    assert(thread->globalVars);
 
-        case TINY_OP_CALLF: {
-            ++thread->pc;
-            Word nargs = state->program[thread->pc++];
-            Tiny_ConstantIndex fIdx = ReadConstIndex(thread);
-            int prevSize = thread->sp - nargs;
-            thread->retVal = state->foreignFunctions[fIdx](thread, &thread->stack[prevSize], nargs);
-            thread->sp = prevSize;
-        } break;
+    thread->globalVars[globalIndex] = value;
+}
 
-        case TINY_OP_GETLOCAL: {
-            ++thread->pc;
-            Tiny_ConstantIndex localIdx = ReadConstIndex(thread);
-            DoPush(thread, thread->stack[thread->fp + localIdx]);
-        } break;
+Tiny_Value Tiny_CallFunction(Tiny_StateThread *thread, int functionIndex, const Tiny_Value *args,
+                             int count) {
+    assert(thread->state && functionIndex >= 0);
 
-        case TINY_OP_GETLOCAL_W: {
-            ++thread->pc;
-            Word localIdx = state->program[thread->pc++];
-            DoPush(thread, thread->stack[thread->fp + localIdx]);
-        } break;
+    int pc, fp, sp, fc;
 
-        case TINY_OP_SETLOCAL: {
-            ++thread->pc;
-            Tiny_ConstantIndex localIdx = ReadConstIndex(thread);
-            thread->stack[thread->fp + localIdx] = DoPop(thread);
-        } break;
+    pc = thread->pc;
+    fp = thread->fp;
+    sp = thread->sp;
+    fc = thread->fc;
 
-        case TINY_OP_GET_RETVAL: {
-            ++thread->pc;
-            DoPush(thread, thread->retVal);
-        } break;
+    Tiny_Value retVal = thread->retVal;
 
-        case TINY_OP_HALT: {
-            thread->pc = -1;
-        } break;
+    AllocGlobals(thread);
 
-        case TINY_OP_MISALIGNED_INSTRUCTION: {
-            assert(false && "Misaligned instruction encountered");
-        } break;
+    // The args could be on this thread's stack (e.g. when a foreign function passes its own args
+    // along, possibly after they've been popped), in which case they move with it if it grows.
+    const Tiny_Value *stack = thread->stack;
+    bool argsOnStack = stack && args >= stack && args < stack + thread->stackCap;
 
-        default: {
-            assert(false && "Unknown opcode encountered");
-        } break;
+    if (!ReserveStack(thread, count)) {
+        StopWithError(thread, "Stack overflow");
+        return Tiny_Null;
     }
 
-    if (thread->numObjects >= thread->maxNumObjects) {
-        GarbageCollect(thread);
+    if (argsOnStack) {
+        args = thread->stack + (args - stack);
     }
 
-    return true;
-}
+    for (int i = 0; i < count; ++i) {
+        thread->stack[thread->sp++] = args[i];
+    }
 
-static Tiny_Expr *Expr_create(Tiny_ExprType type, Tiny_State *state) {
-    Tiny_Expr *exp = Tiny_ArenaAlloc(&state->parserArena, sizeof(Tiny_Expr), sizeof(void *));
+    thread->pc = thread->state->functionPcs[functionIndex];
 
-    exp->next = NULL;
-    exp->pos = state->l.pos;
-    exp->lineNumber = state->l.lineNumber;
-    exp->type = type;
+    if (!DoPushIndir(thread, count)) {
+        thread->sp = sp;
+        StopWithError(thread, "Stack overflow");
+        return Tiny_Null;
+    }
 
-    exp->tag = NULL;
+    // Keep executing until the indir stack is restored (i.e. function is done)
+    Execute(thread, fc, INT64_MAX);
 
-    return exp;
-}
+    Tiny_Value newRetVal = thread->retVal;
 
-static Tiny_Expr *ParseExpr(Tiny_State *state);
+    // If the function ran into an error the thread can't carry on from where it was
+    if (thread->error) {
+        pc = -1;
+    }
 
-static void GetExpectTokenSL(Tiny_State *state, Tiny_TokenKind tok, const char *msg) {
-    Tiny_GetToken(&state->l);
-    if (state->l.lastTok != tok) {
-        ReportErrorSL(state, msg);
-    }
-}
-
-static void ReportErrorE(Tiny_State *state, const Tiny_Expr *exp, const char *s, ...) {
-    va_list args;
-    va_start(args, s);
-
-    state->compileErrorResult.type = TINY_COMPILE_ERROR;
-
-    Tiny_FormatErrorV(state->compileErrorResult.error.msg,
-                      sizeof(state->compileErrorResult.error.msg), state->l.fileName, state->l.src,
-                      exp->pos, s, args);
+    thread->pc = pc;
+    thread->fp = fp;
+    thread->sp = sp;
+    thread->fc = fc;
 
-    va_end(args);
+    thread->retVal = retVal;
 
-    longjmp(state->compileErrorJmpBufs[state->compileCallNestCount - 1], 1);
+    return newRetVal;
 }
 
-static void ReportErrorS(Tiny_State *state, const Tiny_Symbol *sym, const char *s, ...) {
-    va_list args;
-    va_start(args, s);
+bool Tiny_ExecuteCycle(Tiny_StateThread *thread) { return Execute(thread, -1, 1) > 0; }
 
-    state->compileErrorResult.type = TINY_COMPILE_ERROR;
+void Tiny_Run(Tiny_StateThread *thread) { Execute(thread, -1, INT64_MAX); }
 
-    Tiny_FormatErrorV(state->compileErrorResult.error.msg,
-                      sizeof(state->compileErrorResult.error.msg), state->l.fileName, state->l.src,
-                      sym->pos, s, args);
+Tiny_RunResult Tiny_RunBudget(Tiny_StateThread *thread, int64_t maxCycles, int64_t *executed) {
+    int64_t cycles = Execute(thread, -1, maxCycles);
 
-    va_end(args);
+    if (executed) {
+        *executed = cycles;
+    }
 
-    longjmp(state->compileErrorJmpBufs[state->compileCallNestCount - 1], 1);
-}
+    if (thread->error) {
+        return TINY_RUN_ERROR;
+    }
 
-static void ExpectTokenL(Tiny_State *state, Tiny_Lexer *l, Tiny_TokenKind tok, const char *msg) {
-    if (l->lastTok != tok) {
-        ReportErrorL(state, l, msg);
+    if (thread->pc < 0) {
+        return TINY_RUN_DONE;
     }
-}
 
-static void ExpectTokenSL(Tiny_State *state, Tiny_TokenKind tok, const char *msg) {
-    ExpectTokenL(state, &state->l, tok, msg);
+    return thread->yielded ? TINY_RUN_YIELDED : TINY_RUN_BUDGET_EXHAUSTED;
 }
 
-static Tiny_Symbol *DeclareStruct(Tiny_State *state, const char *name, bool search) {
-    if (search) {
-        Tiny_Symbol *s = FindSymbol(state, name, ST_MASK(TINY_SYM_TAG_STRUCT));
-        if (s) return s;
-    }
-
-    Tiny_Symbol *s = Symbol_create(TINY_SYM_TAG_STRUCT, name, state);
+void Tiny_YieldThread(Tiny_StateThread *thread) { thread->yielded = true; }
 
-    s->sstruct.defined = false;
-    s->sstruct.fields = NULL;
+void Tiny_DestroyThread(Tiny_StateThread *thread) {
+    thread->pc = -1;
 
-    sb_push(&state->ctx, state->globalSymbols, s);
+    if (thread->region) {
+        // The objects themselves are freed along with the region
+        for (Tiny_Object *obj = thread->gcHead; obj; obj = obj->next) {
+            FinalizeObject(thread, obj);
+        }
 
-    return s;
-}
+        thread->gcHead = NULL;
 
-static Tiny_Symbol *GetTagFromName(Tiny_State *state, const char *name, bool declareStruct) {
-    if (strcmp(name, "void") == 0)
-        return GetPrimTag(TINY_SYM_TAG_VOID);
-    else if (strcmp(name, "bool") == 0)
-        return GetPrimTag(TINY_SYM_TAG_BOOL);
-    else if (strcmp(name, "int") == 0)
-        return GetPrimTag(TINY_SYM_TAG_INT);
-    else if (strcmp(name, "float") == 0)
-        return GetPrimTag(TINY_SYM_TAG_FLOAT);
-    else if (strcmp(name, "str") == 0)
-        return GetPrimTag(TINY_SYM_TAG_STR);
-    else if (strcmp(name, "any") == 0)
-        return GetPrimTag(TINY_SYM_TAG_ANY);
-    else {
-        for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
-            Tiny_Symbol *s = state->globalSymbols[i];
+        Tiny_DestroyArena(thread->region);
+        TFree(&thread->ctx, thread->region);
 
-            if ((s->type == TINY_SYM_TAG_FOREIGN || s->type == TINY_SYM_TAG_STRUCT) &&
-                strcmp(s->name, name) == 0) {
-                return s;
-            }
-        }
+        thread->region = NULL;
+    }
 
-        if (declareStruct) {
-            return DeclareStruct(state, name, false);
-        }
+    // Free all objects in the gc list (and the ones waiting to be swept, if a collection was in
+    // progress)
+    while (thread->gcHead) {
+        Tiny_Object *next = thread->gcHead->next;
+        DeleteObject(thread, thread->gcHead);
+        thread->gcHead = next;
     }
 
-    return NULL;
-}
+    while (thread->sweepList) {
+        Tiny_Object *next = thread->sweepList->next;
+        DeleteObject(thread, thread->sweepList);
+        thread->sweepList = next;
+    }
 
-static const char *GetTagName(const Tiny_Symbol *tag);
+    sb_free(&thread->ctx, thread->grayStack);
 
-static Tiny_Symbol *GetFieldTag(Tiny_Symbol *s, const char *name, int *index) {
-    assert(s->type == TINY_SYM_TAG_STRUCT);
-    assert(s->sstruct.defined);
+    // The strings in a region are gone without having been uninterned, so this has to be done
+    // after freeing the objects
+    TFree(&thread->ctx, thread->internTable);
 
-    for (int i = 0; i < sb_count(s->sstruct.fields); ++i) {
-        Tiny_Symbol *f = s->sstruct.fields[i];
+    thread->internTable = NULL;
+    thread->internCapacity = 0;
+    thread->internCount = 0;
 
-        if (strcmp(f->name, name) == 0) {
-            if (index) *index = i;
-            return f->fieldTag;
-        }
+    while (thread->objectSlabs) {
+        Tiny_ObjectSlab *next = thread->objectSlabs->next;
+        TFree(&thread->ctx, thread->objectSlabs);
+        thread->objectSlabs = next;
     }
 
-    if (index) *index = -1;
+    memset(thread->objectFreeLists, 0, sizeof(thread->objectFreeLists));
 
-    return NULL;
+    // Free all global variables
+    TFree(&thread->ctx, thread->globalVars);
+
+    TFree(&thread->ctx, thread->stack);
+    TFree(&thread->ctx, thread->frames);
+
+#ifdef TINY_PROFILE_OPCODE_PAIRS
+    TFree(&thread->ctx, thread->opcodePairCounts);
+#endif
 }
 
-static Tiny_TokenKind GetNextToken(Tiny_State *state) { return Tiny_GetToken(&state->l); }
+static void GenerateCode(Tiny_State *state, Word inst) {
+    sb_push(&state->ctx, state->program, inst);
+}
 
-static Tiny_Symbol *ParseTypeL(Tiny_State *state, Tiny_Lexer *l) {
-    ExpectTokenL(state, l, TINY_TOK_IDENT, "Expected identifier for typename.");
+// Tiny_State* state, const T* value, int* pPos
+//
+// Writes out the bytes for T, storing starting pos in pPos.
+//
+// Operands are not aligned (they're always read with memcpy), so instructions are packed
+// without any padding between them.
+#define GEN_VALUE(state, pValue, pPos)                  \
+    do {                                                \
+        *pPos = sb_count(state->program);               \
+        Word *wp = (Word *)pValue;                      \
+        for (int i = 0; i < sizeof(*pValue); ++i) {     \
+            GenerateCode(state, *wp++);                 \
+        }                                               \
+    } while (0)
 
-    Tiny_Symbol *s = GetTagFromName(state, l->lexeme, true);
+// Same as GEN_VALUE but ignore position
+#define GEN_VALUE_NOPOS(state, pValue)  \
+    do {                                \
+        int pos = 0;                    \
+        GEN_VALUE(state, pValue, &pos); \
+    } while (0)
 
-    if (!s) {
-        ReportErrorL(state, l, "%s doesn't name a type.", l->lexeme);
+// Tiny_State* state, const T* pValue, int pc
+//
+// Writes out the value stored in pValue to bytecode stream at pc
+#define GEN_VALUE_AT(state, pValue, pc)             \
+    do {                                            \
+        Word *wp = (Word *)pValue;                  \
+        for (int i = 0; i < sizeof(*pValue); ++i) { \
+            state->program[pc + i] = *wp++;         \
+        }                                           \
+    } while (0)
+
+static int RegisterString(Tiny_State *state, const char *string) {
+    for (int i = 0; i < state->numStrings; ++i) {
+        if (strcmp(state->strings[i], string) == 0) return i;
     }
 
-    Tiny_GetToken(l);
+    assert(state->numStrings < MAX_STRINGS);
+    state->strings[state->numStrings++] = CloneString(&state->ctx, string);
 
-    return s;
+    return state->numStrings - 1;
 }
 
-static Tiny_Symbol *ParseTypeSL(Tiny_State *state) { return ParseTypeL(state, &state->l); }
-
-static Tiny_Expr *ParseStatement(Tiny_State *state);
-
-static Tiny_Expr *ParseIf(Tiny_State *state) {
-    Tiny_Expr *exp = Expr_create(TINY_EXP_IF, state);
+static Tiny_Symbol *GetPrimTag(Tiny_SymbolType type) {
+    static Tiny_Symbol prims[] = {{
+                                      TINY_SYM_TAG_VOID,
+                                      (char *)"void",
+                                  },
+                                  {
+                                      TINY_SYM_TAG_BOOL,
+                                      (char *)"bool",
+                                  },
+                                  {TINY_SYM_TAG_INT, (char *)"int"},
+                                  {TINY_SYM_TAG_FLOAT, (char *)"float"},
+                                  {TINY_SYM_TAG_STR, (char *)"str"},
+                                  {TINY_SYM_TAG_ANY, (char *)"any"}};
 
-    GetNextToken(state);
+    return &prims[type - TINY_SYM_TAG_VOID];
+}
 
-    exp->ifx.cond = ParseExpr(state);
-    exp->ifx.body = ParseStatement(state);
+static Tiny_Symbol *Symbol_create(Tiny_SymbolType type, const char *name, Tiny_State *state) {
+    Tiny_Symbol *sym = TMalloc(&state->ctx, sizeof(Tiny_Symbol));
 
-    if (state->l.lastTok == TINY_TOK_ELSE) {
-        GetNextToken(state);
-        exp->ifx.alt = ParseStatement(state);
-    } else
-        exp->ifx.alt = NULL;
+    sym->name = CloneString(&state->ctx, name);
+    sym->type = type;
+    sym->pos = state->l.pos;
 
-    return exp;
+    return sym;
 }
 
-static Tiny_Expr *ParseBlock(Tiny_State *state) {
-    assert(state->l.lastTok == TINY_TOK_OPENCURLY);
+static void Symbol_destroy(Tiny_Symbol *sym, Tiny_Context *ctx) {
+    if (sym->type == TINY_SYM_FUNCTION) {
+        for (int i = 0; i < sb_count(sym->func.args); ++i) {
+            Tiny_Symbol *arg = sym->func.args[i];
 
-    Tiny_Expr *exp = Expr_create(TINY_EXP_BLOCK, state);
+            assert(arg->type == TINY_SYM_LOCAL);
 
-    exp->blockHead = NULL;
-    Tiny_Expr *blockTail = NULL;
+            Symbol_destroy(arg, ctx);
+        }
 
-    GetNextToken(state);
+        sb_free(ctx, sym->func.args);
 
-    OpenScope(state);
+        for (int i = 0; i < sb_count(sym->func.locals); ++i) {
+            Tiny_Symbol *local = sym->func.locals[i];
 
-    while (state->l.lastTok != TINY_TOK_CLOSECURLY) {
-        Tiny_Expr *e = ParseStatement(state);
-        assert(e);
+            assert(local->type == TINY_SYM_LOCAL);
 
-        TINY_LL_APPEND(exp->blockHead, blockTail, e);
-    }
+            Symbol_destroy(local, ctx);
+        }
 
-    GetNextToken(state);
+        sb_free(ctx, sym->func.locals);
+    } else if (sym->type == TINY_SYM_FOREIGN_FUNCTION) {
+        sb_free(ctx, sym->foreignFunc.argTags);
+    } else if (sym->type == TINY_SYM_TAG_STRUCT) {
+        for (int i = 0; i < sb_count(sym->sstruct.fields); ++i) {
+            Symbol_destroy(sym->sstruct.fields[i], ctx);
+        }
 
-    CloseScope(state);
+        sb_free(ctx, sym->sstruct.fields);
+    }
 
-    return exp;
+    TFree(ctx, sym->name);
+    TFree(ctx, sym);
 }
 
-static Tiny_Expr *ParseFunc(Tiny_State *state) {
-    assert(state->l.lastTok == TINY_TOK_FUNC);
+static void OpenScope(Tiny_State *state) { ++state->currScope; }
 
+static void CloseScope(Tiny_State *state) {
     if (state->currFunc) {
-        ReportErrorSL(state, "Attempted to define function inside of function '%s'.",
-                      state->currFunc->name);
-    }
+        for (int i = 0; i < sb_count(state->currFunc->func.locals); ++i) {
+            Tiny_Symbol *sym = state->currFunc->func.locals[i];
 
-    Tiny_Expr *exp = Expr_create(TINY_EXP_PROC, state);
+            assert(sym->type == TINY_SYM_LOCAL);
 
-    GetExpectTokenSL(state, TINY_TOK_IDENT, "Function name must be identifier!");
+            if (sym->var.scope == state->currScope) {
+                sym->var.scopeEnded = true;
+            }
+        }
+    }
 
-    exp->proc.decl = DeclareFunction(state, state->l.lexeme);
-    state->currFunc = exp->proc.decl;
+    --state->currScope;
+}
 
-    GetExpectTokenSL(state, TINY_TOK_OPENPAREN, "Expected '(' after function name");
+#define ST_MASK(symType) (1UL << (symType))
 
-    GetNextToken(state);
+#define ST_MASK_FUNC (ST_MASK(TINY_SYM_FUNCTION) | ST_MASK(TINY_SYM_FOREIGN_FUNCTION))
+#define ST_MASK_VAR (ST_MASK(TINY_SYM_LOCAL) | ST_MASK(TINY_SYM_GLOBAL))
+#define ST_MASK_VAR_OR_CONST ST_MASK_VAR | ST_MASK(TINY_SYM_CONST)
 
-    typedef struct {
-        char *name;
-        Tiny_Symbol *tag;
-    } Arg;
+static Tiny_Symbol *FindSymbol(Tiny_State *state, const char *name, uint32_t mask) {
+    // This clever trick let's me unify the codepaths for symbols
+    // that can be named and can't be named
+    if (name == ANON_SYM_NAME) {
+        return NULL;
+    }
 
-    Arg *args = NULL;  // array
-
-    while (state->l.lastTok != TINY_TOK_CLOSEPAREN) {
-        ExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier in function parameter list");
-
-        Arg arg;
+    if (state->currFunc && ST_MASK(TINY_SYM_LOCAL) & mask) {
+        // Check local variables
+        for (int i = 0; i < sb_count(state->currFunc->func.locals); ++i) {
+            Tiny_Symbol *sym = state->currFunc->func.locals[i];
 
-        arg.name = CloneString(&state->ctx, state->l.lexeme);
-        GetNextToken(state);
+            assert(sym->type == TINY_SYM_LOCAL);
 
-        if (state->l.lastTok != TINY_TOK_COLON) {
-            ReportErrorSL(state, "Expected ':' after %s", arg.name);
+            // Make sure that it's available in the current scope too
+            if (!sym->var.scopeEnded && strcmp(sym->name, name) == 0) {
+                return sym;
+            }
         }
 
-        GetNextToken(state);
-
-        arg.tag = ParseTypeSL(state);
+        // Check arguments
+        for (int i = 0; i < sb_count(state->currFunc->func.args); ++i) {
+            Tiny_Symbol *sym = state->currFunc->func.args[i];
 
-        sb_push(&state->ctx, args, arg);
+            assert(sym->type == TINY_SYM_LOCAL);
 
-        if (state->l.lastTok != TINY_TOK_CLOSEPAREN && state->l.lastTok != TINY_TOK_COMMA) {
-            ReportErrorSL(state,
-                          "Expected ')' or ',' after parameter name in function "
-                          "parameter list.");
+            if (strcmp(sym->name, name) == 0) {
+                return sym;
+            }
         }
-
-        if (state->l.lastTok == TINY_TOK_COMMA) GetNextToken(state);
     }
 
-    for (int i = 0; i < sb_count(args); ++i) {
-        DeclareArgument(state, args[i].name, args[i].tag, sb_count(args));
-        TFree(&state->ctx, args[i].name);
+    for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
+        Tiny_Symbol *sym = state->globalSymbols[i];
+
+        if (ST_MASK(sym->type) & mask) {
+            if (strcmp(sym->name, name) == 0) return sym;
+        }
     }
 
-    sb_free(&state->ctx, args);
+    return NULL;
+}
 
-    GetNextToken(state);
+static Tiny_Symbol *DeclareGlobalVar(Tiny_State *state, const char *name) {
+    Tiny_Symbol *sym = FindSymbol(state, name, ST_MASK(TINY_SYM_GLOBAL) | ST_MASK(TINY_SYM_CONST));
 
-    if (state->l.lastTok != TINY_TOK_COLON) {
-        exp->proc.decl->func.returnTag = GetPrimTag(TINY_SYM_TAG_VOID);
-    } else {
-        GetNextToken(state);
-        exp->proc.decl->func.returnTag = ParseTypeSL(state);
+    if (sym) {
+        assert(sym->type == TINY_SYM_GLOBAL || sym->type == TINY_SYM_CONST);
+
+        ReportErrorSL(state,
+                      "Attempted to declare multiple global entities with the same "
+                      "name '%s'.",
+                      name);
     }
 
-    OpenScope(state);
+    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_GLOBAL, name, state);
 
-    exp->proc.body = ParseStatement(state);
+    newNode->var.initialized = false;
+    newNode->var.index = state->numGlobalVars;
+    newNode->var.scope = 0;  // Global variable scope don't matter
+    newNode->var.scopeEnded = false;
 
-    CloseScope(state);
+    sb_push(&state->ctx, state->globalSymbols, newNode);
 
-    state->currFunc = NULL;
+    state->numGlobalVars += 1;
 
-    return exp;
+    return newNode;
 }
 
-static Tiny_Symbol *ParseStruct(Tiny_State *state) {
-    if (state->currFunc) {
-        ReportErrorSL(state, "Attempted to declare struct inside func %s. Can't do that bruh.",
-                      state->currFunc->name);
-    }
+// This expects nargs to be known beforehand because arguments are
+// evaluated/pushed left-to-right so the first argument is actually at -nargs
+// position relative to frame pointer We could reverse it, but this works out
+// nicely for Foreign calls since we can just supply a pointer to the initial
+// arg instead of reversing them.
+static Tiny_Symbol *DeclareArgument(Tiny_State *state, const char *name, Tiny_Symbol *tag,
+                                    int nargs) {
+    assert(state->currFunc);
+    assert(tag);
 
-    Tiny_TokenPos pos = state->l.pos;
+    // At this time there would be no locals declared so this should be fine.
+    // Regardless, you shan't have locals + args have the same name.
+    Tiny_Symbol *prevSym = FindSymbol(state, name, ST_MASK(TINY_SYM_LOCAL));
+    if (prevSym) {
+        assert(prevSym->type == TINY_SYM_LOCAL);
 
-    GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after 'struct'.");
+        ReportErrorSL(state, "Function '%s' has multiple arguments with the name '%s'.\n",
+                      state->currFunc->name, name);
+    }
 
-    Tiny_Symbol *s = DeclareStruct(state, state->l.lexeme, true);
+    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_LOCAL, name, state);
 
-    if (s->sstruct.defined) {
-        ReportErrorSL(state, "Attempted to define struct %s multiple times.", state->l.lexeme);
-    }
+    newNode->var.initialized = false;
+    newNode->var.scopeEnded = false;
+    newNode->var.index = -nargs + sb_count(state->currFunc->func.args);
+    newNode->var.scope = 0;  // These should be accessible anywhere in the function
+    newNode->var.tag = tag;
 
-    s->pos = pos;
-    s->sstruct.defined = true;
+    sb_push(&state->ctx, state->currFunc->func.args, newNode);
 
-    GetExpectTokenSL(state, TINY_TOK_OPENCURLY, "Expected '{' after struct name.");
+    return newNode;
+}
 
-    GetNextToken(state);
+static Tiny_Symbol *DeclareLocal(Tiny_State *state, const char *name) {
+    assert(state->currFunc);
 
-    while (state->l.lastTok != TINY_TOK_CLOSECURLY) {
-        ExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier in struct fields.");
+    Tiny_Symbol *prevSym = FindSymbol(state, name, ST_MASK(TINY_SYM_LOCAL));
+    if (prevSym) {
+        assert(prevSym->type == TINY_SYM_LOCAL);
 
-        int count = sb_count(s->sstruct.fields);
+        ReportErrorSL(state,
+                      "Function '%s' has multiple locals in the same scope with "
+                      "name '%s'.\n",
+                      state->currFunc->name, name);
+    }
 
-        if (count >= UCHAR_MAX) {
-            ReportErrorSL(state, "Too many fields in struct.");
-        }
+    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_LOCAL, name, state);
 
-        for (int i = 0; i < count; ++i) {
-            if (strcmp(s->sstruct.fields[i]->name, state->l.lexeme) == 0) {
-                ReportErrorSL(state, "Declared multiple fields with the same name %s.",
-                              state->l.lexeme);
-            }
-        }
+    newNode->var.initialized = false;
+    newNode->var.scopeEnded = false;
+    newNode->var.index = sb_count(state->currFunc->func.locals);
+    newNode->var.scope = state->currScope;
 
-        Tiny_Symbol *f = Symbol_create(TINY_SYM_FIELD, state->l.lexeme, state);
+    sb_push(&state->ctx, state->currFunc->func.locals, newNode);
 
-        GetExpectTokenSL(state, TINY_TOK_COLON, "Expected ':' after field name.");
+    return newNode;
+}
 
-        GetNextToken(state);
+// Declares a local or global depending on whether we are inside a func
+static Tiny_Symbol *DeclareVar(Tiny_State *state, const char *name) {
+    return state->currFunc ? DeclareLocal(state, name) : DeclareGlobalVar(state, name);
+}
 
-        f->fieldTag = ParseTypeSL(state);
+static Tiny_Symbol *DeclareConst(Tiny_State *state, const char *name, Tiny_Symbol *tag) {
+    Tiny_Symbol *sym = FindSymbol(state, name, ST_MASK_VAR_OR_CONST);
 
-        sb_push(&state->ctx, s->sstruct.fields, f);
+    if (sym) {
+        assert(sym->type == TINY_SYM_CONST || sym->type == TINY_SYM_LOCAL ||
+               sym->type == TINY_SYM_GLOBAL);
+
+        ReportErrorSL(state,
+                      "Attempted to define constant with the same name '%s' as "
+                      "another value.\n",
+                      name);
     }
 
-    GetNextToken(state);
+    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_CONST, name, state);
 
-    if (!s->sstruct.fields) {
-        ReportErrorSL(state, "Struct must have at least one field.\n");
-    }
+    newNode->constant.tag = tag;
 
-    return s;
+    sb_push(&state->ctx, state->globalSymbols, newNode);
+
+    return newNode;
 }
 
-static Tiny_Expr *ParseCall(Tiny_State *state, Tiny_StringNode *ident) {
-    assert(state->l.lastTok == TINY_TOK_OPENPAREN);
+static Tiny_Symbol *DeclareFunction(Tiny_State *state, const char *name) {
+    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_FUNCTION, name, state);
 
-    Tiny_Expr *exp = Expr_create(TINY_EXP_CALL, state);
+    newNode->func.index = state->numFunctions;
+    newNode->func.args = NULL;
+    newNode->func.locals = NULL;
 
-    exp->call.argsHead = NULL;
-    Tiny_Expr *argsTail = NULL;
+    sb_push(&state->ctx, state->globalSymbols, newNode);
 
-    GetNextToken(state);
+    state->numFunctions += 1;
 
-    while (state->l.lastTok != TINY_TOK_CLOSEPAREN) {
-        TINY_LL_APPEND(exp->call.argsHead, argsTail, ParseExpr(state));
+    return newNode;
+}
 
-        if (state->l.lastTok == TINY_TOK_COMMA) {
-            GetNextToken(state);
-        } else if (state->l.lastTok != TINY_TOK_CLOSEPAREN) {
-            ReportErrorSL(state, "Expected ')' after call.");
-        }
+static Tiny_BindFunctionResultType BindFunction(Tiny_State *state, const char *name,
+                                                Tiny_Symbol **argTags, bool varargs,
+                                                Tiny_Symbol *returnTag, Tiny_ForeignFunction func) {
+    Tiny_Symbol *prevSym = FindSymbol(state, name, ST_MASK(TINY_SYM_FOREIGN_FUNCTION));
+    if (prevSym) {
+        assert(prevSym->type == TINY_SYM_FOREIGN_FUNCTION);
+        return TINY_BIND_FUNCTION_ERROR_DUPLICATE;
     }
 
-    exp->call.calleeName = ident;
+    Tiny_Symbol *newNode = Symbol_create(TINY_SYM_FOREIGN_FUNCTION, name, state);
 
-    GetNextToken(state);
-    return exp;
-}
+    newNode->foreignFunc.index = state->numForeignFunctions;
 
-static Tiny_Expr *ParseFactor(Tiny_State *state);
+    newNode->foreignFunc.argTags = argTags;
+    newNode->foreignFunc.varargs = varargs;
 
-static Tiny_Expr *ParseValue(Tiny_State *state) {
-    switch (state->l.lastTok) {
-        case TINY_TOK_NULL: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_NULL, state);
+    newNode->foreignFunc.returnTag = returnTag;
 
-            GetNextToken(state);
+    newNode->foreignFunc.callee = func;
 
-            return exp;
-        } break;
+    sb_push(&state->ctx, state->globalSymbols, newNode);
 
-        case TINY_TOK_BOOL: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_BOOL, state);
+    state->numForeignFunctions += 1;
 
-            exp->boolean = state->l.bValue;
+    return TINY_BIND_FUNCTION_SUCCESS;
+}
 
-            GetNextToken(state);
+static Tiny_Symbol *GetTagFromName(Tiny_State *state, const char *name, bool declareStruct);
 
-            return exp;
-        } break;
+void Tiny_RegisterType(Tiny_State *state, const char *name) {
+    Tiny_Symbol *s = GetTagFromName(state, name, false);
 
-        case TINY_TOK_IDENT: {
-            Tiny_TokenPos pos = state->l.pos;
-            int lineNumber = state->l.lineNumber;
+    if (s) {
+        if (s->type == TINY_SYM_TAG_STRUCT && !s->sstruct.defined) {
+            // If there's a struct that's undefined with the same name, the Tiny code is probably
+            // referring to this type that we're about to define here, so just update it in place
+            // to be an opaque foreign type.
+            s->type = TINY_SYM_TAG_FOREIGN;
+        }
 
-            Tiny_StringNode *ident = CreateExprStringNode(state, state->l.lexeme);
-            GetNextToken(state);
+        return;
+    }
 
-            if (state->l.lastTok == TINY_TOK_OPENPAREN) {
-                return ParseCall(state, ident);
-            }
+    s = Symbol_create(TINY_SYM_TAG_FOREIGN, name, state);
 
-            Tiny_Expr *exp = Expr_create(TINY_EXP_ID, state);
+    sb_push(&state->ctx, state->globalSymbols, s);
+}
 
-            exp->pos = pos;
-            exp->lineNumber = lineNumber;
+static Tiny_Symbol *ParseTypeL(Tiny_State *state, Tiny_Lexer *l);
 
-            exp->id.sym = FindSymbol(state, ident->value, ST_MASK_VAR_OR_CONST);
-            exp->id.name = ident;
+Tiny_BindFunctionResultType Tiny_BindFunction(Tiny_State *state, const char *sig,
+                                              Tiny_ForeignFunction func) {
+    Tiny_Lexer l;
 
-            return exp;
-        } break;
+    Tiny_InitLexer(&l, "(bind signature)", sig, state->ctx);
 
-        case TINY_TOK_MINUS:
-        case TINY_TOK_BANG: {
-            int op = state->l.lastTok;
-            GetNextToken(state);
-            Tiny_Expr *exp = Expr_create(TINY_EXP_UNARY, state);
-            exp->unary.op = op;
-            exp->unary.exp = ParseFactor(state);
+    Tiny_GetToken(&l);
 
-            return exp;
-        } break;
+    assert(l.lastTok == TINY_TOK_IDENT);
 
-        case TINY_TOK_CHAR: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_CHAR, state);
-            exp->iValue = state->l.iValue;
-            GetNextToken(state);
-            return exp;
-        } break;
+    char *name = CloneString(&state->ctx, l.lexeme);
 
-        case TINY_TOK_INT: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_INT, state);
-            exp->iValue = state->l.iValue;
-            GetNextToken(state);
-            return exp;
-        } break;
+    Tiny_GetToken(&l);
 
-        case TINY_TOK_FLOAT: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_FLOAT, state);
-            exp->fValue = state->l.fValue;
-            GetNextToken(state);
-            return exp;
-        } break;
+    if (l.lastTok != TINY_TOK_OPENPAREN) {
+        // Just the name
+        Tiny_BindFunctionResultType res =
+            BindFunction(state, name, NULL, true, GetPrimTag(TINY_SYM_TAG_ANY), func);
+        Tiny_DestroyLexer(&l);
 
-        case TINY_TOK_STRING: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_STRING, state);
-            exp->sIndex = RegisterString(state, state->l.lexeme);
-            GetNextToken(state);
-            return exp;
-        } break;
+        TFree(&state->ctx, name);
 
-        case TINY_TOK_OPENPAREN: {
-            GetNextToken(state);
-            Tiny_Expr *inner = ParseExpr(state);
+        return res;
+    }
 
-            ExpectTokenSL(state, TINY_TOK_CLOSEPAREN, "Expected matching ')' after previous '('");
-            GetNextToken(state);
+    Tiny_GetToken(&l);
 
-            Tiny_Expr *exp = Expr_create(TINY_EXP_PAREN, state);
-            exp->paren = inner;
-            return exp;
-        } break;
+    Tiny_Symbol **argTags = NULL;
+    bool varargs = false;
 
-        case TINY_TOK_NEW: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_CONSTRUCTOR, state);
+    for (;;) {
+        if (l.lastTok == TINY_TOK_CLOSEPAREN) {
+            break;
+        }
 
-            GetNextToken(state);
+        if (l.lastTok == TINY_TOK_COMMA) {
+            Tiny_GetToken(&l);
+        } else if (l.lastTok == TINY_TOK_ELLIPSIS) {
+            varargs = true;
+            Tiny_GetToken(&l);
+        } else {
+            Tiny_Symbol *s = ParseTypeL(state, &l);
 
-            Tiny_Symbol *tag = DeclareStruct(state, state->l.lexeme, true);
+            assert(s);
 
-            exp->constructor.structTag = tag;
+            sb_push(&state->ctx, argTags, s);
+        }
+    }
 
-            exp->constructor.argNamesHead = NULL;
-            Tiny_StringNode *argNamesTail = NULL;
+    assert(l.lastTok == TINY_TOK_CLOSEPAREN);
 
-            exp->constructor.argsHead = NULL;
-            Tiny_Expr *argsTail = NULL;
+    Tiny_GetToken(&l);
 
-            GetExpectTokenSL(state, TINY_TOK_OPENCURLY, "Expected '{' after struct name");
+    Tiny_Symbol *returnTag = GetPrimTag(TINY_SYM_TAG_ANY);
 
-            GetNextToken(state);
+    if (l.lastTok == TINY_TOK_COLON) {
+        Tiny_GetToken(&l);
 
-            while (state->l.lastTok != TINY_TOK_CLOSECURLY) {
-                if (state->l.lastTok == TINY_TOK_DOT) {
-                    // Named argument, .xyz = value
-                    GetExpectTokenSL(state, TINY_TOK_IDENT,
-                                     "Expected identifier after '.' in designated initializer.");
+        returnTag = ParseTypeL(state, &l);
+        assert(returnTag);
+    }
 
-                    Tiny_StringNode *ident = CreateExprStringNode(state, state->l.lexeme);
+    Tiny_BindFunctionResultType res = BindFunction(state, name, argTags, varargs, returnTag, func);
 
-                    TINY_LL_APPEND(exp->constructor.argNamesHead, argNamesTail, ident);
+    Tiny_DestroyLexer(&l);
 
-                    GetExpectTokenSL(state, TINY_TOK_EQUAL,
-                                     "Expected = after designated initializer");
+    TFree(&state->ctx, name);
 
-                    GetNextToken(state);
-                }
+    return res;
+}
 
-                Tiny_Expr *e = ParseExpr(state);
+void Tiny_BindConstBool(Tiny_State *state, const char *name, bool b) {
+    DeclareConst(state, name, GetPrimTag(TINY_SYM_TAG_BOOL))->constant.bValue = b;
+}
 
-                TINY_LL_APPEND(exp->constructor.argsHead, argsTail, e);
+void Tiny_BindConstInt(Tiny_State *state, const char *name, Tiny_Int i) {
+    DeclareConst(state, name, GetPrimTag(TINY_SYM_TAG_INT))->constant.iValue = i;
+}
 
-                if (state->l.lastTok != TINY_TOK_CLOSECURLY && state->l.lastTok != TINY_TOK_COMMA) {
-                    ReportErrorSL(state, "Expected '}' or ',' in constructor arg list.");
-                }
+void Tiny_BindConstFloat(Tiny_State *state, const char *name, Tiny_Float f) {
+    DeclareConst(state, name, GetPrimTag(TINY_SYM_TAG_FLOAT))->constant.fValue = f;
+}
 
-                if (state->l.lastTok == TINY_TOK_COMMA) GetNextToken(state);
-            }
+void Tiny_BindConstString(Tiny_State *state, const char *name, const char *string) {
+    DeclareConst(state, name, GetPrimTag(TINY_SYM_TAG_STR))->constant.sIndex =
+        RegisterString(state, string);
+}
 
-            GetNextToken(state);
+// const Tiny_State* state, int* pPC, T* pDest
+//
+// Reads T at pPC and advances it
+#define READ_VALUE_AT(state, pPC, pDest)                      \
+    do {                                                      \
+        memcpy(pDest, state->program + *pPC, sizeof(*pDest)); \
+        *pPC += sizeof(*pDest) / sizeof(Word);                \
+    } while (0)
 
-            return exp;
-        } break;
+// Makes sure there's room for at least `n` more values on the stack, growing it if there isn't.
+// Returns false if that would make it bigger than TINY_THREAD_STACK_SIZE.
+static bool ReserveStack(Tiny_StateThread *thread, int n) {
+    if (thread->stackCap - thread->sp >= n) {
+        return true;
+    }
 
-        case TINY_TOK_CAST: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_CAST, state);
+    int needed = thread->sp + n;
 
-            GetExpectTokenSL(state, TINY_TOK_OPENPAREN, "Expected '(' after cast");
+    if (needed > TINY_THREAD_STACK_SIZE) {
+        return false;
+    }
 
-            GetNextToken(state);
+    // Round up to a whole number of chunks, at least doubling the size so that deep recursion
+    // doesn't have to grow the stack over and over
+    int newCap = thread->stackCap * 2;
 
-            exp->cast.value = ParseExpr(state);
+    if (newCap < needed) {
+        newCap = needed;
+    }
 
-            ExpectTokenSL(state, TINY_TOK_COMMA, "Expected ',' after cast value");
+    newCap = (newCap + TINY_THREAD_STACK_CHUNK_SIZE - 1) / TINY_THREAD_STACK_CHUNK_SIZE *
+             TINY_THREAD_STACK_CHUNK_SIZE;
 
-            GetNextToken(state);
+    if (newCap > TINY_THREAD_STACK_SIZE) {
+        newCap = TINY_THREAD_STACK_SIZE;
+    }
 
-            exp->cast.tag = ParseTypeSL(state);
+    thread->stack = TRealloc(&thread->ctx, thread->stack, sizeof(Tiny_Value) * newCap);
+    thread->stackCap = newCap;
 
-            ExpectTokenSL(state, TINY_TOK_CLOSEPAREN,
-                          "Expected ')' to match previous '(' after cast.");
+    return true;
+}
 
-            GetNextToken(state);
+// Makes sure there's room to push another frame. Returns false if the thread already has
+// TINY_THREAD_MAX_CALL_DEPTH frames.
+static bool ReserveFrame(Tiny_StateThread *thread) {
+    if (thread->fc < thread->frameCap) {
+        return true;
+    }
 
-            while (state->l.lastTok == TINY_TOK_DOT) {
-                Tiny_Expr *e = Expr_create(TINY_EXP_DOT, state);
+    if (thread->fc >= TINY_THREAD_MAX_CALL_DEPTH) {
+        return false;
+    }
 
-                GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after '.'");
+    int newCap = thread->frameCap ? thread->frameCap * 2 : TINY_THREAD_STACK_CHUNK_SIZE / 4;
 
-                e->dot.lhs = exp;
-                e->dot.field = CreateExprStringNode(state, state->l.lexeme);
+    if (newCap > TINY_THREAD_MAX_CALL_DEPTH) {
+        newCap = TINY_THREAD_MAX_CALL_DEPTH;
+    }
 
-                GetNextToken(state);
+    thread->frames = TRealloc(&thread->ctx, thread->frames, sizeof(Tiny_Frame) * newCap);
+    thread->frameCap = newCap;
 
-                exp = e;
-            }
+    return true;
+}
 
-            return exp;
-        } break;
+static bool DoPushIndir(Tiny_StateThread *thread, uint8_t nargs) {
+    if (!ReserveFrame(thread)) {
+        return false;
+    }
 
-        // This is effectively a ternary
-        case TINY_TOK_IF: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_IF_TERNARY, state);
+    thread->frames[thread->fc++] = (Tiny_Frame){thread->pc, thread->fp, nargs};
+    thread->fp = thread->sp;
 
-            GetNextToken(state);
+    return true;
+}
 
-            exp->ifx.cond = ParseExpr(state);
+static void StopWithError(Tiny_StateThread *thread, const char *error) {
+    thread->error = error;
+    thread->pc = -1;
+}
 
-            // Body and else statement must evaluate to a value
-            exp->ifx.body = ParseExpr(state);
+inline static bool ExpectBool(const Tiny_Value value) {
+    assert(Tiny_GetType(value) == TINY_VAL_BOOL);
+    return Tiny_AsBool(value);
+}
 
-            ExpectTokenSL(state, TINY_TOK_ELSE,
-                          "Expected 'else' after true value in if expression");
+// With GCC/Clang the interpreter threads its dispatch through a table of label addresses, so
+// every handler jumps straight to the handler of the next instruction instead of going back
+// through a single shared switch. Define TINY_NO_COMPUTED_GOTO to force the portable switch.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(TINY_NO_COMPUTED_GOTO)
+#define TINY_COMPUTED_GOTO
+#endif
 
-            GetNextToken(state);
+// Runs the thread until it halts, until its call stack unwinds to `stopFc` frames (this is how
+// Tiny_CallFunction knows its function returned) or until `maxCycles` instructions have been
+// executed. Returns the number of instructions executed.
+//
+// The pc, stack pointer and frame pointer are kept in locals for the duration of the loop. They
+// are only written back to the thread when something outside the loop could observe them: calls
+// into foreign functions, garbage collection, and on the way out.
+static int64_t Execute(Tiny_StateThread *thread, int stopFc, int64_t maxCycles) {
+    assert(thread && thread->state);
 
-            exp->ifx.alt = ParseExpr(state);
+    if (thread->pc < 0) return 0;
 
-            return exp;
-        } break;
+    const Tiny_State *state = thread->state;
 
-        case TINY_TOK_LEXER_ERROR: {
-            assert(state->l.errorMsg);
-            ReportErrorSL(state, state->l.errorMsg);
-            return NULL;
-        } break;
+    const Word *program = state->program;
+    const Word *ip = program + thread->pc;
 
-        default:
-            break;
-    }
+    // The stack can move when it grows (see GROW_STACK), so these aren't const
+    Tiny_Value *stack = thread->stack;
+    Tiny_Value *stackEnd = stack + thread->stackCap;
+    Tiny_Value *sp = stack + thread->sp;
+    Tiny_Value *fp = stack + thread->fp;
 
-    ReportErrorSL(state, "Unexpected token '%s'\n", state->l.lexeme);
-    return NULL;
-}
+    int64_t budget = maxCycles;
 
-static Tiny_Expr *ParseSuffix(Tiny_State *state, Tiny_Expr *lhs) {
-    Tiny_Expr *exp = lhs;
+#define SAVE_REGS()                              \
+    do {                                         \
+        thread->pc = (int)(ip - program);        \
+        thread->sp = (int)(sp - stack);          \
+        thread->fp = (int)(fp - stack);          \
+    } while (0)
 
-    while (state->l.lastTok == TINY_TOK_DOT || state->l.lastTok == TINY_TOK_ARROW ||
-           state->l.lastTok == TINY_TOK_OPENSQUARE) {
-        if (state->l.lastTok == TINY_TOK_OPENSQUARE) {
-            // This is the "index" operator. Unlike the arrow operator below, we can't just
-            // rewrite it as we're going here because it relies on the type of the expression
-            // to generate the code correctly.
-            GetNextToken(state);
+// Makes room for n more values on the stack, pointing the locals at wherever it ends up
+#define GROW_STACK(n)                                     \
+    do {                                                  \
+        SAVE_REGS();                                      \
+        if (!ReserveStack(thread, (n))) goto overflow;    \
+        stack = thread->stack;                            \
+        stackEnd = stack + thread->stackCap;              \
+        sp = stack + thread->sp;                          \
+        fp = stack + thread->fp;                          \
+    } while (0)
 
-            Tiny_Expr *e = Expr_create(TINY_EXP_INDEX, state);
+#define PUSH(value)                        \
+    do {                                   \
+        if (sp == stackEnd) GROW_STACK(1); \
+        *sp++ = (value);                   \
+    } while (0)
 
-            e->index.arr = exp;
-            e->index.elem = ParseExpr(state);
+#define POP() (*--sp)
 
-            ExpectTokenSL(state, TINY_TOK_CLOSESQUARE, "Expected ']' after '[' and expression");
-            GetNextToken(state);
+// Operands are unaligned (see GEN_VALUE)
+#define READ_OPERAND(pDest)                     \
+    do {                                        \
+        memcpy(pDest, ip, sizeof(*pDest));      \
+        ip += sizeof(*pDest) / sizeof(Word);    \
+    } while (0)
 
-            exp = e;
-            continue;
-        }
+#ifdef TINY_PROFILE_OPCODE_PAIRS
+#define PROFILE_OPCODE()                                                               \
+    do {                                                                               \
+        if (thread->prevOpcode >= 0) {                                                 \
+            thread->opcodePairCounts[thread->prevOpcode * 256 + *ip] += 1;             \
+        }                                                                              \
+        thread->prevOpcode = *ip;                                                      \
+    } while (0)
+#else
+#define PROFILE_OPCODE()
+#endif
 
-        if (state->l.lastTok == TINY_TOK_ARROW) {
-            // There is always a call on the rhs of an arrow.
-            GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after ->");
+// Objects are only allocated by PUSH_STRUCT and foreign functions, so those are the only places
+// this is checked
+#define COLLECT_IF_NEEDED()                                      \
+    do {                                                         \
+        if (thread->gcPhase != TINY_GC_IDLE ||                   \
+            thread->heapBytes >= thread->nextGCBytes) {          \
+            SAVE_REGS();                                         \
+            GarbageCollect(thread, thread->gcPauseBudgetMicros); \
+        }                                                        \
+    } while (0)
 
-            // Since the arrow "operator" is just syntax sugar, we
-            // actually rewrite the AST as we're producing it rather
-            // than doing some transformation later.
+    // Resuming after a foreign function yielded (see Tiny_YieldThread). A Tiny_CallFunction made
+    // while the thread is yielded (i.e. stopFc >= 0) leaves that alone.
+    if (thread->yielded && stopFc < 0) {
+        thread->yielded = false;
 
-            Tiny_StringNode *ident = CreateExprStringNode(state, state->l.lexeme);
+        if (thread->pushRetValOnResume) {
+            thread->pushRetValOnResume = false;
+            PUSH(thread->retVal);
+        }
+    }
 
-            GetExpectTokenSL(state, TINY_TOK_OPENPAREN, "Expected '(' after -> and function name");
-
-            Tiny_Expr *callExp = ParseCall(state, ident);
+#ifdef TINY_COMPUTED_GOTO
+    static const void *const dispatchTable[256] = {
+        [0 ... 255] = &&op_UNKNOWN,
+
+        [TINY_OP_PUSH_NULL] = &&op_PUSH_NULL,
+        [TINY_OP_PUSH_NULL_N] = &&op_PUSH_NULL_N,
+        [TINY_OP_PUSH_TRUE] = &&op_PUSH_TRUE,
+        [TINY_OP_PUSH_FALSE] = &&op_PUSH_FALSE,
+        [TINY_OP_PUSH_INT] = &&op_PUSH_INT,
+        [TINY_OP_PUSH_0] = &&op_PUSH_0,
+        [TINY_OP_PUSH_1] = &&op_PUSH_1,
+        [TINY_OP_PUSH_CHAR] = &&op_PUSH_CHAR,
+        [TINY_OP_PUSH_FLOAT] = &&op_PUSH_FLOAT,
+        [TINY_OP_PUSH_STRING] = &&op_PUSH_STRING,
+        [TINY_OP_PUSH_STRING_FF] = &&op_PUSH_STRING_FF,
+        [TINY_OP_PUSH_STRUCT] = &&op_PUSH_STRUCT,
+        [TINY_OP_STRUCT_GET] = &&op_STRUCT_GET,
+        [TINY_OP_STRUCT_SET] = &&op_STRUCT_SET,
+        [TINY_OP_ADD] = &&op_ADD,
+        [TINY_OP_SUB] = &&op_SUB,
+        [TINY_OP_MUL] = &&op_MUL,
+        [TINY_OP_DIV] = &&op_DIV,
+        [TINY_OP_MOD] = &&op_MOD,
+        [TINY_OP_OR] = &&op_OR,
+        [TINY_OP_AND] = &&op_AND,
+        [TINY_OP_SHIFT_LEFT] = &&op_SHIFT_LEFT,
+        [TINY_OP_SHIFT_RIGHT] = &&op_SHIFT_RIGHT,
+        [TINY_OP_LT] = &&op_LT,
+        [TINY_OP_LTE] = &&op_LTE,
+        [TINY_OP_GT] = &&op_GT,
+        [TINY_OP_GTE] = &&op_GTE,
+        [TINY_OP_ADD_INT] = &&op_ADD_INT,
+        [TINY_OP_SUB_INT] = &&op_SUB_INT,
+        [TINY_OP_MUL_INT] = &&op_MUL_INT,
+        [TINY_OP_DIV_INT] = &&op_DIV_INT,
+        [TINY_OP_LT_INT] = &&op_LT_INT,
+        [TINY_OP_LTE_INT] = &&op_LTE_INT,
+        [TINY_OP_GT_INT] = &&op_GT_INT,
+        [TINY_OP_GTE_INT] = &&op_GTE_INT,
+        [TINY_OP_ADD_FLOAT] = &&op_ADD_FLOAT,
+        [TINY_OP_SUB_FLOAT] = &&op_SUB_FLOAT,
+        [TINY_OP_MUL_FLOAT] = &&op_MUL_FLOAT,
+        [TINY_OP_DIV_FLOAT] = &&op_DIV_FLOAT,
+        [TINY_OP_LT_FLOAT] = &&op_LT_FLOAT,
+        [TINY_OP_LTE_FLOAT] = &&op_LTE_FLOAT,
+        [TINY_OP_GT_FLOAT] = &&op_GT_FLOAT,
+        [TINY_OP_GTE_FLOAT] = &&op_GTE_FLOAT,
+        [TINY_OP_INT_TO_FLOAT] = &&op_INT_TO_FLOAT,
+        [TINY_OP_ADD1] = &&op_ADD1,
+        [TINY_OP_SUB1] = &&op_SUB1,
+        [TINY_OP_EQU] = &&op_EQU,
+        [TINY_OP_EQU_BOOL] = &&op_EQU_BOOL,
+        [TINY_OP_EQU_INT] = &&op_EQU_INT,
+        [TINY_OP_EQU_FLOAT] = &&op_EQU_FLOAT,
+        [TINY_OP_EQU_STR] = &&op_EQU_STR,
+        [TINY_OP_LOG_NOT] = &&op_LOG_NOT,
+        [TINY_OP_SET] = &&op_SET,
+        [TINY_OP_GET] = &&op_GET,
+        [TINY_OP_GOTO] = &&op_GOTO,
+        [TINY_OP_GOTOZ] = &&op_GOTOZ,
+        [TINY_OP_CALL] = &&op_CALL,
+        [TINY_OP_RETURN] = &&op_RETURN,
+        [TINY_OP_RETURN_VALUE] = &&op_RETURN_VALUE,
+        [TINY_OP_CALLF] = &&op_CALLF,
+        [TINY_OP_GETLOCAL] = &&op_GETLOCAL,
+        [TINY_OP_GETLOCAL_W] = &&op_GETLOCAL_W,
+        [TINY_OP_SETLOCAL] = &&op_SETLOCAL,
+        [TINY_OP_GET_RETVAL] = &&op_GET_RETVAL,
+        [TINY_OP_NEG_INT] = &&op_NEG_INT,
+        [TINY_OP_NEG_FLOAT] = &&op_NEG_FLOAT,
+        [TINY_OP_NOT_EQU] = &&op_NOT_EQU,
+        [TINY_OP_NOT_EQU_BOOL] = &&op_NOT_EQU_BOOL,
+        [TINY_OP_NOT_EQU_INT] = &&op_NOT_EQU_INT,
+        [TINY_OP_NOT_EQU_FLOAT] = &&op_NOT_EQU_FLOAT,
+        [TINY_OP_NOT_EQU_STR] = &&op_NOT_EQU_STR,
+        [TINY_OP_GOTONZ] = &&op_GOTONZ,
+        [TINY_OP_GETLOCAL_W2] = &&op_GETLOCAL_W2,
+        [TINY_OP_GETLOCAL_STRUCT_GET] = &&op_GETLOCAL_STRUCT_GET,
+        [TINY_OP_LT_LOCAL_CONST_GOTOZ] = &&op_LT_LOCAL_CONST_GOTOZ,
+        [TINY_OP_INC_LOCAL] = &&op_INC_LOCAL,
+        [TINY_OP_DEC_LOCAL] = &&op_DEC_LOCAL,
+        [TINY_OP_CALL_RETVAL] = &&op_CALL_RETVAL,
+        [TINY_OP_CALLF_RETVAL] = &&op_CALLF_RETVAL,
+        [TINY_OP_MOVE_R] = &&op_MOVE_R,
+        [TINY_OP_LOAD_INT_R] = &&op_LOAD_INT_R,
+        [TINY_OP_LOAD_FLOAT_R] = &&op_LOAD_FLOAT_R,
+        [TINY_OP_POP_R] = &&op_POP_R,
+        [TINY_OP_STRUCT_GET_R] = &&op_STRUCT_GET_R,
+        [TINY_OP_ADD_INT_R] = &&op_ADD_INT_R,
+        [TINY_OP_SUB_INT_R] = &&op_SUB_INT_R,
+        [TINY_OP_MUL_INT_R] = &&op_MUL_INT_R,
+        [TINY_OP_DIV_INT_R] = &&op_DIV_INT_R,
+        [TINY_OP_MOD_INT_R] = &&op_MOD_INT_R,
+        [TINY_OP_LT_INT_R] = &&op_LT_INT_R,
+        [TINY_OP_LTE_INT_R] = &&op_LTE_INT_R,
+        [TINY_OP_EQU_INT_R] = &&op_EQU_INT_R,
+        [TINY_OP_ADD_FLOAT_R] = &&op_ADD_FLOAT_R,
+        [TINY_OP_SUB_FLOAT_R] = &&op_SUB_FLOAT_R,
+        [TINY_OP_MUL_FLOAT_R] = &&op_MUL_FLOAT_R,
+        [TINY_OP_DIV_FLOAT_R] = &&op_DIV_FLOAT_R,
+        [TINY_OP_LT_FLOAT_R] = &&op_LT_FLOAT_R,
+        [TINY_OP_LTE_FLOAT_R] = &&op_LTE_FLOAT_R,
+        [TINY_OP_EQU_FLOAT_R] = &&op_EQU_FLOAT_R,
+        [TINY_OP_ADD_INT_RK] = &&op_ADD_INT_RK,
+        [TINY_OP_MUL_INT_RK] = &&op_MUL_INT_RK,
+        [TINY_OP_GOTOZ_R] = &&op_GOTOZ_R,
+        [TINY_OP_LT_INT_R_GOTOZ] = &&op_LT_INT_R_GOTOZ,
+        [TINY_OP_LTE_INT_R_GOTOZ] = &&op_LTE_INT_R_GOTOZ,
+        [TINY_OP_LT_INT_RK_GOTOZ] = &&op_LT_INT_RK_GOTOZ,
+        [TINY_OP_LTE_INT_RK_GOTOZ] = &&op_LTE_INT_RK_GOTOZ,
+        [TINY_OP_GT_INT_RK_GOTOZ] = &&op_GT_INT_RK_GOTOZ,
+        [TINY_OP_GTE_INT_RK_GOTOZ] = &&op_GTE_INT_RK_GOTOZ,
+        [TINY_OP_HALT] = &&op_HALT,
+        [TINY_OP_MISALIGNED_INSTRUCTION] = &&op_MISALIGNED_INSTRUCTION,
+    };
+
+#define CASE(op) op_##op:
+#define DEFAULT op_UNKNOWN:
+#define DISPATCH()                      \
+    do {                                \
+        if (budget == 0) goto suspend;  \
+        --budget;                       \
+        PROFILE_OPCODE();               \
+        goto *dispatchTable[*ip];       \
+    } while (0)
 
-            callExp->lineNumber = exp->lineNumber;
-            callExp->pos = exp->pos;
+    DISPATCH();
+#else
+#define CASE(op) case TINY_OP_##op:
+#define DEFAULT default:
+#define DISPATCH() goto dispatch
 
-            // Prepend the expression on the lhs to the call expression on the rhs
-            exp->next = callExp->call.argsHead;
-            callExp->call.argsHead = exp;
+dispatch:
+    if (budget == 0) goto suspend;
+    --budget;
+    PROFILE_OPCODE();
 
-            exp = callExp;
+    switch (*ip) {
+#endif
 
-            continue;
-        }
+    CASE(PUSH_NULL) {
+        ++ip;
+        PUSH(Tiny_Null);
+        DISPATCH();
+    }
 
-        Tiny_Expr *e = Expr_create(TINY_EXP_DOT, state);
+    CASE(PUSH_NULL_N) {
+        Word n = ip[1];
+        ip += 2;
 
-        GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after '.'");
+        if (stackEnd - sp < n) GROW_STACK(n);
 
-        e->dot.lhs = exp;
-        e->dot.field = CreateExprStringNode(state, state->l.lexeme);
+        memset(sp, 0, sizeof(Tiny_Value) * n);
+        sp += n;
+        DISPATCH();
+    }
 
-        GetNextToken(state);
+    CASE(PUSH_TRUE) {
+        ++ip;
+        PUSH(Tiny_NewBool(true));
+        DISPATCH();
+    }
 
-        exp = e;
+    CASE(PUSH_FALSE) {
+        ++ip;
+        PUSH(Tiny_NewBool(false));
+        DISPATCH();
     }
 
-    return exp;
-}
+    CASE(PUSH_INT) {
+        ++ip;
+        Tiny_Int i;
+        READ_OPERAND(&i);
+        PUSH(Tiny_NewInt(i));
+        DISPATCH();
+    }
 
-static Tiny_Expr *ParseFactor(Tiny_State *state) {
-    Tiny_Expr *exp = ParseValue(state);
-    return ParseSuffix(state, exp);
-}
+    CASE(PUSH_0) {
+        ++ip;
+        PUSH(Tiny_NewInt(0));
+        DISPATCH();
+    }
 
-static int GetTokenPrec(int tok) {
-    int prec = -1;
-    switch (tok) {
-        case TINY_TOK_STAR:
-        case TINY_TOK_SLASH:
-        case TINY_TOK_PERCENT:
-        case TINY_TOK_AND:
-        case TINY_TOK_OR:
-            prec = 5;
-            break;
+    CASE(PUSH_1) {
+        ++ip;
+        PUSH(Tiny_NewInt(1));
+        DISPATCH();
+    }
 
-        case TINY_TOK_SHIFT_LEFT:
-        case TINY_TOK_SHIFT_RIGHT:
-        case TINY_TOK_PLUS:
-        case TINY_TOK_MINUS:
-            prec = 4;
-            break;
+    CASE(PUSH_CHAR) {
+        Word c = ip[1];
+        ip += 2;
+        PUSH(Tiny_NewInt(c));
+        DISPATCH();
+    }
 
-        case TINY_TOK_LTE:
-        case TINY_TOK_GTE:
-        case TINY_TOK_EQUALS:
-        case TINY_TOK_NOTEQUALS:
-        case TINY_TOK_LT:
-        case TINY_TOK_GT:
-            prec = 3;
-            break;
+    CASE(PUSH_FLOAT) {
+        ++ip;
+        Tiny_Float f;
+        READ_OPERAND(&f);
+        PUSH(Tiny_NewFloat(f));
+        DISPATCH();
+    }
 
-        case TINY_TOK_LOG_AND:
-        case TINY_TOK_LOG_OR:
-            prec = 2;
-            break;
+    CASE(PUSH_STRING) {
+        ++ip;
+        Tiny_ConstantIndex sIndex;
+        READ_OPERAND(&sIndex);
+        PUSH(Tiny_NewConstString(state->strings[sIndex]));
+        DISPATCH();
     }
 
-    return prec;
-}
+    CASE(PUSH_STRING_FF) {
+        Word sIndex = ip[1];
+        ip += 2;
+        PUSH(Tiny_NewConstString(state->strings[sIndex]));
+        DISPATCH();
+    }
 
-static Tiny_Expr *ParseBinRhs(Tiny_State *state, int exprPrec, Tiny_Expr *lhs) {
-    while (true) {
-        int prec = GetTokenPrec(state->l.lastTok);
+    CASE(PUSH_STRUCT) {
+        Word nFields = ip[1];
+        ip += 2;
 
-        if (prec < exprPrec) return lhs;
+        assert(nFields > 0);
 
-        int binOp = state->l.lastTok;
+        Tiny_Object *obj = NewStructObject(thread, nFields);
+        memcpy(obj->ostruct.fields, sp - nFields, sizeof(Tiny_Value) * nFields);
+        sp -= nFields;
 
-        GetNextToken(state);
+        PUSH(NewObjectValue(obj));
 
-        Tiny_Expr *rhs = ParseFactor(state);
-        int nextPrec = GetTokenPrec(state->l.lastTok);
+        COLLECT_IF_NEEDED();
+        DISPATCH();
+    }
 
-        if (prec < nextPrec) rhs = ParseBinRhs(state, prec + 1, rhs);
+    CASE(STRUCT_GET) {
+        Word i = ip[1];
+        ip += 2;
 
-        Tiny_Expr *newLhs = Expr_create(TINY_EXP_BINARY, state);
+        assert(Tiny_GetType(sp[-1]) == TINY_VAL_STRUCT);
 
-        newLhs->binary.lhs = lhs;
-        newLhs->binary.rhs = rhs;
-        newLhs->binary.op = binOp;
+        Tiny_Object *obj = Tiny_AsObject(sp[-1]);
+        assert(i >= 0 && i < obj->ostruct.n);
 
-        lhs = newLhs;
+        sp[-1] = obj->ostruct.fields[i];
+        DISPATCH();
     }
-}
 
-static Tiny_Expr *ParseExpr(Tiny_State *state) {
-    Tiny_Expr *factor = ParseFactor(state);
-    return ParseBinRhs(state, 0, factor);
-}
+    CASE(STRUCT_SET) {
+        Word i = ip[1];
+        ip += 2;
 
-static Tiny_Expr *ParseStatement(Tiny_State *state) {
-    switch (state->l.lastTok) {
-        case TINY_TOK_OPENCURLY:
-            return ParseBlock(state);
+        Tiny_Value vstruct = POP();
+        Tiny_Value val = POP();
 
-        case TINY_TOK_FUNC:
-            return ParseFunc(state);
+        assert(Tiny_GetType(vstruct) == TINY_VAL_STRUCT);
 
-        case TINY_TOK_IF:
-            return ParseIf(state);
+        Tiny_Object *obj = Tiny_AsObject(vstruct);
+        assert(i >= 0 && i < obj->ostruct.n);
 
-        case TINY_TOK_WHILE: {
-            GetNextToken(state);
-            Tiny_Expr *exp = Expr_create(TINY_EXP_WHILE, state);
+        obj->ostruct.fields[i] = val;
 
-            exp->whilex.cond = ParseExpr(state);
+        // Write barrier (see Tiny_GCWriteBarrier)
+        if (thread->gcPhase == TINY_GC_MARK) MarkValue(thread, val);
 
-            OpenScope(state);
+        DISPATCH();
+    }
 
-            exp->whilex.body = ParseStatement(state);
+#define BIN_OP(OP, operator)                                                       \
+    CASE(OP) {                                                                     \
+        Tiny_Value *a = sp - 2;                                                    \
+        Tiny_Value b = *--sp;                                                      \
+        if (Tiny_GetType(*a) == TINY_VAL_INT && Tiny_GetType(b) == TINY_VAL_INT) { \
+            *a = Tiny_NewInt(Tiny_AsInt(*a) operator Tiny_AsInt(b));               \
+        } else {                                                                   \
+            *a = Tiny_NewFloat(Tiny_ToNumber(*a) operator Tiny_ToNumber(b));       \
+        }                                                                          \
+        ++ip;                                                                      \
+        DISPATCH();                                                                \
+    }
 
-            CloseScope(state);
+#define BIN_OP_INT(OP, operator)                                 \
+    CASE(OP) {                                                   \
+        Tiny_Value *a = sp - 2;                                  \
+        Tiny_Value b = *--sp;                                    \
+        *a = Tiny_NewInt(Tiny_AsInt(*a) operator Tiny_AsInt(b)); \
+        ++ip;                                                    \
+        DISPATCH();                                              \
+    }
 
-            return exp;
-        } break;
+#define REL_OP(OP, operator)                                                           \
+    CASE(OP) {                                                                         \
+        Tiny_Value *a = sp - 2;                                                        \
+        Tiny_Value b = *--sp;                                                          \
+        bool result;                                                                   \
+        if (Tiny_GetType(*a) == TINY_VAL_FLOAT || Tiny_GetType(b) == TINY_VAL_FLOAT) { \
+            result = Tiny_ToNumber(*a) operator Tiny_ToNumber(b);                      \
+        } else {                                                                       \
+            result = Tiny_AsInt(*a) operator Tiny_AsInt(b);                            \
+        }                                                                              \
+        *a = Tiny_NewBool(result);                                                     \
+        ++ip;                                                                          \
+        DISPATCH();                                                                    \
+    }
 
-        case TINY_TOK_FOR: {
-            GetNextToken(state);
+    BIN_OP(ADD, +)
+    BIN_OP(SUB, -)
+    BIN_OP(MUL, *)
+    BIN_OP(DIV, /)
+    BIN_OP_INT(MOD, %)
+    BIN_OP_INT(OR, |)
+    BIN_OP_INT(AND, &)
+    BIN_OP_INT(SHIFT_LEFT, <<)
+    BIN_OP_INT(SHIFT_RIGHT, >>)
+
+    REL_OP(LT, <)
+    REL_OP(GT, >)
+    REL_OP(GTE, >=)
+    REL_OP(LTE, <=)
 
-            Tiny_Expr *exp = Expr_create(TINY_EXP_FOR, state);
+#undef BIN_OP
+#undef BIN_OP_INT
+#undef REL_OP
 
-            // Every local declared after this is scoped to the for
-            OpenScope(state);
+// The typed ops trust the compiler: the operands already have the right type, so only the
+// payload is touched.
+#define BIN_OP_TYPED(OP, T, operator)                                      \
+    CASE(OP) {                                                         \
+        Tiny_Value b = *--sp;                                          \
+        sp[-1] = Tiny_New##T(Tiny_As##T(sp[-1]) operator Tiny_As##T(b)); \
+        ++ip;                                                          \
+        DISPATCH();                                                    \
+    }
 
-            exp->forx.init = ParseStatement(state);
+#define REL_OP_TYPED(OP, T, operator)                                      \
+    CASE(OP) {                                                             \
+        Tiny_Value b = *--sp;                                              \
+        sp[-1] = Tiny_NewBool(Tiny_As##T(sp[-1]) operator Tiny_As##T(b)); \
+        ++ip;                                                              \
+        DISPATCH();                                                        \
+    }
 
-            ExpectTokenSL(state, TINY_TOK_SEMI, "Expected ';' after for initializer.");
+    BIN_OP_TYPED(ADD_INT, Int, +)
+    BIN_OP_TYPED(SUB_INT, Int, -)
+    BIN_OP_TYPED(MUL_INT, Int, *)
+    BIN_OP_TYPED(DIV_INT, Int, /)
+    REL_OP_TYPED(LT_INT, Int, <)
+    REL_OP_TYPED(LTE_INT, Int, <=)
+    REL_OP_TYPED(GT_INT, Int, >)
+    REL_OP_TYPED(GTE_INT, Int, >=)
+
+    BIN_OP_TYPED(ADD_FLOAT, Float, +)
+    BIN_OP_TYPED(SUB_FLOAT, Float, -)
+    BIN_OP_TYPED(MUL_FLOAT, Float, *)
+    BIN_OP_TYPED(DIV_FLOAT, Float, /)
+    REL_OP_TYPED(LT_FLOAT, Float, <)
+    REL_OP_TYPED(LTE_FLOAT, Float, <=)
+    REL_OP_TYPED(GT_FLOAT, Float, >)
+    REL_OP_TYPED(GTE_FLOAT, Float, >=)
+
+    REL_OP_TYPED(EQU_BOOL, Bool, ==)
+    REL_OP_TYPED(EQU_INT, Int, ==)
+    REL_OP_TYPED(EQU_FLOAT, Float, ==)
+
+    REL_OP_TYPED(NOT_EQU_BOOL, Bool, !=)
+    REL_OP_TYPED(NOT_EQU_INT, Int, !=)
+    REL_OP_TYPED(NOT_EQU_FLOAT, Float, !=)
+
+#undef BIN_OP_TYPED
+#undef REL_OP_TYPED
+
+    CASE(EQU_STR) {
+        ++ip;
+        Tiny_Value b = POP();
+        sp[-1] = Tiny_NewBool(AreStringsEqual(sp[-1], b));
+        DISPATCH();
+    }
 
-            GetNextToken(state);
+    CASE(NOT_EQU_STR) {
+        ++ip;
+        Tiny_Value b = POP();
+        sp[-1] = Tiny_NewBool(!AreStringsEqual(sp[-1], b));
+        DISPATCH();
+    }
 
-            exp->forx.cond = ParseExpr(state);
+    CASE(NEG_INT) {
+        ++ip;
+        sp[-1] = Tiny_NewInt(-Tiny_AsInt(sp[-1]));
+        DISPATCH();
+    }
 
-            ExpectTokenSL(state, TINY_TOK_SEMI, "Expected ';' after for condition.");
+    CASE(NEG_FLOAT) {
+        ++ip;
+        sp[-1] = Tiny_NewFloat(-Tiny_AsFloat(sp[-1]));
+        DISPATCH();
+    }
 
-            GetNextToken(state);
+    CASE(INT_TO_FLOAT) {
+        ++ip;
+        sp[-1] = Tiny_NewFloat((Tiny_Float)Tiny_AsInt(sp[-1]));
+        DISPATCH();
+    }
 
-            exp->forx.step = ParseStatement(state);
+    CASE(ADD1) {
+        ++ip;
+        sp[-1] = Tiny_NewInt(Tiny_AsInt(sp[-1]) + 1);
+        DISPATCH();
+    }
 
-            exp->forx.body = ParseStatement(state);
+    CASE(SUB1) {
+        ++ip;
+        sp[-1] = Tiny_NewInt(Tiny_AsInt(sp[-1]) - 1);
+        DISPATCH();
+    }
 
-            CloseScope(state);
+    CASE(EQU) {
+        ++ip;
+        Tiny_Value b = POP();
+        Tiny_Value a = POP();
+        PUSH(Tiny_NewBool(Tiny_AreValuesEqual(a, b)));
+        DISPATCH();
+    }
 
-            return exp;
-        } break;
+    CASE(NOT_EQU) {
+        ++ip;
+        Tiny_Value b = POP();
+        Tiny_Value a = POP();
+        PUSH(Tiny_NewBool(!Tiny_AreValuesEqual(a, b)));
+        DISPATCH();
+    }
 
-        case TINY_TOK_RETURN: {
-            if (!state->currFunc) {
-                ReportErrorSL(state,
-                              "Attempted to return from outside a function. Why? Why would "
-                              "you do that? Why would you do any of that?");
-            }
+    CASE(LOG_NOT) {
+        ++ip;
+        sp[-1] = Tiny_NewBool(!ExpectBool(sp[-1]));
+        DISPATCH();
+    }
 
-            Tiny_Expr *exp = Expr_create(TINY_EXP_RETURN, state);
+    CASE(SET) {
+        ++ip;
+        Tiny_ConstantIndex varIdx;
+        READ_OPERAND(&varIdx);
+        thread->globalVars[varIdx] = POP();
+        DISPATCH();
+    }
 
-            GetNextToken(state);
-            if (state->l.lastTok == TINY_TOK_SEMI) {
-                GetNextToken(state);
-                exp->retExpr = NULL;
-                return exp;
-            }
+    CASE(GET) {
+        ++ip;
+        Tiny_ConstantIndex varIdx;
+        READ_OPERAND(&varIdx);
+        PUSH(thread->globalVars[varIdx]);
+        DISPATCH();
+    }
 
-            if (state->currFunc->func.returnTag->type == TINY_SYM_TAG_VOID) {
-                ReportErrorSL(state,
-                              "Attempted to return value from function which is "
-                              "supposed to return nothing (void).");
-            }
+    CASE(GOTO) {
+        ++ip;
+        Tiny_ConstantIndex newPc;
+        READ_OPERAND(&newPc);
+        ip = program + newPc;
+        DISPATCH();
+    }
 
-            exp->retExpr = ParseExpr(state);
-            return exp;
-        } break;
+    CASE(GOTOZ) {
+        ++ip;
+        Tiny_ConstantIndex newPc;
+        READ_OPERAND(&newPc);
+        if (!ExpectBool(POP())) ip = program + newPc;
+        DISPATCH();
+    }
 
-        // TODO(Apaar): Labeled break/continue
-        case TINY_TOK_BREAK: {
-            GetNextToken(state);
-            Tiny_Expr *exp = Expr_create(TINY_EXP_BREAK, state);
+    CASE(GOTONZ) {
+        ++ip;
+        Tiny_ConstantIndex newPc;
+        READ_OPERAND(&newPc);
+        if (ExpectBool(POP())) ip = program + newPc;
+        DISPATCH();
+    }
 
-            // Set to -1 to make sure we don't get into trouble
-            exp->breakContinue.patchLoc = -1;
+    CASE(CALL)
+    CASE(CALL_RETVAL) {
+        bool pushRetVal = *ip == TINY_OP_CALL_RETVAL;
 
-            return exp;
-        } break;
+        Word nargs = ip[1];
+        ip += 2;
 
-        case TINY_TOK_CONTINUE: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_CONTINUE, state);
+        Tiny_ConstantIndex funcIdx;
+        READ_OPERAND(&funcIdx);
 
-            GetNextToken(state);
+        if (thread->fc == thread->frameCap && !ReserveFrame(thread)) {
+            SAVE_REGS();
+            goto overflow;
+        }
 
-            // Set to -1 to make sure we don't get into trouble
-            exp->breakContinue.patchLoc = -1;
+        thread->frames[thread->fc++] =
+            (Tiny_Frame){(int)(ip - program), (int)(fp - stack), nargs, pushRetVal};
 
-            return exp;
-        } break;
+        fp = sp;
+        ip = program + state->functionPcs[funcIdx];
+        DISPATCH();
+    }
 
-        case TINY_TOK_USE: {
-            if (state->currFunc || state->currScope != 0) {
-                ReportErrorSL(state,
-                              "'use' statements are only valid at the top-level of a Tiny file.");
-            }
+    CASE(RETURN) {
+        thread->retVal = Tiny_Null;
+        goto do_return;
+    }
 
-            Tiny_Expr *exp = Expr_create(TINY_EXP_USE, state);
+    CASE(RETURN_VALUE) {
+        thread->retVal = POP();
+        goto do_return;
+    }
 
-            GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after 'use'");
+do_return: {
+    assert(thread->fc > 0);
 
-            exp->use.moduleName = CreateExprStringNode(state, state->l.lexeme);
+    Tiny_Frame frame = thread->frames[--thread->fc];
 
-            exp->use.argsHead = NULL;
-            Tiny_StringNode *argsTail = NULL;
+    sp = fp - frame.nargs;
+    fp = stack + frame.fp;
 
-            exp->use.asName = NULL;
+    if (frame.pc < 0) {
+        // We returned into a thread that was never started (see Tiny_CallFunction)
+        SAVE_REGS();
+        thread->pc = -1;
+        goto done;
+    }
 
-            GetExpectTokenSL(state, TINY_TOK_OPENPAREN, "Expected '(' after 'use' module name");
+    ip = program + frame.pc;
 
-            GetNextToken(state);
+    if (frame.pushRetVal) {
+        PUSH(thread->retVal);
+    }
 
-            while (state->l.lastTok != TINY_TOK_CLOSEPAREN) {
-                ExpectTokenSL(state, TINY_TOK_STRING,
-                              "Expected string as arg to 'use' module name");
+    if (thread->fc <= stopFc) {
+        goto suspend;
+    }
 
-                Tiny_StringNode *arg = CreateExprStringNode(state, state->l.lexeme);
+    DISPATCH();
+}
 
-                TINY_LL_APPEND(exp->use.argsHead, argsTail, arg);
+    CASE(CALLF)
+    CASE(CALLF_RETVAL) {
+        bool pushRetVal = *ip == TINY_OP_CALLF_RETVAL;
 
-                GetNextToken(state);
+        Word nargs = ip[1];
+        ip += 2;
 
-                // TODO(Apaar): Technically this means the commas are optional.
-                // Should we enforce them?
-                if (state->l.lastTok == TINY_TOK_COMMA) {
-                    GetNextToken(state);
-                }
-            }
+        Tiny_ConstantIndex fIdx;
+        READ_OPERAND(&fIdx);
 
-            GetNextToken(state);
+        int argsIndex = (int)(sp - stack) - nargs;
 
-            // NOTE(Apaar): We do not make `as` an official keyword, we only make a special case
-            // for it in this context. It's too general to be reserved IMO.
-            if (state->l.lastTok == TINY_TOK_IDENT && strcmp(state->l.lexeme, "as") == 0) {
-                GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after 'as'");
+        // The foreign function could store its args in natives that have already been marked
+        // (e.g. array_push), so they get marked now rather than requiring a write barrier
+        if (thread->gcPhase == TINY_GC_MARK) {
+            for (int i = argsIndex; i < argsIndex + nargs; ++i) MarkValue(thread, stack[i]);
+        }
 
-                exp->use.asName = CreateExprStringNode(state, state->l.lexeme);
+        // The args stay on the stack during the call so that anything the foreign function
+        // pushes (e.g. through Tiny_CallFunction) goes above them.
+        SAVE_REGS();
 
-                GetNextToken(state);
-            }
+        thread->retVal = state->foreignFunctions[fIdx](thread, stack + argsIndex, nargs);
 
-            return exp;
-        } break;
+        // The foreign function may have stopped the thread, moved it elsewhere, grown the stack,
+        // or compiled more code into the state (which could reallocate the program).
+        stack = thread->stack;
+        stackEnd = stack + thread->stackCap;
 
-        case TINY_TOK_FOREACH: {
-            Tiny_Expr *exp = Expr_create(TINY_EXP_FOREACH, state);
+        sp = stack + argsIndex;
+        thread->sp = argsIndex;
 
-            GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after 'foreach'");
+        if (thread->pc < 0) {
+            goto done;
+        }
 
-            // Every local declared after this is scoped to the foreach
-            OpenScope(state);
+        program = state->program;
+        ip = program + thread->pc;
+        fp = stack + thread->fp;
 
-            exp->forEach.elemVar = DeclareVar(state, state->l.lexeme);
-            exp->forEach.indexVar = NULL;
-            exp->forEach.reverse = false;
-            exp->forEach.lenFunc = NULL;
-            exp->forEach.getIndexFunc = NULL;
+        // Yields only take effect at the outermost Execute, so a Tiny_CallFunction in the middle
+        // of this foreign function runs to completion regardless
+        if (thread->yielded && stopFc < 0) {
+            thread->pushRetValOnResume = pushRetVal;
+            goto suspend;
+        }
 
-            GetNextToken(state);
+        if (pushRetVal) {
+            PUSH(thread->retVal);
+        }
 
-            if (state->l.lastTok == TINY_TOK_COMMA) {
-                GetExpectTokenSL(state, TINY_TOK_IDENT,
-                                 "Expected identifier after 'foreach {varname},'");
+        COLLECT_IF_NEEDED();
+        DISPATCH();
+    }
 
-                exp->forEach.indexVar = DeclareVar(state, state->l.lexeme);
-                GetNextToken(state);
-            } else {
-                // Declare an anon var for the index
-                exp->forEach.indexVar = DeclareVar(state, ANON_SYM_NAME);
-            }
+    CASE(GETLOCAL) {
+        ++ip;
+        Tiny_ConstantIndex localIdx;
+        READ_OPERAND(&localIdx);
+        PUSH(fp[(int)localIdx]);
+        DISPATCH();
+    }
 
-            const char *err = "Expected 'in' or 'in_reverse' after foreach ...";
+    CASE(GETLOCAL_W) {
+        Word localIdx = ip[1];
+        ip += 2;
+        PUSH(fp[localIdx]);
+        DISPATCH();
+    }
 
-            ExpectTokenSL(state, TINY_TOK_IDENT, err);
+    CASE(SETLOCAL) {
+        ++ip;
+        Tiny_ConstantIndex localIdx;
+        READ_OPERAND(&localIdx);
+        fp[(int)localIdx] = POP();
+        DISPATCH();
+    }
 
-            if (strcmp(state->l.lexeme, "in_reverse") == 0) {
-                exp->forEach.reverse = true;
-            } else if (strcmp(state->l.lexeme, "in") != 0) {
-                // It must be one of in or in_reverse
-                ExpectTokenSL(state, TINY_TOK_IDENT, err);
-            }
-
-            GetNextToken(state);
-
-            exp->forEach.range = ParseExpr(state);
-
-            // You cannot refer to the range value
-            //
-            // TODO(Apaar): What if you could?? :)
-            exp->forEach.rangeVar = DeclareVar(state, ANON_SYM_NAME);
+    CASE(GET_RETVAL) {
+        ++ip;
+        PUSH(thread->retVal);
+        DISPATCH();
+    }
 
-            exp->forEach.body = ParseStatement(state);
+    CASE(GETLOCAL_W2) {
+        Word a = ip[1];
+        Word b = ip[2];
+        ip += 3;
+        PUSH(fp[a]);
+        PUSH(fp[b]);
+        DISPATCH();
+    }
 
-            CloseScope(state);
+    CASE(GETLOCAL_STRUCT_GET) {
+        Word localIdx = ip[1];
+        Word i = ip[2];
+        ip += 3;
 
-            return exp;
-        } break;
+        assert(Tiny_GetType(fp[localIdx]) == TINY_VAL_STRUCT);
 
-        default: {
-            Tiny_Expr *lhs = ParseFactor(state);
+        Tiny_Object *obj = Tiny_AsObject(fp[localIdx]);
+        assert(i >= 0 && i < obj->ostruct.n);
 
-            if (lhs->type == TINY_EXP_CALL) {
-                // It ended up being call, so just return it
-                return lhs;
-            }
+        PUSH(obj->ostruct.fields[i]);
+        DISPATCH();
+    }
 
-            int op = state->l.lastTok;
+    CASE(LT_LOCAL_CONST_GOTOZ) {
+        Word localIdx = ip[1];
+        ip += 2;
 
-            int lineNumber = state->l.lineNumber;
-            Tiny_TokenPos pos = state->l.pos;
+        Tiny_Int k;
+        READ_OPERAND(&k);
 
-            if (state->l.lastTok == TINY_TOK_DECLARE || state->l.lastTok == TINY_TOK_COLON) {
-                if (lhs->type != TINY_EXP_ID) {
-                    ReportErrorSL(state, "Left hand side of declaration must be identifier.");
-                }
+        Tiny_ConstantIndex newPc;
+        READ_OPERAND(&newPc);
 
-                lhs->id.sym = DeclareVar(state, lhs->id.name->value);
+        if (!(Tiny_AsInt(fp[localIdx]) < k)) ip = program + newPc;
+        DISPATCH();
+    }
 
-                if (state->l.lastTok == TINY_TOK_COLON) {
-                    GetNextToken(state);
-                    lhs->id.sym->var.tag = ParseTypeSL(state);
+    CASE(INC_LOCAL) {
+        Word localIdx = ip[1];
+        ip += 2;
+        fp[localIdx] = Tiny_NewInt(Tiny_AsInt(fp[localIdx]) + 1);
+        DISPATCH();
+    }
 
-                    ExpectTokenSL(state, TINY_TOK_EQUAL, "Expected '=' after typename.");
+    CASE(DEC_LOCAL) {
+        Word localIdx = ip[1];
+        ip += 2;
+        fp[localIdx] = Tiny_NewInt(Tiny_AsInt(fp[localIdx]) - 1);
+        DISPATCH();
+    }
 
-                    op = TINY_TOK_EQUAL;
-                }
-            }
+// Register operands are signed offsets from the frame pointer (see TINY_BACKEND_REGISTER)
+#define REG(i) fp[(int8_t)ip[i]]
 
-            // If the precedence is >= 0 then it's an expression operator
-            if (GetTokenPrec(op) >= 0) {
-                ReportErrorSL(state, "Expected assignment statement.");
-            }
+    CASE(MOVE_R) {
+        REG(1) = REG(2);
+        ip += 3;
+        DISPATCH();
+    }
 
-            GetNextToken(state);
+    CASE(LOAD_INT_R) {
+        Tiny_Value *dest = &REG(1);
+        ip += 2;
+        Tiny_Int k;
+        READ_OPERAND(&k);
+        *dest = Tiny_NewInt(k);
+        DISPATCH();
+    }
 
-            Tiny_Expr *rhs = ParseExpr(state);
+    CASE(LOAD_FLOAT_R) {
+        Tiny_Value *dest = &REG(1);
+        ip += 2;
+        Tiny_Float k;
+        READ_OPERAND(&k);
+        *dest = Tiny_NewFloat(k);
+        DISPATCH();
+    }
 
-            if (op == TINY_TOK_DECLARECONST) {
-                if (lhs->type != TINY_EXP_ID) {
-                    ReportErrorSL(state, "Left hand side of declaration must be identifier.");
-                }
+    CASE(POP_R) {
+        REG(1) = POP();
+        ip += 2;
+        DISPATCH();
+    }
 
-                if (rhs->type == TINY_EXP_BOOL) {
-                    DeclareConst(state, lhs->id.name->value, GetPrimTag(TINY_SYM_TAG_BOOL))
-                        ->constant.bValue = rhs->boolean;
-                } else if (rhs->type == TINY_EXP_CHAR) {
-                    DeclareConst(state, lhs->id.name->value, GetPrimTag(TINY_SYM_TAG_INT))
-                        ->constant.iValue = rhs->iValue;
-                } else if (rhs->type == TINY_EXP_INT) {
-                    DeclareConst(state, lhs->id.name->value, GetPrimTag(TINY_SYM_TAG_INT))
-                        ->constant.iValue = rhs->iValue;
-                } else if (rhs->type == TINY_EXP_FLOAT) {
-                    DeclareConst(state, lhs->id.name->value, GetPrimTag(TINY_SYM_TAG_FLOAT))
-                        ->constant.fValue = rhs->fValue;
-                } else if (rhs->type == TINY_EXP_STRING) {
-                    DeclareConst(state, lhs->id.name->value, GetPrimTag(TINY_SYM_TAG_STR))
-                        ->constant.sIndex = rhs->sIndex;
-                } else {
-                    ReportErrorSL(state, "Expected number or string to be bound to constant '%s'.",
-                                  lhs->id.name->value);
-                }
-            }
+    CASE(STRUCT_GET_R) {
+        Tiny_Value vstruct = REG(2);
+        Word i = ip[3];
 
-            Tiny_Expr *bin = Expr_create(TINY_EXP_BINARY, state);
+        assert(Tiny_GetType(vstruct) == TINY_VAL_STRUCT);
 
-            bin->lineNumber = lineNumber;
-            bin->pos = pos;
+        Tiny_Object *obj = Tiny_AsObject(vstruct);
+        assert(i >= 0 && i < obj->ostruct.n);
 
-            bin->binary.lhs = lhs;
-            bin->binary.rhs = rhs;
-            bin->binary.op = op;
+        REG(1) = obj->ostruct.fields[i];
+        ip += 4;
+        DISPATCH();
+    }
 
-            return bin;
-        } break;
+#define BIN_OP_REG(OP, T, operator)                                           \
+    CASE(OP) {                                                                \
+        REG(1) = Tiny_New##T(Tiny_As##T(REG(2)) operator Tiny_As##T(REG(3))); \
+        ip += 4;                                                              \
+        DISPATCH();                                                           \
     }
 
-    ReportErrorSL(state, "Unexpected token '%s'.", state->l.lexeme);
-    return NULL;
-}
+#define REL_OP_REG(OP, T, operator)                                            \
+    CASE(OP) {                                                                 \
+        REG(1) = Tiny_NewBool(Tiny_As##T(REG(2)) operator Tiny_As##T(REG(3))); \
+        ip += 4;                                                               \
+        DISPATCH();                                                            \
+    }
 
-static Tiny_Expr *ParseProgram(Tiny_State *state) {
-    GetNextToken(state);
+#define BIN_OP_REG_CONST(OP, operator)     \
+    CASE(OP) {                             \
+        Tiny_Value *dest = &REG(1);        \
+        Tiny_Int a = Tiny_AsInt(REG(2));   \
+        ip += 3;                           \
+        Tiny_Int k;                        \
+        READ_OPERAND(&k);                  \
+        *dest = Tiny_NewInt(a operator k); \
+        DISPATCH();                        \
+    }
 
-    if (state->l.lastTok == TINY_TOK_EOF) {
-        return NULL;
+#define REL_OP_REG_GOTOZ(OP, operator)                                \
+    CASE(OP) {                                                        \
+        bool result = Tiny_AsInt(REG(1)) operator Tiny_AsInt(REG(2)); \
+        ip += 3;                                                      \
+        Tiny_ConstantIndex newPc;                                     \
+        READ_OPERAND(&newPc);                                         \
+        if (!result) ip = program + newPc;                            \
+        DISPATCH();                                                   \
     }
 
-    Tiny_Expr *head = NULL;
-    Tiny_Expr *tail = NULL;
+#define REL_OP_REG_CONST_GOTOZ(OP, operator)       \
+    CASE(OP) {                                     \
+        Tiny_Int a = Tiny_AsInt(REG(1));           \
+        ip += 2;                                   \
+        Tiny_Int k;                                \
+        READ_OPERAND(&k);                          \
+        Tiny_ConstantIndex newPc;                  \
+        READ_OPERAND(&newPc);                      \
+        if (!(a operator k)) ip = program + newPc; \
+        DISPATCH();                                \
+    }
 
-    while (state->l.lastTok != TINY_TOK_EOF) {
-        if (state->l.lastTok == TINY_TOK_STRUCT) {
-            ParseStruct(state);
-        } else {
-            TINY_LL_APPEND(head, tail, ParseStatement(state));
-        }
+    BIN_OP_REG(ADD_INT_R, Int, +)
+    BIN_OP_REG(SUB_INT_R, Int, -)
+    BIN_OP_REG(MUL_INT_R, Int, *)
+    BIN_OP_REG(DIV_INT_R, Int, /)
+    BIN_OP_REG(MOD_INT_R, Int, %)
+    REL_OP_REG(LT_INT_R, Int, <)
+    REL_OP_REG(LTE_INT_R, Int, <=)
+    REL_OP_REG(EQU_INT_R, Int, ==)
+
+    BIN_OP_REG(ADD_FLOAT_R, Float, +)
+    BIN_OP_REG(SUB_FLOAT_R, Float, -)
+    BIN_OP_REG(MUL_FLOAT_R, Float, *)
+    BIN_OP_REG(DIV_FLOAT_R, Float, /)
+    REL_OP_REG(LT_FLOAT_R, Float, <)
+    REL_OP_REG(LTE_FLOAT_R, Float, <=)
+    REL_OP_REG(EQU_FLOAT_R, Float, ==)
+
+    BIN_OP_REG_CONST(ADD_INT_RK, +)
+    BIN_OP_REG_CONST(MUL_INT_RK, *)
+
+    CASE(GOTOZ_R) {
+        bool cond = ExpectBool(REG(1));
+        ip += 2;
+        Tiny_ConstantIndex newPc;
+        READ_OPERAND(&newPc);
+        if (!cond) ip = program + newPc;
+        DISPATCH();
     }
 
-    return head;
-}
+    REL_OP_REG_GOTOZ(LT_INT_R_GOTOZ, <)
+    REL_OP_REG_GOTOZ(LTE_INT_R_GOTOZ, <=)
+
+    REL_OP_REG_CONST_GOTOZ(LT_INT_RK_GOTOZ, <)
+    REL_OP_REG_CONST_GOTOZ(LTE_INT_RK_GOTOZ, <=)
+    REL_OP_REG_CONST_GOTOZ(GT_INT_RK_GOTOZ, >)
+    REL_OP_REG_CONST_GOTOZ(GTE_INT_RK_GOTOZ, >=)
+
+#undef BIN_OP_REG
+#undef REL_OP_REG
+#undef BIN_OP_REG_CONST
+#undef REL_OP_REG_GOTOZ
+#undef REL_OP_REG_CONST_GOTOZ
+#undef REG
+
+    CASE(HALT) {
+        SAVE_REGS();
+        thread->pc = -1;
+        goto done;
+    }
 
-static const char *GetTagName(const Tiny_Symbol *tag) {
-    assert(tag);
-    return tag->name;
-}
+    CASE(MISALIGNED_INSTRUCTION) {
+        assert(false && "Misaligned instruction encountered");
 
-static bool IsTagAssignableTo(const Tiny_Symbol *src, const Tiny_Symbol *dest) {
-    if (src->type == TINY_SYM_TAG_VOID) {
-        // Can't assign void to anything
-        return false;
+        SAVE_REGS();
+        thread->pc = -1;
+        goto done;
     }
 
-    if (dest->type == TINY_SYM_TAG_ANY) {
-        // Can always assign _to_ any
-        return true;
-    }
+    DEFAULT {
+        assert(false && "Unknown opcode encountered");
 
-    if (src->type == TINY_SYM_TAG_ANY) {
-        // Can only assign any to any
-        return dest->type == TINY_SYM_TAG_ANY;
+        SAVE_REGS();
+        thread->pc = -1;
+        goto done;
     }
 
-    if (src->type == dest->type) {
-        return strcmp(src->name, dest->name) == 0;
+#ifndef TINY_COMPUTED_GOTO
     }
+#endif
 
-    return false;
+overflow:
+    // The registers have already been saved
+    StopWithError(thread, "Stack overflow");
+    goto done;
+
+suspend:
+    SAVE_REGS();
+
+done:
+    return maxCycles - budget;
+
+#undef SAVE_REGS
+#undef GROW_STACK
+#undef PUSH
+#undef POP
+#undef READ_OPERAND
+#undef PROFILE_OPCODE
+#undef COLLECT_IF_NEEDED
+#undef CASE
+#undef DEFAULT
+#undef DISPATCH
 }
 
-static void ResolveTypes(Tiny_State *state, Tiny_Expr *exp) {
-    if (exp->tag) return;
-
-    switch (exp->type) {
-        case TINY_EXP_BREAK:
-        case TINY_EXP_CONTINUE:
-        case TINY_EXP_USE:
-            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
-            break;
-
-        case TINY_EXP_NULL:
-            exp->tag = GetPrimTag(TINY_SYM_TAG_ANY);
-            break;
-        case TINY_EXP_BOOL:
-            exp->tag = GetPrimTag(TINY_SYM_TAG_BOOL);
-            break;
-        case TINY_EXP_CHAR:
-            exp->tag = GetPrimTag(TINY_SYM_TAG_INT);
-            break;
-        case TINY_EXP_INT:
-            exp->tag = GetPrimTag(TINY_SYM_TAG_INT);
-            break;
-        case TINY_EXP_FLOAT:
-            exp->tag = GetPrimTag(TINY_SYM_TAG_FLOAT);
-            break;
-        case TINY_EXP_STRING:
-            exp->tag = GetPrimTag(TINY_SYM_TAG_STR);
-            break;
 
-        case TINY_EXP_ID: {
-            if (!exp->id.sym) {
-                ReportErrorE(state, exp, "Referencing undeclared identifier '%s'.\n",
-                             exp->id.name->value);
-            }
+static Tiny_Expr *Expr_create(Tiny_ExprType type, Tiny_State *state) {
+    Tiny_Expr *exp = Tiny_ArenaAlloc(&state->parserArena, sizeof(Tiny_Expr), sizeof(void *));
 
-            assert(exp->id.sym->type == TINY_SYM_GLOBAL || exp->id.sym->type == TINY_SYM_LOCAL ||
-                   exp->id.sym->type == TINY_SYM_CONST);
+    exp->next = NULL;
+    exp->pos = state->l.pos;
+    exp->lineNumber = state->l.lineNumber;
+    exp->type = type;
 
-            if (exp->id.sym->type != TINY_SYM_CONST) {
-                assert(exp->id.sym->var.tag);
+    exp->tag = NULL;
 
-                exp->tag = exp->id.sym->var.tag;
-            } else {
-                exp->tag = exp->id.sym->constant.tag;
-            }
-        } break;
+    return exp;
+}
 
-        case TINY_EXP_CALL: {
-            Tiny_Symbol *func = FindSymbol(state, exp->call.calleeName->value, ST_MASK_FUNC);
+static Tiny_Expr *ParseExpr(Tiny_State *state);
 
-            if (!func) {
-                ReportErrorE(state, exp, "Calling undeclared function '%s'.\n",
-                             exp->call.calleeName->value);
-            }
+static void GetExpectTokenSL(Tiny_State *state, Tiny_TokenKind tok, const char *msg) {
+    Tiny_GetToken(&state->l);
+    if (state->l.lastTok != tok) {
+        ReportErrorSL(state, msg);
+    }
+}
 
-            int argc = func->type == TINY_SYM_FOREIGN_FUNCTION ? sb_count(func->foreignFunc.argTags)
-                                                               : sb_count(func->func.args);
+static void ReportErrorE(Tiny_State *state, const Tiny_Expr *exp, const char *s, ...) {
+    va_list args;
+    va_start(args, s);
 
-            bool isVarargs = func->type == TINY_SYM_FOREIGN_FUNCTION && func->foreignFunc.varargs;
+    state->compileErrorResult.type = TINY_COMPILE_ERROR;
 
-            int i = 0;
-            for (Tiny_Expr *node = exp->call.argsHead; node; (node = node->next, ++i)) {
-                ResolveTypes(state, node);
+    Tiny_FormatErrorV(state->compileErrorResult.error.msg,
+                      sizeof(state->compileErrorResult.error.msg), state->l.fileName, state->l.src,
+                      exp->pos, s, args);
 
-                const Tiny_Symbol *expectedArgTag = NULL;
+    va_end(args);
 
-                if (i >= argc && !isVarargs) {
-                    ReportErrorE(state, node, "Too many arguments to function '%s' (%d expected).",
-                                 exp->call.calleeName->value, argc);
-                }
+    longjmp(state->compileErrorJmpBufs[state->compileCallNestCount - 1], 1);
+}
 
-                if (func->type == TINY_SYM_FOREIGN_FUNCTION) {
-                    if (i < argc) {
-                        expectedArgTag = func->foreignFunc.argTags[i];
-                    }
-                } else {
-                    expectedArgTag = func->func.args[i]->var.tag;
-                }
+static void ReportErrorS(Tiny_State *state, const Tiny_Symbol *sym, const char *s, ...) {
+    va_list args;
+    va_start(args, s);
 
-                if (!expectedArgTag) {
-                    continue;
-                }
+    state->compileErrorResult.type = TINY_COMPILE_ERROR;
 
-                if (!IsTagAssignableTo(node->tag, expectedArgTag)) {
-                    ReportErrorE(
-                        state, node,
-                        "Argument %i to '%s' is supposed to be a '%s' but you supplied a '%s'\n",
-                        i + 1, func->name, GetTagName(expectedArgTag), GetTagName(node->tag));
-                }
-            }
+    Tiny_FormatErrorV(state->compileErrorResult.error.msg,
+                      sizeof(state->compileErrorResult.error.msg), state->l.fileName, state->l.src,
+                      sym->pos, s, args);
 
-            if (i < argc) {
-                ReportErrorE(state, exp, "'%s' expects (at least) %d args but you supplied %d",
-                             exp->call.calleeName->value, argc, i);
-            }
+    va_end(args);
 
-            exp->tag = func->type == TINY_SYM_FOREIGN_FUNCTION ? func->foreignFunc.returnTag
-                                                               : func->func.returnTag;
-        } break;
+    longjmp(state->compileErrorJmpBufs[state->compileCallNestCount - 1], 1);
+}
 
-        case TINY_EXP_PAREN: {
-            ResolveTypes(state, exp->paren);
+static void ExpectTokenL(Tiny_State *state, Tiny_Lexer *l, Tiny_TokenKind tok, const char *msg) {
+    if (l->lastTok != tok) {
+        ReportErrorL(state, l, msg);
+    }
+}
 
-            exp->tag = exp->paren->tag;
-        } break;
+static void ExpectTokenSL(Tiny_State *state, Tiny_TokenKind tok, const char *msg) {
+    ExpectTokenL(state, &state->l, tok, msg);
+}
+
+static Tiny_Symbol *DeclareStruct(Tiny_State *state, const char *name, bool search) {
+    if (search) {
+        Tiny_Symbol *s = FindSymbol(state, name, ST_MASK(TINY_SYM_TAG_STRUCT));
+        if (s) return s;
+    }
+
+    Tiny_Symbol *s = Symbol_create(TINY_SYM_TAG_STRUCT, name, state);
+
+    s->sstruct.defined = false;
+    s->sstruct.fields = NULL;
+
+    sb_push(&state->ctx, state->globalSymbols, s);
+
+    return s;
+}
+
+static Tiny_Symbol *GetTagFromName(Tiny_State *state, const char *name, bool declareStruct) {
+    if (strcmp(name, "void") == 0)
+        return GetPrimTag(TINY_SYM_TAG_VOID);
+    else if (strcmp(name, "bool") == 0)
+        return GetPrimTag(TINY_SYM_TAG_BOOL);
+    else if (strcmp(name, "int") == 0)
+        return GetPrimTag(TINY_SYM_TAG_INT);
+    else if (strcmp(name, "float") == 0)
+        return GetPrimTag(TINY_SYM_TAG_FLOAT);
+    else if (strcmp(name, "str") == 0)
+        return GetPrimTag(TINY_SYM_TAG_STR);
+    else if (strcmp(name, "any") == 0)
+        return GetPrimTag(TINY_SYM_TAG_ANY);
+    else {
+        for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
+            Tiny_Symbol *s = state->globalSymbols[i];
+
+            if ((s->type == TINY_SYM_TAG_FOREIGN || s->type == TINY_SYM_TAG_STRUCT) &&
+                strcmp(s->name, name) == 0) {
+                return s;
+            }
+        }
+
+        if (declareStruct) {
+            return DeclareStruct(state, name, false);
+        }
+    }
+
+    return NULL;
+}
+
+static const char *GetTagName(const Tiny_Symbol *tag);
+
+static Tiny_Symbol *GetFieldTag(Tiny_Symbol *s, const char *name, int *index) {
+    assert(s->type == TINY_SYM_TAG_STRUCT);
+    assert(s->sstruct.defined);
+
+    for (int i = 0; i < sb_count(s->sstruct.fields); ++i) {
+        Tiny_Symbol *f = s->sstruct.fields[i];
+
+        if (strcmp(f->name, name) == 0) {
+            if (index) *index = i;
+            return f->fieldTag;
+        }
+    }
+
+    if (index) *index = -1;
+
+    return NULL;
+}
+
+static Tiny_TokenKind GetNextToken(Tiny_State *state) { return Tiny_GetToken(&state->l); }
+
+static Tiny_Symbol *ParseTypeL(Tiny_State *state, Tiny_Lexer *l) {
+    ExpectTokenL(state, l, TINY_TOK_IDENT, "Expected identifier for typename.");
+
+    Tiny_Symbol *s = GetTagFromName(state, l->lexeme, true);
+
+    if (!s) {
+        ReportErrorL(state, l, "%s doesn't name a type.", l->lexeme);
+    }
+
+    Tiny_GetToken(l);
+
+    return s;
+}
+
+static Tiny_Symbol *ParseTypeSL(Tiny_State *state) { return ParseTypeL(state, &state->l); }
+
+static Tiny_Expr *ParseStatement(Tiny_State *state);
+
+static Tiny_Expr *ParseIf(Tiny_State *state) {
+    Tiny_Expr *exp = Expr_create(TINY_EXP_IF, state);
+
+    GetNextToken(state);
+
+    exp->ifx.cond = ParseExpr(state);
+    exp->ifx.body = ParseStatement(state);
+
+    if (state->l.lastTok == TINY_TOK_ELSE) {
+        GetNextToken(state);
+        exp->ifx.alt = ParseStatement(state);
+    } else
+        exp->ifx.alt = NULL;
+
+    return exp;
+}
+
+static Tiny_Expr *ParseBlock(Tiny_State *state) {
+    assert(state->l.lastTok == TINY_TOK_OPENCURLY);
+
+    Tiny_Expr *exp = Expr_create(TINY_EXP_BLOCK, state);
+
+    exp->blockHead = NULL;
+    Tiny_Expr *blockTail = NULL;
+
+    GetNextToken(state);
+
+    OpenScope(state);
+
+    while (state->l.lastTok != TINY_TOK_CLOSECURLY) {
+        Tiny_Expr *e = ParseStatement(state);
+        assert(e);
+
+        TINY_LL_APPEND(exp->blockHead, blockTail, e);
+    }
+
+    GetNextToken(state);
+
+    CloseScope(state);
+
+    return exp;
+}
+
+static Tiny_Expr *ParseFunc(Tiny_State *state) {
+    assert(state->l.lastTok == TINY_TOK_FUNC);
+
+    if (state->currFunc) {
+        ReportErrorSL(state, "Attempted to define function inside of function '%s'.",
+                      state->currFunc->name);
+    }
+
+    Tiny_Expr *exp = Expr_create(TINY_EXP_PROC, state);
+
+    GetExpectTokenSL(state, TINY_TOK_IDENT, "Function name must be identifier!");
+
+    exp->proc.decl = DeclareFunction(state, state->l.lexeme);
+    state->currFunc = exp->proc.decl;
+
+    GetExpectTokenSL(state, TINY_TOK_OPENPAREN, "Expected '(' after function name");
+
+    GetNextToken(state);
+
+    typedef struct {
+        char *name;
+        Tiny_Symbol *tag;
+    } Arg;
+
+    Arg *args = NULL;  // array
+
+    while (state->l.lastTok != TINY_TOK_CLOSEPAREN) {
+        ExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier in function parameter list");
+
+        Arg arg;
+
+        arg.name = CloneString(&state->ctx, state->l.lexeme);
+        GetNextToken(state);
+
+        if (state->l.lastTok != TINY_TOK_COLON) {
+            ReportErrorSL(state, "Expected ':' after %s", arg.name);
+        }
+
+        GetNextToken(state);
+
+        arg.tag = ParseTypeSL(state);
+
+        sb_push(&state->ctx, args, arg);
+
+        if (state->l.lastTok != TINY_TOK_CLOSEPAREN && state->l.lastTok != TINY_TOK_COMMA) {
+            ReportErrorSL(state,
+                          "Expected ')' or ',' after parameter name in function "
+                          "parameter list.");
+        }
+
+        if (state->l.lastTok == TINY_TOK_COMMA) GetNextToken(state);
+    }
+
+    for (int i = 0; i < sb_count(args); ++i) {
+        DeclareArgument(state, args[i].name, args[i].tag, sb_count(args));
+        TFree(&state->ctx, args[i].name);
+    }
+
+    sb_free(&state->ctx, args);
+
+    GetNextToken(state);
+
+    if (state->l.lastTok != TINY_TOK_COLON) {
+        exp->proc.decl->func.returnTag = GetPrimTag(TINY_SYM_TAG_VOID);
+    } else {
+        GetNextToken(state);
+        exp->proc.decl->func.returnTag = ParseTypeSL(state);
+    }
+
+    OpenScope(state);
+
+    exp->proc.body = ParseStatement(state);
+
+    CloseScope(state);
+
+    state->currFunc = NULL;
+
+    return exp;
+}
+
+static Tiny_Symbol *ParseStruct(Tiny_State *state) {
+    if (state->currFunc) {
+        ReportErrorSL(state, "Attempted to declare struct inside func %s. Can't do that bruh.",
+                      state->currFunc->name);
+    }
+
+    Tiny_TokenPos pos = state->l.pos;
+
+    GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after 'struct'.");
+
+    Tiny_Symbol *s = DeclareStruct(state, state->l.lexeme, true);
+
+    if (s->sstruct.defined) {
+        ReportErrorSL(state, "Attempted to define struct %s multiple times.", state->l.lexeme);
+    }
+
+    s->pos = pos;
+    s->sstruct.defined = true;
+
+    GetExpectTokenSL(state, TINY_TOK_OPENCURLY, "Expected '{' after struct name.");
+
+    GetNextToken(state);
+
+    while (state->l.lastTok != TINY_TOK_CLOSECURLY) {
+        ExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier in struct fields.");
+
+        int count = sb_count(s->sstruct.fields);
+
+        if (count >= UCHAR_MAX) {
+            ReportErrorSL(state, "Too many fields in struct.");
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (strcmp(s->sstruct.fields[i]->name, state->l.lexeme) == 0) {
+                ReportErrorSL(state, "Declared multiple fields with the same name %s.",
+                              state->l.lexeme);
+            }
+        }
+
+        Tiny_Symbol *f = Symbol_create(TINY_SYM_FIELD, state->l.lexeme, state);
+
+        GetExpectTokenSL(state, TINY_TOK_COLON, "Expected ':' after field name.");
+
+        GetNextToken(state);
+
+        f->fieldTag = ParseTypeSL(state);
+
+        sb_push(&state->ctx, s->sstruct.fields, f);
+    }
+
+    GetNextToken(state);
+
+    if (!s->sstruct.fields) {
+        ReportErrorSL(state, "Struct must have at least one field.\n");
+    }
+
+    return s;
+}
+
+static Tiny_Expr *ParseCall(Tiny_State *state, Tiny_StringNode *ident) {
+    assert(state->l.lastTok == TINY_TOK_OPENPAREN);
+
+    Tiny_Expr *exp = Expr_create(TINY_EXP_CALL, state);
+
+    exp->call.argsHead = NULL;
+    Tiny_Expr *argsTail = NULL;
+
+    GetNextToken(state);
+
+    while (state->l.lastTok != TINY_TOK_CLOSEPAREN) {
+        TINY_LL_APPEND(exp->call.argsHead, argsTail, ParseExpr(state));
+
+        if (state->l.lastTok == TINY_TOK_COMMA) {
+            GetNextToken(state);
+        } else if (state->l.lastTok != TINY_TOK_CLOSEPAREN) {
+            ReportErrorSL(state, "Expected ')' after call.");
+        }
+    }
+
+    exp->call.calleeName = ident;
+
+    GetNextToken(state);
+    return exp;
+}
+
+static Tiny_Expr *ParseFactor(Tiny_State *state);
+
+static Tiny_Expr *ParseValue(Tiny_State *state) {
+    switch (state->l.lastTok) {
+        case TINY_TOK_NULL: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_NULL, state);
+
+            GetNextToken(state);
+
+            return exp;
+        } break;
+
+        case TINY_TOK_BOOL: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_BOOL, state);
+
+            exp->boolean = state->l.bValue;
+
+            GetNextToken(state);
+
+            return exp;
+        } break;
+
+        case TINY_TOK_IDENT: {
+            Tiny_TokenPos pos = state->l.pos;
+            int lineNumber = state->l.lineNumber;
+
+            Tiny_StringNode *ident = CreateExprStringNode(state, state->l.lexeme);
+            GetNextToken(state);
+
+            if (state->l.lastTok == TINY_TOK_OPENPAREN) {
+                return ParseCall(state, ident);
+            }
+
+            Tiny_Expr *exp = Expr_create(TINY_EXP_ID, state);
+
+            exp->pos = pos;
+            exp->lineNumber = lineNumber;
+
+            exp->id.sym = FindSymbol(state, ident->value, ST_MASK_VAR_OR_CONST);
+            exp->id.name = ident;
+
+            return exp;
+        } break;
+
+        case TINY_TOK_MINUS:
+        case TINY_TOK_BANG: {
+            int op = state->l.lastTok;
+            GetNextToken(state);
+            Tiny_Expr *exp = Expr_create(TINY_EXP_UNARY, state);
+            exp->unary.op = op;
+            exp->unary.exp = ParseFactor(state);
+
+            return exp;
+        } break;
+
+        case TINY_TOK_CHAR: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_CHAR, state);
+            exp->iValue = state->l.iValue;
+            GetNextToken(state);
+            return exp;
+        } break;
+
+        case TINY_TOK_INT: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_INT, state);
+            exp->iValue = state->l.iValue;
+            GetNextToken(state);
+            return exp;
+        } break;
+
+        case TINY_TOK_FLOAT: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_FLOAT, state);
+            exp->fValue = state->l.fValue;
+            GetNextToken(state);
+            return exp;
+        } break;
+
+        case TINY_TOK_STRING: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_STRING, state);
+            exp->sIndex = RegisterString(state, state->l.lexeme);
+            GetNextToken(state);
+            return exp;
+        } break;
+
+        case TINY_TOK_OPENPAREN: {
+            GetNextToken(state);
+            Tiny_Expr *inner = ParseExpr(state);
+
+            ExpectTokenSL(state, TINY_TOK_CLOSEPAREN, "Expected matching ')' after previous '('");
+            GetNextToken(state);
+
+            Tiny_Expr *exp = Expr_create(TINY_EXP_PAREN, state);
+            exp->paren = inner;
+            return exp;
+        } break;
+
+        case TINY_TOK_NEW: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_CONSTRUCTOR, state);
+
+            GetNextToken(state);
+
+            Tiny_Symbol *tag = DeclareStruct(state, state->l.lexeme, true);
+
+            exp->constructor.structTag = tag;
+
+            exp->constructor.argNamesHead = NULL;
+            Tiny_StringNode *argNamesTail = NULL;
+
+            exp->constructor.argsHead = NULL;
+            Tiny_Expr *argsTail = NULL;
+
+            GetExpectTokenSL(state, TINY_TOK_OPENCURLY, "Expected '{' after struct name");
+
+            GetNextToken(state);
+
+            while (state->l.lastTok != TINY_TOK_CLOSECURLY) {
+                if (state->l.lastTok == TINY_TOK_DOT) {
+                    // Named argument, .xyz = value
+                    GetExpectTokenSL(state, TINY_TOK_IDENT,
+                                     "Expected identifier after '.' in designated initializer.");
+
+                    Tiny_StringNode *ident = CreateExprStringNode(state, state->l.lexeme);
+
+                    TINY_LL_APPEND(exp->constructor.argNamesHead, argNamesTail, ident);
+
+                    GetExpectTokenSL(state, TINY_TOK_EQUAL,
+                                     "Expected = after designated initializer");
+
+                    GetNextToken(state);
+                }
+
+                Tiny_Expr *e = ParseExpr(state);
+
+                TINY_LL_APPEND(exp->constructor.argsHead, argsTail, e);
+
+                if (state->l.lastTok != TINY_TOK_CLOSECURLY && state->l.lastTok != TINY_TOK_COMMA) {
+                    ReportErrorSL(state, "Expected '}' or ',' in constructor arg list.");
+                }
+
+                if (state->l.lastTok == TINY_TOK_COMMA) GetNextToken(state);
+            }
+
+            GetNextToken(state);
+
+            return exp;
+        } break;
+
+        case TINY_TOK_CAST: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_CAST, state);
+
+            GetExpectTokenSL(state, TINY_TOK_OPENPAREN, "Expected '(' after cast");
+
+            GetNextToken(state);
+
+            exp->cast.value = ParseExpr(state);
+
+            ExpectTokenSL(state, TINY_TOK_COMMA, "Expected ',' after cast value");
+
+            GetNextToken(state);
+
+            exp->cast.tag = ParseTypeSL(state);
+
+            ExpectTokenSL(state, TINY_TOK_CLOSEPAREN,
+                          "Expected ')' to match previous '(' after cast.");
+
+            GetNextToken(state);
+
+            while (state->l.lastTok == TINY_TOK_DOT) {
+                Tiny_Expr *e = Expr_create(TINY_EXP_DOT, state);
+
+                GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after '.'");
+
+                e->dot.lhs = exp;
+                e->dot.field = CreateExprStringNode(state, state->l.lexeme);
+
+                GetNextToken(state);
+
+                exp = e;
+            }
+
+            return exp;
+        } break;
+
+        // This is effectively a ternary
+        case TINY_TOK_IF: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_IF_TERNARY, state);
+
+            GetNextToken(state);
+
+            exp->ifx.cond = ParseExpr(state);
+
+            // Body and else statement must evaluate to a value
+            exp->ifx.body = ParseExpr(state);
+
+            ExpectTokenSL(state, TINY_TOK_ELSE,
+                          "Expected 'else' after true value in if expression");
+
+            GetNextToken(state);
+
+            exp->ifx.alt = ParseExpr(state);
+
+            return exp;
+        } break;
+
+        case TINY_TOK_LEXER_ERROR: {
+            assert(state->l.errorMsg);
+            ReportErrorSL(state, state->l.errorMsg);
+            return NULL;
+        } break;
+
+        default:
+            break;
+    }
+
+    ReportErrorSL(state, "Unexpected token '%s'\n", state->l.lexeme);
+    return NULL;
+}
+
+static Tiny_Expr *ParseSuffix(Tiny_State *state, Tiny_Expr *lhs) {
+    Tiny_Expr *exp = lhs;
+
+    while (state->l.lastTok == TINY_TOK_DOT || state->l.lastTok == TINY_TOK_ARROW ||
+           state->l.lastTok == TINY_TOK_OPENSQUARE) {
+        if (state->l.lastTok == TINY_TOK_OPENSQUARE) {
+            // This is the "index" operator. Unlike the arrow operator below, we can't just
+            // rewrite it as we're going here because it relies on the type of the expression
+            // to generate the code correctly.
+            GetNextToken(state);
+
+            Tiny_Expr *e = Expr_create(TINY_EXP_INDEX, state);
+
+            e->index.arr = exp;
+            e->index.elem = ParseExpr(state);
+
+            ExpectTokenSL(state, TINY_TOK_CLOSESQUARE, "Expected ']' after '[' and expression");
+            GetNextToken(state);
+
+            exp = e;
+            continue;
+        }
+
+        if (state->l.lastTok == TINY_TOK_ARROW) {
+            // There is always a call on the rhs of an arrow.
+            GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after ->");
+
+            // Since the arrow "operator" is just syntax sugar, we
+            // actually rewrite the AST as we're producing it rather
+            // than doing some transformation later.
+
+            Tiny_StringNode *ident = CreateExprStringNode(state, state->l.lexeme);
+
+            GetExpectTokenSL(state, TINY_TOK_OPENPAREN, "Expected '(' after -> and function name");
+
+            Tiny_Expr *callExp = ParseCall(state, ident);
+
+            callExp->lineNumber = exp->lineNumber;
+            callExp->pos = exp->pos;
+
+            // Prepend the expression on the lhs to the call expression on the rhs
+            exp->next = callExp->call.argsHead;
+            callExp->call.argsHead = exp;
+
+            exp = callExp;
+
+            continue;
+        }
+
+        Tiny_Expr *e = Expr_create(TINY_EXP_DOT, state);
+
+        GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after '.'");
+
+        e->dot.lhs = exp;
+        e->dot.field = CreateExprStringNode(state, state->l.lexeme);
+
+        GetNextToken(state);
+
+        exp = e;
+    }
+
+    return exp;
+}
+
+static Tiny_Expr *ParseFactor(Tiny_State *state) {
+    Tiny_Expr *exp = ParseValue(state);
+    return ParseSuffix(state, exp);
+}
+
+static int GetTokenPrec(int tok) {
+    int prec = -1;
+    switch (tok) {
+        case TINY_TOK_STAR:
+        case TINY_TOK_SLASH:
+        case TINY_TOK_PERCENT:
+        case TINY_TOK_AND:
+        case TINY_TOK_OR:
+            prec = 5;
+            break;
+
+        case TINY_TOK_SHIFT_LEFT:
+        case TINY_TOK_SHIFT_RIGHT:
+        case TINY_TOK_PLUS:
+        case TINY_TOK_MINUS:
+            prec = 4;
+            break;
+
+        case TINY_TOK_LTE:
+        case TINY_TOK_GTE:
+        case TINY_TOK_EQUALS:
+        case TINY_TOK_NOTEQUALS:
+        case TINY_TOK_LT:
+        case TINY_TOK_GT:
+            prec = 3;
+            break;
+
+        case TINY_TOK_LOG_AND:
+        case TINY_TOK_LOG_OR:
+            prec = 2;
+            break;
+    }
+
+    return prec;
+}
+
+static Tiny_Expr *ParseBinRhs(Tiny_State *state, int exprPrec, Tiny_Expr *lhs) {
+    while (true) {
+        int prec = GetTokenPrec(state->l.lastTok);
+
+        if (prec < exprPrec) return lhs;
+
+        int binOp = state->l.lastTok;
+
+        GetNextToken(state);
+
+        Tiny_Expr *rhs = ParseFactor(state);
+        int nextPrec = GetTokenPrec(state->l.lastTok);
+
+        if (prec < nextPrec) rhs = ParseBinRhs(state, prec + 1, rhs);
+
+        Tiny_Expr *newLhs = Expr_create(TINY_EXP_BINARY, state);
+
+        newLhs->binary.lhs = lhs;
+        newLhs->binary.rhs = rhs;
+        newLhs->binary.op = binOp;
+
+        lhs = newLhs;
+    }
+}
+
+static Tiny_Expr *ParseExpr(Tiny_State *state) {
+    Tiny_Expr *factor = ParseFactor(state);
+    return ParseBinRhs(state, 0, factor);
+}
+
+static Tiny_Expr *ParseStatement(Tiny_State *state) {
+    switch (state->l.lastTok) {
+        case TINY_TOK_OPENCURLY:
+            return ParseBlock(state);
+
+        case TINY_TOK_FUNC:
+            return ParseFunc(state);
+
+        case TINY_TOK_IF:
+            return ParseIf(state);
+
+        case TINY_TOK_WHILE: {
+            GetNextToken(state);
+            Tiny_Expr *exp = Expr_create(TINY_EXP_WHILE, state);
+
+            exp->whilex.cond = ParseExpr(state);
+
+            OpenScope(state);
+
+            exp->whilex.body = ParseStatement(state);
+
+            CloseScope(state);
+
+            return exp;
+        } break;
+
+        case TINY_TOK_FOR: {
+            GetNextToken(state);
+
+            Tiny_Expr *exp = Expr_create(TINY_EXP_FOR, state);
+
+            // Every local declared after this is scoped to the for
+            OpenScope(state);
+
+            exp->forx.init = ParseStatement(state);
+
+            ExpectTokenSL(state, TINY_TOK_SEMI, "Expected ';' after for initializer.");
+
+            GetNextToken(state);
+
+            exp->forx.cond = ParseExpr(state);
+
+            ExpectTokenSL(state, TINY_TOK_SEMI, "Expected ';' after for condition.");
+
+            GetNextToken(state);
+
+            exp->forx.step = ParseStatement(state);
+
+            exp->forx.body = ParseStatement(state);
+
+            CloseScope(state);
+
+            return exp;
+        } break;
+
+        case TINY_TOK_RETURN: {
+            if (!state->currFunc) {
+                ReportErrorSL(state,
+                              "Attempted to return from outside a function. Why? Why would "
+                              "you do that? Why would you do any of that?");
+            }
+
+            Tiny_Expr *exp = Expr_create(TINY_EXP_RETURN, state);
+
+            GetNextToken(state);
+            if (state->l.lastTok == TINY_TOK_SEMI) {
+                GetNextToken(state);
+                exp->retExpr = NULL;
+                return exp;
+            }
+
+            if (state->currFunc->func.returnTag->type == TINY_SYM_TAG_VOID) {
+                ReportErrorSL(state,
+                              "Attempted to return value from function which is "
+                              "supposed to return nothing (void).");
+            }
+
+            exp->retExpr = ParseExpr(state);
+            return exp;
+        } break;
+
+        // TODO(Apaar): Labeled break/continue
+        case TINY_TOK_BREAK: {
+            GetNextToken(state);
+            Tiny_Expr *exp = Expr_create(TINY_EXP_BREAK, state);
+
+            // Set to -1 to make sure we don't get into trouble
+            exp->breakContinue.patchLoc = -1;
+
+            return exp;
+        } break;
+
+        case TINY_TOK_CONTINUE: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_CONTINUE, state);
+
+            GetNextToken(state);
+
+            // Set to -1 to make sure we don't get into trouble
+            exp->breakContinue.patchLoc = -1;
+
+            return exp;
+        } break;
+
+        case TINY_TOK_USE: {
+            if (state->currFunc || state->currScope != 0) {
+                ReportErrorSL(state,
+                              "'use' statements are only valid at the top-level of a Tiny file.");
+            }
+
+            Tiny_Expr *exp = Expr_create(TINY_EXP_USE, state);
+
+            GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after 'use'");
+
+            exp->use.moduleName = CreateExprStringNode(state, state->l.lexeme);
+
+            exp->use.argsHead = NULL;
+            Tiny_StringNode *argsTail = NULL;
+
+            exp->use.asName = NULL;
+
+            GetExpectTokenSL(state, TINY_TOK_OPENPAREN, "Expected '(' after 'use' module name");
+
+            GetNextToken(state);
+
+            while (state->l.lastTok != TINY_TOK_CLOSEPAREN) {
+                ExpectTokenSL(state, TINY_TOK_STRING,
+                              "Expected string as arg to 'use' module name");
+
+                Tiny_StringNode *arg = CreateExprStringNode(state, state->l.lexeme);
+
+                TINY_LL_APPEND(exp->use.argsHead, argsTail, arg);
+
+                GetNextToken(state);
+
+                // TODO(Apaar): Technically this means the commas are optional.
+                // Should we enforce them?
+                if (state->l.lastTok == TINY_TOK_COMMA) {
+                    GetNextToken(state);
+                }
+            }
+
+            GetNextToken(state);
+
+            // NOTE(Apaar): We do not make `as` an official keyword, we only make a special case
+            // for it in this context. It's too general to be reserved IMO.
+            if (state->l.lastTok == TINY_TOK_IDENT && strcmp(state->l.lexeme, "as") == 0) {
+                GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after 'as'");
+
+                exp->use.asName = CreateExprStringNode(state, state->l.lexeme);
+
+                GetNextToken(state);
+            }
+
+            return exp;
+        } break;
+
+        case TINY_TOK_FOREACH: {
+            Tiny_Expr *exp = Expr_create(TINY_EXP_FOREACH, state);
+
+            GetExpectTokenSL(state, TINY_TOK_IDENT, "Expected identifier after 'foreach'");
+
+            // Every local declared after this is scoped to the foreach
+            OpenScope(state);
+
+            exp->forEach.elemVar = DeclareVar(state, state->l.lexeme);
+            exp->forEach.indexVar = NULL;
+            exp->forEach.reverse = false;
+            exp->forEach.lenFunc = NULL;
+            exp->forEach.getIndexFunc = NULL;
+            exp->forEach.iterNextFunc = NULL;
+            exp->forEach.iterKeyFunc = NULL;
+            exp->forEach.iterValueFunc = NULL;
+
+            GetNextToken(state);
+
+            if (state->l.lastTok == TINY_TOK_COMMA) {
+                GetExpectTokenSL(state, TINY_TOK_IDENT,
+                                 "Expected identifier after 'foreach {varname},'");
+
+                exp->forEach.indexVar = DeclareVar(state, state->l.lexeme);
+                GetNextToken(state);
+            } else {
+                // Declare an anon var for the index
+                exp->forEach.indexVar = DeclareVar(state, ANON_SYM_NAME);
+            }
+
+            const char *err = "Expected 'in' or 'in_reverse' after foreach ...";
+
+            ExpectTokenSL(state, TINY_TOK_IDENT, err);
+
+            if (strcmp(state->l.lexeme, "in_reverse") == 0) {
+                exp->forEach.reverse = true;
+            } else if (strcmp(state->l.lexeme, "in") != 0) {
+                // It must be one of in or in_reverse
+                ExpectTokenSL(state, TINY_TOK_IDENT, err);
+            }
+
+            GetNextToken(state);
+
+            exp->forEach.range = ParseExpr(state);
+
+            // You cannot refer to the range value
+            //
+            // TODO(Apaar): What if you could?? :)
+            exp->forEach.rangeVar = DeclareVar(state, ANON_SYM_NAME);
+
+            // We don't know whether the range is iterated with a cursor until its type is resolved
+            exp->forEach.cursorVar = DeclareVar(state, ANON_SYM_NAME);
+
+            exp->forEach.body = ParseStatement(state);
+
+            CloseScope(state);
+
+            return exp;
+        } break;
+
+        default: {
+            Tiny_Expr *lhs = ParseFactor(state);
+
+            if (lhs->type == TINY_EXP_CALL) {
+                // It ended up being call, so just return it
+                return lhs;
+            }
+
+            int op = state->l.lastTok;
+
+            int lineNumber = state->l.lineNumber;
+            Tiny_TokenPos pos = state->l.pos;
+
+            if (state->l.lastTok == TINY_TOK_DECLARE || state->l.lastTok == TINY_TOK_COLON) {
+                if (lhs->type != TINY_EXP_ID) {
+                    ReportErrorSL(state, "Left hand side of declaration must be identifier.");
+                }
+
+                lhs->id.sym = DeclareVar(state, lhs->id.name->value);
+
+                if (state->l.lastTok == TINY_TOK_COLON) {
+                    GetNextToken(state);
+                    lhs->id.sym->var.tag = ParseTypeSL(state);
+
+                    ExpectTokenSL(state, TINY_TOK_EQUAL, "Expected '=' after typename.");
+
+                    op = TINY_TOK_EQUAL;
+                }
+            }
+
+            // If the precedence is >= 0 then it's an expression operator
+            if (GetTokenPrec(op) >= 0) {
+                ReportErrorSL(state, "Expected assignment statement.");
+            }
+
+            GetNextToken(state);
+
+            Tiny_Expr *rhs = ParseExpr(state);
+
+            if (op == TINY_TOK_DECLARECONST) {
+                if (lhs->type != TINY_EXP_ID) {
+                    ReportErrorSL(state, "Left hand side of declaration must be identifier.");
+                }
+
+                if (rhs->type == TINY_EXP_BOOL) {
+                    DeclareConst(state, lhs->id.name->value, GetPrimTag(TINY_SYM_TAG_BOOL))
+                        ->constant.bValue = rhs->boolean;
+                } else if (rhs->type == TINY_EXP_CHAR) {
+                    DeclareConst(state, lhs->id.name->value, GetPrimTag(TINY_SYM_TAG_INT))
+                        ->constant.iValue = rhs->iValue;
+                } else if (rhs->type == TINY_EXP_INT) {
+                    DeclareConst(state, lhs->id.name->value, GetPrimTag(TINY_SYM_TAG_INT))
+                        ->constant.iValue = rhs->iValue;
+                } else if (rhs->type == TINY_EXP_FLOAT) {
+                    DeclareConst(state, lhs->id.name->value, GetPrimTag(TINY_SYM_TAG_FLOAT))
+                        ->constant.fValue = rhs->fValue;
+                } else if (rhs->type == TINY_EXP_STRING) {
+                    DeclareConst(state, lhs->id.name->value, GetPrimTag(TINY_SYM_TAG_STR))
+                        ->constant.sIndex = rhs->sIndex;
+                } else {
+                    ReportErrorSL(state, "Expected number or string to be bound to constant '%s'.",
+                                  lhs->id.name->value);
+                }
+            }
+
+            Tiny_Expr *bin = Expr_create(TINY_EXP_BINARY, state);
+
+            bin->lineNumber = lineNumber;
+            bin->pos = pos;
+
+            bin->binary.lhs = lhs;
+            bin->binary.rhs = rhs;
+            bin->binary.op = op;
+
+            return bin;
+        } break;
+    }
+
+    ReportErrorSL(state, "Unexpected token '%s'.", state->l.lexeme);
+    return NULL;
+}
+
+static Tiny_Expr *ParseProgram(Tiny_State *state) {
+    GetNextToken(state);
+
+    if (state->l.lastTok == TINY_TOK_EOF) {
+        return NULL;
+    }
+
+    Tiny_Expr *head = NULL;
+    Tiny_Expr *tail = NULL;
+
+    while (state->l.lastTok != TINY_TOK_EOF) {
+        if (state->l.lastTok == TINY_TOK_STRUCT) {
+            ParseStruct(state);
+        } else {
+            TINY_LL_APPEND(head, tail, ParseStatement(state));
+        }
+    }
+
+    return head;
+}
+
+static const char *GetTagName(const Tiny_Symbol *tag) {
+    assert(tag);
+    return tag->name;
+}
+
+static bool IsTagAssignableTo(const Tiny_Symbol *src, const Tiny_Symbol *dest) {
+    if (src->type == TINY_SYM_TAG_VOID) {
+        // Can't assign void to anything
+        return false;
+    }
+
+    if (dest->type == TINY_SYM_TAG_ANY) {
+        // Can always assign _to_ any
+        return true;
+    }
+
+    if (src->type == TINY_SYM_TAG_ANY) {
+        // Can only assign any to any
+        return dest->type == TINY_SYM_TAG_ANY;
+    }
+
+    if (src->type == dest->type) {
+        return strcmp(src->name, dest->name) == 0;
+    }
+
+    return false;
+}
+
+static Tiny_Symbol *GetFuncReturnTag(const Tiny_Symbol *func) {
+    return func->type == TINY_SYM_FOREIGN_FUNCTION ? func->foreignFunc.returnTag
+                                                   : func->func.returnTag;
+}
+
+// Finds {typeName}_{suffix}, which `foreach` needs in order to iterate over `range`
+static const Tiny_Symbol *FindForeachFunc(Tiny_State *state, Tiny_Expr *range,
+                                          const char *typeName, const char *suffix) {
+    char buf[256] = {0};
+    snprintf(buf, sizeof(buf), "%s_%s", typeName, suffix);
+
+    const Tiny_Symbol *func = FindSymbol(state, buf, ST_MASK_FUNC);
+
+    if (!func) {
+        ReportErrorE(state, range,
+                     "In order to use `foreach` on this you must define %s, but no such function "
+                     "exists",
+                     buf);
+    }
+
+    return func;
+}
+
+static void ResolveTypes(Tiny_State *state, Tiny_Expr *exp) {
+    if (exp->tag) return;
+
+    switch (exp->type) {
+        case TINY_EXP_BREAK:
+        case TINY_EXP_CONTINUE:
+        case TINY_EXP_USE:
+            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+            break;
+
+        case TINY_EXP_NULL:
+            exp->tag = GetPrimTag(TINY_SYM_TAG_ANY);
+            break;
+        case TINY_EXP_BOOL:
+            exp->tag = GetPrimTag(TINY_SYM_TAG_BOOL);
+            break;
+        case TINY_EXP_CHAR:
+            exp->tag = GetPrimTag(TINY_SYM_TAG_INT);
+            break;
+        case TINY_EXP_INT:
+            exp->tag = GetPrimTag(TINY_SYM_TAG_INT);
+            break;
+        case TINY_EXP_FLOAT:
+            exp->tag = GetPrimTag(TINY_SYM_TAG_FLOAT);
+            break;
+        case TINY_EXP_STRING:
+            exp->tag = GetPrimTag(TINY_SYM_TAG_STR);
+            break;
+
+        case TINY_EXP_ID: {
+            if (!exp->id.sym) {
+                ReportErrorE(state, exp, "Referencing undeclared identifier '%s'.\n",
+                             exp->id.name->value);
+            }
+
+            assert(exp->id.sym->type == TINY_SYM_GLOBAL || exp->id.sym->type == TINY_SYM_LOCAL ||
+                   exp->id.sym->type == TINY_SYM_CONST);
+
+            if (exp->id.sym->type != TINY_SYM_CONST) {
+                assert(exp->id.sym->var.tag);
+
+                exp->tag = exp->id.sym->var.tag;
+            } else {
+                exp->tag = exp->id.sym->constant.tag;
+            }
+        } break;
+
+        case TINY_EXP_CALL: {
+            Tiny_Symbol *func = FindSymbol(state, exp->call.calleeName->value, ST_MASK_FUNC);
+
+            if (!func) {
+                ReportErrorE(state, exp, "Calling undeclared function '%s'.\n",
+                             exp->call.calleeName->value);
+            }
+
+            int argc = func->type == TINY_SYM_FOREIGN_FUNCTION ? sb_count(func->foreignFunc.argTags)
+                                                               : sb_count(func->func.args);
+
+            bool isVarargs = func->type == TINY_SYM_FOREIGN_FUNCTION && func->foreignFunc.varargs;
+
+            int i = 0;
+            for (Tiny_Expr *node = exp->call.argsHead; node; (node = node->next, ++i)) {
+                ResolveTypes(state, node);
+
+                const Tiny_Symbol *expectedArgTag = NULL;
+
+                if (i >= argc && !isVarargs) {
+                    ReportErrorE(state, node, "Too many arguments to function '%s' (%d expected).",
+                                 exp->call.calleeName->value, argc);
+                }
+
+                if (func->type == TINY_SYM_FOREIGN_FUNCTION) {
+                    if (i < argc) {
+                        expectedArgTag = func->foreignFunc.argTags[i];
+                    }
+                } else {
+                    expectedArgTag = func->func.args[i]->var.tag;
+                }
+
+                if (!expectedArgTag) {
+                    continue;
+                }
+
+                if (!IsTagAssignableTo(node->tag, expectedArgTag)) {
+                    ReportErrorE(
+                        state, node,
+                        "Argument %i to '%s' is supposed to be a '%s' but you supplied a '%s'\n",
+                        i + 1, func->name, GetTagName(expectedArgTag), GetTagName(node->tag));
+                }
+            }
+
+            if (i < argc) {
+                ReportErrorE(state, exp, "'%s' expects (at least) %d args but you supplied %d",
+                             exp->call.calleeName->value, argc, i);
+            }
+
+            exp->tag = func->type == TINY_SYM_FOREIGN_FUNCTION ? func->foreignFunc.returnTag
+                                                               : func->func.returnTag;
+        } break;
+
+        case TINY_EXP_PAREN: {
+            ResolveTypes(state, exp->paren);
+
+            exp->tag = exp->paren->tag;
+        } break;
 
         case TINY_EXP_BINARY: {
             switch (exp->binary.op) {
@@ -2596,496 +4332,1502 @@ static void ResolveTypes(Tiny_State *state, Tiny_Expr *exp) {
                     ResolveTypes(state, exp->binary.lhs);
                     ResolveTypes(state, exp->binary.rhs);
 
-                    bool iLhs = exp->binary.lhs->tag->type == TINY_SYM_TAG_INT;
-                    bool iRhs = exp->binary.rhs->tag->type == TINY_SYM_TAG_INT;
+                    bool iLhs = exp->binary.lhs->tag->type == TINY_SYM_TAG_INT;
+                    bool iRhs = exp->binary.rhs->tag->type == TINY_SYM_TAG_INT;
+
+                    bool fLhs = !iLhs && exp->binary.lhs->tag->type == TINY_SYM_TAG_FLOAT;
+                    bool fRhs = !iRhs && exp->binary.rhs->tag->type == TINY_SYM_TAG_FLOAT;
+
+                    if ((!iLhs && !fLhs) || (!iRhs && !fRhs)) {
+                        ReportErrorE(state, exp,
+                                     "Left and right hand side of binary op must be ints or "
+                                     "floats, but they're %s and %s",
+                                     GetTagName(exp->binary.lhs->tag),
+                                     GetTagName(exp->binary.rhs->tag));
+                    }
+
+                    exp->tag = GetPrimTag((iLhs && iRhs) ? TINY_SYM_TAG_INT : TINY_SYM_TAG_FLOAT);
+                } break;
+
+                case TINY_TOK_AND:
+                case TINY_TOK_OR:
+                case TINY_TOK_PERCENT:
+                case TINY_TOK_SHIFT_LEFT:
+                case TINY_TOK_SHIFT_RIGHT: {
+                    ResolveTypes(state, exp->binary.lhs);
+                    ResolveTypes(state, exp->binary.rhs);
+
+                    bool iLhs = exp->binary.lhs->tag->type == TINY_SYM_TAG_INT;
+                    bool iRhs = exp->binary.rhs->tag->type == TINY_SYM_TAG_INT;
+
+                    if (!(iLhs && iRhs)) {
+                        ReportErrorE(
+                            state, exp,
+                            "Both sides of binary op must be ints, but they're %s and %s\n",
+                            GetTagName(exp->binary.lhs->tag), GetTagName(exp->binary.rhs->tag));
+                    }
+
+                    exp->tag = GetPrimTag(TINY_SYM_TAG_INT);
+                } break;
+
+                case TINY_TOK_LOG_AND:
+                case TINY_TOK_LOG_OR: {
+                    ResolveTypes(state, exp->binary.lhs);
+                    ResolveTypes(state, exp->binary.rhs);
+
+                    if (exp->binary.lhs->tag->type != TINY_SYM_TAG_BOOL ||
+                        exp->binary.rhs->tag->type != TINY_SYM_TAG_BOOL) {
+                        ReportErrorE(state, exp,
+                                     "Left and right hand side of binary and/or must be bools, "
+                                     "but they're %s and %s",
+                                     GetTagName(exp->binary.lhs->tag),
+                                     GetTagName(exp->binary.rhs->tag));
+                    }
+
+                    exp->tag = GetPrimTag(TINY_SYM_TAG_BOOL);
+                } break;
+
+                case TINY_TOK_GT:
+                case TINY_TOK_LT:
+                case TINY_TOK_LTE:
+                case TINY_TOK_GTE: {
+                    ResolveTypes(state, exp->binary.lhs);
+                    ResolveTypes(state, exp->binary.rhs);
+
+                    bool iLhs = exp->binary.lhs->tag->type == TINY_SYM_TAG_INT;
+                    bool iRhs = exp->binary.rhs->tag->type == TINY_SYM_TAG_INT;
+
+                    bool fLhs = !iLhs && exp->binary.lhs->tag->type == TINY_SYM_TAG_FLOAT;
+                    bool fRhs = !iRhs && exp->binary.rhs->tag->type == TINY_SYM_TAG_FLOAT;
+
+                    if ((!iLhs && !fLhs) || (!iRhs && !fRhs)) {
+                        ReportErrorE(state, exp,
+                                     "Left and right hand side of binary comparison must be "
+                                     "ints or floats, but they're %s and %s",
+                                     GetTagName(exp->binary.lhs->tag),
+                                     GetTagName(exp->binary.rhs->tag));
+                    }
+
+                    exp->tag = GetPrimTag(TINY_SYM_TAG_BOOL);
+                } break;
+
+                case TINY_TOK_EQUALS:
+                case TINY_TOK_NOTEQUALS: {
+                    ResolveTypes(state, exp->binary.lhs);
+                    ResolveTypes(state, exp->binary.rhs);
+
+                    if (exp->binary.lhs->tag->type == TINY_SYM_TAG_VOID ||
+                        exp->binary.rhs->tag->type == TINY_SYM_TAG_VOID) {
+                        ReportErrorE(
+                            state, exp,
+                            "Attempted to check for equality with void. This is not allowed.");
+                    }
+
+                    exp->tag = GetPrimTag(TINY_SYM_TAG_BOOL);
+                } break;
+
+                case TINY_TOK_DECLARE: {
+                    assert(exp->binary.lhs->type == TINY_EXP_ID);
+
+                    assert(exp->binary.lhs->id.sym);
+
+                    ResolveTypes(state, exp->binary.rhs);
+
+                    if (exp->binary.rhs->tag->type == TINY_SYM_TAG_VOID) {
+                        ReportErrorE(state, exp,
+                                     "Attempted to initialize variable with void expression. "
+                                     "Don't do that.");
+                    }
+
+                    exp->binary.lhs->id.sym->var.tag = exp->binary.rhs->tag;
+
+                    exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+                } break;
+
+                case TINY_TOK_PLUSEQUAL:
+                case TINY_TOK_MINUSEQUAL:
+                case TINY_TOK_STAREQUAL:
+                case TINY_TOK_SLASHEQUAL:
+                case TINY_TOK_PERCENTEQUAL:
+                case TINY_TOK_OREQUAL:
+                case TINY_TOK_ANDEQUAL:
+                case TINY_TOK_EQUAL: {
+                    ResolveTypes(state, exp->binary.lhs);
+                    ResolveTypes(state, exp->binary.rhs);
+
+                    if (!IsTagAssignableTo(exp->binary.rhs->tag, exp->binary.lhs->tag)) {
+                        ReportErrorE(
+                            state, exp, "Attempted to assign a '%s' to a '%s'. Can't do that.",
+                            GetTagName(exp->binary.rhs->tag), GetTagName(exp->binary.lhs->tag));
+                    }
+
+                    exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+                } break;
+
+                default: {
+                    ResolveTypes(state, exp->binary.rhs);
+                    exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+                } break;
+            }
+        } break;
+
+        case TINY_EXP_UNARY: {
+            ResolveTypes(state, exp->unary.exp);
+
+            switch (exp->unary.op) {
+                case TINY_TOK_MINUS: {
+                    bool i = exp->unary.exp->tag->type == TINY_SYM_TAG_INT;
+                    bool f = !i && exp->unary.exp->tag->type == TINY_SYM_TAG_FLOAT;
+
+                    if (!(i || f)) {
+                        ReportErrorE(state, exp, "Attempted to apply unary '-' to a %s.",
+                                     GetTagName(exp->unary.exp->tag));
+                    }
+
+                    exp->tag = i ? GetPrimTag(TINY_SYM_TAG_INT) : GetPrimTag(TINY_SYM_TAG_FLOAT);
+                } break;
+
+                case TINY_TOK_BANG: {
+                    if (exp->unary.exp->tag->type != TINY_SYM_TAG_BOOL) {
+                        ReportErrorE(state, exp, "Attempted to apply unary 'not' to a %s.",
+                                     GetTagName(exp->unary.exp->tag));
+                    }
+
+                    exp->tag = GetPrimTag(TINY_SYM_TAG_BOOL);
+                } break;
+
+                default:
+                    assert(0);
+                    break;
+            }
+        } break;
+
+        case TINY_EXP_BLOCK: {
+            for (Tiny_Expr *node = exp->blockHead; node; node = node->next) {
+                ResolveTypes(state, node);
+            }
+
+            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+        } break;
+
+        case TINY_EXP_PROC: {
+            Tiny_Symbol *prevCurrFunc = state->currFunc;
+            state->currFunc = exp->proc.decl;
+
+            ResolveTypes(state, exp->proc.body);
+
+            state->currFunc = prevCurrFunc;
+
+            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+        } break;
+
+        case TINY_EXP_IF: {
+            ResolveTypes(state, exp->ifx.cond);
+
+            if (exp->ifx.cond->tag->type != TINY_SYM_TAG_BOOL) {
+                ReportErrorE(state, exp, "If condition is supposed to be a bool but its a %s",
+                             GetTagName(exp->ifx.cond->tag));
+            }
+
+            ResolveTypes(state, exp->ifx.body);
+
+            if (exp->ifx.alt) {
+                ResolveTypes(state, exp->ifx.alt);
+            }
+
+            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+        } break;
+
+        case TINY_EXP_RETURN: {
+            assert(state->currFunc);
+
+            if (exp->retExpr) {
+                ResolveTypes(state, exp->retExpr);
+
+                if (!IsTagAssignableTo(exp->retExpr->tag, state->currFunc->func.returnTag)) {
+                    ReportErrorE(
+                        state, exp,
+                        "You tried to return a '%s' from function '%s' but its return type is '%s'",
+                        GetTagName(exp->retExpr->tag), state->currFunc->name,
+                        GetTagName(state->currFunc->func.returnTag));
+                }
+            } else if (state->currFunc->func.returnTag->type != TINY_SYM_TAG_VOID) {
+                ReportErrorE(state, exp,
+                             "Attempted to return without value in function '%s' even though its "
+                             "return type is %s",
+                             state->currFunc->name, GetTagName(state->currFunc->func.returnTag));
+            }
+
+            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+        } break;
+
+        case TINY_EXP_WHILE: {
+            ResolveTypes(state, exp->whilex.cond);
+
+            if (exp->whilex.cond->tag->type != TINY_SYM_TAG_BOOL) {
+                ReportErrorE(state, exp, "While condition is supposed to be a bool but its a %s",
+                             GetTagName(exp->whilex.cond->tag));
+            }
+
+            ResolveTypes(state, exp->whilex.body);
+
+            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+        } break;
+
+        case TINY_EXP_FOR: {
+            ResolveTypes(state, exp->forx.init);
+            ResolveTypes(state, exp->forx.cond);
+
+            if (exp->forx.cond->tag->type != TINY_SYM_TAG_BOOL) {
+                ReportErrorE(state, exp, "For condition is supposed to be a bool but its a %s",
+                             GetTagName(exp->forx.cond->tag));
+            }
+
+            ResolveTypes(state, exp->forx.step);
+            ResolveTypes(state, exp->forx.body);
+
+            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+        } break;
+
+        case TINY_EXP_DOT: {
+            ResolveTypes(state, exp->dot.lhs);
+
+            if (exp->dot.lhs->tag->type != TINY_SYM_TAG_STRUCT) {
+                ReportErrorE(state, exp, "Cannot use '.' on a %s", GetTagName(exp->dot.lhs->tag));
+            }
+
+            exp->tag = GetFieldTag(exp->dot.lhs->tag, exp->dot.field->value, NULL);
+
+            if (!exp->tag) {
+                ReportErrorE(state, exp, "Struct %s doesn't have a field named %s",
+                             GetTagName(exp->dot.lhs->tag), exp->dot.field->value);
+            }
+        } break;
+
+        case TINY_EXP_CONSTRUCTOR: {
+            assert(exp->constructor.structTag->sstruct.defined);
+
+            int tagCount = sb_count(exp->constructor.structTag->sstruct.fields);
+
+            Tiny_StringNode *nameNode = exp->constructor.argNamesHead;
+
+            int i = 0;
+            for (Tiny_Expr *argNode = exp->constructor.argsHead; argNode;
+                 (argNode = argNode->next, ++i)) {
+                ResolveTypes(state, argNode);
+
+                if (!nameNode && exp->constructor.argNamesHead) {
+                    ReportErrorE(state, exp,
+                                 "Invalid designated initializer for struct %s. Make sure you "
+                                 "initialize every field.",
+                                 GetTagName(exp->constructor.structTag));
+                }
+
+                if (i >= tagCount) {
+                    ReportErrorE(state, exp,
+                                 "struct %s constructor expects %d args but you supplied more.",
+                                 GetTagName(exp->constructor.structTag), tagCount);
+                }
+
+                if (exp->constructor.argNamesHead) {
+                    bool found = false;
+
+                    for (int j = 0; j < tagCount; ++j) {
+                        Tiny_Symbol *expectedField = exp->constructor.structTag->sstruct.fields[j];
+                        assert(expectedField->type == TINY_SYM_FIELD);
+
+                        if (strcmp(nameNode->value, expectedField->name) != 0) {
+                            continue;
+                        }
+
+                        if (!IsTagAssignableTo(argNode->tag, expectedField->fieldTag)) {
+                            ReportErrorE(state, argNode,
+                                         "Designated initializer .%s to constructor is supposed to "
+                                         "be a %s but "
+                                         "you supplied a %s",
+                                         expectedField->name, GetTagName(expectedField->fieldTag),
+                                         GetTagName(argNode->tag));
+                        }
+
+                        found = true;
+                        break;
+                    }
+
+                    if (!found) {
+                        ReportErrorE(state, argNode,
+                                     "Designated initializer .%s doesn't correspond to any"
+                                     "field on struct %s",
+                                     nameNode->value, GetTagName(exp->constructor.structTag));
+                    }
+                } else {
+                    Tiny_Symbol *expectedField = exp->constructor.structTag->sstruct.fields[i];
+                    assert(expectedField->type == TINY_SYM_FIELD);
+
+                    if (!IsTagAssignableTo(argNode->tag, expectedField->fieldTag)) {
+                        ReportErrorE(
+                            state, argNode,
+                            "Initializer %i (for field '%s') to constructor is supposed to "
+                            "be a %s but "
+                            "you supplied a %s",
+                            i + 1, expectedField->name, GetTagName(expectedField->fieldTag),
+                            GetTagName(argNode->tag));
+                    }
+                }
+
+                if (nameNode) {
+                    nameNode = nameNode->next;
+                }
+            }
+
+            exp->tag = exp->constructor.structTag;
+        } break;
+
+        case TINY_EXP_CAST: {
+            assert(exp->cast.value);
+            assert(exp->cast.tag);
+
+            ResolveTypes(state, exp->cast.value);
+
+            // TODO(Apaar): Allow casting of int to float etc
+
+            // Allow casting from any or to any, but nothing else
+            if (exp->cast.value->tag->type != TINY_SYM_TAG_ANY &&
+                exp->cast.tag->type != TINY_SYM_TAG_ANY) {
+                ReportErrorE(state, exp->cast.value, "Attempted to cast a %s; only any is allowed.",
+                             GetTagName(exp->cast.value->tag));
+            }
+
+            exp->tag = exp->cast.tag;
+        } break;
+
+        case TINY_EXP_IF_TERNARY: {
+            assert(exp->ifx.cond);
+            assert(exp->ifx.body);
+            assert(exp->ifx.alt);
+
+            ResolveTypes(state, exp->ifx.cond);
+
+            if (exp->ifx.cond->tag->type != TINY_SYM_TAG_BOOL) {
+                ReportErrorE(state, exp,
+                             "Ternary if condition is supposed to be a bool but its a %s",
+                             GetTagName(exp->ifx.cond->tag));
+            }
+
+            ResolveTypes(state, exp->ifx.body);
+            ResolveTypes(state, exp->ifx.alt);
+
+            // TODO(Apaar): We assume symbols are interned here
+            if (exp->ifx.body->tag != exp->ifx.alt->tag) {
+                ReportErrorE(
+                    state, exp,
+                    "Ternary if 'true' value type '%s' is different from the false value type '%s'",
+                    GetTagName(exp->ifx.body->tag), GetTagName(exp->ifx.alt->tag));
+            }
+
+            exp->tag = exp->ifx.body->tag;
+        } break;
+
+        case TINY_EXP_INDEX: {
+            ResolveTypes(state, exp->index.arr);
+            ResolveTypes(state, exp->index.elem);
+
+            const char *arrTypeName = GetTagName(exp->index.arr->tag);
+
+            // TODO(Apaar): Allow for longer names??
+            char buf[256] = {0};
+            snprintf(buf, sizeof(buf), "%s_get_index", arrTypeName);
+
+            // This better exist (registered or otherwise)
+            const Tiny_Symbol *getIndexFunc = FindSymbol(state, buf, ST_MASK_FUNC);
+
+            if (!getIndexFunc) {
+                ReportErrorE(state, exp->index.arr,
+                             "In order to use [] you must define %s, but no such function exists",
+                             buf);
+            }
+
+            Tiny_Symbol *getIndexReturnType = getIndexFunc->type == TINY_SYM_FOREIGN_FUNCTION
+                                                  ? getIndexFunc->foreignFunc.returnTag
+                                                  : getIndexFunc->func.returnTag;
+
+            // TODO(Apaar): Check that the argument count of getIndexFunc is 2 and also that it
+            // receives the correct argument types.
+
+            exp->tag = getIndexReturnType;
+
+            snprintf(buf, sizeof(buf), "%s_set_index", arrTypeName);
+
+            // This one may or may not exist. Only matters if used.
+            // TODO(Apaar): If it does exist, we should ensure it is symmetric with the getIndexFunc
+            const Tiny_Symbol *setIndexFunc = FindSymbol(state, buf, ST_MASK_FUNC);
+
+            exp->index.getIndexFunc = getIndexFunc;
+            exp->index.setIndexFunc = setIndexFunc;
+        } break;
+
+        case TINY_EXP_FOREACH: {
+            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+
+            ResolveTypes(state, exp->forEach.range);
+
+            exp->forEach.cursorVar->var.tag = GetPrimTag(TINY_SYM_TAG_INT);
+
+            const char *rangeTypeName = GetTagName(exp->forEach.range->tag);
+
+            char iterNextName[256] = {0};
+            snprintf(iterNextName, sizeof(iterNextName), "%s_iter_next", rangeTypeName);
+
+            const Tiny_Symbol *iterNextFunc = FindSymbol(state, iterNextName, ST_MASK_FUNC);
+
+            if (iterNextFunc) {
+                if (exp->forEach.reverse) {
+                    ReportErrorE(state, exp->forEach.range,
+                                 "Cannot use `in_reverse` on a %s since it's iterated with %s.",
+                                 rangeTypeName, iterNextName);
+                }
+
+                const Tiny_Symbol *iterKeyFunc =
+                    FindForeachFunc(state, exp->forEach.range, rangeTypeName, "iter_key");
+                const Tiny_Symbol *iterValueFunc =
+                    FindForeachFunc(state, exp->forEach.range, rangeTypeName, "iter_value");
+
+                exp->forEach.iterNextFunc = iterNextFunc;
+                exp->forEach.iterKeyFunc = iterKeyFunc;
+                exp->forEach.iterValueFunc = iterValueFunc;
+
+                exp->forEach.elemVar->var.tag = GetFuncReturnTag(iterKeyFunc);
+                exp->forEach.indexVar->var.tag = GetFuncReturnTag(iterValueFunc);
+
+                ResolveTypes(state, exp->forEach.body);
+                break;
+            }
+
+            // Must resolve the types of the elemVar and indexVar before resolving the body
+            // because it probably uses these vars
+            exp->forEach.indexVar->var.tag = GetPrimTag(TINY_SYM_TAG_INT);
+
+            {
+                const char *arrTypeName = GetTagName(exp->forEach.range->tag);
+
+                // HACK(Apaar): Copy pasted wholesale from above
+                // COPYPASTE BEGIN
+
+                // TODO(Apaar): Allow for longer names??
+                char buf[256] = {0};
+                snprintf(buf, sizeof(buf), "%s_get_index", arrTypeName);
+
+                // This better exist (registered or otherwise)
+                const Tiny_Symbol *getIndexFunc = FindSymbol(state, buf, ST_MASK_FUNC);
+
+                if (!getIndexFunc) {
+                    ReportErrorE(state, exp->forEach.range,
+                                 "In order to use `foreach` on this you must define %s, but no "
+                                 "such function exists",
+                                 buf, arrTypeName);
+                }
+
+                Tiny_Symbol *getIndexReturnType = getIndexFunc->type == TINY_SYM_FOREIGN_FUNCTION
+                                                      ? getIndexFunc->foreignFunc.returnTag
+                                                      : getIndexFunc->func.returnTag;
+
+                // TODO(Apaar): Check that the argument count of getIndexFunc is 2 and also that it
+                // receives the correct argument types.
+
+                // COPYPASTE END
+
+                snprintf(buf, sizeof(buf), "%s_len", arrTypeName);
+
+                // This better exist (registered or otherwise)
+                const Tiny_Symbol *lenFunc = FindSymbol(state, buf, ST_MASK_FUNC);
+
+                if (!lenFunc) {
+                    ReportErrorE(state, exp->forEach.range,
+                                 "In order to use `foreach` on this you must define %s, but no "
+                                 "such function exists",
+                                 buf);
+                }
+
+                exp->forEach.getIndexFunc = getIndexFunc;
+                exp->forEach.lenFunc = lenFunc;
+                exp->forEach.elemVar->var.tag = getIndexReturnType;
+            }
+
+            ResolveTypes(state, exp->forEach.body);
+        } break;
+
+        case TINY_EXP_INLINE_CALL: {
+            // Calls are only inlined after types are resolved (and keep the tag of the call they
+            // replaced), so these never make it here
+            assert(0);
+        } break;
+    }
+}
+
+// Returns true if exp is a literal (after folding, this includes constants)
+static bool IsLiteralExpr(const Tiny_Expr *exp) {
+    switch (exp->type) {
+        case TINY_EXP_BOOL:
+        case TINY_EXP_CHAR:
+        case TINY_EXP_INT:
+        case TINY_EXP_FLOAT:
+        case TINY_EXP_STRING:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool IsIntLiteralExpr(const Tiny_Expr *exp) {
+    return exp->type == TINY_EXP_INT || exp->type == TINY_EXP_CHAR;
+}
+
+static Tiny_Float GetLiteralAsFloat(const Tiny_Expr *exp) {
+    return IsIntLiteralExpr(exp) ? (Tiny_Float)exp->iValue : exp->fValue;
+}
+
+// Replaces exp with the given expression (which is usually one of its children), keeping it in
+// whatever list it was in.
+static void ReplaceExpr(Tiny_Expr *exp, const Tiny_Expr *with) {
+    Tiny_Expr *next = exp->next;
+
+    *exp = *with;
+    exp->next = next;
+}
+
+static void ReplaceWithEmptyBlock(Tiny_Expr *exp) {
+    exp->type = TINY_EXP_BLOCK;
+    exp->blockHead = NULL;
+}
+
+static void ReplaceWithBool(Tiny_Expr *exp, bool value) {
+    exp->type = TINY_EXP_BOOL;
+    exp->boolean = value;
+}
+
+// Replaces exp with the given int, unless it doesn't survive being stored in a Tiny_Value (in
+// which case folding it could change what the program does).
+static bool ReplaceWithInt(Tiny_Expr *exp, Tiny_Int value) {
+#ifdef TINY_VALUE_NANBOX
+    if (value > TINY_NANBOX_INT_MAX || value < -TINY_NANBOX_INT_MAX - 1) {
+        return false;
+    }
+#endif
+
+    exp->type = TINY_EXP_INT;
+    exp->iValue = value;
+
+    return true;
+}
+
+static void ReplaceWithFloat(Tiny_Expr *exp, Tiny_Float value) {
+    exp->type = TINY_EXP_FLOAT;
+    exp->fValue = value;
+}
+
+// Folds `lhs op rhs` where both sides are int literals. Leaves exp alone if the operation would
+// fail (or be undefined) at runtime.
+static void FoldIntBinary(Tiny_Expr *exp, int op, Tiny_Int a, Tiny_Int b) {
+    // Overflow wraps around at runtime, but it's undefined for signed ints in C
+    uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+
+    switch (op) {
+        case TINY_TOK_PLUS:
+            ReplaceWithInt(exp, (Tiny_Int)(ua + ub));
+            break;
+        case TINY_TOK_MINUS:
+            ReplaceWithInt(exp, (Tiny_Int)(ua - ub));
+            break;
+        case TINY_TOK_STAR:
+            ReplaceWithInt(exp, (Tiny_Int)(ua * ub));
+            break;
+
+        case TINY_TOK_SLASH:
+        case TINY_TOK_PERCENT:
+            if (b == 0 || (b == -1 && a == INT64_MIN)) break;
+            ReplaceWithInt(exp, op == TINY_TOK_SLASH ? a / b : a % b);
+            break;
+
+        case TINY_TOK_AND:
+            ReplaceWithInt(exp, a & b);
+            break;
+        case TINY_TOK_OR:
+            ReplaceWithInt(exp, a | b);
+            break;
+
+        case TINY_TOK_SHIFT_LEFT:
+        case TINY_TOK_SHIFT_RIGHT:
+            if (b < 0 || b >= 64 || (op == TINY_TOK_SHIFT_LEFT && a < 0)) break;
+            ReplaceWithInt(exp, op == TINY_TOK_SHIFT_LEFT ? (Tiny_Int)(ua << b) : a >> b);
+            break;
+
+        case TINY_TOK_LT:
+            ReplaceWithBool(exp, a < b);
+            break;
+        case TINY_TOK_LTE:
+            ReplaceWithBool(exp, a <= b);
+            break;
+        case TINY_TOK_GT:
+            ReplaceWithBool(exp, a > b);
+            break;
+        case TINY_TOK_GTE:
+            ReplaceWithBool(exp, a >= b);
+            break;
+    }
+}
+
+// Folds `lhs op rhs` where either side is a float literal and the other one is a float or int
+// literal, just like CompileArithmetic would convert them.
+static void FoldFloatBinary(Tiny_Expr *exp, int op, Tiny_Float a, Tiny_Float b) {
+    switch (op) {
+        case TINY_TOK_PLUS:
+            ReplaceWithFloat(exp, a + b);
+            break;
+        case TINY_TOK_MINUS:
+            ReplaceWithFloat(exp, a - b);
+            break;
+        case TINY_TOK_STAR:
+            ReplaceWithFloat(exp, a * b);
+            break;
+        case TINY_TOK_SLASH:
+            ReplaceWithFloat(exp, a / b);
+            break;
+        case TINY_TOK_LT:
+            ReplaceWithBool(exp, a < b);
+            break;
+        case TINY_TOK_LTE:
+            ReplaceWithBool(exp, a <= b);
+            break;
+        case TINY_TOK_GT:
+            ReplaceWithBool(exp, a > b);
+            break;
+        case TINY_TOK_GTE:
+            ReplaceWithBool(exp, a >= b);
+            break;
+    }
+}
+
+// Folds `lhs == rhs` (or !=) if both sides are literals with the same type
+static void FoldEquality(Tiny_State *state, Tiny_Expr *exp) {
+    const Tiny_Expr *lhs = exp->binary.lhs;
+    const Tiny_Expr *rhs = exp->binary.rhs;
+
+    if (!IsLiteralExpr(lhs) || !IsLiteralExpr(rhs) || lhs->tag != rhs->tag) {
+        return;
+    }
+
+    bool equal;
 
-                    bool fLhs = !iLhs && exp->binary.lhs->tag->type == TINY_SYM_TAG_FLOAT;
-                    bool fRhs = !iRhs && exp->binary.rhs->tag->type == TINY_SYM_TAG_FLOAT;
+    switch (lhs->tag->type) {
+        case TINY_SYM_TAG_BOOL:
+            equal = lhs->boolean == rhs->boolean;
+            break;
+        case TINY_SYM_TAG_INT:
+            equal = lhs->iValue == rhs->iValue;
+            break;
+        case TINY_SYM_TAG_FLOAT:
+            equal = lhs->fValue == rhs->fValue;
+            break;
+        case TINY_SYM_TAG_STR:
+            equal = strcmp(state->strings[lhs->sIndex], state->strings[rhs->sIndex]) == 0;
+            break;
+        default:
+            return;
+    }
 
-                    if ((!iLhs && !fLhs) || (!iRhs && !fRhs)) {
-                        ReportErrorE(state, exp,
-                                     "Left and right hand side of binary op must be ints or "
-                                     "floats, but they're %s and %s",
-                                     GetTagName(exp->binary.lhs->tag),
-                                     GetTagName(exp->binary.rhs->tag));
-                    }
+    ReplaceWithBool(exp, exp->binary.op == TINY_TOK_EQUALS ? equal : !equal);
+}
 
-                    exp->tag = GetPrimTag((iLhs && iRhs) ? TINY_SYM_TAG_INT : TINY_SYM_TAG_FLOAT);
-                } break;
+// Folds a call to strcat with string literal arguments into a string literal
+static void FoldStrcat(Tiny_State *state, Tiny_Expr *exp) {
+    const Tiny_Symbol *func = FindSymbol(state, exp->call.calleeName->value, ST_MASK_FUNC);
 
-                case TINY_TOK_AND:
-                case TINY_TOK_OR:
-                case TINY_TOK_PERCENT:
-                case TINY_TOK_SHIFT_LEFT:
-                case TINY_TOK_SHIFT_RIGHT: {
-                    ResolveTypes(state, exp->binary.lhs);
-                    ResolveTypes(state, exp->binary.rhs);
+    if (!func || func->type != TINY_SYM_FOREIGN_FUNCTION ||
+        func->foreignFunc.callee != Tiny_StdStrcat || state->numStrings >= MAX_STRINGS) {
+        return;
+    }
 
-                    bool iLhs = exp->binary.lhs->tag->type == TINY_SYM_TAG_INT;
-                    bool iRhs = exp->binary.rhs->tag->type == TINY_SYM_TAG_INT;
+    size_t totalLen = 0;
 
-                    if (!(iLhs && iRhs)) {
-                        ReportErrorE(
-                            state, exp,
-                            "Both sides of binary op must be ints, but they're %s and %s\n",
-                            GetTagName(exp->binary.lhs->tag), GetTagName(exp->binary.rhs->tag));
-                    }
+    for (const Tiny_Expr *arg = exp->call.argsHead; arg; arg = arg->next) {
+        if (arg->type != TINY_EXP_STRING) {
+            return;
+        }
 
-                    exp->tag = GetPrimTag(TINY_SYM_TAG_INT);
-                } break;
+        totalLen += strlen(state->strings[arg->sIndex]);
+    }
 
-                case TINY_TOK_LOG_AND:
-                case TINY_TOK_LOG_OR: {
-                    ResolveTypes(state, exp->binary.lhs);
-                    ResolveTypes(state, exp->binary.rhs);
+    char *str = TMalloc(&state->ctx, totalLen + 1);
+    char *ptr = str;
 
-                    if (exp->binary.lhs->tag->type != TINY_SYM_TAG_BOOL ||
-                        exp->binary.rhs->tag->type != TINY_SYM_TAG_BOOL) {
-                        ReportErrorE(state, exp,
-                                     "Left and right hand side of binary and/or must be bools, "
-                                     "but they're %s and %s",
-                                     GetTagName(exp->binary.lhs->tag),
-                                     GetTagName(exp->binary.rhs->tag));
-                    }
+    for (const Tiny_Expr *arg = exp->call.argsHead; arg; arg = arg->next) {
+        size_t len = strlen(state->strings[arg->sIndex]);
 
-                    exp->tag = GetPrimTag(TINY_SYM_TAG_BOOL);
-                } break;
+        memcpy(ptr, state->strings[arg->sIndex], len);
+        ptr += len;
+    }
 
-                case TINY_TOK_GT:
-                case TINY_TOK_LT:
-                case TINY_TOK_LTE:
-                case TINY_TOK_GTE: {
-                    ResolveTypes(state, exp->binary.lhs);
-                    ResolveTypes(state, exp->binary.rhs);
+    *ptr = '\0';
 
-                    bool iLhs = exp->binary.lhs->tag->type == TINY_SYM_TAG_INT;
-                    bool iRhs = exp->binary.rhs->tag->type == TINY_SYM_TAG_INT;
+    exp->type = TINY_EXP_STRING;
+    exp->sIndex = RegisterString(state, str);
 
-                    bool fLhs = !iLhs && exp->binary.lhs->tag->type == TINY_SYM_TAG_FLOAT;
-                    bool fRhs = !iRhs && exp->binary.rhs->tag->type == TINY_SYM_TAG_FLOAT;
+    TFree(&state->ctx, str);
+}
 
-                    if ((!iLhs && !fLhs) || (!iRhs && !fRhs)) {
-                        ReportErrorE(state, exp,
-                                     "Left and right hand side of binary comparison must be "
-                                     "ints or floats, but they're %s and %s",
-                                     GetTagName(exp->binary.lhs->tag),
-                                     GetTagName(exp->binary.rhs->tag));
-                    }
+// Evaluates the parts of exp that only depend on literals and constants at compile time, and
+// removes the bodies of ifs and loops whose condition is known to be false. This runs after
+// ResolveTypes (so we know the types of everything and that they're valid) and rewrites the
+// tree in place.
+static void FoldConstants(Tiny_State *state, Tiny_Expr *exp) {
+    if (!exp) {
+        return;
+    }
 
-                    exp->tag = GetPrimTag(TINY_SYM_TAG_BOOL);
-                } break;
+    switch (exp->type) {
+        case TINY_EXP_ID: {
+            const Tiny_Symbol *sym = exp->id.sym;
 
-                case TINY_TOK_EQUALS:
-                case TINY_TOK_NOTEQUALS: {
-                    ResolveTypes(state, exp->binary.lhs);
-                    ResolveTypes(state, exp->binary.rhs);
+            if (sym->type != TINY_SYM_CONST) {
+                break;
+            }
 
-                    if (exp->binary.lhs->tag->type == TINY_SYM_TAG_VOID ||
-                        exp->binary.rhs->tag->type == TINY_SYM_TAG_VOID) {
-                        ReportErrorE(
-                            state, exp,
-                            "Attempted to check for equality with void. This is not allowed.");
-                    }
+            switch (sym->constant.tag->type) {
+                case TINY_SYM_TAG_BOOL:
+                    ReplaceWithBool(exp, sym->constant.bValue);
+                    break;
+                case TINY_SYM_TAG_INT:
+                    ReplaceWithInt(exp, sym->constant.iValue);
+                    break;
+                case TINY_SYM_TAG_FLOAT:
+                    ReplaceWithFloat(exp, sym->constant.fValue);
+                    break;
+                case TINY_SYM_TAG_STR:
+                    exp->type = TINY_EXP_STRING;
+                    exp->sIndex = (int)sym->constant.sIndex;
+                    break;
+                default:
+                    assert(0);
+                    break;
+            }
+        } break;
 
-                    exp->tag = GetPrimTag(TINY_SYM_TAG_BOOL);
-                } break;
+        case TINY_EXP_CALL: {
+            for (Tiny_Expr *arg = exp->call.argsHead; arg; arg = arg->next) {
+                FoldConstants(state, arg);
+            }
 
-                case TINY_TOK_DECLARE: {
-                    assert(exp->binary.lhs->type == TINY_EXP_ID);
+            FoldStrcat(state, exp);
+        } break;
 
-                    assert(exp->binary.lhs->id.sym);
+        case TINY_EXP_PAREN: {
+            FoldConstants(state, exp->paren);
 
-                    ResolveTypes(state, exp->binary.rhs);
+            if (IsLiteralExpr(exp->paren)) {
+                ReplaceExpr(exp, exp->paren);
+            }
+        } break;
 
-                    if (exp->binary.rhs->tag->type == TINY_SYM_TAG_VOID) {
-                        ReportErrorE(state, exp,
-                                     "Attempted to initialize variable with void expression. "
-                                     "Don't do that.");
-                    }
+        case TINY_EXP_UNARY: {
+            Tiny_Expr *value = exp->unary.exp;
 
-                    exp->binary.lhs->id.sym->var.tag = exp->binary.rhs->tag;
+            FoldConstants(state, value);
 
-                    exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
-                } break;
+            if (exp->unary.op == TINY_TOK_BANG && value->type == TINY_EXP_BOOL) {
+                ReplaceWithBool(exp, !value->boolean);
+            } else if (exp->unary.op == TINY_TOK_MINUS && IsIntLiteralExpr(value)) {
+                ReplaceWithInt(exp, (Tiny_Int)(0 - (uint64_t)value->iValue));
+            } else if (exp->unary.op == TINY_TOK_MINUS && value->type == TINY_EXP_FLOAT) {
+                ReplaceWithFloat(exp, -value->fValue);
+            }
+        } break;
 
+        case TINY_EXP_BINARY: {
+            Tiny_Expr *lhs = exp->binary.lhs;
+            Tiny_Expr *rhs = exp->binary.rhs;
+
+            switch (exp->binary.op) {
+                case TINY_TOK_DECLARECONST:
+                    break;
+
+                case TINY_TOK_DECLARE:
+                case TINY_TOK_EQUAL:
                 case TINY_TOK_PLUSEQUAL:
                 case TINY_TOK_MINUSEQUAL:
                 case TINY_TOK_STAREQUAL:
                 case TINY_TOK_SLASHEQUAL:
                 case TINY_TOK_PERCENTEQUAL:
                 case TINY_TOK_OREQUAL:
-                case TINY_TOK_ANDEQUAL:
-                case TINY_TOK_EQUAL: {
-                    ResolveTypes(state, exp->binary.lhs);
-                    ResolveTypes(state, exp->binary.rhs);
+                case TINY_TOK_ANDEQUAL: {
+                    // The lhs is being assigned to, but its subexpressions are still evaluated
+                    if (lhs->type == TINY_EXP_DOT) {
+                        FoldConstants(state, lhs->dot.lhs);
+                    } else if (lhs->type == TINY_EXP_INDEX) {
+                        FoldConstants(state, lhs->index.arr);
+                        FoldConstants(state, lhs->index.elem);
+                    }
+
+                    FoldConstants(state, rhs);
+                } break;
+
+                case TINY_TOK_LOG_AND:
+                case TINY_TOK_LOG_OR: {
+                    FoldConstants(state, lhs);
+                    FoldConstants(state, rhs);
+
+                    if (lhs->type != TINY_EXP_BOOL) {
+                        break;
+                    }
+
+                    // The rhs is only evaluated if the lhs doesn't decide the result
+                    if (lhs->boolean == (exp->binary.op == TINY_TOK_LOG_OR)) {
+                        ReplaceWithBool(exp, lhs->boolean);
+                    } else {
+                        ReplaceExpr(exp, rhs);
+                    }
+                } break;
+
+                case TINY_TOK_EQUALS:
+                case TINY_TOK_NOTEQUALS: {
+                    FoldConstants(state, lhs);
+                    FoldConstants(state, rhs);
+
+                    FoldEquality(state, exp);
+                } break;
+
+                default: {
+                    FoldConstants(state, lhs);
+                    FoldConstants(state, rhs);
+
+                    if (IsIntLiteralExpr(lhs) && IsIntLiteralExpr(rhs)) {
+                        FoldIntBinary(exp, exp->binary.op, lhs->iValue, rhs->iValue);
+                    } else if ((IsIntLiteralExpr(lhs) || lhs->type == TINY_EXP_FLOAT) &&
+                               (IsIntLiteralExpr(rhs) || rhs->type == TINY_EXP_FLOAT)) {
+                        FoldFloatBinary(exp, exp->binary.op, GetLiteralAsFloat(lhs),
+                                        GetLiteralAsFloat(rhs));
+                    }
+                } break;
+            }
+        } break;
+
+        case TINY_EXP_BLOCK: {
+            for (Tiny_Expr *node = exp->blockHead; node; node = node->next) {
+                FoldConstants(state, node);
+            }
+        } break;
+
+        case TINY_EXP_PROC: {
+            FoldConstants(state, exp->proc.body);
+        } break;
+
+        case TINY_EXP_IF: {
+            FoldConstants(state, exp->ifx.cond);
+            FoldConstants(state, exp->ifx.body);
+            FoldConstants(state, exp->ifx.alt);
+
+            if (exp->ifx.cond->type != TINY_EXP_BOOL) {
+                break;
+            }
+
+            Tiny_Expr *taken = exp->ifx.cond->boolean ? exp->ifx.body : exp->ifx.alt;
+
+            if (taken) {
+                ReplaceExpr(exp, taken);
+            } else {
+                ReplaceWithEmptyBlock(exp);
+            }
+        } break;
+
+        case TINY_EXP_IF_TERNARY: {
+            FoldConstants(state, exp->ifx.cond);
+            FoldConstants(state, exp->ifx.body);
+            FoldConstants(state, exp->ifx.alt);
+
+            if (exp->ifx.cond->type == TINY_EXP_BOOL) {
+                ReplaceExpr(exp, exp->ifx.cond->boolean ? exp->ifx.body : exp->ifx.alt);
+            }
+        } break;
+
+        case TINY_EXP_RETURN: {
+            FoldConstants(state, exp->retExpr);
+        } break;
+
+        case TINY_EXP_WHILE: {
+            FoldConstants(state, exp->whilex.cond);
+            FoldConstants(state, exp->whilex.body);
+
+            if (exp->whilex.cond->type == TINY_EXP_BOOL && !exp->whilex.cond->boolean) {
+                ReplaceWithEmptyBlock(exp);
+            }
+        } break;
+
+        case TINY_EXP_FOR: {
+            FoldConstants(state, exp->forx.init);
+            FoldConstants(state, exp->forx.cond);
+            FoldConstants(state, exp->forx.step);
+            FoldConstants(state, exp->forx.body);
+
+            if (exp->forx.cond->type == TINY_EXP_BOOL && !exp->forx.cond->boolean) {
+                // The init still runs
+                ReplaceExpr(exp, exp->forx.init);
+            }
+        } break;
+
+        case TINY_EXP_DOT: {
+            FoldConstants(state, exp->dot.lhs);
+        } break;
+
+        case TINY_EXP_CONSTRUCTOR: {
+            for (Tiny_Expr *arg = exp->constructor.argsHead; arg; arg = arg->next) {
+                FoldConstants(state, arg);
+            }
+        } break;
+
+        case TINY_EXP_CAST: {
+            FoldConstants(state, exp->cast.value);
+        } break;
+
+        case TINY_EXP_INDEX: {
+            FoldConstants(state, exp->index.arr);
+            FoldConstants(state, exp->index.elem);
+        } break;
+
+        case TINY_EXP_FOREACH: {
+            FoldConstants(state, exp->forEach.range);
+            FoldConstants(state, exp->forEach.body);
+        } break;
+
+        case TINY_EXP_INLINE_CALL: {
+            FoldConstants(state, exp->inlineCall.body);
+        } break;
+
+        default:
+            break;
+    }
+}
+
+static Tiny_StringNode *CloneStringNode(Tiny_Arena *arena, const Tiny_StringNode *node) {
+    if (!node) {
+        return NULL;
+    }
+
+    size_t len = strlen(node->value);
+
+    Tiny_StringNode *clone =
+        Tiny_ArenaAlloc(arena, sizeof(Tiny_StringNode) + len + 1, sizeof(void *));
+    char *dup = (char *)clone + sizeof(Tiny_StringNode);
+
+    memcpy(dup, node->value, len + 1);
+    clone->value = dup;
+    clone->next = NULL;
+
+    return clone;
+}
+
+static Tiny_Expr *CloneInlineExpr(Tiny_Arena *arena, const Tiny_Expr *exp,
+                                  Tiny_Symbol *const *params, Tiny_Expr *const *args);
+
+static Tiny_Expr *CloneInlineExprList(Tiny_Arena *arena, const Tiny_Expr *head,
+                                      Tiny_Symbol *const *params, Tiny_Expr *const *args) {
+    Tiny_Expr *clonedHead = NULL;
+    Tiny_Expr **next = &clonedHead;
+
+    for (const Tiny_Expr *node = head; node; node = node->next) {
+        *next = CloneInlineExpr(arena, node, params, args);
+        next = &(*next)->next;
+    }
+
+    return clonedHead;
+}
+
+// Deep copies an expression which can be inlined (see CountInlineExprNodes) into the given arena.
+// If args is non-NULL, references to params[i] are replaced with a copy of args[i].
+static Tiny_Expr *CloneInlineExpr(Tiny_Arena *arena, const Tiny_Expr *exp,
+                                  Tiny_Symbol *const *params, Tiny_Expr *const *args) {
+    if (!exp) {
+        return NULL;
+    }
+
+    if (args && exp->type == TINY_EXP_ID) {
+        for (int i = 0; i < sb_count(params); ++i) {
+            if (exp->id.sym == params[i]) {
+                exp = args[i];
+                break;
+            }
+        }
+    }
+
+    Tiny_Expr *clone = Tiny_ArenaAlloc(arena, sizeof(Tiny_Expr), sizeof(void *));
+
+    *clone = *exp;
+    clone->next = NULL;
+
+    switch (exp->type) {
+        case TINY_EXP_ID:
+            clone->id.name = CloneStringNode(arena, exp->id.name);
+            break;
+
+        case TINY_EXP_CALL:
+            clone->call.calleeName = CloneStringNode(arena, exp->call.calleeName);
+            clone->call.argsHead = CloneInlineExprList(arena, exp->call.argsHead, params, args);
+            break;
+
+        case TINY_EXP_BINARY:
+            clone->binary.lhs = CloneInlineExpr(arena, exp->binary.lhs, params, args);
+            clone->binary.rhs = CloneInlineExpr(arena, exp->binary.rhs, params, args);
+            break;
+
+        case TINY_EXP_PAREN:
+            clone->paren = CloneInlineExpr(arena, exp->paren, params, args);
+            break;
+
+        case TINY_EXP_UNARY:
+            clone->unary.exp = CloneInlineExpr(arena, exp->unary.exp, params, args);
+            break;
 
-                    if (!IsTagAssignableTo(exp->binary.rhs->tag, exp->binary.lhs->tag)) {
-                        ReportErrorE(
-                            state, exp, "Attempted to assign a '%s' to a '%s'. Can't do that.",
-                            GetTagName(exp->binary.rhs->tag), GetTagName(exp->binary.lhs->tag));
-                    }
+        case TINY_EXP_DOT:
+            clone->dot.lhs = CloneInlineExpr(arena, exp->dot.lhs, params, args);
+            clone->dot.field = CloneStringNode(arena, exp->dot.field);
+            break;
 
-                    exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
-                } break;
+        case TINY_EXP_CONSTRUCTOR:
+            // The args were already put in the right order by ResolveTypes
+            clone->constructor.argNamesHead = NULL;
+            clone->constructor.argsHead =
+                CloneInlineExprList(arena, exp->constructor.argsHead, params, args);
+            break;
 
-                default: {
-                    ResolveTypes(state, exp->binary.rhs);
-                    exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
-                } break;
-            }
-        } break;
+        case TINY_EXP_CAST:
+            clone->cast.value = CloneInlineExpr(arena, exp->cast.value, params, args);
+            break;
 
-        case TINY_EXP_UNARY: {
-            ResolveTypes(state, exp->unary.exp);
+        case TINY_EXP_INDEX:
+            clone->index.arr = CloneInlineExpr(arena, exp->index.arr, params, args);
+            clone->index.elem = CloneInlineExpr(arena, exp->index.elem, params, args);
+            break;
 
-            switch (exp->unary.op) {
-                case TINY_TOK_MINUS: {
-                    bool i = exp->unary.exp->tag->type == TINY_SYM_TAG_INT;
-                    bool f = !i && exp->unary.exp->tag->type == TINY_SYM_TAG_FLOAT;
+        case TINY_EXP_IF_TERNARY:
+            clone->ifx.cond = CloneInlineExpr(arena, exp->ifx.cond, params, args);
+            clone->ifx.body = CloneInlineExpr(arena, exp->ifx.body, params, args);
+            clone->ifx.alt = CloneInlineExpr(arena, exp->ifx.alt, params, args);
+            break;
 
-                    if (!(i || f)) {
-                        ReportErrorE(state, exp, "Attempted to apply unary '-' to a %s.",
-                                     GetTagName(exp->unary.exp->tag));
-                    }
+        default:
+            break;
+    }
 
-                    exp->tag = i ? GetPrimTag(TINY_SYM_TAG_INT) : GetPrimTag(TINY_SYM_TAG_FLOAT);
-                } break;
+    return clone;
+}
 
-                case TINY_TOK_BANG: {
-                    if (exp->unary.exp->tag->type != TINY_SYM_TAG_BOOL) {
-                        ReportErrorE(state, exp, "Attempted to apply unary 'not' to a %s.",
-                                     GetTagName(exp->unary.exp->tag));
-                    }
+// Returns the number of nodes in exp, or -1 if it contains something we can't inline into
+// another function. Since exp is an expression, the only locals it can refer to are the args of
+// func.
+static int CountInlineExprNodes(const Tiny_Symbol *func, const Tiny_Expr *exp) {
+    int count = 1;
 
-                    exp->tag = GetPrimTag(TINY_SYM_TAG_BOOL);
-                } break;
+    const Tiny_Expr *children[3] = {NULL};
+    const Tiny_Expr *list = NULL;
 
-                default:
-                    assert(0);
-                    break;
+    switch (exp->type) {
+        case TINY_EXP_NULL:
+        case TINY_EXP_BOOL:
+        case TINY_EXP_CHAR:
+        case TINY_EXP_INT:
+        case TINY_EXP_FLOAT:
+        case TINY_EXP_STRING:
+            break;
+
+        case TINY_EXP_ID: {
+            if (exp->id.sym->type != TINY_SYM_LOCAL) {
+                break;
             }
-        } break;
 
-        case TINY_EXP_BLOCK: {
-            for (Tiny_Expr *node = exp->blockHead; node; node = node->next) {
-                ResolveTypes(state, node);
+            for (int i = 0; i < sb_count(func->func.args); ++i) {
+                if (exp->id.sym == func->func.args[i]) {
+                    return count;
+                }
             }
 
-            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
+            return -1;
         } break;
 
-        case TINY_EXP_PROC: {
-            Tiny_Symbol *prevCurrFunc = state->currFunc;
-            state->currFunc = exp->proc.decl;
+        case TINY_EXP_CALL:
+            // Recursive functions can't be inlined
+            if (strcmp(exp->call.calleeName->value, func->name) == 0) {
+                return -1;
+            }
 
-            ResolveTypes(state, exp->proc.body);
+            list = exp->call.argsHead;
+            break;
 
-            state->currFunc = prevCurrFunc;
+        case TINY_EXP_BINARY:
+            children[0] = exp->binary.lhs;
+            children[1] = exp->binary.rhs;
+            break;
 
-            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
-        } break;
+        case TINY_EXP_PAREN:
+            children[0] = exp->paren;
+            break;
 
-        case TINY_EXP_IF: {
-            ResolveTypes(state, exp->ifx.cond);
+        case TINY_EXP_UNARY:
+            children[0] = exp->unary.exp;
+            break;
 
-            if (exp->ifx.cond->tag->type != TINY_SYM_TAG_BOOL) {
-                ReportErrorE(state, exp, "If condition is supposed to be a bool but its a %s",
-                             GetTagName(exp->ifx.cond->tag));
-            }
+        case TINY_EXP_DOT:
+            children[0] = exp->dot.lhs;
+            break;
 
-            ResolveTypes(state, exp->ifx.body);
+        case TINY_EXP_CONSTRUCTOR:
+            list = exp->constructor.argsHead;
+            break;
 
-            if (exp->ifx.alt) {
-                ResolveTypes(state, exp->ifx.alt);
-            }
+        case TINY_EXP_CAST:
+            children[0] = exp->cast.value;
+            break;
 
-            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
-        } break;
+        case TINY_EXP_INDEX:
+            children[0] = exp->index.arr;
+            children[1] = exp->index.elem;
+            break;
 
-        case TINY_EXP_RETURN: {
-            assert(state->currFunc);
+        case TINY_EXP_IF_TERNARY:
+            children[0] = exp->ifx.cond;
+            children[1] = exp->ifx.body;
+            children[2] = exp->ifx.alt;
+            break;
 
-            if (exp->retExpr) {
-                ResolveTypes(state, exp->retExpr);
+        default:
+            return -1;
+    }
 
-                if (!IsTagAssignableTo(exp->retExpr->tag, state->currFunc->func.returnTag)) {
-                    ReportErrorE(
-                        state, exp,
-                        "You tried to return a '%s' from function '%s' but its return type is '%s'",
-                        GetTagName(exp->retExpr->tag), state->currFunc->name,
-                        GetTagName(state->currFunc->func.returnTag));
-                }
-            } else if (state->currFunc->func.returnTag->type != TINY_SYM_TAG_VOID) {
-                ReportErrorE(state, exp,
-                             "Attempted to return without value in function '%s' even though its "
-                             "return type is %s",
-                             state->currFunc->name, GetTagName(state->currFunc->func.returnTag));
-            }
+    for (int i = 0; i < 3 && children[i]; ++i) {
+        int n = CountInlineExprNodes(func, children[i]);
 
-            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
-        } break;
+        if (n < 0) return -1;
+        count += n;
+    }
 
-        case TINY_EXP_WHILE: {
-            ResolveTypes(state, exp->whilex.cond);
+    for (const Tiny_Expr *node = list; node; node = node->next) {
+        int n = CountInlineExprNodes(func, node);
 
-            if (exp->whilex.cond->tag->type != TINY_SYM_TAG_BOOL) {
-                ReportErrorE(state, exp, "While condition is supposed to be a bool but its a %s",
-                             GetTagName(exp->whilex.cond->tag));
-            }
+        if (n < 0) return -1;
+        count += n;
+    }
 
-            ResolveTypes(state, exp->whilex.body);
+    return count;
+}
 
-            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
-        } break;
+// If the value returned by the statement is a single expression (i.e. it is `return x` or
+// `{ return x }`) returns x.
+static Tiny_Expr *GetReturnedExpr(Tiny_Expr *exp) {
+    if (exp && exp->type == TINY_EXP_BLOCK && exp->blockHead && !exp->blockHead->next) {
+        exp = exp->blockHead;
+    }
 
-        case TINY_EXP_FOR: {
-            ResolveTypes(state, exp->forx.init);
-            ResolveTypes(state, exp->forx.cond);
+    return exp && exp->type == TINY_EXP_RETURN ? exp->retExpr : NULL;
+}
 
-            if (exp->forx.cond->tag->type != TINY_SYM_TAG_BOOL) {
-                ReportErrorE(state, exp, "For condition is supposed to be a bool but its a %s",
-                             GetTagName(exp->forx.cond->tag));
-            }
+// If the body of the given function consists of `if c return x` statements followed by a
+// `return y`, returns an equivalent expression (i.e. `c ? x : y`), or NULL otherwise.
+static Tiny_Expr *GetFunctionBodyAsExpr(Tiny_State *state, const Tiny_Symbol *func,
+                                        Tiny_Expr *body) {
+    if (!body || body->type != TINY_EXP_BLOCK || !body->blockHead) {
+        return NULL;
+    }
 
-            ResolveTypes(state, exp->forx.step);
-            ResolveTypes(state, exp->forx.body);
+    Tiny_Expr *result = NULL;
 
-            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
-        } break;
+    // Where the next expression should go
+    Tiny_Expr **next = &result;
 
-        case TINY_EXP_DOT: {
-            ResolveTypes(state, exp->dot.lhs);
+    for (Tiny_Expr *node = body->blockHead; node; node = node->next) {
+        Tiny_Expr *value = NULL;
 
-            if (exp->dot.lhs->tag->type != TINY_SYM_TAG_STRUCT) {
-                ReportErrorE(state, exp, "Cannot use '.' on a %s", GetTagName(exp->dot.lhs->tag));
-            }
+        if (node->type == TINY_EXP_IF && !node->ifx.alt && node->next) {
+            value = GetReturnedExpr(node->ifx.body);
+        } else if (!node->next) {
+            value = GetReturnedExpr(node);
+        }
 
-            exp->tag = GetFieldTag(exp->dot.lhs->tag, exp->dot.field->value, NULL);
+        if (!value || value->tag != func->func.returnTag) {
+            return NULL;
+        }
 
-            if (!exp->tag) {
-                ReportErrorE(state, exp, "Struct %s doesn't have a field named %s",
-                             GetTagName(exp->dot.lhs->tag), exp->dot.field->value);
-            }
-        } break;
+        if (node->type == TINY_EXP_IF) {
+            Tiny_Expr *ternary = Expr_create(TINY_EXP_IF_TERNARY, state);
 
-        case TINY_EXP_CONSTRUCTOR: {
-            assert(exp->constructor.structTag->sstruct.defined);
+            ternary->pos = node->pos;
+            ternary->lineNumber = node->lineNumber;
+            ternary->tag = func->func.returnTag;
 
-            int tagCount = sb_count(exp->constructor.structTag->sstruct.fields);
+            ternary->ifx.cond = node->ifx.cond;
+            ternary->ifx.body = value;
 
-            Tiny_StringNode *nameNode = exp->constructor.argNamesHead;
+            *next = ternary;
+            next = &ternary->ifx.alt;
+        } else {
+            *next = value;
+        }
+    }
 
-            int i = 0;
-            for (Tiny_Expr *argNode = exp->constructor.argsHead; argNode;
-                 (argNode = argNode->next, ++i)) {
-                ResolveTypes(state, argNode);
+    return result;
+}
 
-                if (!nameNode && exp->constructor.argNamesHead) {
-                    ReportErrorE(state, exp,
-                                 "Invalid designated initializer for struct %s. Make sure you "
-                                 "initialize every field.",
-                                 GetTagName(exp->constructor.structTag));
-                }
+// Remembers the bodies of the functions in the program which are small enough to inline
+static void FindInlineExprs(Tiny_State *state, Tiny_Expr *progHead) {
+    while (sb_count(state->inlineExprs) < state->numFunctions) {
+        sb_push(&state->ctx, state->inlineExprs, NULL);
+    }
 
-                if (i >= tagCount) {
-                    ReportErrorE(state, exp,
-                                 "struct %s constructor expects %d args but you supplied more.",
-                                 GetTagName(exp->constructor.structTag), tagCount);
-                }
+    for (Tiny_Expr *exp = progHead; exp; exp = exp->next) {
+        if (exp->type != TINY_EXP_PROC) {
+            continue;
+        }
 
-                if (exp->constructor.argNamesHead) {
-                    bool found = false;
+        const Tiny_Symbol *func = exp->proc.decl;
 
-                    for (int j = 0; j < tagCount; ++j) {
-                        Tiny_Symbol *expectedField = exp->constructor.structTag->sstruct.fields[j];
-                        assert(expectedField->type == TINY_SYM_FIELD);
+        if (func->func.returnTag->type == TINY_SYM_TAG_VOID || sb_count(func->func.locals) > 0) {
+            continue;
+        }
 
-                        if (strcmp(nameNode->value, expectedField->name) != 0) {
-                            continue;
-                        }
+        Tiny_Expr *body = GetFunctionBodyAsExpr(state, func, exp->proc.body);
 
-                        if (!IsTagAssignableTo(argNode->tag, expectedField->fieldTag)) {
-                            ReportErrorE(state, argNode,
-                                         "Designated initializer .%s to constructor is supposed to "
-                                         "be a %s but "
-                                         "you supplied a %s",
-                                         expectedField->name, GetTagName(expectedField->fieldTag),
-                                         GetTagName(argNode->tag));
-                        }
+        if (!body) {
+            continue;
+        }
 
-                        found = true;
-                        break;
-                    }
+        int count = CountInlineExprNodes(func, body);
 
-                    if (!found) {
-                        ReportErrorE(state, argNode,
-                                     "Designated initializer .%s doesn't correspond to any"
-                                     "field on struct %s",
-                                     nameNode->value, GetTagName(exp->constructor.structTag));
-                    }
-                } else {
-                    Tiny_Symbol *expectedField = exp->constructor.structTag->sstruct.fields[i];
-                    assert(expectedField->type == TINY_SYM_FIELD);
+        if (count >= 0 && count <= TINY_INLINE_BUDGET) {
+            state->inlineExprs[func->func.index] =
+                CloneInlineExpr(&state->inlineArena, body, NULL, NULL);
+        }
+    }
+}
 
-                    if (!IsTagAssignableTo(argNode->tag, expectedField->fieldTag)) {
-                        ReportErrorE(
-                            state, argNode,
-                            "Initializer %i (for field '%s') to constructor is supposed to "
-                            "be a %s but "
-                            "you supplied a %s",
-                            i + 1, expectedField->name, GetTagName(expectedField->fieldTag),
-                            GetTagName(argNode->tag));
-                    }
-                }
+// Replaces the call exp with the body of the function being called if it's small enough (see
+// FindInlineExprs). Args are stored in new locals of the caller, unless they're literals or
+// locals which can be used in the body directly. Outside of functions, we can only inline if
+// that's the case for all of them.
+static void InlineCall(Tiny_State *state, Tiny_Symbol *caller, Tiny_Expr *exp) {
+    const Tiny_Symbol *func = FindSymbol(state, exp->call.calleeName->value, ST_MASK_FUNC);
 
-                if (nameNode) {
-                    nameNode = nameNode->next;
-                }
-            }
+    if (!func || func->type != TINY_SYM_FUNCTION || func == caller ||
+        (int)func->func.index >= sb_count(state->inlineExprs) ||
+        !state->inlineExprs[func->func.index]) {
+        return;
+    }
 
-            exp->tag = exp->constructor.structTag;
-        } break;
+    int nargs = sb_count(func->func.args);
 
-        case TINY_EXP_CAST: {
-            assert(exp->cast.value);
-            assert(exp->cast.tag);
+    Tiny_Expr **args =
+        Tiny_ArenaAlloc(&state->parserArena, sizeof(Tiny_Expr *) * (nargs + 1), sizeof(void *));
+    Tiny_Symbol **temps =
+        Tiny_ArenaAlloc(&state->parserArena, sizeof(Tiny_Symbol *) * (nargs + 1), sizeof(void *));
 
-            ResolveTypes(state, exp->cast.value);
+    int numTemps = 0;
+    int i = 0;
 
-            // TODO(Apaar): Allow casting of int to float etc
+    for (Tiny_Expr *arg = exp->call.argsHead; arg; (arg = arg->next, ++i)) {
+        bool isLocal = arg->type == TINY_EXP_ID && arg->id.sym->type == TINY_SYM_LOCAL;
 
-            // Allow casting from any or to any, but nothing else
-            if (exp->cast.value->tag->type != TINY_SYM_TAG_ANY &&
-                exp->cast.tag->type != TINY_SYM_TAG_ANY) {
-                ReportErrorE(state, exp->cast.value, "Attempted to cast a %s; only any is allowed.",
-                             GetTagName(exp->cast.value->tag));
-            }
+        args[i] = arg;
+        temps[i] = NULL;
 
-            exp->tag = exp->cast.tag;
-        } break;
+        if (!(IsLiteralExpr(arg) || isLocal) || arg->tag != func->func.args[i]->var.tag) {
+            ++numTemps;
+        }
+    }
+
+    assert(i == nargs);
+
+    if (numTemps > 0 && (!caller || sb_count(caller->func.locals) + numTemps > 0xff)) {
+        return;
+    }
+
+    i = 0;
 
-        case TINY_EXP_IF_TERNARY: {
-            assert(exp->ifx.cond);
-            assert(exp->ifx.body);
-            assert(exp->ifx.alt);
+    for (Tiny_Expr *arg = exp->call.argsHead; arg; (arg = arg->next, ++i)) {
+        bool isLocal = arg->type == TINY_EXP_ID && arg->id.sym->type == TINY_SYM_LOCAL;
 
-            ResolveTypes(state, exp->ifx.cond);
+        if ((IsLiteralExpr(arg) || isLocal) && arg->tag == func->func.args[i]->var.tag) {
+            continue;
+        }
 
-            if (exp->ifx.cond->tag->type != TINY_SYM_TAG_BOOL) {
-                ReportErrorE(state, exp,
-                             "Ternary if condition is supposed to be a bool but its a %s",
-                             GetTagName(exp->ifx.cond->tag));
-            }
+        const Tiny_Symbol *param = func->func.args[i];
+        Tiny_Symbol *temp = Symbol_create(TINY_SYM_LOCAL, param->name, state);
 
-            ResolveTypes(state, exp->ifx.body);
-            ResolveTypes(state, exp->ifx.alt);
+        temp->var.initialized = true;
+        temp->var.scopeEnded = true;
+        temp->var.index = sb_count(caller->func.locals);
+        temp->var.scope = 0;
+        temp->var.tag = param->var.tag;
 
-            // TODO(Apaar): We assume symbols are interned here
-            if (exp->ifx.body->tag != exp->ifx.alt->tag) {
-                ReportErrorE(
-                    state, exp,
-                    "Ternary if 'true' value type '%s' is different from the false value type '%s'",
-                    GetTagName(exp->ifx.body->tag), GetTagName(exp->ifx.alt->tag));
-            }
+        sb_push(&state->ctx, caller->func.locals, temp);
 
-            exp->tag = exp->ifx.body->tag;
-        } break;
+        Tiny_Expr *ref = Expr_create(TINY_EXP_ID, state);
 
-        case TINY_EXP_INDEX: {
-            ResolveTypes(state, exp->index.arr);
-            ResolveTypes(state, exp->index.elem);
+        ref->pos = arg->pos;
+        ref->lineNumber = arg->lineNumber;
+        ref->tag = temp->var.tag;
+        ref->id.name = CreateExprStringNode(state, param->name);
+        ref->id.sym = temp;
 
-            const char *arrTypeName = GetTagName(exp->index.arr->tag);
+        args[i] = ref;
+        temps[i] = temp;
+    }
 
-            // TODO(Apaar): Allow for longer names??
-            char buf[256] = {0};
-            snprintf(buf, sizeof(buf), "%s_get_index", arrTypeName);
+    Tiny_Expr *body = CloneInlineExpr(&state->parserArena, state->inlineExprs[func->func.index],
+                                      func->func.args, args);
 
-            // This better exist (registered or otherwise)
-            const Tiny_Symbol *getIndexFunc = FindSymbol(state, buf, ST_MASK_FUNC);
+    if (numTemps == 0) {
+        Tiny_TokenPos pos = exp->pos;
+        int lineNumber = exp->lineNumber;
 
-            if (!getIndexFunc) {
-                ReportErrorE(state, exp->index.arr,
-                             "In order to use [] you must define %s, but no such function exists",
-                             buf);
-            }
+        ReplaceExpr(exp, body);
 
-            Tiny_Symbol *getIndexReturnType = getIndexFunc->type == TINY_SYM_FOREIGN_FUNCTION
-                                                  ? getIndexFunc->foreignFunc.returnTag
-                                                  : getIndexFunc->func.returnTag;
+        exp->pos = pos;
+        exp->lineNumber = lineNumber;
+    } else {
+        Tiny_Expr *argsHead = exp->call.argsHead;
 
-            // TODO(Apaar): Check that the argument count of getIndexFunc is 2 and also that it
-            // receives the correct argument types.
+        exp->type = TINY_EXP_INLINE_CALL;
+        exp->inlineCall.argsHead = argsHead;
+        exp->inlineCall.temps = temps;
+        exp->inlineCall.body = body;
+    }
 
-            exp->tag = getIndexReturnType;
+    // The args might make more of the body constant
+    FoldConstants(state, exp);
+}
 
-            snprintf(buf, sizeof(buf), "%s_set_index", arrTypeName);
+static void InlineCallsInExpr(Tiny_State *state, Tiny_Symbol *caller, Tiny_Expr *exp) {
+    if (!exp) {
+        return;
+    }
 
-            // This one may or may not exist. Only matters if used.
-            // TODO(Apaar): If it does exist, we should ensure it is symmetric with the getIndexFunc
-            const Tiny_Symbol *setIndexFunc = FindSymbol(state, buf, ST_MASK_FUNC);
+    switch (exp->type) {
+        case TINY_EXP_CALL: {
+            for (Tiny_Expr *arg = exp->call.argsHead; arg; arg = arg->next) {
+                InlineCallsInExpr(state, caller, arg);
+            }
 
-            exp->index.getIndexFunc = getIndexFunc;
-            exp->index.setIndexFunc = setIndexFunc;
+            InlineCall(state, caller, exp);
         } break;
 
-        case TINY_EXP_FOREACH: {
-            exp->tag = GetPrimTag(TINY_SYM_TAG_VOID);
-
-            ResolveTypes(state, exp->forEach.range);
+        case TINY_EXP_BINARY:
+            InlineCallsInExpr(state, caller, exp->binary.lhs);
+            InlineCallsInExpr(state, caller, exp->binary.rhs);
+            break;
 
-            // Must resolve the types of the elemVar and indexVar before resolving the body
-            // because it probably uses these vars
-            exp->forEach.indexVar->var.tag = GetPrimTag(TINY_SYM_TAG_INT);
+        case TINY_EXP_PAREN:
+            InlineCallsInExpr(state, caller, exp->paren);
+            break;
 
-            {
-                const char *arrTypeName = GetTagName(exp->forEach.range->tag);
+        case TINY_EXP_UNARY:
+            InlineCallsInExpr(state, caller, exp->unary.exp);
+            break;
 
-                // HACK(Apaar): Copy pasted wholesale from above
-                // COPYPASTE BEGIN
+        case TINY_EXP_DOT:
+            InlineCallsInExpr(state, caller, exp->dot.lhs);
+            break;
 
-                // TODO(Apaar): Allow for longer names??
-                char buf[256] = {0};
-                snprintf(buf, sizeof(buf), "%s_get_index", arrTypeName);
+        case TINY_EXP_CONSTRUCTOR:
+            for (Tiny_Expr *arg = exp->constructor.argsHead; arg; arg = arg->next) {
+                InlineCallsInExpr(state, caller, arg);
+            }
+            break;
 
-                // This better exist (registered or otherwise)
-                const Tiny_Symbol *getIndexFunc = FindSymbol(state, buf, ST_MASK_FUNC);
+        case TINY_EXP_CAST:
+            InlineCallsInExpr(state, caller, exp->cast.value);
+            break;
 
-                if (!getIndexFunc) {
-                    ReportErrorE(state, exp->forEach.range,
-                                 "In order to use `foreach` on this you must define %s, but no "
-                                 "such function exists",
-                                 buf, arrTypeName);
-                }
+        case TINY_EXP_INDEX:
+            InlineCallsInExpr(state, caller, exp->index.arr);
+            InlineCallsInExpr(state, caller, exp->index.elem);
+            break;
 
-                Tiny_Symbol *getIndexReturnType = getIndexFunc->type == TINY_SYM_FOREIGN_FUNCTION
-                                                      ? getIndexFunc->foreignFunc.returnTag
-                                                      : getIndexFunc->func.returnTag;
+        case TINY_EXP_IF_TERNARY:
+            InlineCallsInExpr(state, caller, exp->ifx.cond);
+            InlineCallsInExpr(state, caller, exp->ifx.body);
+            InlineCallsInExpr(state, caller, exp->ifx.alt);
+            break;
 
-                // TODO(Apaar): Check that the argument count of getIndexFunc is 2 and also that it
-                // receives the correct argument types.
+        default:
+            break;
+    }
+}
 
-                // COPYPASTE END
+// Inlines calls to small functions (see FindInlineExprs) which are used as expressions in the
+// given statement. `caller` is the function the statement is in, or NULL.
+static void InlineCalls(Tiny_State *state, Tiny_Symbol *caller, Tiny_Expr *exp) {
+    if (!exp) {
+        return;
+    }
 
-                snprintf(buf, sizeof(buf), "%s_len", arrTypeName);
+    switch (exp->type) {
+        case TINY_EXP_CALL:
+            // The call itself is a statement so its value isn't used
+            for (Tiny_Expr *arg = exp->call.argsHead; arg; arg = arg->next) {
+                InlineCallsInExpr(state, caller, arg);
+            }
+            break;
 
-                // This better exist (registered or otherwise)
-                const Tiny_Symbol *lenFunc = FindSymbol(state, buf, ST_MASK_FUNC);
+        case TINY_EXP_BINARY: {
+            Tiny_Expr *lhs = exp->binary.lhs;
 
-                if (!lenFunc) {
-                    ReportErrorE(state, exp->forEach.range,
-                                 "In order to use `foreach` on this you must define %s, but no "
-                                 "such function exists",
-                                 buf);
-                }
+            if (exp->binary.op == TINY_TOK_DECLARECONST) {
+                break;
+            }
 
-                exp->forEach.getIndexFunc = getIndexFunc;
-                exp->forEach.lenFunc = lenFunc;
-                exp->forEach.elemVar->var.tag = getIndexReturnType;
+            if (lhs->type == TINY_EXP_DOT) {
+                InlineCallsInExpr(state, caller, lhs->dot.lhs);
+            } else if (lhs->type == TINY_EXP_INDEX) {
+                InlineCallsInExpr(state, caller, lhs->index.arr);
+                InlineCallsInExpr(state, caller, lhs->index.elem);
             }
 
-            ResolveTypes(state, exp->forEach.body);
+            InlineCallsInExpr(state, caller, exp->binary.rhs);
         } break;
+
+        case TINY_EXP_BLOCK:
+            for (Tiny_Expr *node = exp->blockHead; node; node = node->next) {
+                InlineCalls(state, caller, node);
+            }
+            break;
+
+        case TINY_EXP_PROC:
+            InlineCalls(state, exp->proc.decl, exp->proc.body);
+            break;
+
+        case TINY_EXP_IF:
+            InlineCallsInExpr(state, caller, exp->ifx.cond);
+            InlineCalls(state, caller, exp->ifx.body);
+            InlineCalls(state, caller, exp->ifx.alt);
+            break;
+
+        case TINY_EXP_RETURN:
+            InlineCallsInExpr(state, caller, exp->retExpr);
+            break;
+
+        case TINY_EXP_WHILE:
+            InlineCallsInExpr(state, caller, exp->whilex.cond);
+            InlineCalls(state, caller, exp->whilex.body);
+            break;
+
+        case TINY_EXP_FOR:
+            InlineCalls(state, caller, exp->forx.init);
+            InlineCallsInExpr(state, caller, exp->forx.cond);
+            InlineCalls(state, caller, exp->forx.step);
+            InlineCalls(state, caller, exp->forx.body);
+            break;
+
+        case TINY_EXP_FOREACH:
+            InlineCallsInExpr(state, caller, exp->forEach.range);
+            InlineCalls(state, caller, exp->forEach.body);
+            break;
+
+        default:
+            break;
     }
 }
 
@@ -3136,6 +5878,133 @@ static void GeneratePushString(Tiny_State *state, Tiny_ConstantIndex sIndex) {
 }
 
 static void CompileExpr(Tiny_State *state, Tiny_Expr *exp);
+static void CompileAssignVarToTopOfStack(Tiny_State *state, Tiny_Symbol *destVar,
+                                         Tiny_Expr *errExp);
+
+// Compiles the given int or float expression so that it leaves a float on the stack.
+static void CompileExprAsFloat(Tiny_State *state, Tiny_Expr *exp) {
+    if (exp->tag->type != TINY_SYM_TAG_INT) {
+        CompileExpr(state, exp);
+        return;
+    }
+
+    if (exp->type == TINY_EXP_INT || exp->type == TINY_EXP_CHAR) {
+        GeneratePushFloat(state, (Tiny_Float)exp->iValue);
+    } else {
+        CompileExpr(state, exp);
+        GenerateCode(state, TINY_OP_INT_TO_FLOAT);
+    }
+}
+
+// Compiles `lhs op rhs` where op is an arithmetic or comparison operator (also used for
+// compound assignments, in which case `op` is the operator without the '=').
+//
+// If both sides are ints we use the int opcode, and if either side is a float we convert
+// the other one and use the float opcode. The untyped opcodes are only used if the lhs is an
+// `any` (which is only possible for compound assignments).
+static void CompileArithmetic(Tiny_State *state, int op, Tiny_Expr *lhs, Tiny_Expr *rhs) {
+    Word genericOp, intOp, floatOp;
+
+    switch (op) {
+        case TINY_TOK_PLUS:
+            genericOp = TINY_OP_ADD, intOp = TINY_OP_ADD_INT, floatOp = TINY_OP_ADD_FLOAT;
+            break;
+        case TINY_TOK_MINUS:
+            genericOp = TINY_OP_SUB, intOp = TINY_OP_SUB_INT, floatOp = TINY_OP_SUB_FLOAT;
+            break;
+        case TINY_TOK_STAR:
+            genericOp = TINY_OP_MUL, intOp = TINY_OP_MUL_INT, floatOp = TINY_OP_MUL_FLOAT;
+            break;
+        case TINY_TOK_SLASH:
+            genericOp = TINY_OP_DIV, intOp = TINY_OP_DIV_INT, floatOp = TINY_OP_DIV_FLOAT;
+            break;
+        case TINY_TOK_LT:
+            genericOp = TINY_OP_LT, intOp = TINY_OP_LT_INT, floatOp = TINY_OP_LT_FLOAT;
+            break;
+        case TINY_TOK_LTE:
+            genericOp = TINY_OP_LTE, intOp = TINY_OP_LTE_INT, floatOp = TINY_OP_LTE_FLOAT;
+            break;
+        case TINY_TOK_GT:
+            genericOp = TINY_OP_GT, intOp = TINY_OP_GT_INT, floatOp = TINY_OP_GT_FLOAT;
+            break;
+        case TINY_TOK_GTE:
+            genericOp = TINY_OP_GTE, intOp = TINY_OP_GTE_INT, floatOp = TINY_OP_GTE_FLOAT;
+            break;
+
+        // These are only defined for ints
+        case TINY_TOK_PERCENT:
+            genericOp = intOp = floatOp = TINY_OP_MOD;
+            break;
+        case TINY_TOK_OR:
+            genericOp = intOp = floatOp = TINY_OP_OR;
+            break;
+        case TINY_TOK_AND:
+            genericOp = intOp = floatOp = TINY_OP_AND;
+            break;
+        case TINY_TOK_SHIFT_LEFT:
+            genericOp = intOp = floatOp = TINY_OP_SHIFT_LEFT;
+            break;
+        case TINY_TOK_SHIFT_RIGHT:
+            genericOp = intOp = floatOp = TINY_OP_SHIFT_RIGHT;
+            break;
+
+        default:
+            assert(0);
+            return;
+    }
+
+    Tiny_SymbolType lhsType = lhs->tag->type;
+    Tiny_SymbolType rhsType = rhs->tag->type;
+
+    if (lhsType == TINY_SYM_TAG_ANY || rhsType == TINY_SYM_TAG_ANY) {
+        CompileExpr(state, lhs);
+        CompileExpr(state, rhs);
+        GenerateCode(state, genericOp);
+    } else if (lhsType == TINY_SYM_TAG_INT && rhsType == TINY_SYM_TAG_INT) {
+        CompileExpr(state, lhs);
+
+        if (rhs->type == TINY_EXP_INT && rhs->iValue == 1 &&
+            (intOp == TINY_OP_ADD_INT || intOp == TINY_OP_SUB_INT)) {
+            GenerateCode(state, intOp == TINY_OP_ADD_INT ? TINY_OP_ADD1 : TINY_OP_SUB1);
+        } else {
+            CompileExpr(state, rhs);
+            GenerateCode(state, intOp);
+        }
+    } else {
+        CompileExprAsFloat(state, lhs);
+        CompileExprAsFloat(state, rhs);
+        GenerateCode(state, floatOp);
+    }
+}
+
+// Compiles `lhs == rhs`, using a typed comparison if both sides have the same primitive type.
+static void CompileEquality(Tiny_State *state, Tiny_Expr *lhs, Tiny_Expr *rhs) {
+    CompileExpr(state, lhs);
+    CompileExpr(state, rhs);
+
+    Word op = TINY_OP_EQU;
+
+    if (lhs->tag == rhs->tag) {
+        switch (lhs->tag->type) {
+            case TINY_SYM_TAG_BOOL:
+                op = TINY_OP_EQU_BOOL;
+                break;
+            case TINY_SYM_TAG_INT:
+                op = TINY_OP_EQU_INT;
+                break;
+            case TINY_SYM_TAG_FLOAT:
+                op = TINY_OP_EQU_FLOAT;
+                break;
+            case TINY_SYM_TAG_STR:
+                op = TINY_OP_EQU_STR;
+                break;
+            default:
+                break;
+        }
+    }
+
+    GenerateCode(state, op);
+}
 
 static void CompileCallSymbolWithArgsPrepared(Tiny_State *state, Word nargs, const Tiny_Symbol *fn,
                                               Tiny_Expr *errorExp) {
@@ -3331,117 +6200,41 @@ static void CompileExpr(Tiny_State *state, Tiny_Expr *exp) {
         } break;
 
         case TINY_EXP_CAST: {
-            assert(exp->tag);
-            assert(exp->cast.value);
-
-            // TODO(Apaar): Once the cast actually does something, change this to
-            // generate casting opcodes (ex. OP_INT_TO_FLOAT, OP_FLOAT_TO_INT, etc)
-            CompileExpr(state, exp->cast.value);
-        } break;
-
-        case TINY_EXP_BINARY: {
-            switch (exp->binary.op) {
-                case TINY_TOK_PLUS: {
-                    CompileExpr(state, exp->binary.lhs);
-
-                    if (exp->binary.rhs->type == TINY_EXP_INT && exp->binary.rhs->iValue == 1) {
-                        GenerateCode(state, TINY_OP_ADD1);
-                    } else {
-                        CompileExpr(state, exp->binary.rhs);
-                        GenerateCode(state, TINY_OP_ADD);
-                    }
-                } break;
-
-                case TINY_TOK_MINUS: {
-                    CompileExpr(state, exp->binary.lhs);
-
-                    if (exp->binary.rhs->type == TINY_EXP_INT && exp->binary.rhs->iValue == 1) {
-                        GenerateCode(state, TINY_OP_SUB1);
-                    } else {
-                        CompileExpr(state, exp->binary.rhs);
-                        GenerateCode(state, TINY_OP_SUB);
-                    }
-                } break;
-
-                case TINY_TOK_STAR: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_MUL);
-                } break;
-
-                case TINY_TOK_SLASH: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_DIV);
-                } break;
-
-                case TINY_TOK_PERCENT: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_MOD);
-                } break;
-
-                case TINY_TOK_OR: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_OR);
-                } break;
-
-                case TINY_TOK_AND: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_AND);
-                } break;
-
-                case TINY_TOK_SHIFT_LEFT: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_SHIFT_LEFT);
-                } break;
-
-                case TINY_TOK_SHIFT_RIGHT: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_SHIFT_RIGHT);
-                } break;
+            assert(exp->tag);
+            assert(exp->cast.value);
 
-                case TINY_TOK_LT: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_LT);
-                } break;
+            // TODO(Apaar): Once the cast actually does something, change this to
+            // generate casting opcodes (ex. OP_INT_TO_FLOAT, OP_FLOAT_TO_INT, etc)
+            CompileExpr(state, exp->cast.value);
+        } break;
 
-                case TINY_TOK_GT: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_GT);
+        case TINY_EXP_BINARY: {
+            switch (exp->binary.op) {
+                case TINY_TOK_PLUS:
+                case TINY_TOK_MINUS:
+                case TINY_TOK_STAR:
+                case TINY_TOK_SLASH:
+                case TINY_TOK_PERCENT:
+                case TINY_TOK_OR:
+                case TINY_TOK_AND:
+                case TINY_TOK_SHIFT_LEFT:
+                case TINY_TOK_SHIFT_RIGHT:
+                case TINY_TOK_LT:
+                case TINY_TOK_GT:
+                case TINY_TOK_LTE:
+                case TINY_TOK_GTE: {
+                    CompileArithmetic(state, exp->binary.op, exp->binary.lhs, exp->binary.rhs);
                 } break;
 
                 case TINY_TOK_EQUALS: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_EQU);
+                    CompileEquality(state, exp->binary.lhs, exp->binary.rhs);
                 } break;
 
                 case TINY_TOK_NOTEQUALS: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_EQU);
+                    CompileEquality(state, exp->binary.lhs, exp->binary.rhs);
                     GenerateCode(state, TINY_OP_LOG_NOT);
                 } break;
 
-                case TINY_TOK_LTE: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_LTE);
-                } break;
-
-                case TINY_TOK_GTE: {
-                    CompileExpr(state, exp->binary.lhs);
-                    CompileExpr(state, exp->binary.rhs);
-                    GenerateCode(state, TINY_OP_GTE);
-                } break;
-
                 case TINY_TOK_LOG_AND: {
                     CompileExpr(state, exp->binary.lhs);
 
@@ -3498,14 +6291,20 @@ static void CompileExpr(Tiny_State *state, Tiny_Expr *exp) {
 
                         Tiny_Int iValue = -exp->unary.exp->iValue;
                         GEN_VALUE_NOPOS(state, &iValue);
-                    } else {
+                    } else if (exp->unary.exp->type == TINY_EXP_FLOAT) {
+                        GeneratePushFloat(state, -exp->unary.exp->fValue);
+                    } else if (exp->unary.exp->tag->type == TINY_SYM_TAG_INT) {
                         CompileExpr(state, exp->unary.exp);
 
                         GenerateCode(state, TINY_OP_PUSH_INT);
                         Tiny_Int iValue = -1;
                         GEN_VALUE_NOPOS(state, &iValue);
 
-                        GenerateCode(state, TINY_OP_MUL);
+                        GenerateCode(state, TINY_OP_MUL_INT);
+                    } else {
+                        CompileExpr(state, exp->unary.exp);
+                        GeneratePushFloat(state, -1);
+                        GenerateCode(state, TINY_OP_MUL_FLOAT);
                     }
                 } break;
 
@@ -3521,6 +6320,19 @@ static void CompileExpr(Tiny_State *state, Tiny_Expr *exp) {
             }
         } break;
 
+        case TINY_EXP_INLINE_CALL: {
+            int i = 0;
+
+            for (Tiny_Expr *arg = exp->inlineCall.argsHead; arg; (arg = arg->next, ++i)) {
+                if (exp->inlineCall.temps[i]) {
+                    CompileExpr(state, arg);
+                    CompileAssignVarToTopOfStack(state, exp->inlineCall.temps[i], arg);
+                }
+            }
+
+            CompileExpr(state, exp->inlineCall.body);
+        } break;
+
         case TINY_EXP_IF_TERNARY: {
             CompileExpr(state, exp->ifx.cond);
 
@@ -3681,6 +6493,424 @@ static void CompileAssignVarToTopOfStack(Tiny_State *state, Tiny_Symbol *destVar
     destVar->var.initialized = true;
 }
 
+// Registers are frame slots relative to fp which are stored in a signed byte
+#define MIN_REGISTER INT8_MIN
+#define MAX_REGISTER INT8_MAX
+#define NO_REGISTER (MAX_REGISTER + 1)
+
+static bool IsCompilingRegisterFunction(const Tiny_State *state) { return state->nextReg >= 0; }
+
+static void GenerateRegister(Tiny_State *state, int reg) {
+    assert(reg >= MIN_REGISTER && reg <= MAX_REGISTER);
+    GenerateCode(state, (Word)(int8_t)reg);
+}
+
+static int AllocRegister(Tiny_State *state) {
+    int reg = state->nextReg++;
+
+    // IsRegisterExpr makes sure there's always enough registers
+    assert(reg <= MAX_REGISTER);
+
+    if (state->nextReg > state->maxReg) {
+        state->maxReg = state->nextReg;
+    }
+
+    return reg;
+}
+
+// Returns the register of the local (or argument) referred to by exp, or NO_REGISTER if it isn't
+// one or it can't be addressed as a register.
+static int GetLocalRegister(const Tiny_Expr *exp) {
+    if (exp->type != TINY_EXP_ID || !exp->id.sym || exp->id.sym->type != TINY_SYM_LOCAL) {
+        return NO_REGISTER;
+    }
+
+    int index = exp->id.sym->var.index;
+
+    return index >= MIN_REGISTER && index <= MAX_REGISTER ? index : NO_REGISTER;
+}
+
+// Returns the register instruction which computes `lhs op rhs`, or -1 if there isn't one. Both
+// sides must be ints or both must be floats. For > and >= this returns the instruction for < and
+// <= respectively, so the operands have to be swapped.
+static int GetRegisterBinaryOp(int op, const Tiny_Expr *lhs, const Tiny_Expr *rhs) {
+    if (lhs->tag != rhs->tag) {
+        return -1;
+    }
+
+    bool isInt = lhs->tag->type == TINY_SYM_TAG_INT;
+
+    if (!isInt && lhs->tag->type != TINY_SYM_TAG_FLOAT) {
+        return -1;
+    }
+
+    switch (op) {
+        case TINY_TOK_PLUS:
+            return isInt ? TINY_OP_ADD_INT_R : TINY_OP_ADD_FLOAT_R;
+        case TINY_TOK_MINUS:
+            return isInt ? TINY_OP_SUB_INT_R : TINY_OP_SUB_FLOAT_R;
+        case TINY_TOK_STAR:
+            return isInt ? TINY_OP_MUL_INT_R : TINY_OP_MUL_FLOAT_R;
+        case TINY_TOK_SLASH:
+            return isInt ? TINY_OP_DIV_INT_R : TINY_OP_DIV_FLOAT_R;
+        case TINY_TOK_PERCENT:
+            return isInt ? TINY_OP_MOD_INT_R : -1;
+        case TINY_TOK_LT:
+        case TINY_TOK_GT:
+            return isInt ? TINY_OP_LT_INT_R : TINY_OP_LT_FLOAT_R;
+        case TINY_TOK_LTE:
+        case TINY_TOK_GTE:
+            return isInt ? TINY_OP_LTE_INT_R : TINY_OP_LTE_FLOAT_R;
+        case TINY_TOK_EQUALS:
+            return isInt ? TINY_OP_EQU_INT_R : TINY_OP_EQU_FLOAT_R;
+        default:
+            return -1;
+    }
+}
+
+// Upper bound on the number of registers CompileRegisterExpr allocates for exp
+static int CountRegistersNeeded(const Tiny_Expr *exp) {
+    switch (exp->type) {
+        case TINY_EXP_PAREN:
+            return CountRegistersNeeded(exp->paren);
+        case TINY_EXP_BINARY:
+            return 1 + CountRegistersNeeded(exp->binary.lhs) +
+                   CountRegistersNeeded(exp->binary.rhs);
+        default:
+            return 1;
+    }
+}
+
+// Whether exp should be compiled with CompileRegisterExpr, i.e. we're inside a function compiled by
+// the register backend, there's enough registers left, and exp is something that the register
+// instructions can compute directly.
+static bool IsRegisterExpr(const Tiny_State *state, const Tiny_Expr *exp) {
+    if (!IsCompilingRegisterFunction(state) ||
+        state->nextReg + CountRegistersNeeded(exp) > MAX_REGISTER + 1) {
+        return false;
+    }
+
+    while (exp->type == TINY_EXP_PAREN) {
+        exp = exp->paren;
+    }
+
+    switch (exp->type) {
+        case TINY_EXP_ID:
+            return GetLocalRegister(exp) != NO_REGISTER;
+
+        case TINY_EXP_INT:
+        case TINY_EXP_CHAR:
+        case TINY_EXP_FLOAT:
+            return true;
+
+        case TINY_EXP_DOT:
+            return GetLocalRegister(exp->dot.lhs) != NO_REGISTER;
+
+        case TINY_EXP_BINARY:
+            return GetRegisterBinaryOp(exp->binary.op, exp->binary.lhs, exp->binary.rhs) >= 0;
+
+        default:
+            return false;
+    }
+}
+
+static int CompileRegisterExpr(Tiny_State *state, Tiny_Expr *exp, int dest);
+
+// Compiles `lhs op rhs` (see GetRegisterBinaryOp) into dest, or a new register if dest is
+// NO_REGISTER. Returns the register holding the result.
+static int CompileRegisterBinary(Tiny_State *state, int op, Tiny_Expr *lhs, Tiny_Expr *rhs,
+                                 int dest) {
+    int regOp = GetRegisterBinaryOp(op, lhs, rhs);
+    assert(regOp >= 0);
+
+    // Constants on the rhs of int additions and multiplications are encoded in the instruction
+    if (regOp == TINY_OP_ADD_INT_R || regOp == TINY_OP_SUB_INT_R || regOp == TINY_OP_MUL_INT_R) {
+        if ((lhs->type == TINY_EXP_INT || lhs->type == TINY_EXP_CHAR) &&
+            regOp != TINY_OP_SUB_INT_R) {
+            Tiny_Expr *temp = lhs;
+            lhs = rhs;
+            rhs = temp;
+        }
+
+        if (rhs->type == TINY_EXP_INT || rhs->type == TINY_EXP_CHAR) {
+            int a = CompileRegisterExpr(state, lhs, NO_REGISTER);
+
+            if (dest == NO_REGISTER) dest = AllocRegister(state);
+
+            Tiny_Int k = regOp == TINY_OP_SUB_INT_R ? -rhs->iValue : rhs->iValue;
+
+            GenerateCode(state,
+                         regOp == TINY_OP_MUL_INT_R ? TINY_OP_MUL_INT_RK : TINY_OP_ADD_INT_RK);
+            GenerateRegister(state, dest);
+            GenerateRegister(state, a);
+            GEN_VALUE_NOPOS(state, &k);
+
+            return dest;
+        }
+    }
+
+    if (op == TINY_TOK_GT || op == TINY_TOK_GTE) {
+        Tiny_Expr *temp = lhs;
+        lhs = rhs;
+        rhs = temp;
+    }
+
+    int a = CompileRegisterExpr(state, lhs, NO_REGISTER);
+    int b = CompileRegisterExpr(state, rhs, NO_REGISTER);
+
+    if (dest == NO_REGISTER) dest = AllocRegister(state);
+
+    GenerateCode(state, (Word)regOp);
+    GenerateRegister(state, dest);
+    GenerateRegister(state, a);
+    GenerateRegister(state, b);
+
+    return dest;
+}
+
+// Compiles exp into dest, or if dest is NO_REGISTER, into whatever register is convenient (which
+// could be the register of a local, so it must not be written to). Returns the register holding
+// the result. Anything which can't be computed with register instructions is evaluated on the
+// stack and popped into a register.
+static int CompileRegisterExpr(Tiny_State *state, Tiny_Expr *exp, int dest) {
+    while (exp->type == TINY_EXP_PAREN) {
+        exp = exp->paren;
+    }
+
+    int reg = GetLocalRegister(exp);
+
+    if (reg != NO_REGISTER) {
+        if (dest == NO_REGISTER || dest == reg) {
+            return reg;
+        }
+
+        GenerateCode(state, TINY_OP_MOVE_R);
+        GenerateRegister(state, dest);
+        GenerateRegister(state, reg);
+
+        return dest;
+    }
+
+    if (exp->type == TINY_EXP_BINARY &&
+        GetRegisterBinaryOp(exp->binary.op, exp->binary.lhs, exp->binary.rhs) >= 0) {
+        return CompileRegisterBinary(state, exp->binary.op, exp->binary.lhs, exp->binary.rhs,
+                                     dest);
+    }
+
+    if (dest == NO_REGISTER) dest = AllocRegister(state);
+
+    if (exp->type == TINY_EXP_DOT && GetLocalRegister(exp->dot.lhs) != NO_REGISTER) {
+        int idx;
+
+        GetFieldTag(exp->dot.lhs->tag, exp->dot.field->value, &idx);
+
+        assert(idx >= 0 && idx <= UCHAR_MAX);
+
+        GenerateCode(state, TINY_OP_STRUCT_GET_R);
+        GenerateRegister(state, dest);
+        GenerateRegister(state, GetLocalRegister(exp->dot.lhs));
+        GenerateCode(state, (Word)idx);
+    } else if (exp->type == TINY_EXP_INT || exp->type == TINY_EXP_CHAR) {
+        Tiny_Int k = exp->iValue;
+
+        GenerateCode(state, TINY_OP_LOAD_INT_R);
+        GenerateRegister(state, dest);
+        GEN_VALUE_NOPOS(state, &k);
+    } else if (exp->type == TINY_EXP_FLOAT) {
+        Tiny_Float k = exp->fValue;
+
+        GenerateCode(state, TINY_OP_LOAD_FLOAT_R);
+        GenerateRegister(state, dest);
+        GEN_VALUE_NOPOS(state, &k);
+    } else {
+        CompileExpr(state, exp);
+
+        GenerateCode(state, TINY_OP_POP_R);
+        GenerateRegister(state, dest);
+    }
+
+    return dest;
+}
+
+// Compiles an assignment to a local using register instructions. Returns false without generating
+// any code if that's not possible.
+static bool CompileRegisterAssignment(Tiny_State *state, Tiny_Expr *exp) {
+    if (!IsCompilingRegisterFunction(state)) {
+        return false;
+    }
+
+    Tiny_Expr *lhs = exp->binary.lhs;
+    Tiny_Expr *rhs = exp->binary.rhs;
+
+    int dest = GetLocalRegister(lhs);
+
+    if (dest == NO_REGISTER) {
+        return false;
+    }
+
+    int op;
+
+    switch (exp->binary.op) {
+        case TINY_TOK_EQUAL:
+        case TINY_TOK_DECLARE:
+            op = 0;
+            break;
+        case TINY_TOK_PLUSEQUAL:
+            op = TINY_TOK_PLUS;
+            break;
+        case TINY_TOK_MINUSEQUAL:
+            op = TINY_TOK_MINUS;
+            break;
+        case TINY_TOK_STAREQUAL:
+            op = TINY_TOK_STAR;
+            break;
+        case TINY_TOK_SLASHEQUAL:
+            op = TINY_TOK_SLASH;
+            break;
+        case TINY_TOK_PERCENTEQUAL:
+            op = TINY_TOK_PERCENT;
+            break;
+        default:
+            return false;
+    }
+
+    int firstTempReg = state->nextReg;
+
+    if (op == 0) {
+        if (!IsRegisterExpr(state, rhs)) {
+            return false;
+        }
+
+        CompileRegisterExpr(state, rhs, dest);
+    } else {
+        if (GetRegisterBinaryOp(op, lhs, rhs) < 0 || !IsRegisterExpr(state, rhs)) {
+            return false;
+        }
+
+        CompileRegisterBinary(state, op, lhs, rhs, dest);
+    }
+
+    state->nextReg = firstTempReg;
+
+    lhs->id.sym->var.initialized = true;
+
+    return true;
+}
+
+// Generates code which jumps if cond is false. Returns the location of the jump operand so that it
+// can be patched.
+static Tiny_ConstantIndex GenerateCondJump(Tiny_State *state, Tiny_Expr *cond) {
+    if (!IsRegisterExpr(state, cond)) {
+        CompileExpr(state, cond);
+        return GenerateJump(state, TINY_OP_GOTOZ, 0);
+    }
+
+    while (cond->type == TINY_EXP_PAREN) {
+        cond = cond->paren;
+    }
+
+    int firstTempReg = state->nextReg;
+
+    Tiny_ConstantIndex dest = 0;
+    int pos = 0;
+
+    int op = cond->type == TINY_EXP_BINARY ? cond->binary.op : 0;
+    int regOp = op ? GetRegisterBinaryOp(op, cond->binary.lhs, cond->binary.rhs) : -1;
+
+    if (regOp == TINY_OP_LT_INT_R || regOp == TINY_OP_LTE_INT_R) {
+        Tiny_Expr *lhs = cond->binary.lhs;
+        Tiny_Expr *rhs = cond->binary.rhs;
+
+        if (rhs->type == TINY_EXP_INT || rhs->type == TINY_EXP_CHAR) {
+            int a = CompileRegisterExpr(state, lhs, NO_REGISTER);
+            Tiny_Int k = rhs->iValue;
+
+            GenerateCode(state, op == TINY_TOK_LT    ? TINY_OP_LT_INT_RK_GOTOZ
+                                : op == TINY_TOK_LTE ? TINY_OP_LTE_INT_RK_GOTOZ
+                                : op == TINY_TOK_GT  ? TINY_OP_GT_INT_RK_GOTOZ
+                                                     : TINY_OP_GTE_INT_RK_GOTOZ);
+            GenerateRegister(state, a);
+            GEN_VALUE_NOPOS(state, &k);
+        } else {
+            if (op == TINY_TOK_GT || op == TINY_TOK_GTE) {
+                Tiny_Expr *temp = lhs;
+                lhs = rhs;
+                rhs = temp;
+            }
+
+            int a = CompileRegisterExpr(state, lhs, NO_REGISTER);
+            int b = CompileRegisterExpr(state, rhs, NO_REGISTER);
+
+            GenerateCode(state, regOp == TINY_OP_LT_INT_R ? TINY_OP_LT_INT_R_GOTOZ
+                                                          : TINY_OP_LTE_INT_R_GOTOZ);
+            GenerateRegister(state, a);
+            GenerateRegister(state, b);
+        }
+    } else {
+        int reg = CompileRegisterExpr(state, cond, NO_REGISTER);
+
+        GenerateCode(state, TINY_OP_GOTOZ_R);
+        GenerateRegister(state, reg);
+    }
+
+    GEN_VALUE(state, &dest, &pos);
+
+    state->nextReg = firstTempReg;
+
+    return pos;
+}
+
+static void CompileStatement(Tiny_State *state, Tiny_Expr *exp);
+
+// Compiles the loop for a `foreach` over something iterated with a cursor (see forEach.iterNextFunc
+// in expr.h). Expects the range to have been assigned to the rangeVar already.
+static void CompileForeachCursor(Tiny_State *state, Tiny_Expr *exp) {
+    // (cursor) := iter_next(range, 0)
+    CompileGetVar(state, exp->forEach.rangeVar);
+    GenerateCode(state, TINY_OP_PUSH_0);
+    CompileCallSymbolWithArgsPrepared(state, 2, exp->forEach.iterNextFunc, exp);
+    GenerateCode(state, TINY_OP_GET_RETVAL);
+    CompileAssignVarToTopOfStack(state, exp->forEach.cursorVar, exp);
+
+    // Foreach cond: 0 < cursor
+    int condPc = sb_count(state->program);
+
+    GenerateCode(state, TINY_OP_PUSH_0);
+    CompileGetVar(state, exp->forEach.cursorVar);
+    GenerateCode(state, TINY_OP_LT);
+
+    int skipBodyLoc = GenerateJump(state, TINY_OP_GOTOZ, 0);
+
+    CompileGetVar(state, exp->forEach.rangeVar);
+    CompileGetVar(state, exp->forEach.cursorVar);
+    CompileCallSymbolWithArgsPrepared(state, 2, exp->forEach.iterKeyFunc, exp);
+    GenerateCode(state, TINY_OP_GET_RETVAL);
+    CompileAssignVarToTopOfStack(state, exp->forEach.elemVar, exp);
+
+    CompileGetVar(state, exp->forEach.rangeVar);
+    CompileGetVar(state, exp->forEach.cursorVar);
+    CompileCallSymbolWithArgsPrepared(state, 2, exp->forEach.iterValueFunc, exp);
+    GenerateCode(state, TINY_OP_GET_RETVAL);
+    CompileAssignVarToTopOfStack(state, exp->forEach.indexVar, exp);
+
+    if (exp->forEach.body) CompileStatement(state, exp->forEach.body);
+
+    int stepPc = sb_count(state->program);
+
+    // Foreach step: (cursor) = iter_next(range, cursor)
+    CompileGetVar(state, exp->forEach.rangeVar);
+    CompileGetVar(state, exp->forEach.cursorVar);
+    CompileCallSymbolWithArgsPrepared(state, 2, exp->forEach.iterNextFunc, exp);
+    GenerateCode(state, TINY_OP_GET_RETVAL);
+    CompileAssignVarToTopOfStack(state, exp->forEach.cursorVar, exp);
+
+    GenerateJump(state, TINY_OP_GOTO, condPc);
+
+    PatchJumpLoc(state, skipBodyLoc, sb_count(state->program));
+
+    PatchBreakContinue(state, exp->forEach.body, sb_count(state->program), stepPc);
+}
+
 static void CompileStatement(Tiny_State *state, Tiny_Expr *exp) {
     AddPCFileLineRecord(
         state,
@@ -3726,6 +6956,10 @@ static void CompileStatement(Tiny_State *state, Tiny_Expr *exp) {
                                      "index expression");
                     }
 
+                    if (CompileRegisterAssignment(state, exp)) {
+                        break;
+                    }
+
                     if (exp->binary.lhs->type == TINY_EXP_INDEX) {
                         // When we call _set_index we need to ensure the array, and index
                         // are on the stack in that order before the value.
@@ -3735,59 +6969,40 @@ static void CompileStatement(Tiny_State *state, Tiny_Expr *exp) {
                     }
 
                     switch (exp->binary.op) {
-                        case TINY_TOK_PLUSEQUAL: {
-                            CompileGetLHS(state, exp->binary.lhs);
-
-                            if (exp->binary.rhs->type == TINY_EXP_INT &&
-                                exp->binary.rhs->iValue == 1) {
-                                GenerateCode(state, TINY_OP_ADD1);
-                            } else {
-                                CompileExpr(state, exp->binary.rhs);
-                                GenerateCode(state, TINY_OP_ADD);
-                            }
-                        } break;
-
-                        case TINY_TOK_MINUSEQUAL: {
-                            CompileGetLHS(state, exp->binary.lhs);
-
-                            if (exp->binary.rhs->type == TINY_EXP_INT &&
-                                exp->binary.rhs->iValue == 1) {
-                                GenerateCode(state, TINY_OP_SUB1);
-                            } else {
-                                CompileExpr(state, exp->binary.rhs);
-                                GenerateCode(state, TINY_OP_SUB);
-                            }
-                        } break;
-
-                        case TINY_TOK_STAREQUAL: {
-                            CompileGetLHS(state, exp->binary.lhs);
-                            CompileExpr(state, exp->binary.rhs);
-                            GenerateCode(state, TINY_OP_MUL);
-                        } break;
+                        case TINY_TOK_PLUSEQUAL:
+                            CompileArithmetic(state, TINY_TOK_PLUS, exp->binary.lhs,
+                                              exp->binary.rhs);
+                            break;
 
-                        case TINY_TOK_SLASHEQUAL: {
-                            CompileGetLHS(state, exp->binary.lhs);
-                            CompileExpr(state, exp->binary.rhs);
-                            GenerateCode(state, TINY_OP_DIV);
-                        } break;
+                        case TINY_TOK_MINUSEQUAL:
+                            CompileArithmetic(state, TINY_TOK_MINUS, exp->binary.lhs,
+                                              exp->binary.rhs);
+                            break;
 
-                        case TINY_TOK_PERCENTEQUAL: {
-                            CompileGetLHS(state, exp->binary.lhs);
-                            CompileExpr(state, exp->binary.rhs);
-                            GenerateCode(state, TINY_OP_MOD);
-                        } break;
+                        case TINY_TOK_STAREQUAL:
+                            CompileArithmetic(state, TINY_TOK_STAR, exp->binary.lhs,
+                                              exp->binary.rhs);
+                            break;
 
-                        case TINY_TOK_ANDEQUAL: {
-                            CompileGetLHS(state, exp->binary.lhs);
-                            CompileExpr(state, exp->binary.rhs);
-                            GenerateCode(state, TINY_OP_AND);
-                        } break;
+                        case TINY_TOK_SLASHEQUAL:
+                            CompileArithmetic(state, TINY_TOK_SLASH, exp->binary.lhs,
+                                              exp->binary.rhs);
+                            break;
 
-                        case TINY_TOK_OREQUAL: {
-                            CompileGetLHS(state, exp->binary.lhs);
-                            CompileExpr(state, exp->binary.rhs);
-                            GenerateCode(state, TINY_OP_OR);
-                        } break;
+                        case TINY_TOK_PERCENTEQUAL:
+                            CompileArithmetic(state, TINY_TOK_PERCENT, exp->binary.lhs,
+                                              exp->binary.rhs);
+                            break;
+
+                        case TINY_TOK_ANDEQUAL:
+                            CompileArithmetic(state, TINY_TOK_AND, exp->binary.lhs,
+                                              exp->binary.rhs);
+                            break;
+
+                        case TINY_TOK_OREQUAL:
+                            CompileArithmetic(state, TINY_TOK_OR, exp->binary.lhs,
+                                              exp->binary.rhs);
+                            break;
 
                         default:
                             CompileExpr(state, exp->binary.rhs);
@@ -3850,24 +7065,39 @@ static void CompileStatement(Tiny_State *state, Tiny_Expr *exp) {
                              0xff);
             }
 
-            if (sb_count(exp->proc.decl->func.locals) > 0) {
+            int numLocals = sb_count(exp->proc.decl->func.locals);
+            int numSlotsLoc = -1;
+
+            if (state->backend == TINY_BACKEND_REGISTER) {
+                // Temporaries are stored above the locals, so we only know how many slots to
+                // reserve once the body has been compiled.
+                GenerateCode(state, TINY_OP_PUSH_NULL_N);
+                numSlotsLoc = sb_count(state->program);
+                GenerateCode(state, 0);
+
+                state->nextReg = state->maxReg = numLocals;
+            } else if (numLocals > 0) {
                 GenerateCode(state, TINY_OP_PUSH_NULL_N);
-                GenerateCode(state, (Word)sb_count(exp->proc.decl->func.locals));
+                GenerateCode(state, (Word)numLocals);
             }
 
             if (exp->proc.body) {
                 CompileStatement(state, exp->proc.body);
             }
 
+            if (numSlotsLoc >= 0) {
+                // If this ends up being 0 the peephole pass gets rid of it
+                state->program[numSlotsLoc] = (Word)state->maxReg;
+                state->nextReg = state->maxReg = -1;
+            }
+
             GenerateCode(state, TINY_OP_RETURN);
 
             PatchJumpLoc(state, skipFuncBodyLoc, sb_count(state->program));
         } break;
 
         case TINY_EXP_IF: {
-            CompileExpr(state, exp->ifx.cond);
-
-            int skipBodyLoc = GenerateJump(state, TINY_OP_GOTOZ, 0);
+            int skipBodyLoc = GenerateCondJump(state, exp->ifx.cond);
 
             if (exp->ifx.body) CompileStatement(state, exp->ifx.body);
 
@@ -3887,9 +7117,7 @@ static void CompileStatement(Tiny_State *state, Tiny_Expr *exp) {
         case TINY_EXP_WHILE: {
             int condPc = sb_count(state->program);
 
-            CompileExpr(state, exp->whilex.cond);
-
-            int skipBodyLoc = GenerateJump(state, TINY_OP_GOTOZ, 0);
+            int skipBodyLoc = GenerateCondJump(state, exp->whilex.cond);
 
             if (exp->whilex.body) CompileStatement(state, exp->whilex.body);
 
@@ -3903,9 +7131,7 @@ static void CompileStatement(Tiny_State *state, Tiny_Expr *exp) {
             CompileStatement(state, exp->forx.init);
 
             int condPc = sb_count(state->program);
-            CompileExpr(state, exp->forx.cond);
-
-            int skipBodyLoc = GenerateJump(state, TINY_OP_GOTOZ, 0);
+            int skipBodyLoc = GenerateCondJump(state, exp->forx.cond);
 
             if (exp->forx.body) CompileStatement(state, exp->forx.body);
 
@@ -3921,12 +7147,20 @@ static void CompileStatement(Tiny_State *state, Tiny_Expr *exp) {
         } break;
 
         case TINY_EXP_FOREACH: {
+            // Assign to range expr
+            CompileExpr(state, exp->forEach.range);
+            CompileAssignVarToTopOfStack(state, exp->forEach.rangeVar, exp->forEach.range);
+
+            if (exp->forEach.iterNextFunc) {
+                CompileForeachCursor(state, exp);
+                break;
+            }
+
             assert(exp->forEach.lenFunc);
             assert(exp->forEach.getIndexFunc);
 
-            // Assign to range expr
-            CompileExpr(state, exp->forEach.range);
-            CompileAssignVarToTopOfStack(state, exp->forEach.rangeVar, exp->forEach.range);
+            // Unused when iterating by index, but it's still declared
+            exp->forEach.cursorVar->var.initialized = true;
 
             if (exp->forEach.reverse) {
                 // Initialize indexVar to len - 1
@@ -4060,6 +7294,731 @@ static void BuildForeignFunctions(Tiny_State *state) {
     }
 }
 
+// Describes the operands which follow each opcode in the bytecode, one character per operand:
+//
+// w - Word
+// r - Word which is a register (see TINY_BACKEND_REGISTER), i.e. a signed offset from fp
+// c - Tiny_ConstantIndex
+// j - Tiny_ConstantIndex which is a pc to jump to
+// i - Tiny_Int
+// f - Tiny_Float
+static const struct {
+    const char *name;
+    const char *operands;
+} OpcodeInfo[256] = {
+#define OP(op, operands) [TINY_OP_##op] = {#op, operands}
+    OP(PUSH_NULL, ""),
+    OP(PUSH_NULL_N, "w"),
+    OP(PUSH_TRUE, ""),
+    OP(PUSH_FALSE, ""),
+    OP(PUSH_INT, "i"),
+    OP(PUSH_0, ""),
+    OP(PUSH_1, ""),
+    OP(PUSH_CHAR, "w"),
+    OP(PUSH_FLOAT, "f"),
+    OP(PUSH_STRING, "c"),
+    OP(PUSH_STRING_FF, "w"),
+    OP(PUSH_STRUCT, "w"),
+    OP(STRUCT_GET, "w"),
+    OP(STRUCT_SET, "w"),
+    OP(ADD, ""),
+    OP(SUB, ""),
+    OP(MUL, ""),
+    OP(DIV, ""),
+    OP(MOD, ""),
+    OP(OR, ""),
+    OP(AND, ""),
+    OP(SHIFT_LEFT, ""),
+    OP(SHIFT_RIGHT, ""),
+    OP(LT, ""),
+    OP(LTE, ""),
+    OP(GT, ""),
+    OP(GTE, ""),
+    OP(ADD_INT, ""),
+    OP(SUB_INT, ""),
+    OP(MUL_INT, ""),
+    OP(DIV_INT, ""),
+    OP(LT_INT, ""),
+    OP(LTE_INT, ""),
+    OP(GT_INT, ""),
+    OP(GTE_INT, ""),
+    OP(ADD_FLOAT, ""),
+    OP(SUB_FLOAT, ""),
+    OP(MUL_FLOAT, ""),
+    OP(DIV_FLOAT, ""),
+    OP(LT_FLOAT, ""),
+    OP(LTE_FLOAT, ""),
+    OP(GT_FLOAT, ""),
+    OP(GTE_FLOAT, ""),
+    OP(INT_TO_FLOAT, ""),
+    OP(ADD1, ""),
+    OP(SUB1, ""),
+    OP(EQU, ""),
+    OP(EQU_BOOL, ""),
+    OP(EQU_INT, ""),
+    OP(EQU_FLOAT, ""),
+    OP(EQU_STR, ""),
+    OP(LOG_NOT, ""),
+    OP(SET, "c"),
+    OP(GET, "c"),
+    OP(GOTO, "j"),
+    OP(GOTOZ, "j"),
+    OP(CALL, "wc"),
+    OP(RETURN, ""),
+    OP(RETURN_VALUE, ""),
+    OP(CALLF, "wc"),
+    OP(GETLOCAL, "c"),
+    OP(GETLOCAL_W, "w"),
+    OP(SETLOCAL, "c"),
+    OP(GET_RETVAL, ""),
+    OP(NEG_INT, ""),
+    OP(NEG_FLOAT, ""),
+    OP(NOT_EQU, ""),
+    OP(NOT_EQU_BOOL, ""),
+    OP(NOT_EQU_INT, ""),
+    OP(NOT_EQU_FLOAT, ""),
+    OP(NOT_EQU_STR, ""),
+    OP(GOTONZ, "j"),
+    OP(GETLOCAL_W2, "ww"),
+    OP(GETLOCAL_STRUCT_GET, "ww"),
+    OP(LT_LOCAL_CONST_GOTOZ, "wij"),
+    OP(INC_LOCAL, "w"),
+    OP(DEC_LOCAL, "w"),
+    OP(CALL_RETVAL, "wc"),
+    OP(CALLF_RETVAL, "wc"),
+    OP(MOVE_R, "rr"),
+    OP(LOAD_INT_R, "ri"),
+    OP(LOAD_FLOAT_R, "rf"),
+    OP(POP_R, "r"),
+    OP(STRUCT_GET_R, "rrw"),
+    OP(ADD_INT_R, "rrr"),
+    OP(SUB_INT_R, "rrr"),
+    OP(MUL_INT_R, "rrr"),
+    OP(DIV_INT_R, "rrr"),
+    OP(MOD_INT_R, "rrr"),
+    OP(LT_INT_R, "rrr"),
+    OP(LTE_INT_R, "rrr"),
+    OP(EQU_INT_R, "rrr"),
+    OP(ADD_FLOAT_R, "rrr"),
+    OP(SUB_FLOAT_R, "rrr"),
+    OP(MUL_FLOAT_R, "rrr"),
+    OP(DIV_FLOAT_R, "rrr"),
+    OP(LT_FLOAT_R, "rrr"),
+    OP(LTE_FLOAT_R, "rrr"),
+    OP(EQU_FLOAT_R, "rrr"),
+    OP(ADD_INT_RK, "rri"),
+    OP(MUL_INT_RK, "rri"),
+    OP(GOTOZ_R, "rj"),
+    OP(LT_INT_R_GOTOZ, "rrj"),
+    OP(LTE_INT_R_GOTOZ, "rrj"),
+    OP(LT_INT_RK_GOTOZ, "rij"),
+    OP(LTE_INT_RK_GOTOZ, "rij"),
+    OP(GT_INT_RK_GOTOZ, "rij"),
+    OP(GTE_INT_RK_GOTOZ, "rij"),
+    OP(HALT, ""),
+    OP(MISALIGNED_INSTRUCTION, ""),
+#undef OP
+};
+
+#define MAX_INSTRUCTION_OPERANDS 3
+
+// A decoded instruction. The passes below decode the generated code into these, rewrite them,
+// and then emit them again. Jump operands and `pc` always refer to the pcs of the code as it was
+// decoded; EmitInstructions relocates them.
+typedef struct Instruction {
+    int pc;
+    Word op;
+
+    union {
+        Word w;
+        Tiny_ConstantIndex c;
+        Tiny_Int i;
+        Tiny_Float f;
+    } args[MAX_INSTRUCTION_OPERANDS];
+} Instruction;
+
+// Decodes the instruction at pc and returns the pc of the next one
+static int DecodeInstruction(const Tiny_State *state, int pc, Instruction *inst) {
+    const char *operands = OpcodeInfo[state->program[pc]].operands;
+
+    assert(operands && "Attempted to decode an unknown opcode");
+
+    inst->pc = pc;
+    inst->op = state->program[pc++];
+
+    for (int i = 0; operands[i]; ++i) {
+        assert(i < MAX_INSTRUCTION_OPERANDS);
+
+        switch (operands[i]) {
+            case 'w':
+            case 'r':
+                inst->args[i].w = state->program[pc++];
+                break;
+            case 'c':
+            case 'j':
+                READ_VALUE_AT(state, &pc, &inst->args[i].c);
+                break;
+            case 'i':
+                READ_VALUE_AT(state, &pc, &inst->args[i].i);
+                break;
+            case 'f':
+                READ_VALUE_AT(state, &pc, &inst->args[i].f);
+                break;
+            default:
+                assert(0);
+                break;
+        }
+    }
+
+    return pc;
+}
+
+// Decodes all the code from startPc to the end of the program into an array
+static Instruction *DecodeInstructions(Tiny_State *state, int startPc) {
+    Instruction *insts = NULL;
+
+    for (int pc = startPc; pc < sb_count(state->program);) {
+        Instruction inst = {0};
+
+        pc = DecodeInstruction(state, pc, &inst);
+        sb_push(&state->ctx, insts, inst);
+    }
+
+    return insts;
+}
+
+// Returns the index of the first instruction whose (original) pc is >= pc, or the number of
+// instructions if there isn't one.
+static int LowerBoundInstruction(const Instruction *insts, int pc) {
+    int lo = 0;
+    int hi = sb_count(insts);
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (insts[mid].pc < pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Returns an array with an entry for every pc from startPc to the end of the program (inclusive)
+// which is true if anything could jump to that pc. A jump to an instruction that was removed ends
+// up at the next one (see EmitInstructions), so that's the one which gets marked.
+static bool *FindJumpTargets(Tiny_State *state, int startPc, const Instruction *insts) {
+    int endPc = sb_count(state->program);
+    int count = sb_count(insts);
+
+    bool *isTarget = TMalloc(&state->ctx, sizeof(bool) * (endPc - startPc + 1));
+    memset(isTarget, 0, sizeof(bool) * (endPc - startPc + 1));
+
+    for (int i = 0; i < sb_count(insts); ++i) {
+        const char *operands = OpcodeInfo[insts[i].op].operands;
+
+        for (int j = 0; operands[j]; ++j) {
+            if (operands[j] != 'j') continue;
+
+            int dest = (int)insts[i].args[j].c;
+            assert(dest >= startPc && dest <= endPc);
+
+            int index = LowerBoundInstruction(insts, dest);
+            isTarget[(index < count ? insts[index].pc : endPc) - startPc] = true;
+        }
+    }
+
+    for (int i = 0; i < state->numFunctions; ++i) {
+        int pc = state->functionPcs[i];
+
+        if (pc >= startPc && pc <= endPc) {
+            int index = LowerBoundInstruction(insts, pc);
+            isTarget[(index < count ? insts[index].pc : endPc) - startPc] = true;
+        }
+    }
+
+    return isTarget;
+}
+
+// Replaces all the code from startPc onwards with the given instructions and relocates everything
+// that refers to a pc in there: jumps, functionPcs, and pcToFileLine.
+//
+// Anything that referred to an instruction which isn't in insts anymore now refers to the next
+// one that is, so passes can only drop instructions that could be jumped to if skipping them
+// doesn't change anything.
+static void EmitInstructions(Tiny_State *state, int startPc, const Instruction *insts) {
+    int oldEndPc = sb_count(state->program);
+    int count = sb_count(insts);
+
+    // Where each instruction ends up, with one extra entry for the end of the program
+    int *newPcs = TMalloc(&state->ctx, sizeof(int) * (count + 1));
+
+    // Positions of jump operands which have to be patched once we know where everything is
+    int *jumpPatchLocs = NULL;
+
+    stb__sbn(state->program) = startPc;
+
+    for (int i = 0; i < count; ++i) {
+        const Instruction *inst = &insts[i];
+        const char *operands = OpcodeInfo[inst->op].operands;
+
+        newPcs[i] = sb_count(state->program);
+
+        GenerateCode(state, inst->op);
+
+        for (int j = 0; operands[j]; ++j) {
+            switch (operands[j]) {
+                case 'w':
+                case 'r':
+                    GenerateCode(state, inst->args[j].w);
+                    break;
+                case 'c':
+                    GEN_VALUE_NOPOS(state, &inst->args[j].c);
+                    break;
+                case 'j': {
+                    int pos = 0;
+                    GEN_VALUE(state, &inst->args[j].c, &pos);
+                    sb_push(&state->ctx, jumpPatchLocs, pos);
+                } break;
+                case 'i':
+                    GEN_VALUE_NOPOS(state, &inst->args[j].i);
+                    break;
+                case 'f':
+                    GEN_VALUE_NOPOS(state, &inst->args[j].f);
+                    break;
+            }
+        }
+    }
+
+    newPcs[count] = sb_count(state->program);
+
+    for (int i = 0; i < sb_count(jumpPatchLocs); ++i) {
+        int pos = jumpPatchLocs[i];
+
+        Tiny_ConstantIndex dest;
+        memcpy(&dest, state->program + pos, sizeof(dest));
+
+        assert((int)dest >= startPc && (int)dest <= oldEndPc);
+
+        PatchJumpLoc(state, pos, newPcs[LowerBoundInstruction(insts, (int)dest)]);
+    }
+
+    for (int i = 0; i < state->numFunctions; ++i) {
+        int pc = state->functionPcs[i];
+
+        if (pc < startPc || pc > oldEndPc) continue;
+
+        state->functionPcs[i] = newPcs[LowerBoundInstruction(insts, pc)];
+    }
+
+    // Line records that pointed into code which was removed or merged into a previous
+    // instruction move to the next instruction. If that leaves two records at the same pc, the
+    // later one wins just like in AddPCFileLineRecord.
+    int lineCount = 0;
+
+    for (int i = 0; i < sb_count(state->pcToFileLine); ++i) {
+        Tiny_PCToFileLine record = state->pcToFileLine[i];
+
+        if (record.pc >= startPc) {
+            record.pc = newPcs[LowerBoundInstruction(insts, record.pc)];
+        }
+
+        if (lineCount > 0 && state->pcToFileLine[lineCount - 1].pc == record.pc) {
+            state->pcToFileLine[lineCount - 1] = record;
+        } else {
+            state->pcToFileLine[lineCount++] = record;
+        }
+    }
+
+    if (state->pcToFileLine) {
+        stb__sbn(state->pcToFileLine) = lineCount;
+    }
+
+    sb_free(&state->ctx, jumpPatchLocs);
+    TFree(&state->ctx, newPcs);
+}
+
+// Returns the integer pushed by inst if it's one of the int push instructions
+static bool GetPushedInt(const Instruction *inst, Tiny_Int *value) {
+    switch (inst->op) {
+        case TINY_OP_PUSH_0:
+            *value = 0;
+            return true;
+        case TINY_OP_PUSH_1:
+            *value = 1;
+            return true;
+        case TINY_OP_PUSH_INT:
+            *value = inst->args[0].i;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns true if inst just pushes a value without any side effects
+static bool IsPurePush(const Instruction *inst) {
+    switch (inst->op) {
+        case TINY_OP_PUSH_NULL:
+        case TINY_OP_PUSH_TRUE:
+        case TINY_OP_PUSH_FALSE:
+        case TINY_OP_PUSH_INT:
+        case TINY_OP_PUSH_0:
+        case TINY_OP_PUSH_1:
+        case TINY_OP_PUSH_CHAR:
+        case TINY_OP_PUSH_FLOAT:
+        case TINY_OP_PUSH_STRING:
+        case TINY_OP_PUSH_STRING_FF:
+        case TINY_OP_GET:
+        case TINY_OP_GETLOCAL:
+        case TINY_OP_GETLOCAL_W:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns true if the SETLOCAL or SET at insts[i] is overwritten before anything could read the
+// value it stores. We only look ahead within the basic block, and only past instructions that
+// can't fail or leave the function.
+static bool IsDeadStore(int startPc, const Instruction *insts, int i, const bool *isTarget) {
+    const Instruction *store = &insts[i];
+
+    for (int j = i + 1; j < sb_count(insts); ++j) {
+        const Instruction *inst = &insts[j];
+
+        if (isTarget[inst->pc - startPc]) {
+            return false;
+        }
+
+        switch (inst->op) {
+            case TINY_OP_SETLOCAL:
+            case TINY_OP_SET:
+                if (inst->op == store->op && inst->args[0].c == store->args[0].c) {
+                    return true;
+                }
+                break;
+
+            case TINY_OP_GETLOCAL:
+            case TINY_OP_GET:
+                if (inst->op == (store->op == TINY_OP_SET ? TINY_OP_GET : TINY_OP_GETLOCAL) &&
+                    inst->args[0].c == store->args[0].c) {
+                    return false;
+                }
+                break;
+
+            case TINY_OP_GETLOCAL_W:
+                if (store->op == TINY_OP_SETLOCAL && inst->args[0].w == store->args[0].c) {
+                    return false;
+                }
+                break;
+
+            case TINY_OP_PUSH_NULL:
+            case TINY_OP_PUSH_TRUE:
+            case TINY_OP_PUSH_FALSE:
+            case TINY_OP_PUSH_INT:
+            case TINY_OP_PUSH_0:
+            case TINY_OP_PUSH_1:
+            case TINY_OP_PUSH_CHAR:
+            case TINY_OP_PUSH_FLOAT:
+            case TINY_OP_PUSH_STRING:
+            case TINY_OP_PUSH_STRING_FF:
+            case TINY_OP_PUSH_STRUCT:
+            case TINY_OP_STRUCT_GET:
+            case TINY_OP_STRUCT_SET:
+            case TINY_OP_ADD_INT:
+            case TINY_OP_SUB_INT:
+            case TINY_OP_MUL_INT:
+            case TINY_OP_LT_INT:
+            case TINY_OP_LTE_INT:
+            case TINY_OP_GT_INT:
+            case TINY_OP_GTE_INT:
+            case TINY_OP_ADD_FLOAT:
+            case TINY_OP_SUB_FLOAT:
+            case TINY_OP_MUL_FLOAT:
+            case TINY_OP_DIV_FLOAT:
+            case TINY_OP_LT_FLOAT:
+            case TINY_OP_LTE_FLOAT:
+            case TINY_OP_GT_FLOAT:
+            case TINY_OP_GTE_FLOAT:
+            case TINY_OP_INT_TO_FLOAT:
+            case TINY_OP_EQU_BOOL:
+            case TINY_OP_EQU_INT:
+            case TINY_OP_EQU_FLOAT:
+            case TINY_OP_EQU_STR:
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    return false;
+}
+
+static const struct {
+    Word equ, notEqu;
+} EquOps[] = {
+    {TINY_OP_EQU, TINY_OP_NOT_EQU},
+    {TINY_OP_EQU_BOOL, TINY_OP_NOT_EQU_BOOL},
+    {TINY_OP_EQU_INT, TINY_OP_NOT_EQU_INT},
+    {TINY_OP_EQU_FLOAT, TINY_OP_NOT_EQU_FLOAT},
+    {TINY_OP_EQU_STR, TINY_OP_NOT_EQU_STR},
+};
+
+#define NUM_EQU_OPS ((int)(sizeof(EquOps) / sizeof(EquOps[0])))
+
+// Tries to combine the instruction `prev` with the one after it into a single instruction.
+// Returns true and modifies prev if it could.
+static bool CombineInstructions(Instruction *prev, const Instruction *next) {
+    Tiny_Int k;
+
+    if (next->op == TINY_OP_MUL_INT && GetPushedInt(prev, &k) && k == -1) {
+        prev->op = TINY_OP_NEG_INT;
+        return true;
+    }
+
+    if (next->op == TINY_OP_MUL_FLOAT && prev->op == TINY_OP_PUSH_FLOAT && prev->args[0].f == -1) {
+        prev->op = TINY_OP_NEG_FLOAT;
+        return true;
+    }
+
+    if (prev->op == TINY_OP_LOG_NOT && next->op == TINY_OP_GOTOZ) {
+        prev->op = TINY_OP_GOTONZ;
+        prev->args[0] = next->args[0];
+        return true;
+    }
+
+    for (int i = 0; i < NUM_EQU_OPS; ++i) {
+        if (prev->op == EquOps[i].equ && next->op == TINY_OP_LOG_NOT) {
+            prev->op = EquOps[i].notEqu;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Simplifies the code:
+//
+// - Removes PUSH_NULL_N 0 and GOTOs to the next instruction.
+// - Turns conditional jumps on a constant into a GOTO or removes them.
+// - Removes a value being stored into a variable that is overwritten before it's read.
+// - Rewrites negation, !=, and conditional jumps on a negated condition using the opcodes in
+//   opcodes.h which are meant for them.
+// - Inverts a conditional jump which only skips over a GOTO.
+//
+// The pcs of the resulting instructions are those of the first instruction they replaced.
+static Instruction *Peephole(Tiny_State *state, int startPc, const Instruction *insts,
+                             const bool *isTarget) {
+    int count = sb_count(insts);
+    Instruction *result = NULL;
+
+    // If we remove an instruction that could be jumped to, jumps to it end up at the next
+    // instruction we keep, which therefore can't be combined with the one before it.
+    bool nextIsTarget = false;
+
+    for (int i = 0; i < count; ++i) {
+        const Instruction *inst = &insts[i];
+        bool instIsTarget = nextIsTarget || isTarget[inst->pc - startPc];
+
+        nextIsTarget = false;
+
+        if (inst->op == TINY_OP_PUSH_NULL_N && inst->args[0].w == 0) {
+            nextIsTarget = instIsTarget;
+            continue;
+        }
+
+        if (inst->op == TINY_OP_GOTO && LowerBoundInstruction(insts, inst->args[0].c) == i + 1) {
+            nextIsTarget = instIsTarget;
+            continue;
+        }
+
+        if (IsPurePush(inst) && i + 1 < count &&
+            (insts[i + 1].op == TINY_OP_SETLOCAL || insts[i + 1].op == TINY_OP_SET) &&
+            !isTarget[insts[i + 1].pc - startPc] && IsDeadStore(startPc, insts, i + 1, isTarget)) {
+            nextIsTarget = instIsTarget;
+            ++i;
+            continue;
+        }
+
+        Instruction next = *inst;
+
+        if (!instIsTarget && sb_count(result) > 0) {
+            Instruction *prev = &result[sb_count(result) - 1];
+
+            // Conditional jumps on a constant (e.g. `while true`)
+            if (inst->op == TINY_OP_GOTOZ &&
+                (prev->op == TINY_OP_PUSH_TRUE || prev->op == TINY_OP_PUSH_FALSE)) {
+                if (prev->op == TINY_OP_PUSH_FALSE) {
+                    prev->op = TINY_OP_GOTO;
+                    prev->args[0] = inst->args[0];
+                } else {
+                    // We don't know whether the instruction before this could be jumped to, so
+                    // play it safe
+                    stb__sbn(result) -= 1;
+                    nextIsTarget = true;
+                }
+                continue;
+            }
+
+            // GOTOZ a; GOTO b; a: ... (or the same with GOTONZ)
+            if ((prev->op == TINY_OP_GOTOZ || prev->op == TINY_OP_GOTONZ) &&
+                inst->op == TINY_OP_GOTO &&
+                LowerBoundInstruction(insts, prev->args[0].c) == i + 1) {
+                prev->op = prev->op == TINY_OP_GOTOZ ? TINY_OP_GOTONZ : TINY_OP_GOTOZ;
+                prev->args[0] = inst->args[0];
+                continue;
+            }
+
+            if (CombineInstructions(prev, inst)) {
+                continue;
+            }
+
+            // We'll have combined EQU; LOG_NOT by the time we see the GOTOZ after them
+            for (int j = 0; j < NUM_EQU_OPS; ++j) {
+                if (prev->op == EquOps[j].notEqu && inst->op == TINY_OP_GOTOZ) {
+                    prev->op = EquOps[j].equ;
+                    next.op = TINY_OP_GOTONZ;
+                }
+            }
+        }
+
+        sb_push(&state->ctx, result, next);
+    }
+
+    return result;
+}
+
+// Makes jumps to a GOTO go straight to where that GOTO goes
+static void ThreadJumps(Instruction *insts) {
+    // So we don't loop forever on code that jumps to itself
+    const int maxHops = 8;
+
+    for (int i = 0; i < sb_count(insts); ++i) {
+        const char *operands = OpcodeInfo[insts[i].op].operands;
+
+        for (int j = 0; operands[j]; ++j) {
+            if (operands[j] != 'j') continue;
+
+            for (int hop = 0; hop < maxHops; ++hop) {
+                int index = LowerBoundInstruction(insts, insts[i].args[j].c);
+
+                if (index == sb_count(insts) || index == i || insts[index].op != TINY_OP_GOTO) {
+                    break;
+                }
+
+                insts[i].args[j].c = insts[index].args[0].c;
+            }
+        }
+    }
+}
+
+// Tries to fuse the instructions starting at insts[0] into a superinstruction (see opcodes.h).
+// `count` is the number of instructions that can be fused, i.e. none of insts[1..count) are jump
+// targets. Returns the number of instructions that were fused into `fused`, or 0.
+static int FuseSuperinstruction(const Instruction *insts, int count, Instruction *fused) {
+    *fused = insts[0];
+
+    if (count >= 4 && insts[0].op == TINY_OP_GETLOCAL_W && insts[2].op == TINY_OP_LT_INT &&
+        insts[3].op == TINY_OP_GOTOZ) {
+        Tiny_Int k;
+
+        if (GetPushedInt(&insts[1], &k)) {
+            fused->op = TINY_OP_LT_LOCAL_CONST_GOTOZ;
+            fused->args[0].w = insts[0].args[0].w;
+            fused->args[1].i = k;
+            fused->args[2].c = insts[3].args[0].c;
+            return 4;
+        }
+    }
+
+    if (count >= 3 && insts[0].op == TINY_OP_GETLOCAL_W &&
+        (insts[1].op == TINY_OP_ADD1 || insts[1].op == TINY_OP_SUB1) &&
+        insts[2].op == TINY_OP_SETLOCAL && insts[2].args[0].c == insts[0].args[0].w) {
+        fused->op = insts[1].op == TINY_OP_ADD1 ? TINY_OP_INC_LOCAL : TINY_OP_DEC_LOCAL;
+        return 3;
+    }
+
+    if (count >= 2) {
+        switch (insts[0].op) {
+            case TINY_OP_GETLOCAL_W: {
+                if (insts[1].op == TINY_OP_GETLOCAL_W) {
+                    fused->op = TINY_OP_GETLOCAL_W2;
+                    fused->args[1].w = insts[1].args[0].w;
+                    return 2;
+                }
+
+                if (insts[1].op == TINY_OP_STRUCT_GET) {
+                    fused->op = TINY_OP_GETLOCAL_STRUCT_GET;
+                    fused->args[1].w = insts[1].args[0].w;
+                    return 2;
+                }
+            } break;
+
+            case TINY_OP_CALL:
+            case TINY_OP_CALLF: {
+                if (insts[1].op == TINY_OP_GET_RETVAL) {
+                    fused->op =
+                        insts[0].op == TINY_OP_CALL ? TINY_OP_CALL_RETVAL : TINY_OP_CALLF_RETVAL;
+                    return 2;
+                }
+            } break;
+        }
+    }
+
+    return 0;
+}
+
+// Rewrites common instruction sequences into superinstructions. A sequence is never fused if
+// something could jump into the middle of it.
+static Instruction *FuseSuperinstructions(Tiny_State *state, int startPc, const Instruction *insts,
+                                          const bool *isTarget) {
+    Instruction *result = NULL;
+
+    for (int i = 0; i < sb_count(insts);) {
+        // Find out how many instructions we could fuse starting here
+        int count = 1;
+
+        while (i + count < sb_count(insts) && count < 4 &&
+               !isTarget[insts[i + count].pc - startPc]) {
+            ++count;
+        }
+
+        Instruction fused;
+        int n = FuseSuperinstruction(&insts[i], count, &fused);
+
+        sb_push(&state->ctx, result, fused);
+        i += n > 0 ? n : 1;
+    }
+
+    return result;
+}
+
+// Runs after the code for a module has been generated (from startPc to the end of the program)
+static void OptimizeProgram(Tiny_State *state, int startPc) {
+    Instruction *insts = DecodeInstructions(state, startPc);
+    bool *isTarget = FindJumpTargets(state, startPc, insts);
+
+    Instruction *simplified = Peephole(state, startPc, insts, isTarget);
+
+    ThreadJumps(simplified);
+
+    // The peephole pass and jump threading change where jumps land
+    TFree(&state->ctx, isTarget);
+    isTarget = FindJumpTargets(state, startPc, simplified);
+
+    Instruction *fused = FuseSuperinstructions(state, startPc, simplified, isTarget);
+
+    EmitInstructions(state, startPc, fused);
+
+    sb_free(&state->ctx, fused);
+    sb_free(&state->ctx, simplified);
+    TFree(&state->ctx, isTarget);
+    sb_free(&state->ctx, insts);
+}
+
 static void CompileState(Tiny_State *state, Tiny_Expr *progHead) {
     // If this state was already compiled and it ends with an TINY_OP_HALT, We'll
     // just overwrite it
@@ -4069,10 +8028,27 @@ static void CompileState(Tiny_State *state, Tiny_Expr *progHead) {
         }
     }
 
+    int startPc = sb_count(state->program);
+
+    // In case a previous compile failed in the middle of a function
+    state->nextReg = state->maxReg = -1;
+
     for (Tiny_Expr *exp = progHead; exp; exp = exp->next) {
         ResolveTypes(state, exp);
     }
 
+    if (state->optimizationLevel > 0) {
+        for (Tiny_Expr *exp = progHead; exp; exp = exp->next) {
+            FoldConstants(state, exp);
+        }
+
+        FindInlineExprs(state, progHead);
+
+        for (Tiny_Expr *exp = progHead; exp; exp = exp->next) {
+            InlineCalls(state, NULL, exp);
+        }
+    }
+
     // Allocate room for vm execution info
 
     // We realloc because this state might be compiled multiple times (if, e.g.,
@@ -4095,6 +8071,10 @@ static void CompileState(Tiny_State *state, Tiny_Expr *progHead) {
 
     CompileProgram(state, progHead);
     GenerateCode(state, TINY_OP_HALT);
+
+    if (state->optimizationLevel > 0) {
+        OptimizeProgram(state, startPc);
+    }
 }
 
 Tiny_CompileResult Tiny_CompileString(Tiny_State *state, const char *name, const char *string) {
@@ -4375,15 +8355,41 @@ bool Tiny_DisasmOne(const Tiny_State *state, int *ppc, char *buf, size_t maxlen)
             OP_NO_ARGS(MOD)
             OP_NO_ARGS(OR)
             OP_NO_ARGS(AND)
+            OP_NO_ARGS(SHIFT_LEFT)
+            OP_NO_ARGS(SHIFT_RIGHT)
             OP_NO_ARGS(LT)
             OP_NO_ARGS(LTE)
             OP_NO_ARGS(GT)
             OP_NO_ARGS(GTE)
 
+            OP_NO_ARGS(ADD_INT)
+            OP_NO_ARGS(SUB_INT)
+            OP_NO_ARGS(MUL_INT)
+            OP_NO_ARGS(DIV_INT)
+            OP_NO_ARGS(LT_INT)
+            OP_NO_ARGS(LTE_INT)
+            OP_NO_ARGS(GT_INT)
+            OP_NO_ARGS(GTE_INT)
+
+            OP_NO_ARGS(ADD_FLOAT)
+            OP_NO_ARGS(SUB_FLOAT)
+            OP_NO_ARGS(MUL_FLOAT)
+            OP_NO_ARGS(DIV_FLOAT)
+            OP_NO_ARGS(LT_FLOAT)
+            OP_NO_ARGS(LTE_FLOAT)
+            OP_NO_ARGS(GT_FLOAT)
+            OP_NO_ARGS(GTE_FLOAT)
+
+            OP_NO_ARGS(INT_TO_FLOAT)
+
             OP_NO_ARGS(ADD1)
             OP_NO_ARGS(SUB1)
 
             OP_NO_ARGS(EQU)
+            OP_NO_ARGS(EQU_BOOL)
+            OP_NO_ARGS(EQU_INT)
+            OP_NO_ARGS(EQU_FLOAT)
+            OP_NO_ARGS(EQU_STR)
 
             OP_NO_ARGS(LOG_NOT)
 
@@ -4490,14 +8496,46 @@ bool Tiny_DisasmOne(const Tiny_State *state, int *ppc, char *buf, size_t maxlen)
         } break;
 
             OP_NO_ARGS(GET_RETVAL)
+
             OP_NO_ARGS(HALT)
             OP_NO_ARGS(MISALIGNED_INSTRUCTION)
 
 #undef OP_NO_ARGS
 
         default: {
-            snprintf(buf, maxlen, "(unknown opcode %d)", state->program[pc]);
-            return false;
+            // Everything else (superinstructions and register instructions) is printed based on
+            // its operand description
+            if (!OpcodeInfo[state->program[pc]].name) {
+                snprintf(buf, maxlen, "(unknown opcode %d)", state->program[pc]);
+                return false;
+            }
+
+            Instruction inst;
+            pc = DecodeInstruction(state, pc, &inst);
+
+            const char *operands = OpcodeInfo[inst.op].operands;
+
+            int n = snprintf(buf, maxlen, "%s", OpcodeInfo[inst.op].name);
+
+            for (int i = 0; operands[i] && n >= 0 && n < maxlen; ++i) {
+                switch (operands[i]) {
+                    case 'w':
+                        n += snprintf(buf + n, maxlen - n, " %d", inst.args[i].w);
+                        break;
+                    case 'r':
+                        n += snprintf(buf + n, maxlen - n, " r%d", (int8_t)inst.args[i].w);
+                        break;
+                    case 'i':
+                        n += snprintf(buf + n, maxlen - n, " %lld", (long long)inst.args[i].i);
+                        break;
+                    case 'f':
+                        n += snprintf(buf + n, maxlen - n, " %g", inst.args[i].f);
+                        break;
+                    default:
+                        n += snprintf(buf + n, maxlen - n, " %d", (int)inst.args[i].c);
+                        break;
+                }
+            }
         } break;
     }
 
@@ -4510,6 +8548,47 @@ bool Tiny_DisasmOne(const Tiny_State *state, int *ppc, char *buf, size_t maxlen)
     return true;
 }
 
+#ifdef TINY_PROFILE_OPCODE_PAIRS
+typedef struct OpcodePairCount {
+    int prev, op;
+    uint64_t count;
+} OpcodePairCount;
+
+static int CompareOpcodePairCounts(const void *aRaw, const void *bRaw) {
+    const OpcodePairCount *a = aRaw;
+    const OpcodePairCount *b = bRaw;
+
+    // Descending
+    return (a->count < b->count) - (a->count > b->count);
+}
+
+void Tiny_WriteOpcodePairProfile(const Tiny_StateThread *thread, FILE *file) {
+    Tiny_Context ctx = thread->ctx;
+
+    OpcodePairCount *pairs = NULL;
+
+    for (int i = 0; i < 256 * 256; ++i) {
+        if (thread->opcodePairCounts[i] == 0) continue;
+
+        sb_push(&ctx, pairs, ((OpcodePairCount){i / 256, i % 256, thread->opcodePairCounts[i]}));
+    }
+
+    if (pairs) {
+        qsort(pairs, sb_count(pairs), sizeof(OpcodePairCount), CompareOpcodePairCounts);
+    }
+
+    for (int i = 0; i < sb_count(pairs); ++i) {
+        const char *prevName = OpcodeInfo[pairs[i].prev].name;
+        const char *name = OpcodeInfo[pairs[i].op].name;
+
+        fprintf(file, "%llu %s %s\n", (unsigned long long)pairs[i].count,
+                prevName ? prevName : "(unknown)", name ? name : "(unknown)");
+    }
+
+    sb_free(&ctx, pairs);
+}
+#endif
+
 Tiny_BindMacroResultType Tiny_BindMacro(Tiny_State *state, const char *name,
                                         Tiny_MacroFunction fn) {
     for (int i = 0; i < sb_count(state->globalSymbols); ++i) {
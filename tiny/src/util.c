@@ -4,9 +4,14 @@
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "tiny.h"
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 void *TMalloc(Tiny_Context *ctx, size_t size) { return ctx->alloc(NULL, size, ctx->userdata); }
 
 void *TRealloc(Tiny_Context *ctx, void *ptr, size_t size) {
@@ -102,3 +107,153 @@ void Tiny_FormatErrorV(char *buf, size_t bufsize, const char *fileName, const ch
         APPEND("\n");
     }
 }
+
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+
+// Full 64x64 -> 128 bit multiply. The low half is xored into *a and the high half into *b
+// (rather than replacing them, like wyhash's WYHASH_CONDOM mode) so that if one side happens to be
+// 0, whatever was in the other side still makes it through instead of the result being 0.
+// Otherwise an input equal to one of the (public) constants below would wipe out the seed.
+static void HashMum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a ^= (uint64_t)r;
+    *b ^= (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t hi;
+    uint64_t lo = _umul128(*a, *b, &hi);
+    *a ^= lo;
+    *b ^= hi;
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a ^= lo;
+    *b ^= rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t HashMix(uint64_t a, uint64_t b) {
+    HashMum(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t HashRead64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t HashRead32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t Tiny_HashBytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = data;
+
+    seed ^= HashMix(seed ^ HASH_P0, HASH_P1);
+
+    uint64_t a, b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            // Two (possibly overlapping) reads from each end cover every byte
+            size_t off = (len >> 3) << 2;
+
+            a = (HashRead32(p) << 32) | HashRead32(p + off);
+            b = (HashRead32(p + len - 4) << 32) | HashRead32(p + len - 4 - off);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+
+        // The seed goes into both sides of the multiply so that no block (picked without
+        // knowing the seed) can zero either of them
+        for (; i > 16; i -= 16, p += 16) {
+            seed = HashMix(HashRead64(p) ^ HASH_P1 ^ seed, HashRead64(p + 8) ^ seed);
+        }
+
+        // The last 16 bytes (which may overlap with the last block hashed above)
+        a = HashRead64(p + i - 16);
+        b = HashRead64(p + i - 8);
+    }
+
+    a ^= HASH_P1 ^ seed;
+    b ^= seed;
+
+    HashMum(&a, &b);
+
+    return HashMix(a ^ HASH_P0 ^ len, b ^ HASH_P1);
+}
+
+uint64_t Tiny_HashInt(uint64_t x, uint64_t seed) {
+    uint64_t a = x ^ HASH_P0 ^ seed;
+    uint64_t b = seed ^ HASH_P1;
+
+    HashMum(&a, &b);
+
+    return HashMix(a ^ HASH_P0, b ^ HASH_P2);
+}
+
+static uint64_t HashSeed;
+
+static uint64_t GenerateHashSeed(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+
+    // There's no portable source of randomness, so mix the time with addresses that move around
+    // from run to run when address space layout randomization is on.
+    void *heap = malloc(1);
+    int stack;
+
+    uint64_t seed = Tiny_HashInt((uint64_t)ts.tv_sec, (uint64_t)ts.tv_nsec);
+    seed = Tiny_HashInt((uintptr_t)&HashSeed, seed);
+    seed = Tiny_HashInt((uintptr_t)heap, seed);
+    seed = Tiny_HashInt((uintptr_t)&stack, seed);
+    seed = Tiny_HashInt((uint64_t)clock(), seed);
+
+    free(heap);
+
+    // Zero means we haven't picked one yet
+    return seed ? seed : 1;
+}
+
+uint64_t Tiny_GetHashSeed(void) {
+#if defined(_MSC_VER)
+    uint64_t seed = (uint64_t)_InterlockedCompareExchange64((volatile __int64 *)&HashSeed, 0, 0);
+
+    if (!seed) {
+        // If another thread got there first, use its seed
+        uint64_t newSeed = GenerateHashSeed();
+        uint64_t prev = (uint64_t)_InterlockedCompareExchange64((volatile __int64 *)&HashSeed,
+                                                                (__int64)newSeed, 0);
+        seed = prev ? prev : newSeed;
+    }
+#else
+    uint64_t seed = __atomic_load_n(&HashSeed, __ATOMIC_ACQUIRE);
+
+    if (!seed) {
+        // If another thread got there first, use its seed
+        uint64_t expected = 0;
+        uint64_t newSeed = GenerateHashSeed();
+
+        seed = __atomic_compare_exchange_n(&HashSeed, &expected, newSeed, false, __ATOMIC_ACQ_REL,
+                                           __ATOMIC_ACQUIRE)
+                   ? newSeed
+                   : expected;
+    }
+#endif
+
+    return seed;
+}